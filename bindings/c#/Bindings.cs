@@ -31,9 +31,33 @@ internal static class Bindings
     [DllImport(Lib)]
     public static extern IntPtr led_matrix_create_offscreen_canvas(IntPtr matrix);
 
+    [DllImport(Lib)]
+    public static extern IntPtr led_matrix_acquire_offscreen_canvas(IntPtr matrix);
+
+    [DllImport(Lib)]
+    [return: MarshalAs(UnmanagedType.I1)]
+    public static extern bool led_matrix_release_offscreen_canvas(IntPtr matrix, IntPtr canvas);
+
     [DllImport(Lib)]
     public static extern IntPtr led_matrix_swap_on_vsync(IntPtr matrix, IntPtr canvas);
 
+    [DllImport(Lib)]
+    [return: MarshalAs(UnmanagedType.I1)]
+    public static extern bool led_matrix_enqueue_canvas(IntPtr matrix, IntPtr canvas, uint framerate_fraction);
+
+    [DllImport(Lib)]
+    [SuppressGCTransition]
+    public static extern IntPtr led_matrix_reclaim_canvas(IntPtr matrix, out uint presented_at_us);
+
+    [DllImport(Lib)]
+    public static extern void led_matrix_get_refresh_stats(IntPtr matrix, out RefreshStats stats);
+
+    [DllImport(Lib)]
+    public static extern void led_matrix_reset_refresh_stats(IntPtr matrix);
+
+    [DllImport(Lib)]
+    public static extern int led_matrix_get_refresh_cpu(IntPtr matrix);
+
     [DllImport(Lib)]
     public static extern IntPtr led_matrix_get_canvas(IntPtr matrix);
 
@@ -45,6 +69,13 @@ internal static class Bindings
     [SuppressGCTransition]
     public static extern void led_matrix_set_brightness(IntPtr matrix, byte brightness);
 
+    [DllImport(Lib)]
+    [SuppressGCTransition]
+    public static extern byte led_matrix_get_output_brightness(IntPtr matrix);
+
+    [DllImport(Lib)]
+    public static extern void led_matrix_set_output_brightness(IntPtr matrix, byte brightness);
+
     [DllImport(Lib, CharSet = CharSet.Ansi)]
     public static extern IntPtr load_font(string bdf_font_file);
 
@@ -69,7 +100,14 @@ internal static class Bindings
 
     [DllImport(Lib)]
     public static extern void led_canvas_set_pixels(IntPtr canvas, int x, int y, int width, int height,
-                                                    ref Color colors);
+                                                    in Color colors);
+
+    [DllImport(Lib)]
+    public static extern void led_canvas_set_frame_rgb(IntPtr canvas, in byte rgb, int stride);
+
+    [DllImport(Lib)]
+    public static extern void led_canvas_fill_rect(IntPtr canvas, int x, int y, int width, int height,
+                                                   byte r, byte g, byte b);
 
     [DllImport(Lib)]
     public static extern void led_canvas_clear(IntPtr canvas);
@@ -17,13 +17,20 @@ internal struct InternalRGBLedMatrixOptions
     public int scan_mode;
     public int row_address_type;
     public int multiplexing;
-    public IntPtr led_rgb_sequence;
-    public IntPtr pixel_mapper_config;
-    public IntPtr panel_type;
     public byte disable_hardware_pulsing;
     public byte show_refresh_rate;
     public byte inverse_colors;
+    public IntPtr led_rgb_sequence;
+    public IntPtr pixel_mapper_config;
+    public IntPtr panel_type;
     public int limit_refresh_rate_hz;
+    public byte packed_framebuffer;
+    public byte dma_output;
+    public IntPtr pixel_mapper_cache;
+    public IntPtr multiplex_table;
+    public IntPtr color_calibration;
+    public int pwm_temporal_dither_bits;
+    public byte hugepage_framebuffer;
 
     public InternalRGBLedMatrixOptions(RGBLedMatrixOptions opt)
     {
@@ -46,5 +53,12 @@ internal struct InternalRGBLedMatrixOptions
         brightness = opt.Brightness;
         disable_hardware_pulsing = (byte)(opt.DisableHardwarePulsing ? 1 : 0);
         row_address_type = opt.RowAddressType;
+        packed_framebuffer = (byte)(opt.PackedFramebuffer ? 1 : 0);
+        dma_output = (byte)(opt.DmaOutput ? 1 : 0);
+        pixel_mapper_cache = Marshal.StringToHGlobalAnsi(opt.PixelMapperCache);
+        multiplex_table = Marshal.StringToHGlobalAnsi(opt.MultiplexTable);
+        color_calibration = Marshal.StringToHGlobalAnsi(opt.ColorCalibration);
+        pwm_temporal_dither_bits = opt.PwmTemporalDitherBits;
+        hugepage_framebuffer = (byte)(opt.HugepageFramebuffer ? 1 : 0);
     }
 };
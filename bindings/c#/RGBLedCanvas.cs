@@ -1,3 +1,5 @@
+using System.Runtime.InteropServices;
+
 namespace RPiRgbLEDMatrix;
 
 /// <summary>
@@ -49,9 +51,55 @@ public class RGBLedCanvas
     {
         if (colors.Length < width * height)
             throw new ArgumentOutOfRangeException(nameof(colors));
-        led_canvas_set_pixels(_canvas, x, y, width, height, ref colors[0]);
+        led_canvas_set_pixels(_canvas, x, y, width, height, in colors[0]);
     }
 
+    /// <summary>
+    /// Copies the colors from the specified buffer to a rectangle on the canvas.
+    /// </summary>
+    /// <param name="x">The X coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="y">The Y coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="width">Width of the rectangle.</param>
+    /// <param name="height">Height of the rectangle.</param>
+    /// <param name="colors">Buffer containing the colors to copy.</param>
+    public void SetPixels(int x, int y, int width, int height, ReadOnlySpan<Color> colors)
+    {
+        if (colors.Length < width * height)
+            throw new ArgumentOutOfRangeException(nameof(colors));
+        led_canvas_set_pixels(_canvas, x, y, width, height, in MemoryMarshal.GetReference(colors));
+    }
+
+    /// <summary>
+    /// Sets the entire canvas from a packed RGB image (three bytes per pixel, red first)
+    /// of exactly the size of the canvas, in one native call.
+    /// This is the fastest way to show a frame.
+    /// </summary>
+    /// <param name="rgb">The image, <paramref name="stride"/> bytes per row.</param>
+    /// <param name="stride">Bytes from the start of one row to the next; 3 * <see cref="Width"/> if tightly packed.</param>
+    public void SetFrame(ReadOnlySpan<byte> rgb, int stride)
+    {
+        if (stride < 3 * Width || rgb.Length < stride * (Height - 1) + 3 * Width)
+            throw new ArgumentOutOfRangeException(nameof(rgb));
+        led_canvas_set_frame_rgb(_canvas, in MemoryMarshal.GetReference(rgb), stride);
+    }
+
+    /// <summary>
+    /// Sets the entire canvas from a tightly packed RGB image of the size of the canvas.
+    /// </summary>
+    /// <param name="rgb">The image, 3 * <see cref="Width"/> bytes per row.</param>
+    public void SetFrame(ReadOnlySpan<byte> rgb) => SetFrame(rgb, 3 * Width);
+
+    /// <summary>
+    /// Fills a rectangle with the specified color.
+    /// </summary>
+    /// <param name="x">The X coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="y">The Y coordinate of the top-left pixel of the rectangle.</param>
+    /// <param name="width">Width of the rectangle.</param>
+    /// <param name="height">Height of the rectangle.</param>
+    /// <param name="color">The color to fill with.</param>
+    public void FillRect(int x, int y, int width, int height, Color color) =>
+        led_canvas_fill_rect(_canvas, x, y, width, height, color.R, color.G, color.B);
+
     /// <summary>
     /// Sets the color of the entire canvas.
     /// </summary>
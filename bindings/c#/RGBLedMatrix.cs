@@ -57,6 +57,9 @@ public class RGBLedMatrix : IDisposable
             if(options.HardwareMapping is not null) Marshal.FreeHGlobal(opt.hardware_mapping);
             if(options.LedRgbSequence is not null) Marshal.FreeHGlobal(opt.led_rgb_sequence);
             if(options.PixelMapperConfig is not null) Marshal.FreeHGlobal(opt.pixel_mapper_config);
+            if(options.PixelMapperCache is not null) Marshal.FreeHGlobal(opt.pixel_mapper_cache);
+            if(options.MultiplexTable is not null) Marshal.FreeHGlobal(opt.multiplex_table);
+            if(options.ColorCalibration is not null) Marshal.FreeHGlobal(opt.color_calibration);
             if(options.PanelType is not null) Marshal.FreeHGlobal(opt.panel_type);
         }
     }
@@ -67,6 +70,19 @@ public class RGBLedMatrix : IDisposable
     /// <returns>An instance of <see cref="RGBLedCanvas"/> representing the canvas.</returns>
     public RGBLedCanvas CreateOffscreenCanvas() => new(led_matrix_create_offscreen_canvas(matrix));
 
+    /// <summary>
+    /// Like <see cref="CreateOffscreenCanvas"/>, but re-uses a canvas given back
+    /// with <see cref="ReleaseOffscreenCanvas"/> if there is one.
+    /// </summary>
+    public RGBLedCanvas AcquireOffscreenCanvas() => new(led_matrix_acquire_offscreen_canvas(matrix));
+
+    /// <summary>
+    /// Gives a canvas back to be re-used or freed. Don't use it afterwards.
+    /// </summary>
+    /// <returns>false if the canvas is still shown, queued or not reclaimed yet.</returns>
+    public bool ReleaseOffscreenCanvas(RGBLedCanvas canvas) =>
+        led_matrix_release_offscreen_canvas(matrix, canvas._canvas);
+
     /// <summary>
     /// Returns a canvas representing the current frame buffer.
     /// </summary>
@@ -84,6 +100,47 @@ public class RGBLedMatrix : IDisposable
     public void SwapOnVsync(RGBLedCanvas canvas) =>
         canvas._canvas = led_matrix_swap_on_vsync(matrix, canvas._canvas);
 
+    /// <summary>
+    /// Non-blocking alternative to <see cref="SwapOnVsync"/>: queues the canvas to be
+    /// shown after the ones queued before. Don't draw on it until it is returned
+    /// by <see cref="TryReclaim"/>. Don't mix with <see cref="SwapOnVsync"/>.
+    /// </summary>
+    /// <param name="canvas">Canvas to show.</param>
+    /// <param name="framerateFraction">Number of refreshes to show it at least.</param>
+    /// <returns>false if the queue is full.</returns>
+    public bool TryEnqueue(RGBLedCanvas canvas, uint framerateFraction = 1) =>
+        led_matrix_enqueue_canvas(matrix, canvas._canvas, framerateFraction);
+
+    /// <summary>
+    /// Returns a canvas that was replaced on the display by a queued one and can be
+    /// drawn on again, or null if there is none yet.
+    /// </summary>
+    public RGBLedCanvas? TryReclaim()
+    {
+        var canvas = led_matrix_reclaim_canvas(matrix, out _);
+        return canvas == IntPtr.Zero ? null : new RGBLedCanvas(canvas);
+    }
+
+    /// <summary>
+    /// Statistics of the refresh since the start or <see cref="ResetRefreshStats"/>.
+    /// </summary>
+    public RefreshStats GetRefreshStats()
+    {
+        led_matrix_get_refresh_stats(matrix, out var stats);
+        return stats;
+    }
+
+    /// <summary>
+    /// Resets the refresh statistics; takes effect with the next refresh.
+    /// </summary>
+    public void ResetRefreshStats() => led_matrix_reset_refresh_stats(matrix);
+
+    /// <summary>
+    /// The CPU the refresh thread runs on (see --led-refresh-cpu), to keep
+    /// other latency-sensitive threads away from it. -1 if not refreshing.
+    /// </summary>
+    public int RefreshCpu => led_matrix_get_refresh_cpu(matrix);
+
     /// <summary>
     /// The general brightness of the matrix.
     /// </summary>
@@ -93,6 +150,16 @@ public class RGBLedMatrix : IDisposable
         set => led_matrix_set_brightness(matrix, value);
     }
 
+    /// <summary>
+    /// Brightness applied while refreshing. Takes effect right away for
+    /// whatever is shown, no need to redraw canvases.
+    /// </summary>
+    public byte OutputBrightness
+    {
+        get => led_matrix_get_output_brightness(matrix);
+        set => led_matrix_set_output_brightness(matrix, value);
+    }
+
     protected virtual void Dispose(bool disposing)
     {
         if (disposedValue) return;
@@ -58,6 +58,11 @@ public struct RGBLedMatrixOptions
     /// </summary>
     public int PwmDitherBits = 0;
 
+    /// <summary>
+    /// Additional color bits (0..2) shown over a sequence of refreshes.
+    /// </summary>
+    public int PwmTemporalDitherBits = 0;
+
     /// <summary>
     /// The initial brightness of the panel in percent. Valid range is 1..100
     /// </summary>
@@ -80,6 +85,12 @@ public struct RGBLedMatrixOptions
     /// </summary>
     public Multiplexing Multiplexing = Multiplexing.Direct;
 
+    /// <summary>
+    /// Multiplexing described as table (or <c>"@"</c> followed by the name
+    /// of a file containing it) instead of <see cref="Multiplexing"/>.
+    /// </summary>
+    public string? MultiplexTable = null;
+
     /// <summary>
     /// In case the internal sequence of mapping is not <c>"RGB"</c>, this
     /// contains the real mapping. Some panels mix up these colors.
@@ -92,12 +103,25 @@ public struct RGBLedMatrixOptions
     /// parameter.
     public string? PixelMapperConfig = null;
 
+    /// <summary>
+    /// File to keep the final pixel mapping in, so that the next start with
+    /// the same options is faster.
+    /// </summary>
+    public string? PixelMapperCache = null;
+
     /// <summary>
     /// Panel type. Typically just empty, but certain panels (FM6126)
     /// requie an initialization sequence
     /// </summary>
     public string? PanelType = null;
 
+    /// <summary>
+    /// Per-channel correction of the panels, e.g.
+    /// <c>"gain=1,0.9,0.85;gamma=2.2;lut=panel.cube"</c> (or <c>"@"</c>
+    /// followed by the name of a file containing it).
+    /// </summary>
+    public string? ColorCalibration = null;
+
     /// <summary>
     /// Allow to use the hardware subsystem to create pulses. This won't do
     /// anything if output enable is not connected to GPIO 18.
@@ -112,6 +136,22 @@ public struct RGBLedMatrixOptions
     /// </summary>
     public int LimitRefreshRateHz = 0;
 
+    /// <summary>
+    /// Store only the color bits in the framebuffer. Uses less memory,
+    /// at the expense of a bit more work while refreshing.
+    /// </summary>
+    public bool PackedFramebuffer = false;
+
+    /// <summary>
+    /// Refresh the panel with the DMA engine instead of the CPU.
+    /// </summary>
+    public bool DmaOutput = false;
+
+    /// <summary>
+    /// Put the framebuffers into huge pages, if the kernel has some reserved.
+    /// </summary>
+    public bool HugepageFramebuffer = false;
+
     /// <summary>
     /// Slowdown GPIO. Needed for faster Pis/slower panels.
     /// </summary>
@@ -0,0 +1,46 @@
+using System.Runtime.InteropServices;
+
+namespace RPiRgbLEDMatrix;
+
+/// <summary>
+/// Statistics of the refresh thread, see RGBMatrix::RefreshStats in
+/// include/led-matrix.h. Times are in microseconds.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct RefreshStats
+{
+    /// <summary>
+    /// Number of histogram buckets in <see cref="RefreshHistogram"/>.
+    /// </summary>
+    public const int HistogramBuckets = 64;
+
+    /// <summary>
+    /// Refresh time covered by each histogram bucket.
+    /// </summary>
+    public const int HistogramBucketUs = 250;
+
+    public ulong Refreshes;
+    public ulong TotalRefreshUs;
+    public uint MinRefreshUs;
+    public uint MaxRefreshUs;
+
+    /// <summary>
+    /// Refreshes taking i * HistogramBucketUs up to (i+1) * HistogramBucketUs;
+    /// the last bucket also counts all longer ones.
+    /// </summary>
+    [MarshalAs(UnmanagedType.ByValArray, SizeConst = HistogramBuckets)]
+    public uint[] RefreshHistogram;
+
+    /// <summary>
+    /// Refreshes that took longer than the limited refresh rate allows.
+    /// </summary>
+    public ulong OverBudget;
+
+    public ulong Swaps;
+    public ulong TotalSwapLatencyUs;
+    public uint MaxSwapLatencyUs;
+
+    public ulong PulseSleeps;
+    public ulong TotalPulseOvershootUs;
+    public uint MaxPulseOvershootUs;
+}
@@ -17,7 +17,11 @@ cdef class RGBMatrixOptions:
     cdef bytes __py_encoded_hardware_mapping
     cdef bytes __py_encoded_led_rgb_sequence
     cdef bytes __py_encoded_pixel_mapper_config
+    cdef bytes __py_encoded_pixel_mapper_cache
+    cdef bytes __py_encoded_multiplex_table
     cdef bytes __py_encoded_panel_type
+    cdef bytes __py_encoded_color_calibration
+    cdef bytes __py_encoded_refresh_scheduling
 
 # Local Variables:
 # mode: python
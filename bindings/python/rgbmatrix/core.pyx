@@ -1,7 +1,7 @@
 # distutils: language = c++
 
 from libcpp cimport bool
-from libc.stdint cimport uint8_t, uint32_t, uintptr_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t, uintptr_t
 from PIL import Image
 import cython
 
@@ -9,49 +9,84 @@ cdef class Canvas:
     cdef cppinc.Canvas* __getCanvas(self) except +:
         raise Exception("Not implemented")
 
+    # Show "image" with its top left corner at offset_x, offset_y.
+    # The image is either a Pillow image in 'RGB' mode or any C-contiguous
+    # object supporting the buffer protocol with packed RGB bytes, such as a
+    # numpy uint8 array of shape (height, width, 3), bytes or memoryview.
+    # One-dimensional buffers are rows as wide as the canvas.
+    # The pixels are copied natively in one go. "unsafe" is not needed
+    # anymore and only there for compatibility.
     def SetImage(self, image, int offset_x = 0, int offset_y = 0, unsafe=True):
-        if (image.mode != "RGB"):
-            raise Exception("Currently, only RGB mode is supported for SetImage(). Please create images with mode 'RGB' or convert first with image = image.convert('RGB'). Pull requests to support more modes natively are also welcome :)")
-
-        if unsafe:
-            #In unsafe mode we directly access the underlying PIL image array
-            #in cython, which is considered unsafe pointer accecss,
-            #however it's super fast and seems to work fine
-            #https://groups.google.com/forum/#!topic/cython-users/Dc1ft5W6KM4
+        if hasattr(image, 'mode'):  # Pillow image
+            if (image.mode != "RGB"):
+                raise Exception("Currently, only RGB mode is supported for SetImage(). Please create images with mode 'RGB' or convert first with image = image.convert('RGB'). Pull requests to support more modes natively are also welcome :)")
             img_width, img_height = image.size
-            self.SetPixelsPillow(offset_x, offset_y, img_width, img_height, image)
+            self.SetPixelsRGB(image.tobytes(), offset_x, offset_y,
+                              img_width, img_height)
+            return
+
+        buf = memoryview(image)
+        if buf.itemsize != 1:
+            raise ValueError("SetImage() needs a buffer of bytes (e.g. dtype uint8)")
+        if buf.ndim == 3:
+            img_height, img_width, channels = buf.shape
+            if channels != 3:
+                raise ValueError("SetImage() needs 3 channels (RGB), got %d" % channels)
+        elif buf.ndim == 2:
+            img_height, img_width = buf.shape[0], buf.shape[1] // 3
         else:
-            # First implementation of a SetImage(). OPTIMIZE_ME: A more native
-            # implementation that directly reads the buffer and calls the underlying
-            # C functions can certainly be faster.
-            img_width, img_height = image.size
-            pixels = image.load()
-            for x in range(max(0, -offset_x), min(img_width, self.width - offset_x)):
-                for y in range(max(0, -offset_y), min(img_height, self.height - offset_y)):
-                    (r, g, b) = pixels[x, y]
-                    self.SetPixel(x + offset_x, y + offset_y, r, g, b)
+            img_width = self.width
+            img_height = buf.nbytes // (3 * img_width)
+        self.SetPixelsRGB(buf, offset_x, offset_y, img_width, img_height)
 
+    # Set the "width" x "height" pixels at "xstart", "ystart" from a
+    # C-contiguous buffer of packed RGB bytes; the GIL is released meanwhile.
     @cython.boundscheck(False)
     @cython.wraparound(False)
-    def SetPixelsPillow(self, int xstart, int ystart, int width, int height, image):
-        cdef cppinc.FrameCanvas* my_canvas = <cppinc.FrameCanvas*>self.__getCanvas()
+    def SetPixelsRGB(self, data, int xstart, int ystart, int width, int height):
+        cdef const uint8_t[::1] pixels = memoryview(data).cast('B')
+        cdef cppinc.Canvas* my_canvas = self.__getCanvas()
+        cdef cppinc.FrameCanvas* frame_canvas
         cdef int frame_width = my_canvas.width()
         cdef int frame_height = my_canvas.height()
         cdef int row, col
-        cdef uint8_t r, g, b
-        cdef uint32_t **image_ptr
-        cdef uint32_t pixel
-        image.load()
-        ptr_tmp = dict(image.im.unsafe_ptrs)['image32']
-        image_ptr = (<uint32_t **>(<uintptr_t>ptr_tmp))
-
-        for col in range(max(0, -xstart), min(width, frame_width - xstart)):
-            for row in range(max(0, -ystart), min(height, frame_height - ystart)):
-                pixel = image_ptr[row][col]
-                r = (pixel ) & 0xFF
-                g = (pixel >> 8) & 0xFF
-                b = (pixel >> 16) & 0xFF
-                my_canvas.SetPixel(xstart+col, ystart+row, r, g, b)
+        cdef int row_begin, row_end, col_begin, col_end
+        cdef const uint8_t *rgb
+        cdef const uint8_t *pixel
+        if width <= 0 or height <= 0:
+            return
+        if pixels.shape[0] < 3 * width * height:
+            raise ValueError("Buffer of %d bytes too small for %dx%d RGB pixels"
+                             % (pixels.shape[0], width, height))
+        rgb = &pixels[0]
+        if isinstance(self, FrameCanvas):
+            frame_canvas = <cppinc.FrameCanvas*>my_canvas
+            with nogil:
+                if (xstart == 0 and ystart == 0
+                    and width == frame_width and height == frame_height):
+                    frame_canvas.SetFrameRGB(rgb, 3 * width)
+                else:
+                    frame_canvas.SetPixels(xstart, ystart, width, height,
+                                           <cppinc.Color*>rgb)
+        else:
+            # The RGBMatrix itself only sets single pixels. Clipped to the
+            # canvas before, so that the loop is plain C.
+            row_begin = -ystart if ystart < 0 else 0
+            row_end = frame_height - ystart if frame_height - ystart < height else height
+            col_begin = -xstart if xstart < 0 else 0
+            col_end = frame_width - xstart if frame_width - xstart < width else width
+            with nogil:
+                for row in range(row_begin, row_end):
+                    for col in range(col_begin, col_end):
+                        pixel = rgb + 3 * (row * width + col)
+                        my_canvas.SetPixel(xstart + col, ystart + row,
+                                           pixel[0], pixel[1], pixel[2])
+
+    def SetPixelsPillow(self, int xstart, int ystart, int width, int height, image):
+        if (width, height) != image.size:
+            image = image.crop((0, 0, width, height))
+        self.SetPixelsRGB(image.convert('RGB').tobytes(), xstart, ystart,
+                          width, height)
 
 cdef class FrameCanvas(Canvas):
     def __dealloc__(self):
@@ -164,20 +199,54 @@ cdef class RGBMatrixOptions:
             self.__py_encoded_pixel_mapper_config = value.encode('utf-8')
             self.__options.pixel_mapper_config = self.__py_encoded_pixel_mapper_config
 
+    property pixel_mapper_cache:
+        def __get__(self): return self.__options.pixel_mapper_cache
+        def __set__(self, value):
+            self.__py_encoded_pixel_mapper_cache = value.encode('utf-8')
+            self.__options.pixel_mapper_cache = self.__py_encoded_pixel_mapper_cache
+
+    property multiplex_table:
+        def __get__(self): return self.__options.multiplex_table
+        def __set__(self, value):
+            self.__py_encoded_multiplex_table = value.encode('utf-8')
+            self.__options.multiplex_table = self.__py_encoded_multiplex_table
+
     property panel_type:
         def __get__(self): return self.__options.panel_type
         def __set__(self, value):
             self.__py_encoded_panel_type = value.encode('utf-8')
             self.__options.panel_type = self.__py_encoded_panel_type
 
+    property color_calibration:
+        def __get__(self): return self.__options.color_calibration
+        def __set__(self, value):
+            self.__py_encoded_color_calibration = value.encode('utf-8')
+            self.__options.color_calibration = self.__py_encoded_color_calibration
+
     property pwm_dither_bits:
         def __get__(self): return self.__options.pwm_dither_bits
         def __set__(self, uint8_t value): self.__options.pwm_dither_bits = value
 
+    property pwm_temporal_dither_bits:
+        def __get__(self): return self.__options.pwm_temporal_dither_bits
+        def __set__(self, uint8_t value): self.__options.pwm_temporal_dither_bits = value
+
     property limit_refresh_rate_hz:
         def __get__(self): return self.__options.limit_refresh_rate_hz
         def __set__(self, value): self.__options.limit_refresh_rate_hz = value
 
+    property packed_framebuffer:
+        def __get__(self): return self.__options.packed_framebuffer
+        def __set__(self, value): self.__options.packed_framebuffer = value
+
+    property dma_output:
+        def __get__(self): return self.__options.dma_output
+        def __set__(self, value): self.__options.dma_output = value
+
+    property hugepage_framebuffer:
+        def __get__(self): return self.__options.hugepage_framebuffer
+        def __set__(self, value): self.__options.hugepage_framebuffer = value
+
 
     # RuntimeOptions properties
 
@@ -193,6 +262,24 @@ cdef class RGBMatrixOptions:
         def __get__(self): return self.__runtime_options.drop_privileges
         def __set__(self, uint8_t value): self.__runtime_options.drop_privileges = value
 
+    property refresh_cpu:
+        def __get__(self): return self.__runtime_options.refresh_cpu
+        def __set__(self, int value): self.__runtime_options.refresh_cpu = value
+
+    property refresh_scheduling:
+        def __get__(self): return self.__runtime_options.refresh_scheduling
+        def __set__(self, value):
+            self.__py_encoded_refresh_scheduling = value.encode('utf-8')
+            self.__runtime_options.refresh_scheduling = self.__py_encoded_refresh_scheduling
+
+    property refresh_priority:
+        def __get__(self): return self.__runtime_options.refresh_priority
+        def __set__(self, int value): self.__runtime_options.refresh_priority = value
+
+    property lock_memory:
+        def __get__(self): return self.__runtime_options.lock_memory
+        def __set__(self, value): self.__runtime_options.lock_memory = value
+
 cdef class RGBMatrix(Canvas):
     def __cinit__(self, int rows = 0, int chains = 0, int parallel = 0,
         RGBMatrixOptions options = None):
@@ -233,6 +320,15 @@ cdef class RGBMatrix(Canvas):
     def CreateFrameCanvas(self):
         return __createFrameCanvas(self.__matrix.CreateFrameCanvas())
 
+    # Like CreateFrameCanvas(), but re-uses canvases given back with
+    # ReleaseFrameCanvas(). Releasing returns False if the canvas is still
+    # shown or queued; don't use it after releasing.
+    def AcquireFrameCanvas(self):
+        return __createFrameCanvas(self.__matrix.AcquireFrameCanvas())
+
+    def ReleaseFrameCanvas(self, FrameCanvas canvas):
+        return self.__matrix.ReleaseFrameCanvas(canvas.__canvas)
+
     # The optional "framerate_fraction" parameter allows to choose which
     # multiple of the global frame-count to use. So it slows down your animation
     # to an exact integer fraction of the refresh rate.
@@ -241,8 +337,30 @@ cdef class RGBMatrix(Canvas):
     # 28Hz animation, nicely locked to the refresh-rate).
     # If you combine this with RGBMatrixOptions.limit_refresh_rate_hz you can create
     # time-correct animations.
+    # The GIL is released while waiting, so other Python threads can prepare
+    # the next frame meanwhile.
     def SwapOnVSync(self, FrameCanvas newFrame, uint8_t framerate_fraction = 1):
-        return __createFrameCanvas(self.__matrix.SwapOnVSync(newFrame.__canvas, framerate_fraction))
+        cdef cppinc.FrameCanvas *previous
+        cdef cppinc.FrameCanvas *next_frame = newFrame.__canvas
+        with nogil:
+            previous = self.__matrix.SwapOnVSync(next_frame, framerate_fraction)
+        return __createFrameCanvas(previous)
+
+    # GPIO inputs. Reserve the pins of interest with RequestInputs(), then
+    # either wait with AwaitInputChange(timeout_ms) - a timeout of 0 returns
+    # the current bits right away - or add InputEventFd() to a selector:
+    # it becomes readable on each change; os.read(fd, 8) resets it.
+    def RequestInputs(self, uint64_t bits):
+        return self.__matrix.RequestInputs(bits)
+
+    def AwaitInputChange(self, int timeout_ms = -1):
+        cdef uint64_t result
+        with nogil:
+            result = self.__matrix.AwaitInputChange(timeout_ms)
+        return result
+
+    def InputEventFd(self):
+        return self.__matrix.InputEventFd()
 
     property luminanceCorrect:
         def __get__(self): return self.__matrix.luminance_correct()
@@ -256,6 +374,13 @@ cdef class RGBMatrix(Canvas):
         def __get__(self): return self.__matrix.brightness()
         def __set__(self, brightness): self.__matrix.SetBrightness(brightness)
 
+    property output_brightness:
+        def __get__(self): return self.__matrix.output_brightness()
+        def __set__(self, brightness): self.__matrix.SetOutputBrightness(brightness)
+
+    property refresh_cpu:
+        def __get__(self): return self.__matrix.GetRefreshCpu()
+
     property height:
         def __get__(self): return self.__matrix.height()
 
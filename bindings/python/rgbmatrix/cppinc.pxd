@@ -1,5 +1,5 @@
 from libcpp cimport bool
-from libc.stdint cimport uint8_t, uint32_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t
 
 ########################
 ### External classes ###
@@ -13,6 +13,25 @@ cdef extern from "canvas.h" namespace "rgb_matrix":
         void Clear() nogil
         void Fill(uint8_t, uint8_t, uint8_t) nogil
 
+cdef extern from "graphics.h" namespace "rgb_matrix":
+    cdef struct Color:
+        Color(uint8_t, uint8_t, uint8_t) except +
+        uint8_t r
+        uint8_t g
+        uint8_t b
+
+    cdef cppclass Font:
+        Font() except +
+        bool LoadFont(const char*)
+        int height()
+        int baseline()
+        int CharacterWidth(uint32_t)
+        int DrawGlyph(Canvas*, int, int, const Color, uint32_t);
+
+    cdef int DrawText(Canvas*, const Font, int, int, const Color, const char*)
+    cdef void DrawCircle(Canvas*, int, int, int, const Color)
+    cdef void DrawLine(Canvas*, int, int, int, int, const Color)
+
 cdef extern from "led-matrix.h" namespace "rgb_matrix":
     cdef cppclass RGBMatrix(Canvas):
         bool SetPWMBits(uint8_t)
@@ -21,20 +40,34 @@ cdef extern from "led-matrix.h" namespace "rgb_matrix":
         bool luminance_correct()
         void SetBrightness(uint8_t)
         uint8_t brightness()
+        void SetOutputBrightness(uint8_t)
+        uint8_t output_brightness()
+        int GetRefreshCpu()
         FrameCanvas *CreateFrameCanvas()
-        FrameCanvas *SwapOnVSync(FrameCanvas*, uint8_t)
+        FrameCanvas *AcquireFrameCanvas()
+        bool ReleaseFrameCanvas(FrameCanvas*)
+        FrameCanvas *SwapOnVSync(FrameCanvas*, uint8_t) nogil
+        uint64_t RequestInputs(uint64_t)
+        uint64_t AwaitInputChange(int) nogil
+        int InputEventFd()
 
     cdef cppclass FrameCanvas(Canvas):
         bool SetPWMBits(uint8_t)
         uint8_t pwmbits()
         void SetBrightness(uint8_t)
         uint8_t brightness()
+        void SetPixels(int, int, int, int, Color*) nogil
+        void SetFrameRGB(const uint8_t*, int) nogil
 
     struct RuntimeOptions:
       RuntimeOptions() except +
       int gpio_slowdown
       int daemon
       int drop_privileges
+      int refresh_cpu
+      const char *refresh_scheduling
+      int refresh_priority
+      bool lock_memory
 
 
     RGBMatrix *CreateMatrixFromOptions(Options &options, RuntimeOptions runtime_options)
@@ -58,31 +91,19 @@ cdef extern from "led-matrix.h" namespace "rgb_matrix::RGBMatrix":
         int row_address_type
         int multiplexing
         int pwm_dither_bits
+        int pwm_temporal_dither_bits
         int limit_refresh_rate_hz
 
         bool disable_hardware_pulsing
         bool show_refresh_rate
         bool inverse_colors
+        bool packed_framebuffer
+        bool dma_output
+        bool hugepage_framebuffer
 
         const char *led_rgb_sequence
         const char *pixel_mapper_config
+        const char *pixel_mapper_cache
+        const char *multiplex_table
         const char *panel_type
-
-cdef extern from "graphics.h" namespace "rgb_matrix":
-    cdef struct Color:
-        Color(uint8_t, uint8_t, uint8_t) except +
-        uint8_t r
-        uint8_t g
-        uint8_t b
-
-    cdef cppclass Font:
-        Font() except +
-        bool LoadFont(const char*)
-        int height()
-        int baseline()
-        int CharacterWidth(uint32_t)
-        int DrawGlyph(Canvas*, int, int, const Color, uint32_t);
-
-    cdef int DrawText(Canvas*, const Font, int, int, const Color, const char*)
-    cdef void DrawCircle(Canvas*, int, int, int, const Color)
-    cdef void DrawLine(Canvas*, int, int, int, int, const Color)
+        const char *color_calibration
@@ -1,9 +1,36 @@
 #!/usr/bin/python
 from distutils.core import setup, Extension
+import hashlib
+import os
+import sys
+
+# With cython available, the extensions are built from the *.pyx sources.
+# Otherwise the checked-in *.cpp files are used, but only if they were
+# generated from the current sources; else we'd silently build an old module.
+try:
+    from Cython.Build import cythonize
+except ImportError:
+    cythonize = None
+
+def generated_sources_are_current():
+    with open('rgbmatrix/cython-sources.sha256') as recorded:
+        for line in recorded:
+            checksum, filename = line.split()
+            with open(os.path.join('rgbmatrix', filename), 'rb') as f:
+                if hashlib.sha256(f.read()).hexdigest() != checksum:
+                    sys.stderr.write('rgbmatrix/%s changed since the *.cpp '
+                                     'files were generated.\n' % filename)
+                    return False
+    return True
+
+source_suffix = '.pyx' if cythonize else '.cpp'
+if not cythonize and not generated_sources_are_current():
+    sys.exit('Please install cython (e.g. sudo apt-get install cython3) to '
+             'build the python bindings from the current sources.')
 
 core_ext = Extension(
     name                = 'core',
-    sources             = ['rgbmatrix/core.cpp'],
+    sources             = ['rgbmatrix/core' + source_suffix],
     include_dirs        = ['../../include'],
     library_dirs        = ['../../lib'],
     libraries           = ['rgbmatrix'],
@@ -13,7 +40,7 @@ core_ext = Extension(
 
 graphics_ext = Extension(
     name                = 'graphics',
-    sources             = ['rgbmatrix/graphics.cpp'],
+    sources             = ['rgbmatrix/graphics' + source_suffix],
     include_dirs        = ['../../include'],
     library_dirs        = ['../../lib'],
     libraries           = ['rgbmatrix'],
@@ -28,6 +55,8 @@ setup(
     author_email        = 'christoph.friedrich@vonaffenfels.de',
     classifiers         = ['Development Status :: 3 - Alpha'],
     ext_package         = 'rgbmatrix',
-    ext_modules         = [core_ext, graphics_ext],
+    ext_modules         = (cythonize([core_ext, graphics_ext],
+                                     include_path=['rgbmatrix'])
+                           if cythonize else [core_ext, graphics_ext]),
     packages            = ['rgbmatrix']
 )
@@ -2,56 +2,76 @@
 // A program that reads frames form STDIN as RGB24, much like
 // https://github.com/polyfloyd/ledcat does.
 //
+// With -s <name>, frames are instead taken from a shared memory frame ring
+// (see include/shm-frame-ring.h) that other processes render into; the
+// newest frame is shown at every refresh, the renderer never waits.
+//
 // This code is public domain
 // (but note, that the led-matrix library this depends on is GPL v2)
 
 #include "led-matrix.h"
+#include "shm-frame-ring.h"
 
 #include <math.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <vector>
+
 #define FPS 60
 
 using rgb_matrix::RGBMatrix;
-using rgb_matrix::Canvas;
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::SharedFrameRing;
 
 volatile bool interrupt_received = false;
 static void InterruptHandler(int signo) {
   interrupt_received = true;
 }
 
-int main(int argc, char *argv[]) {
-  RGBMatrix::Options defaults;
-  defaults.hardware_mapping = "regular"; // or e.g. "adafruit-hat"
-  defaults.rows = 32;
-  defaults.chain_length = 1;
-  defaults.parallel = 1;
-  Canvas *canvas = RGBMatrix::CreateFromFlags(&argc, &argv, &defaults);
-  if (canvas == NULL) {
-    return 1;
-  }
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Reads RGB24 frames of the size of the matrix from stdin.\n");
+  fprintf(stderr, "Options:\n"
+          "\t-s <name>  : Show frames from shared memory frame ring <name>\n"
+          "\t             (e.g. /ledcat) instead of reading stdin.\n"
+          "\t-n <slots> : Number of frames in the ring. Default: 3.\n"
+          "\t-m <mode>  : Permissions of the ring, e.g. 0660 to let the\n"
+          "\t             group produce frames. Default: 0600.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
 
-  // It is always good to set up a signal handler to cleanly exit when we
-  // receive a CTRL-C for instance. The DrawOnCanvas() routine is looking
-  // for that.
-  signal(SIGTERM, InterruptHandler);
-  signal(SIGINT, InterruptHandler);
+// Show the newest frame of the ring at each refresh until interrupted.
+static void ShowFromRing(RGBMatrix *matrix, SharedFrameRing *ring) {
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  while (!interrupt_received) {
+    if (ring->GetNewest(offscreen, 100)) {
+      offscreen = matrix->SwapOnVSync(offscreen);
+    }
+  }
+}
 
-  ssize_t frame_size = canvas->width() * canvas->height() * 3;
-  uint8_t buf[frame_size];
+static void ShowFromStdin(RGBMatrix *matrix) {
+  FrameCanvas *offscreen = matrix->CreateFrameCanvas();
+  const ssize_t frame_size = matrix->width() * matrix->height() * 3;
+  std::vector<uint8_t> buf(frame_size);
 
-  while (1) {
+  while (!interrupt_received) {
     struct timespec start;
     timespec_get(&start, TIME_UTC);
 
     ssize_t nread;
     ssize_t total_nread = 0;
-    while ((nread = read(STDIN_FILENO, &buf[total_nread], frame_size - total_nread)) > 0) {
+    while (total_nread < frame_size
+           && (nread = read(STDIN_FILENO, &buf[total_nread],
+                            frame_size - total_nread)) > 0) {
       if (interrupt_received) {
-        return 1;
+        return;
       }
       total_nread += nread;
     }
@@ -59,13 +79,8 @@ int main(int argc, char *argv[]) {
       break;
     }
 
-    for (int y = 0; y < canvas->height(); y++) {
-      for (int x = 0; x < canvas->width(); x++) {
-        uint8_t *p = &buf[(y * canvas->width() + x) * 3];
-        uint8_t r = *(p+0), g = *(p+1), b = *(p+2);
-        canvas->SetPixel(x, y, r, g, b);
-      }
-    }
+    offscreen->SetFrameRGB(buf.data(), matrix->width() * 3);
+    offscreen = matrix->SwapOnVSync(offscreen);
 
     struct timespec end;
     timespec_get(&end, TIME_UTC);
@@ -74,9 +89,58 @@ int main(int argc, char *argv[]) {
       usleep(1000000l / FPS - tudiff);
     }
   }
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options defaults;
+  defaults.hardware_mapping = "regular"; // or e.g. "adafruit-hat"
+  defaults.rows = 32;
+  defaults.chain_length = 1;
+  defaults.parallel = 1;
+  RGBMatrix *matrix = RGBMatrix::CreateFromFlags(&argc, &argv, &defaults);
+  if (matrix == NULL) {
+    return usage(argv[0]);
+  }
+
+  const char *ring_name = NULL;
+  int slots = 3;
+  mode_t mode = 0600;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:m:")) != -1) {
+    switch (opt) {
+    case 's': ring_name = optarg; break;
+    case 'n': slots = atoi(optarg); break;
+    case 'm': mode = strtol(optarg, NULL, 8) & 0666; break;
+    default:
+      delete matrix;
+      return usage(argv[0]);
+    }
+  }
+
+  SharedFrameRing *ring = NULL;
+  if (ring_name) {
+    ring = SharedFrameRing::Create(ring_name, matrix->width(),
+                                   matrix->height(), slots, mode);
+    if (ring == NULL) {
+      delete matrix;
+      return 1;
+    }
+  }
+
+  // It is always good to set up a signal handler to cleanly exit when we
+  // receive a CTRL-C for instance.
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  if (ring) {
+    ShowFromRing(matrix, ring);
+  } else {
+    ShowFromStdin(matrix);
+  }
 
   // Animation finished. Shut down the RGB matrix.
-  canvas->Clear();
-  delete canvas;
+  delete ring;
+  matrix->Clear();
+  delete matrix;
   return 0;
 }
@@ -46,6 +46,27 @@ public:
 
   // Fill screen with given 24bpp color.
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) = 0;
+
+  // Fill the rectangle of "width" x "height" pixels with its top left corner
+  // at (x,y) with given color. Parts outside the canvas are ignored.
+  // The default implementation sets each pixel; canvases such as the
+  // FrameCanvas do this a lot faster.
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    const int x_end = x + width < this->width() ? x + width : this->width();
+    const int y_end = y + height < this->height() ? y + height : this->height();
+    for (int iy = y < 0 ? 0 : y; iy < y_end; ++iy) {
+      for (int ix = x < 0 ? 0 : x; ix < x_end; ++ix) {
+        SetPixel(ix, iy, red, green, blue);
+      }
+    }
+  }
+
+  // Horizontal line of "width" pixels starting at (x,y) to the right.
+  void DrawHLine(int x, int y, int width,
+                 uint8_t red, uint8_t green, uint8_t blue) {
+    FillRect(x, y, width, 1, red, green, blue);
+  }
 };
 
 }  // namespace rgb_matrix
@@ -0,0 +1,119 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Compose the content of a screen from several layers with transparency,
+// e.g. a ticker with semi-transparent background on top of a video.
+//
+// Each layer is a Canvas, so everything that draws on a Canvas can be used.
+// The compositor only blends the regions in which layers changed, and only
+// writes the regions changed since the last time to the FrameCanvas, so
+// layers that did not change cost nothing.
+
+#ifndef RPI_COMPOSITOR_H
+#define RPI_COMPOSITOR_H
+
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+#include "canvas.h"
+#include "graphics.h"
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+class Compositor {
+public:
+  // A layer of RGBA pixels. Everything is transparent initially.
+  class Layer : public Canvas {
+  public:
+    // -- Canvas interface. These set opaque pixels.
+    virtual int width() const { return width_; }
+    virtual int height() const { return height_; }
+    virtual void SetPixel(int x, int y,
+                          uint8_t red, uint8_t green, uint8_t blue);
+    virtual void Clear();  // Make all of the layer transparent.
+    virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+    virtual void FillRect(int x, int y, int width, int height,
+                          uint8_t red, uint8_t green, uint8_t blue);
+
+    // Set pixel with "alpha" from 0 (transparent) to 255 (opaque).
+    void SetPixelRGBA(int x, int y,
+                      uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha);
+
+    // Set a "width" x "height" region with the top left corner at (x,y) from
+    // an image of four bytes (r, g, b, alpha) per pixel. "stride" is the
+    // number of bytes from the start of one image row to the next.
+    void SetImageRGBA(int x, int y, int width, int height,
+                      const uint8_t *rgba, int stride);
+
+  private:
+    friend class Compositor;
+    Layer(int width, int height);
+
+    inline uint8_t *PixelAt(int x, int y) {
+      return &pixels_[4 * (y * width_ + x)];
+    }
+    // Clip to the layer and mark the region as changed. Returns false if
+    // nothing is left.
+    bool ClipAndMark(int *x, int *y, int *width, int *height);
+
+    const int width_;
+    const int height_;
+    std::vector<uint8_t> pixels_;   // r, g, b, alpha
+    int dirty_x0_, dirty_y0_, dirty_x1_, dirty_y1_;  // Empty if x0 >= x1
+  };
+
+  // Compositor for a screen of "width" x "height", e.g. the size of the
+  // matrix.
+  Compositor(int width, int height);
+  ~Compositor();
+
+  // Create a new layer in front of all existing ones. The Compositor keeps
+  // ownership.
+  Layer *AddLayer();
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Blend the layers where they changed and write everything that changed,
+  // since this canvas was last composed to, to "canvas". So this works with
+  // any number of FrameCanvases used for double buffering.
+  // The canvas is expected to be only written by the Compositor.
+  void Compose(FrameCanvas *canvas);
+
+private:
+  struct Rect {
+    Rect() : x0(0), y0(0), x1(0), y1(0) {}
+    Rect(int xx0, int yy0, int xx1, int yy1)
+      : x0(xx0), y0(yy0), x1(xx1), y1(yy1) {}
+    bool empty() const { return x0 >= x1 || y0 >= y1; }
+    void Add(const Rect &other);
+    int x0, y0, x1, y1;
+  };
+
+  Compositor(const Compositor &);  // Not copyable.
+
+  void Blend(const Rect &region);
+
+  const int width_;
+  const int height_;
+  std::vector<Layer*> layers_;
+  std::vector<Color> screen_;   // Current result of all layers.
+  // Regions not written yet to the FrameCanvases we were composing to.
+  std::vector<std::pair<const FrameCanvas*, Rect> > pending_;
+};
+}  // namespace rgb_matrix
+#endif  // RPI_COMPOSITOR_H
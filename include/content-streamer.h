@@ -18,6 +18,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 namespace rgb_matrix {
 class FrameCanvas;
@@ -36,6 +37,19 @@ public:
   // Write bytes from buffer. Similar to Posix behavior that allows short
   // writes.
   virtual ssize_t Append(const void *buf, size_t count) = 0;
+
+  // If the stream content is in memory: return a pointer to the next "count"
+  // bytes and advance past them, which avoids copying with Read().
+  // Returns NULL if not supported or fewer bytes available; Read() is to be
+  // used then. The data stays valid until the next Append().
+  virtual const char *ReadInPlace(size_t count) { (void)count; return NULL; }
+
+  // Random access for streams that support it, which is needed for seeking
+  // in StreamReader. Go to "offset" from the beginning; returns success.
+  virtual bool Seek(uint64_t offset) { (void)offset; return false; }
+
+  // Total size of the stream content or -1 if not known.
+  virtual int64_t Size() { return -1; }
 };
 
 class FileStreamIO : public StreamIO {
@@ -46,6 +60,53 @@ public:
   virtual void Rewind();
   virtual ssize_t Read(void *buf, size_t count);
   virtual ssize_t Append(const void *buf, size_t count);
+  virtual bool Seek(uint64_t offset);
+  virtual int64_t Size();
+
+private:
+  const int fd_;
+};
+
+// Read-only stream of a file mapped into memory, so that StreamReader can
+// take frames directly from the mapped pages. The kernel is asked to read
+// ahead of what is read. Falls back to plain reading if the file can't be
+// mapped (e.g. a pipe).
+class MmapStreamIO : public StreamIO {
+public:
+  explicit MmapStreamIO(int fd);  // Takes ownership of fd.
+  ~MmapStreamIO();
+
+  virtual void Rewind();
+  virtual ssize_t Read(void *buf, size_t count);
+  virtual ssize_t Append(const void *buf, size_t count);  // Not supported.
+  virtual const char *ReadInPlace(size_t count);
+  virtual bool Seek(uint64_t offset);
+  virtual int64_t Size();
+
+private:
+  void ReadAhead(size_t count);
+
+  const int fd_;
+  char *mapped_;  // NULL if not mapped.
+  size_t size_;
+  size_t pos_;
+};
+
+// Stream over a connected TCP socket, e.g. to send content rendered on one
+// machine to the Pis showing it (see utils/stream-receiver.cc). Can't be
+// rewound.
+class SocketStreamIO : public StreamIO {
+public:
+  explicit SocketStreamIO(int fd);  // Takes ownership of fd.
+  ~SocketStreamIO();
+
+  // Connect to "host" (name or address) at "port". Returns NULL on failure,
+  // a message is printed to stderr then.
+  static SocketStreamIO *Connect(const char *host, int port);
+
+  virtual void Rewind();  // Not supported.
+  virtual ssize_t Read(void *buf, size_t count);
+  virtual ssize_t Append(const void *buf, size_t count);
 
 private:
   const int fd_;
@@ -56,6 +117,9 @@ public:
   virtual void Rewind();
   virtual ssize_t Read(void *buf, size_t count);
   virtual ssize_t Append(const void *buf, size_t count);
+  virtual const char *ReadInPlace(size_t count);
+  virtual bool Seek(uint64_t offset);
+  virtual int64_t Size();
 
 private:
   std::string buffer_;  // super simplistic.
@@ -65,17 +129,44 @@ private:
 class StreamWriter {
 public:
   // Does not take ownership of StreamIO
-  StreamWriter(StreamIO *io);
+  // With "delta_encoding", frames are stored as the difference to the
+  // previous frame, which is much smaller if only parts of the content
+  // change. Such streams can't be read by versions of this library before
+  // this option was introduced.
+  StreamWriter(StreamIO *io, bool delta_encoding = false);
 
   // Stream out given canvas at the given time. "hold_time_us" indicates
   // for how long this frame is to be shown in microseconds.
-  bool Stream(const FrameCanvas &frame, uint32_t hold_time_us);
+  // Optionally, "present_at_us" gives the wall-clock time (CLOCK_REALTIME
+  // in microseconds) the frame is meant to go live, so that several
+  // machines with synchronized clocks (e.g. NTP) can show their part of a
+  // wall at the same time. 0 means: right after the previous frame's hold
+  // time.
+  bool Stream(const FrameCanvas &frame, uint32_t hold_time_us,
+              uint64_t present_at_us = 0);
+
+  // Append an index of all frames streamed, which allows StreamReader to
+  // seek to a frame or time. Call once after the last frame. Requires the
+  // StreamIO to be empty before the first frame was streamed.
+  bool WriteIndex();
 
 private:
   void WriteFileHeader(const FrameCanvas &frame, size_t len);
+  void EncodeDelta(const char *data, size_t len);
+  bool Write(const void *data, size_t len);
 
   StreamIO *const io_;
+  const bool delta_encoding_;
   bool header_written_;
+  std::string previous_frame_;  // With delta encoding.
+  std::string encoded_;
+
+  // For the index.
+  uint64_t written_;   // Bytes so far.
+  uint64_t time_us_;   // Sum of hold times so far.
+  uint32_t frames_;
+  uint32_t last_full_frame_;
+  std::string index_;
 };
 
 class StreamReader {
@@ -89,7 +180,32 @@ public:
 
   // Get next frame and its timestamp. Returns 'false' if there is an error
   // or end of stream reached..
-  bool GetNext(FrameCanvas *frame, uint32_t* hold_time_us);
+  // If "present_at_us" is not NULL, it receives the wall-clock presentation
+  // time the frame was streamed with (see StreamWriter::Stream()) or 0.
+  bool GetNext(FrameCanvas *frame, uint32_t* hold_time_us,
+               uint64_t *present_at_us = NULL);
+
+  // Like GetNext(), but instead of filling a canvas, return the serialized
+  // next frame in "data" and "len", as accepted by FrameCanvas::Deserialize().
+  // If the StreamIO supports ReadInPlace(), this points directly into the
+  // stream content, otherwise to a buffer valid until the next call.
+  // The "frame" is only used to check that the stream is made for it.
+  bool GetNextData(const FrameCanvas &frame, const char **data, size_t *len,
+                   uint32_t *hold_time_us, uint64_t *present_at_us = NULL);
+
+  // Seeking needs a StreamIO that supports it and a stream with an index
+  // (see StreamWriter::WriteIndex()). Otherwise, these return false or -1.
+
+  // Number of frames in the stream.
+  int GetFrameCount();
+
+  // Make the next GetNext() return the given frame (counting from 0).
+  // Immediate for streams stored in full; with delta encoding, the frames
+  // since the last full frame need to be read.
+  bool SeekToFrame(int frame);
+
+  // Seek to the frame that is shown "time_us" microseconds after start.
+  bool SeekToTime(uint64_t time_us);
 
 private:
   enum State {
@@ -97,12 +213,59 @@ private:
     STREAM_READING,
     STREAM_ERROR,
   };
-  bool ReadFileHeader(const FrameCanvas &frame);
+  bool Read(void *buf, size_t count);
+  const char *ReadInPlace(size_t count);
+  bool ReadFileHeader();
+  bool ReadFrame(const char **data, uint32_t *hold_time_us,
+                 uint64_t *present_at_us);
+  bool ApplyDelta(const char *delta, size_t len);
+  bool LoadIndex();
 
   StreamIO *io_;
+  int width_;
+  int height_;
+  bool delta_encoded_;
+  std::string index_;           // IndexEntries, once loaded.
+  bool index_loaded_;
+  std::string current_frame_;  // Reconstructed from deltas.
   size_t frame_buf_size_;
   State state_;
 
   char *header_frame_buffer_;
+  uint64_t position_;  // In the StreamIO.
+};
+
+// Reads the frames of a StreamReader in a separate thread into spare
+// canvases ahead of time, so that a slow read, e.g. from an SD card, does
+// not delay showing the next frame. At the end of the stream, it continues
+// at the beginning, so that loops run without a gap.
+class StreamPrefetcher {
+public:
+  // Read ahead from "reader" into the given canvases; their number is the
+  // number of frames read ahead. Neither reader nor canvases are owned;
+  // the reader is not to be used otherwise while prefetching.
+  StreamPrefetcher(StreamReader *reader,
+                   const std::vector<FrameCanvas*> &canvases);
+  ~StreamPrefetcher();
+
+  // Get the next frame and its hold time (and presentation time, see
+  // StreamReader::GetNext()); blocks until it is read.
+  // Returns NULL at the end of the stream, then continues with the first
+  // frame again. If the stream has no frames or can't be rewound (such as a
+  // SocketStreamIO), it returns NULL from then on.
+  FrameCanvas *GetNext(uint32_t *hold_time_us,
+                       uint64_t *present_at_us = NULL);
+
+  // Give back a canvas from GetNext() that is not needed anymore, usually
+  // the one returned by SwapOnVSync() once the next frame is shown.
+  void Recycle(FrameCanvas *canvas);
+
+  // Stop reading ahead and add all canvases not given out with GetNext()
+  // (including the recycled ones) to "canvases".
+  void Stop(std::vector<FrameCanvas*> *canvases);
+
+private:
+  class PrefetchThread;
+  PrefetchThread *const thread_;
 };
 }
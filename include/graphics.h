@@ -13,6 +13,7 @@
 #include <stddef.h>
 
 #include <map>
+#include <vector>
 
 namespace rgb_matrix {
 struct Color {
@@ -70,14 +71,35 @@ public:
 private:
   Font(const Font& x);  // No copy constructor. Use references or pointer instead.
 
-  struct Glyph;
-  typedef std::map<uint32_t, Glyph*> CodepointGlyphMap;
-
+  // Glyphs while loading and transforming: bitmap per row.
+  struct BitmapGlyph;
+  typedef std::map<uint32_t, BitmapGlyph> CodepointBitmapMap;
+
+  // Packed glyph as used for drawing. All glyphs are in one contiguous atlas:
+  // each row of a glyph is a run of spans of set pixels.
+  struct Span {
+    uint16_t x;  // Start relative to the left of the glyph.
+    uint16_t length;
+  };
+  struct Glyph {
+    int device_width, device_height;
+    int width, height;
+    int x_offset, y_offset;
+    uint32_t first_row;  // Row index into row_start_
+  };
+
+  void Pack(const CodepointBitmapMap &bitmaps);
+  void Unpack(CodepointBitmapMap *bitmaps) const;
   const Glyph *FindGlyph(uint32_t codepoint) const;
 
   int font_height_;
   int base_line_;
-  CodepointGlyphMap glyphs_;
+  std::vector<Glyph> glyphs_;
+  std::vector<uint32_t> row_start_;  // Spans of row i: row_start_[i..i+1)
+  std::vector<Span> spans_;
+  int latin_glyph_[256];   // Index into glyphs_ for codepoints < 256 or -1.
+  // Sorted by codepoint: all other codepoints with their index into glyphs_.
+  std::vector<std::pair<uint32_t, int> > other_glyph_;
 };
 
 // -- Some utility functions.
@@ -152,6 +152,31 @@ struct RGBLedMatrixOptions {
    * to keep a constant refresh rate. <= 0 for no limit.
    */
   int limit_refresh_rate_hz;     /* Corresponding flag: --led-limit-refresh */
+
+  /* Store only color bits in the framebuffer: less memory, a bit more work
+   * while refreshing.
+   */
+  bool packed_framebuffer;       /* Flag: --led-packed-framebuffer */
+
+  /* Refresh the panel with the DMA engine instead of the CPU. */
+  bool dma_output;               /* Flag: --led-dma */
+
+  /* File to keep the final pixel mapping in for faster startup. */
+  const char *pixel_mapper_cache;  /* Flag: --led-pixel-mapper-cache */
+
+  /* Multiplexing described as table (or '@' and filename) instead of
+   * multiplexing type.
+   */
+  const char *multiplex_table;     /* Flag: --led-multiplex-table */
+
+  /* Per-channel gain, gamma and 3D lookup table (or '@' and filename). */
+  const char *color_calibration;   /* Flag: --led-color-calibration */
+
+  /* Additional color bits (0..2) shown over a sequence of refreshes. */
+  int pwm_temporal_dither_bits;    /* Flag: --led-pwm-temporal-dither */
+
+  /* Put the framebuffers into huge pages, if the kernel has some reserved. */
+  bool hugepage_framebuffer;       /* Flag: --led-hugepages */
 };
 
 /**
@@ -194,6 +219,16 @@ struct RGBLedRuntimeOptions {
   // to. Unless chosen otherwise, the default is "daemon" for user and group.
   const char *drop_priv_user;
   const char *drop_priv_group;
+
+  // Placement and scheduling of the refresh thread; see RuntimeOptions in
+  // led-matrix.h. As with the other fields, 0 (or NULL) keeps the default.
+  // refresh_cpu is only used if refresh_cpu_set is true, so that any core,
+  // including 0, or -1 for the last core, can be chosen.
+  bool refresh_cpu_set;
+  int refresh_cpu;                 // Flag: --led-refresh-cpu
+  const char *refresh_scheduling;  // Flag: --led-refresh-sched
+  int refresh_priority;            // Flag: --led-refresh-priority
+  bool lock_memory;                // Flag: --led-lock-memory (default off)
 };
 
 /**
@@ -327,6 +362,22 @@ void led_canvas_clear(struct LedCanvas *canvas);
 /** Fill matrix with given color. */
 void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b);
 
+/**
+ * Fill rectangle of "width" x "height" with top left corner at x, y.
+ */
+void led_canvas_fill_rect(struct LedCanvas *canvas, int x, int y,
+                          int width, int height,
+                          uint8_t r, uint8_t g, uint8_t b);
+
+/**
+ * Set the whole canvas from a packed RGB image (three bytes per pixel, r
+ * first) of exactly the size of the canvas. "stride" is the number of bytes
+ * from the start of one image row to the next, 3 * width if tightly packed.
+ * This is the fastest way to get a full frame into the canvas.
+ */
+void led_canvas_set_frame_rgb(struct LedCanvas *canvas,
+                              const uint8_t *rgb, int stride);
+
 /*** API to provide double-buffering. ***/
 
 /**
@@ -335,6 +386,16 @@ void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b);
  */
 struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix);
 
+/**
+ * Canvas pool, see RGBMatrix::AcquireFrameCanvas()/ReleaseFrameCanvas():
+ * like led_matrix_create_offscreen_canvas(), but re-uses released canvases.
+ * A released canvas must not be used anymore; releasing fails (returns
+ * false) while it is shown, queued or not reclaimed yet.
+ */
+struct LedCanvas *led_matrix_acquire_offscreen_canvas(struct RGBLedMatrix *matrix);
+bool led_matrix_release_offscreen_canvas(struct RGBLedMatrix *matrix,
+                                         struct LedCanvas *canvas);
+
 /**
  * Swap the given canvas (created with create_offscreen_canvas) with the
  * currently active canvas on vsync (blocks until vsync is reached).
@@ -350,9 +411,89 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas);
 
+/**
+ * Non-blocking alternative to led_matrix_swap_on_vsync(): queue the canvas
+ * to be shown after the ones queued before. Returns false if the queue is
+ * full. Canvases replaced on the display are returned by
+ * led_matrix_reclaim_canvas(), or NULL if there is none right now.
+ * Call both from the same thread; don't mix with led_matrix_swap_on_vsync().
+ */
+bool led_matrix_enqueue_canvas(struct RGBLedMatrix *matrix,
+                               struct LedCanvas *canvas,
+                               unsigned framerate_fraction);
+struct LedCanvas *led_matrix_reclaim_canvas(struct RGBLedMatrix *matrix,
+                                            uint32_t *presented_at_us);
+
+/**
+ * Timed presentation: like the functions above, but the canvas is shown at
+ * the first refresh at or after "present_at_us", a time in the rolling
+ * over microsecond time base of led_matrix_get_microsecond_counter().
+ * If "presented_at_us" is not NULL, it receives the time the canvas went
+ * live.
+ */
+struct LedCanvas *led_matrix_swap_on_vsync_at(struct RGBLedMatrix *matrix,
+                                              struct LedCanvas *canvas,
+                                              uint32_t present_at_us,
+                                              uint32_t *presented_at_us);
+bool led_matrix_enqueue_canvas_at(struct RGBLedMatrix *matrix,
+                                  struct LedCanvas *canvas,
+                                  uint32_t present_at_us);
+uint32_t led_matrix_get_microsecond_counter(void);
+
 uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix);
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix, uint8_t brightness);
 
+/**
+ * Brightness in percent applied while refreshing; takes effect right away
+ * for whatever is shown without re-drawing canvases. Range 1..100.
+ */
+uint8_t led_matrix_get_output_brightness(struct RGBLedMatrix *matrix);
+void led_matrix_set_output_brightness(struct RGBLedMatrix *matrix,
+                                      uint8_t brightness);
+
+/**
+ * Statistics of the refresh thread; see RGBMatrix::RefreshStats in
+ * led-matrix.h for details. Times are in microseconds.
+ */
+#define LED_REFRESH_HISTOGRAM_BUCKETS 64
+#define LED_REFRESH_HISTOGRAM_BUCKET_US 250
+struct LedRefreshStats {
+  uint64_t refreshes;
+  uint64_t total_refresh_us;
+  uint32_t min_refresh_us;
+  uint32_t max_refresh_us;
+  uint32_t refresh_histogram[LED_REFRESH_HISTOGRAM_BUCKETS];
+  uint64_t over_budget;
+  uint64_t swaps;
+  uint64_t total_swap_latency_us;
+  uint32_t max_swap_latency_us;
+  uint64_t pulse_sleeps;
+  uint64_t total_pulse_overshoot_us;
+  uint32_t max_pulse_overshoot_us;
+};
+void led_matrix_get_refresh_stats(struct RGBLedMatrix *matrix,
+                                  struct LedRefreshStats *stats);
+void led_matrix_reset_refresh_stats(struct RGBLedMatrix *matrix);
+
+/**
+ * The CPU the refresh thread runs on, -1 if the refresh is not running.
+ */
+int led_matrix_get_refresh_cpu(struct RGBLedMatrix *matrix);
+
+/**
+ * GPIO inputs, see RGBMatrix::RequestInputs() and AwaitInputChange().
+ * A timeout of 0 returns the latest input bits without waiting.
+ */
+uint64_t led_matrix_request_inputs(struct RGBLedMatrix *matrix, uint64_t bits);
+uint64_t led_matrix_await_input_change(struct RGBLedMatrix *matrix,
+                                       int timeout_ms);
+/**
+ * Non-blocking file descriptor to poll() for input changes; read its 8 byte
+ * counter to reset it. -1 if the refresh is not running.
+ * See RGBMatrix::InputEventFd().
+ */
+int led_matrix_input_event_fd(struct RGBLedMatrix *matrix);
+
 // Utility function: set an image from the given buffer containting pixels.
 //
 // Draw image of size "image_width" and "image_height" from pixel at
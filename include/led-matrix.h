@@ -23,6 +23,7 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -36,6 +37,12 @@ class RGBMatrix;
 class FrameCanvas;   // Canvas for Double- and Multibuffering
 struct RuntimeOptions;
 
+// Rolling over microsecond counter; this is the time base for presentation
+// times, e.g. in RGBMatrix::SwapOnVSyncAt(). As it wraps around every ~71
+// minutes, compare times by their difference: (int32_t)(a - b) < 0 if a is
+// before b.
+uint32_t GetMicrosecondCounter();
+
 // The RGB matrix provides the framebuffer and the facilities to constantly
 // update the LED matrix.
 //
@@ -91,6 +98,10 @@ public:
     // Set PWM bits used for output. Default is 11, but if you only deal with
     // limited comic-colors, 1 might be sufficient. Lower require less CPU and
     // increases refresh-rate.
+    // Values above 11 (up to 16) add bits at the low end for better color
+    // in low-light situations; the timing of the upper 11 bits stays the
+    // same. The value given at creation time is the upper limit for
+    // RGBMatrix::SetPWMBits() later.
     // Flag: --led-pwm-bits
     int pwm_bits;
 
@@ -105,6 +116,14 @@ public:
     // Flag: --led-pwm-dither-bits
     int pwm_dither_bits;
 
+    // Colors get this many bits (0..2) more precision than the bitplanes
+    // shown in one refresh. The framebuffers keep 2^bits variants that are
+    // shown one after another, which in sum show the additional bits. Same
+    // refresh rate, better dark colors, but that much more memory and time
+    // for drawing.
+    // Flag: --led-pwm-temporal-dither
+    int pwm_temporal_dither_bits;
+
     // The initial brightness of the panel in percent. Valid range is 1..100
     // Default: 100
     // Flag: --led-brightness
@@ -147,14 +166,54 @@ public:
     // parameter.
     const char *pixel_mapper_config;   // Flag: --led-pixel-mapper
 
+    // If set, the final pixel mapping is stored in this file and loaded
+    // from it in the next start with the same options, instead of being
+    // computed again; saves startup time for large setups with several
+    // pixel mappers. The file is re-created whenever the options differ.
+    const char *pixel_mapper_cache;    // Flag: --led-pixel-mapper-cache
+
+    // Multiplexing described as table instead of one of the built-in
+    // types, for panels not known yet. The format is described in the
+    // README. With a leading '@', the name of a file containing the table.
+    const char *multiplex_table;       // Flag: --led-multiplex-table
+
     // Panel type. Typically an empty string or NULL, but some panels need
     // a particular initialization sequence, so this is used for that.
     // This can be e.g. "FM6126A" for that particular panel type.
     const char *panel_type;  // Flag: --led-panel-type
 
+    // Per-channel correction of the panels, as semicolon separated list of
+    // gain=<r>,<g>,<b> (output luminance factor), gamma=<r>,<g>,<b> (power
+    // curve instead of the CIE1931 luminance correction) and lut=<file>
+    // (3D lookup table in .cube format). E.g. "gain=1,0.9,0.85;gamma=2.2".
+    // With a leading '@', the name of a file containing that description.
+    // Computed into the color lookup tables when the matrix is created.
+    const char *color_calibration;  // Flag: --led-color-calibration
+
     // Limit refresh rate of LED panel. This will help on a loaded system
     // to keep a constant refresh rate. <= 0 for no limit.
     int limit_refresh_rate_hz;   // Flag: --led-limit-refresh
+
+    // Store only the color bits in the framebuffer instead of full GPIO
+    // words. This reduces the memory footprint of each canvas considerably
+    // (by factor 3 to 10, depending on parallel chains), at the expense of
+    // some extra work while clocking out the data. Helps large setups whose
+    // framebuffers don't fit into the CPU cache anymore.
+    // Serialized canvases are not compatible between the two modes.
+    bool packed_framebuffer;     // Flag: --led-packed-framebuffer
+
+    // Refresh the panel with the DMA engine instead of the CPU. Needs the
+    // hardware pulse generator and direct row addressing; dithering,
+    // limit_refresh_rate_hz and frame fractions in SwapOnVSync() are not
+    // applied. Falls back to CPU refresh if not available.
+    bool dma_output;             // Flag: --led-dma
+
+    // Put the framebuffer of each canvas into huge pages, so that refreshing
+    // needs fewer TLB entries. Each canvas then takes at least one huge page
+    // (typically 2MB), so this is only worthwhile for large setups. Needs
+    // huge pages reserved in the kernel (vm.nr_hugepages), otherwise regular
+    // pages are used.
+    bool hugepage_framebuffer;   // Flag: --led-hugepages
   };
 
   // Factory to create a matrix. Additional functionality includes dropping
@@ -199,6 +258,8 @@ public:
                         uint8_t red, uint8_t green, uint8_t blue);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue);
 
   // -- Double- and Multibuffering.
 
@@ -213,9 +274,21 @@ public:
   // The ownership of the created Canvases remains with the RGBMatrix, so you
   // don't have to worry about deleting them (but you also don't want to create
   // more than needed as this will fill up your memory as they are only deleted
-  // when the RGBMatrix is deleted).
+  // when the RGBMatrix is deleted or given back with ReleaseFrameCanvas()).
   FrameCanvas *CreateFrameCanvas();
 
+  // A pool of canvases, for applications that need many frames for a while
+  // (e.g. pre-rendering a scene) and then drop them again.
+  // AcquireFrameCanvas() returns a cleared canvas like CreateFrameCanvas(),
+  // re-using a released one if possible. ReleaseFrameCanvas() gives a canvas
+  // back; a few are kept for re-use, the memory of all others is freed. Don't
+  // use the canvas after releasing it.
+  // A canvas can't be released while it is shown, queued with EnqueueFrame()
+  // or not reclaimed yet with ReclaimFrame(); then false is returned and
+  // nothing changes. Call from the thread doing the swapping or queueing.
+  FrameCanvas *AcquireFrameCanvas();
+  bool ReleaseFrameCanvas(FrameCanvas *canvas);
+
   // This method waits to the next VSync and swaps the active buffer with the
   // supplied buffer. The formerly active buffer is returned.
   //
@@ -234,6 +307,55 @@ public:
   // time-correct animations.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // Like SwapOnVSync(), but the swap happens at the first refresh boundary
+  // at or after "present_at_us", given in the time base of
+  // GetMicrosecondCounter(). Blocks until then. If "presented_at_us" is
+  // not NULL, it receives the time the new frame actually went live.
+  //
+  // Instead of sleeping until a frame is due, an animation or video can just
+  // add its frame duration to the previous presentation time:
+  //
+  //   uint32_t t = GetMicrosecondCounter();
+  //   for (;;) {
+  //     DrawNextFrame(offscreen);
+  //     t += frame_duration_us;
+  //     offscreen = matrix->SwapOnVSyncAt(offscreen, t);
+  //   }
+  FrameCanvas *SwapOnVSyncAt(FrameCanvas *other, uint32_t present_at_us,
+                             uint32_t *presented_at_us = NULL);
+
+  // Non-blocking alternative to SwapOnVSync() for producers that want to
+  // prepare several frames ahead, e.g. video.
+  //
+  // EnqueueFrame() queues "canvas" to be shown after the frames queued
+  // before, each for at least "framerate_fraction" refreshes (in DMA mode,
+  // frame fractions are not applied). It returns right away: "true" if
+  // queued, "false" if the queue of up to four frames is full.
+  //
+  // Once a queued frame replaces the one shown so far, the latter can be
+  // fetched for re-use with ReclaimFrame(), which returns NULL if there is
+  // none (yet). The first reclaimed canvas is the one shown before the first
+  // EnqueueFrame(). Reclaim regularly: if there are too many frames to
+  // reclaim, the queue does not advance.
+  //
+  // EnqueueFrameAt() instead queues a frame to be shown at the first refresh
+  // boundary at or after "present_at_us" (see SwapOnVSyncAt()). ReclaimFrame()
+  // stores the time the returned canvas went live in "presented_at_us" if
+  // not NULL.
+  //
+  // These are meant to be called from the same, single thread, and not to
+  // be mixed with SwapOnVSync() usage.
+  //
+  //   FrameCanvas *canvas = matrix->CreateFrameCanvas();  // more for pipelining
+  //   for (;;) {
+  //     DrawNextFrame(canvas);
+  //     while (!matrix->EnqueueFrame(canvas)) usleep(1000);  // or other work
+  //     while ((canvas = matrix->ReclaimFrame()) == NULL) usleep(1000);
+  //   }
+  bool EnqueueFrame(FrameCanvas *canvas, unsigned framerate_fraction = 1);
+  bool EnqueueFrameAt(FrameCanvas *canvas, uint32_t present_at_us);
+  FrameCanvas *ReclaimFrame(uint32_t *presented_at_us = NULL);
+
   // -- Setting shape and behavior of matrix.
 
   // Apply a pixel mapper. This is used to re-map pixels according to some
@@ -257,6 +379,40 @@ public:
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();   // return the pwm-bits of the currently active buffer.
 
+  // Settings that can be changed while the matrix is running; same meaning
+  // as the corresponding Options.
+  struct RefreshSettings {
+    int pwm_bits;
+    int pwm_dither_bits;
+    int pwm_lsb_nanoseconds;
+    int limit_refresh_rate_hz;
+    const char *pixel_mapper_config;  // NULL: unchanged. "": no mappers.
+  };
+
+  // Current settings. The pixel_mapper_config points to storage of the
+  // matrix that is valid until the next Reconfigure().
+  RefreshSettings GetRefreshSettings() const;
+
+  // Change the settings without re-creating the RGBMatrix: a new pixel
+  // mapping is built first, then everything is switched between two
+  // refreshes, so there is no glitch on the panel. Returns when the new
+  // settings are in effect. Values out of range are rejected with a message
+  // on stderr and false returned; nothing is changed then.
+  // With Options::dma_output, pwm_dither_bits and pwm_lsb_nanoseconds can
+  // not be changed.
+  //
+  // All FrameCanvas keep their content, but with a different
+  // pixel_mapper_config, width() and height() might change and content
+  // is best drawn again. With more pwm_bits, the additional low bits of
+  // the colors stay dark until the content is drawn again.
+  //
+  // Not thread-safe with drawing: the pixel mapping all canvases share is
+  // replaced, and drawing does not lock. The refresh is synchronized
+  // internally, but no other thread may use the matrix or any of its
+  // canvases (drawing, SwapOnVSync(), CreateFrameCanvas(), ...) while
+  // this is in progress. Usually, call it from the one thread that draws.
+  bool Reconfigure(const RefreshSettings &settings);
+
   // Map brightness of output linearly to input with CIE1931 profile.
   void set_luminance_correct(bool on);
   bool luminance_correct() const;
@@ -266,6 +422,56 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Set brightness in percent that is applied while refreshing the panel by
+  // shortening the on-time of the LEDs. 1%..100%; default 100.
+  // In contrast to SetBrightness(), this takes effect on the next refresh
+  // for whatever is shown, without having to re-draw any FrameCanvas, so it
+  // is a cheap way to fade the whole display. Both brightness values
+  // multiply. Very low values might show less color accuracy in dark colors.
+  void SetOutputBrightness(uint8_t brightness);
+  uint8_t output_brightness();
+
+  //-- Statistics of the refresh thread.
+  // Collected all the time; reading them does not disturb the refresh.
+  // Times are in microseconds. A refresh is one full output of the frame;
+  // its refresh rate in Hz is 1e6 / refresh time.
+  struct RefreshStats {
+    static const int kHistogramBuckets = 64;
+    static const int kHistogramBucketUs = 250;
+
+    uint64_t refreshes;          // Number of refreshes.
+    uint64_t total_refresh_us;   // Sum of all refresh times, for average.
+    uint32_t min_refresh_us;
+    uint32_t max_refresh_us;
+    // Refreshes taking i * kHistogramBucketUs up to (i+1) * kHistogramBucketUs
+    // are counted in bucket i; the last bucket also counts all longer ones.
+    uint32_t refresh_histogram[kHistogramBuckets];
+
+    // With limit_refresh_rate_hz: refreshes that took longer than the
+    // time available per refresh.
+    uint64_t over_budget;
+
+    // Time from SwapOnVSync()/EnqueueFrame() to the frame going live.
+    // For queued or timed frames, this includes the intended waiting.
+    uint64_t swaps;
+    uint64_t total_swap_latency_us;
+    uint32_t max_swap_latency_us;
+
+    // How much longer than needed the refresh thread slept while waiting
+    // for output-enable pulses to finish. Only with hardware pulsing.
+    uint64_t pulse_sleeps;
+    uint64_t total_pulse_overshoot_us;
+    uint32_t max_pulse_overshoot_us;
+  };
+  void GetRefreshStats(RefreshStats *stats);
+  void ResetRefreshStats();   // Takes effect with the next refresh.
+
+  // The CPU the refresh thread runs on (see RuntimeOptions::refresh_cpu),
+  // e.g. to keep other latency-sensitive threads of the application away
+  // from it. If the thread is not pinned, this is where it was last seen.
+  // -1 if the refresh is not running.
+  int GetRefreshCpu() const;
+
   //-- GPIO interaction.
   // This library uses the GPIO pins to drive the matrix; this is a safe way
   // to request the 'remaining' bits to be used for user purposes.
@@ -298,6 +504,15 @@ public:
   // Returns the bitmap of all GPIO input pins.
   uint64_t AwaitInputChange(int timeout_ms);
 
+  // A file descriptor that becomes readable whenever the input pins change,
+  // so that inputs can be handled in an existing poll()/epoll() loop
+  // instead of a thread blocking in AwaitInputChange().
+  // When readable, read() the 8 byte counter (the number of changes)
+  // to reset it, then get the current bits with AwaitInputChange(0).
+  // The descriptor is non-blocking and owned by the matrix, don't close it.
+  // Returns -1 if the refresh has not been started yet.
+  int InputEventFd();
+
   // Request user writable GPIO bits.
   // This allows to request a bitmap of GPIO-bits to be used by the user for
   // writing.
@@ -373,6 +588,55 @@ public:
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
   void CopyFrom(const FrameCanvas &other);
 
+  //-- Change tracking.
+  // Internally, the canvas is organized in segments, one for each row address
+  // that is multiplexed on the panel (so e.g. 16 for a 32 row panel). Each
+  // segment remembers if it was written to since the last ClearChanged().
+  // This allows to only copy or store the parts that actually changed,
+  // which is a lot cheaper for mostly static content in large setups.
+
+  // Number of segments; at most 64.
+  int NumSegments() const;
+
+  // Bitmask of segments changed since last ClearChanged(); bit n is set if
+  // segment n was written to.
+  uint64_t ChangedSegments() const;
+  void ClearChanged();
+
+  // Like CopyFrom(), but only copies the segments that were changed in
+  // "other". The changed-state of this canvas is not modified.
+  //
+  // Useful in the double-buffering workflow: after SwapOnVSync(), bring
+  // the new off-screen canvas up to date with content drawn in the previous
+  // frame by copying only what changed and ClearChanged() on the canvas we
+  // copied from.
+  void CopyChangedFrom(const FrameCanvas &other);
+
+  // Like Serialize(), but only provides the data of a single segment. This
+  // data is found at offset (segment * len) in the buffer Serialize()
+  // provides.
+  void SerializeSegment(int segment, const char **data, size_t *len) const;
+
+  // Set the whole canvas from a packed RGB image (three bytes per pixel, r
+  // first) of exactly width() x height() pixels. "stride" is the number of
+  // bytes from the start of one image row to the next; for a tightly packed
+  // image that is 3 * width().
+  // This is the fastest way to get a full frame of pixels into the canvas.
+  void SetFrameRGB(const uint8_t *rgb, int stride);
+
+  // Draw with multiple threads. The canvas is split into horizontal bands of
+  // "band_height" rows and fn(y_begin, y_end) is called for each band with
+  // its rows [y_begin, y_end); your function must only set pixels in these
+  // rows.
+  // Bands are handed to worker threads (on the cores not used by the refresh
+  // thread) as far as they can be written concurrently: bands that share
+  // memory internally (depending on the panel multiplexing and pixel
+  // mapping) are called one after the other by the same thread.
+  // Returns when all bands are drawn. Only use SetPixel(), SetPixels() or
+  // other drawing functions that just set pixels within "fn".
+  void ParallelForRows(int band_height,
+                       const std::function<void(int y_begin, int y_end)> &fn);
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
@@ -382,6 +646,8 @@ public:
                          Color *colors);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue);
 
 private:
   friend class RGBMatrix;
@@ -435,6 +701,29 @@ struct RuntimeOptions {
   // to. Unless chosen otherwise, the default is "daemon" for user and group.
   const char *drop_priv_user;
   const char *drop_priv_group;
+
+  // The CPU core the refresh thread is pinned to. With -1, it is the last
+  // core, except for "deadline" scheduling, where the thread is not pinned.
+  // Flag: --led-refresh-cpu
+  int refresh_cpu;
+
+  // Scheduling policy of the refresh thread. One of
+  //   "fifo"     : SCHED_FIFO with refresh_priority (default).
+  //   "deadline" : SCHED_DEADLINE. Runtime and period are derived from the
+  //                time the first refreshes take and limit_refresh_rate_hz.
+  //   "other"    : Regular scheduling, no realtime priority.
+  // Flag: --led-refresh-sched
+  const char *refresh_scheduling;
+
+  // Realtime priority with "fifo" scheduling, 1..99. Default: 99.
+  // Flag: --led-refresh-priority
+  int refresh_priority;
+
+  // Lock the memory of the process as it is when the refresh starts and
+  // framebuffers created later, so that page faults don't delay the refresh.
+  // Off by default, as it pins all memory of the application.
+  // Flag: --led-lock-memory
+  bool lock_memory;
 };
 
 // Convenience utility functions to read standard rgb-matrix flags and create
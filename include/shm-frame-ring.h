@@ -0,0 +1,99 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Pass RGB frames from a renderer process to the process showing them
+// through shared memory: no copies through pipes, and the producer never
+// waits for the display; the consumer always shows the newest frame.
+//
+// The shared memory (shm_open() "name") contains a header followed by
+// "slots" frames of width * height packed RGB pixels (r first), each frame
+// starting at a multiple of 64 bytes:
+//
+//   uint32_t magic;           // kMagic
+//   uint32_t width, height, slots;
+//   uint32_t latest;          // Number of the newest complete frame; 0: none
+//   uint32_t sequence[16];    // Per slot: odd while it is written.
+//
+// Frame number n is in slot n % slots. So other languages can produce
+// frames as well: increment sequence, write pixels, increment sequence,
+// then set latest (and FUTEX_WAKE on it).
+
+#ifndef RPI_SHM_FRAME_RING_H
+#define RPI_SHM_FRAME_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace rgb_matrix {
+class FrameCanvas;
+
+class SharedFrameRing {
+public:
+  static const int kMaxSlots = 16;
+
+  // Create a new ring for frames of "width" x "height" with "slots" frames
+  // (2..kMaxSlots; three allow the producer to always have a free one).
+  // An existing ring with the same name is replaced. The ring is removed
+  // again when the returned object is deleted. Only processes allowed by
+  // the permissions "mode" can open it; e.g. 0660 for the group.
+  // Returns NULL on failure; a message is printed to stderr then.
+  static SharedFrameRing *Create(const char *name, int width, int height,
+                                 int slots = 3, mode_t mode = 0600);
+
+  // Open an existing ring. Its geometry is read just once here; whatever
+  // is written to the header later is not trusted. Returns NULL on failure.
+  static SharedFrameRing *Open(const char *name);
+
+  ~SharedFrameRing();
+
+  int width() const;
+  int height() const;
+
+  // -- Producer side; only one producer at a time.
+
+  // Returns the width() * height() RGB pixels of the next frame to fill.
+  uint8_t *BeginFrame();
+
+  // Publish the frame filled after BeginFrame() as the newest frame.
+  void EndFrame();
+
+  // -- Consumer side.
+
+  // Wait up to "timeout_ms" (-1: forever) for a frame newer than the last
+  // one returned and set "canvas" from it. Frames produced in between are
+  // skipped. Returns false on timeout or if "canvas" does not have the
+  // size of the ring.
+  bool GetNewest(FrameCanvas *canvas, int timeout_ms);
+
+private:
+  struct Header;
+
+  SharedFrameRing(const char *name, bool owner, void *mem, size_t size,
+                  int width, int height, int slots);
+  const uint8_t *Slot(int slot) const;
+
+  char *const name_;
+  const bool owner_;
+  void *const mem_;
+  const size_t size_;
+  Header *const header_;
+  const int width_;    // Geometry as checked in Create() or Open();
+  const int height_;   // not read from the shared header again.
+  const int slots_;
+  uint32_t writing_;   // Producer: frame number in progress.
+  uint32_t shown_;     // Consumer: last frame number returned.
+};
+}  // namespace rgb_matrix
+#endif  // RPI_SHM_FRAME_RING_H
@@ -38,7 +38,7 @@ namespace rgb_matrix {
 static constexpr int kMaxFontWidth = 196;
 typedef std::bitset<kMaxFontWidth> rowbitmap_t;
 
-struct Font::Glyph {
+struct Font::BitmapGlyph {
   int device_width, device_height;
   int width, height;
   int x_offset, y_offset;
@@ -66,13 +66,10 @@ static bool parseBitmap(const char *buffer, rowbitmap_t* result) {
   return true;
 }
 
-Font::Font() : font_height_(-1), base_line_(0) {}
-Font::~Font() {
-  for (CodepointGlyphMap::iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
-    delete it->second;
-  }
+Font::Font() : font_height_(-1), base_line_(0) {
+  std::fill(latin_glyph_, latin_glyph_ + 256, -1);
 }
+Font::~Font() {}
 
 // TODO: that might not be working for all input files yet.
 bool Font::LoadFont(const char *path) {
@@ -80,11 +77,14 @@ bool Font::LoadFont(const char *path) {
   FILE *f = fopen(path, "r");
   if (f == NULL)
     return false;
+  CodepointBitmapMap bitmaps;
+  Unpack(&bitmaps);  // Glyphs of previous loads stay unless replaced.
   uint32_t codepoint;
   char buffer[1024];
   int dummy;
-  Glyph tmp;
-  Glyph *current_glyph = NULL;
+  BitmapGlyph tmp;
+  BitmapGlyph current_glyph;
+  bool in_glyph = false;
   int row = 0;
 
   while (fgets(buffer, sizeof(buffer), f)) {
@@ -103,45 +103,113 @@ bool Font::LoadFont(const char *path) {
     }
     else if (sscanf(buffer, "BBX %d %d %d %d", &tmp.width, &tmp.height,
                     &tmp.x_offset, &tmp.y_offset) == 4) {
-      current_glyph = new Glyph();
-      *current_glyph = tmp;
-      current_glyph->bitmap.resize(tmp.height);
+      current_glyph = tmp;
+      current_glyph.bitmap.assign(tmp.height, rowbitmap_t());
+      in_glyph = true;
       row = -1;  // let's not start yet, wait for BITMAP
     }
     else if (strncmp(buffer, "BITMAP", strlen("BITMAP")) == 0) {
       row = 0;
     }
-    else if (current_glyph && row >= 0 && row < current_glyph->height
-             && parseBitmap(buffer, &current_glyph->bitmap[row])) {
+    else if (in_glyph && row >= 0 && row < current_glyph.height
+             && parseBitmap(buffer, &current_glyph.bitmap[row])) {
       row++;
     }
     else if (strncmp(buffer, "ENDCHAR", strlen("ENDCHAR")) == 0) {
-      if (current_glyph && row == current_glyph->height) {
-        delete glyphs_[codepoint];  // just in case there was one.
-        glyphs_[codepoint] = current_glyph;
-        current_glyph = NULL;
+      if (in_glyph && row == current_glyph.height) {
+        bitmaps[codepoint] = current_glyph;  // replacing possible old one.
+        in_glyph = false;
       }
     }
   }
   fclose(f);
+  Pack(bitmaps);
   return true;
 }
 
+// Convert bitmaps into the atlas, replacing all glyphs.
+void Font::Pack(const CodepointBitmapMap &bitmaps) {
+  glyphs_.clear();
+  row_start_.clear();
+  spans_.clear();
+  other_glyph_.clear();
+  std::fill(latin_glyph_, latin_glyph_ + 256, -1);
+  for (CodepointBitmapMap::const_iterator it = bitmaps.begin();
+       it != bitmaps.end(); ++it) {
+    const BitmapGlyph &b = it->second;
+    const Glyph g = { b.device_width, b.device_height, b.width, b.height,
+                      b.x_offset, b.y_offset, (uint32_t)row_start_.size() };
+    for (int y = 0; y < b.height; ++y) {
+      row_start_.push_back(spans_.size());
+      const rowbitmap_t &row = b.bitmap[y];
+      for (int x = 0; x < b.device_width; /**/) {
+        if (!row.test(kMaxFontWidth - 1 - x)) {
+          ++x;
+          continue;
+        }
+        Span span;
+        span.x = x;
+        while (x < b.device_width && row.test(kMaxFontWidth - 1 - x)) ++x;
+        span.length = x - span.x;
+        spans_.push_back(span);
+      }
+    }
+    const int index = glyphs_.size();
+    glyphs_.push_back(g);
+    if (it->first < 256) {
+      latin_glyph_[it->first] = index;
+    } else {
+      other_glyph_.push_back(std::make_pair(it->first, index));  // Sorted.
+    }
+  }
+  row_start_.push_back(spans_.size());  // End of last row.
+}
+
+void Font::Unpack(CodepointBitmapMap *bitmaps) const {
+  std::vector<std::pair<uint32_t, int> > all(other_glyph_);
+  for (uint32_t cp = 0; cp < 256; ++cp) {
+    if (latin_glyph_[cp] >= 0) all.push_back(std::make_pair(cp, latin_glyph_[cp]));
+  }
+  for (size_t i = 0; i < all.size(); ++i) {
+    const Glyph &g = glyphs_[all[i].second];
+    BitmapGlyph &b = (*bitmaps)[all[i].first];
+    b.device_width = g.device_width;
+    b.device_height = g.device_height;
+    b.width = g.width;
+    b.height = g.height;
+    b.x_offset = g.x_offset;
+    b.y_offset = g.y_offset;
+    b.bitmap.assign(g.height, rowbitmap_t());
+    for (int y = 0; y < g.height; ++y) {
+      for (uint32_t s = row_start_[g.first_row + y];
+           s < row_start_[g.first_row + y + 1]; ++s) {
+        for (int x = spans_[s].x; x < spans_[s].x + spans_[s].length; ++x) {
+          b.bitmap[y].set(kMaxFontWidth - 1 - x);
+        }
+      }
+    }
+  }
+}
+
 Font *Font::CreateOutlineFont() const {
   Font *r = new Font();
   const int kBorder = 1;
   r->font_height_ = font_height_ + 2*kBorder;
   r->base_line_ = base_line_ + kBorder;
-  for (CodepointGlyphMap::const_iterator it = glyphs_.begin();
-       it != glyphs_.end(); ++it) {
-    const Glyph *orig = it->second;
+  CodepointBitmapMap glyphs, outline_glyphs;
+  Unpack(&glyphs);
+  for (CodepointBitmapMap::const_iterator it = glyphs.begin();
+       it != glyphs.end(); ++it) {
+    const BitmapGlyph *orig = &it->second;
     const int height = orig->height + 2 * kBorder;
-    Glyph *const tmp_glyph = new Glyph();
+    BitmapGlyph *const tmp_glyph = &outline_glyphs[it->first];
     tmp_glyph->bitmap.resize(height);
     tmp_glyph->width  = orig->width  + 2*kBorder;
     tmp_glyph->height = height;
-    tmp_glyph->device_width  = orig->device_width + 2*kBorder;
+    tmp_glyph->device_width  = std::min(orig->device_width + 2*kBorder,
+                                        kMaxFontWidth);
     tmp_glyph->device_height = height;
+    tmp_glyph->x_offset = 0;
     tmp_glyph->y_offset = orig->y_offset - kBorder;
     // TODO: we don't really need bounding box, right ?
     const rowbitmap_t fill_pattern = 0b111;
@@ -163,16 +231,27 @@ Font *Font::CreateOutlineFont() const {
       rowbitmap_t orig_bitmap = orig->bitmap[h] >> kBorder;
       tmp_glyph->bitmap[h+kBorder] &= ~orig_bitmap;
     }
-    r->glyphs_[it->first] = tmp_glyph;
   }
+  r->Pack(outline_glyphs);
   return r;
 }
 
+static bool CodepointLess(const std::pair<uint32_t, int> &entry,
+                          uint32_t codepoint) {
+  return entry.first < codepoint;
+}
+
 const Font::Glyph *Font::FindGlyph(uint32_t unicode_codepoint) const {
-  CodepointGlyphMap::const_iterator found = glyphs_.find(unicode_codepoint);
-  if (found == glyphs_.end())
+  if (unicode_codepoint < 256) {
+    const int index = latin_glyph_[unicode_codepoint];
+    return index < 0 ? NULL : &glyphs_[index];
+  }
+  std::vector<std::pair<uint32_t, int> >::const_iterator found
+    = std::lower_bound(other_glyph_.begin(), other_glyph_.end(),
+                       unicode_codepoint, CodepointLess);
+  if (found == other_glyph_.end() || found->first != unicode_codepoint)
     return NULL;
-  return found->second;
+  return &glyphs_[found->second];
 }
 
 int Font::CharacterWidth(uint32_t unicode_codepoint) const {
@@ -193,14 +272,24 @@ int Font::DrawGlyph(Canvas *c, int x_pos, int y_pos,
     return g->device_width;  // Outside canvas border. Bail out early.
   }
 
+  const int canvas_height = c->height();
   for (int y = 0; y < g->height; ++y) {
-    const rowbitmap_t& row = g->bitmap[y];
-    for (int x = 0; x < g->device_width; ++x) {
-      if (row.test(kMaxFontWidth - 1 - x)) {
-        c->SetPixel(x_pos + x, y_pos + y, color.r, color.g, color.b);
-      } else if (bgcolor) {
-        c->SetPixel(x_pos + x, y_pos + y, bgcolor->r, bgcolor->g, bgcolor->b);
+    if (y_pos + y < 0 || y_pos + y >= canvas_height) continue;
+    int x = 0;  // Up to here, the row is drawn.
+    for (uint32_t s = row_start_[g->first_row + y];
+         s < row_start_[g->first_row + y + 1]; ++s) {
+      const Span &span = spans_[s];
+      if (bgcolor && span.x > x) {
+        c->DrawHLine(x_pos + x, y_pos + y, span.x - x,
+                     bgcolor->r, bgcolor->g, bgcolor->b);
       }
+      c->DrawHLine(x_pos + span.x, y_pos + y, span.length,
+                   color.r, color.g, color.b);
+      x = span.x + span.length;
+    }
+    if (bgcolor && g->device_width > x) {
+      c->DrawHLine(x_pos + x, y_pos + y, g->device_width - x,
+                   bgcolor->r, bgcolor->g, bgcolor->b);
     }
   }
   return g->device_width;
@@ -0,0 +1,306 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Benchmark of the hot paths of the library without hardware: the output
+// goes to a memory backed GPIO that counts the writes.
+// Built and run with 'make bench'. Prints one JSON object per line and
+// measurement, e.g.
+//   {"geometry":"64x32","bench":"SetPixel","ns_per_pixel":4.210}
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+
+#include "canvas.h"
+#include "graphics.h"
+#include "pixel-mapper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+using rgb_matrix::Canvas;
+using rgb_matrix::Color;
+using rgb_matrix::GPIO;
+using rgb_matrix::PixelMapper;
+using rgb_matrix::internal::Framebuffer;
+using rgb_matrix::internal::PixelDesignator;
+using rgb_matrix::internal::PixelDesignatorMap;
+
+namespace {
+struct Geometry {
+  const char *name;
+  const char *hardware_mapping;
+  int rows, cols, chain, parallel;
+};
+
+const Geometry kGeometries[] = {
+  { "64x32",                  "regular",        32, 64, 1, 1 },
+  { "64x64-chain8-parallel3", "regular",        64, 64, 8, 3 },
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+  { "64x32-chain4-parallel6", "compute-module", 32, 64, 4, 6 },
+#endif
+};
+
+const int kGpioSlowdown = 1;   // Default of --led-slowdown-gpio
+const int kMinMeasureNanos = 200 * 1000 * 1000;
+
+int64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Average time of "fn" in nanoseconds, called often enough to be measurable.
+template <typename Function>
+double NanosPerCall(const Function &fn) {
+  fn();  // Warm up caches.
+  for (int64_t count = 1; /**/; count *= 2) {
+    const int64_t start = NowNanos();
+    for (int64_t i = 0; i < count; ++i) fn();
+    const int64_t duration = NowNanos() - start;
+    if (duration >= kMinMeasureNanos) return (double)duration / count;
+  }
+}
+
+void Report(const Geometry &g, const char *bench,
+            const char *unit, double value) {
+  printf("{\"geometry\":\"%s\",\"bench\":\"%s\",\"%s\":%.3f}\n",
+         g.name, bench, unit, value);
+  fflush(stdout);
+}
+
+// Like the FrameCanvas, to draw text with the regular graphics functions.
+class FramebufferCanvas : public Canvas {
+public:
+  explicit FramebufferCanvas(Framebuffer *frame) : frame_(frame) {}
+  virtual int width() const { return frame_->width(); }
+  virtual int height() const { return frame_->height(); }
+  virtual void SetPixel(int x, int y,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    frame_->SetPixel(x, y, red, green, blue);
+  }
+  virtual void Clear() { frame_->Clear(); }
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) {
+    frame_->Fill(red, green, blue);
+  }
+  virtual void FillRect(int x, int y, int width, int height,
+                        uint8_t red, uint8_t green, uint8_t blue) {
+    frame_->FillRect(x, y, width, height, red, green, blue);
+  }
+
+private:
+  Framebuffer *const frame_;
+};
+
+// Time of building the pixel lookup with "mapper", as
+// RGBMatrix::ApplyPixelMapper() does, and of setting all pixels of a frame
+// through it, as a FrameCanvas with --led-pixel-mapper does. Then the pixel
+// map is not read in the order of the bitplanes any more, so its size
+// matters.
+void BenchPixelMapper(const Geometry &g, const char *name, const char *param,
+                      const PixelDesignatorMap &base) {
+  const PixelMapper *mapper = rgb_matrix::FindPixelMapper(name, g.chain,
+                                                          g.parallel, param);
+  int width, height;
+  if (mapper == NULL || !mapper->GetSizeMapping(base.width(), base.height(),
+                                                &width, &height)) {
+    return;  // Not applicable to this geometry.
+  }
+  PixelDesignatorMap *const original = const_cast<PixelDesignatorMap*>(&base);
+  PixelDesignatorMap mapped(width, height, base);
+  const double ns = NanosPerCall([&]() {
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          int orig_x = -1, orig_y = -1;
+          mapper->MapVisibleToMatrix(base.width(), base.height(),
+                                     x, y, &orig_x, &orig_y);
+          *mapped.get(x, y) = *original->get(orig_x, orig_y);
+        }
+      }
+    });
+  char bench[64];
+  snprintf(bench, sizeof(bench), "PixelMapper:%s%s%s",
+           name, param ? ":" : "", param ? param : "");
+  Report(g, bench, "ns_per_pixel", ns / (width * height));
+
+  PixelDesignatorMap *mapped_map = &mapped;
+  Framebuffer frame(g.rows, g.cols * g.chain, g.parallel,
+                    Framebuffer::kDefaultBitPlanes, 0, "RGB", false, false, 0,
+                    false, &mapped_map);
+  uint8_t value = 0;
+  snprintf(bench, sizeof(bench), "SetPixel:%s%s%s",
+           name, param ? ":" : "", param ? param : "");
+  Report(g, bench, "ns_per_pixel", NanosPerCall([&]() {
+        ++value;
+        for (int y = 0; y < height; ++y) {
+          for (int x = 0; x < width; ++x) {
+            frame.SetPixel(x, y, x + value, y + value, x ^ y);
+          }
+        }
+      }) / (width * height));
+}
+
+void RunGeometry(const Geometry &g, const rgb_matrix::Font *font) {
+  Framebuffer::InitHardwareMapping(g.hardware_mapping);
+  GPIO io;
+  io.InitMemoryBacked(kGpioSlowdown);
+  const int bitplanes = Framebuffer::kDefaultBitPlanes;
+  Framebuffer::InitGPIO(&io, g.rows, g.parallel, bitplanes,
+                        false, 130, 0, 0);
+
+  PixelDesignatorMap *shared_mapper = NULL;
+  Framebuffer frame(g.rows, g.cols * g.chain, g.parallel, bitplanes,
+                    0, "RGB", false, false, 0, false, &shared_mapper);
+  Framebuffer other(g.rows, g.cols * g.chain, g.parallel, bitplanes,
+                    0, "RGB", false, false, 0, false, &shared_mapper);
+  const int width = frame.width();
+  const int height = frame.height();
+  const int pixels = width * height;
+  printf("{\"geometry\":\"%s\",\"bench\":\"PixelDesignatorMap\","
+         "\"bytes\":%llu}\n", g.name,
+         (unsigned long long)pixels * sizeof(PixelDesignator));
+
+  uint8_t value = 0;
+  Report(g, "SetPixel", "ns_per_pixel", NanosPerCall([&]() {
+        ++value;
+        for (int y = 0; y < height; ++y) {
+          for (int x = 0; x < width; ++x) {
+            frame.SetPixel(x, y, x + value, y + value, x ^ y);
+          }
+        }
+      }) / pixels);
+
+  Report(g, "Fill", "ns_per_pixel", NanosPerCall([&]() {
+        ++value;
+        frame.Fill(value, 255 - value, value / 2);
+      }) / pixels);
+
+  std::vector<Color> colors(pixels);
+  std::vector<uint8_t> rgb(3 * pixels);
+  for (int i = 0; i < pixels; ++i) {
+    colors[i] = Color(i, i >> 3, i >> 6);
+    rgb[3*i + 0] = colors[i].r;
+    rgb[3*i + 1] = colors[i].g;
+    rgb[3*i + 2] = colors[i].b;
+  }
+  Report(g, "SetPixels", "ns_per_pixel", NanosPerCall([&]() {
+        frame.SetPixels(0, 0, width, height, colors.data());
+      }) / pixels);
+  Report(g, "SetFrameRGB", "ns_per_pixel", NanosPerCall([&]() {
+        frame.SetFrameRGB(rgb.data(), 3 * width);
+      }) / pixels);
+
+  Report(g, "CopyFrom", "ns_per_pixel", NanosPerCall([&]() {
+        other.CopyFrom(&frame);
+      }) / pixels);
+
+  if (font) {
+    FramebufferCanvas canvas(&frame);
+    const char kText[] = "The quick brown fox 0123456789";
+    const Color color(255, 255, 0);
+    Report(g, "DrawText", "ns_per_glyph", NanosPerCall([&]() {
+          rgb_matrix::DrawText(&canvas, *font, 0, font->baseline(),
+                               color, NULL, kText, 0);
+        }) / strlen(kText));
+  }
+
+  BenchPixelMapper(g, "U-mapper", NULL, *shared_mapper);
+  BenchPixelMapper(g, "V-mapper", NULL, *shared_mapper);
+  BenchPixelMapper(g, "Rotate", "90", *shared_mapper);
+  BenchPixelMapper(g, "Mirror", "H", *shared_mapper);
+
+  frame.SetFrameRGB(rgb.data(), 3 * width);  // Content as in a video.
+  const uint64_t writes_before = io.write_count();
+  frame.DumpToMatrix(&io, 0);
+  const uint64_t writes = io.write_count() - writes_before;
+  const double refresh_ns = NanosPerCall([&]() { frame.DumpToMatrix(&io, 0); });
+  Report(g, "DumpToMatrix", "ns_per_refresh", refresh_ns);
+  Report(g, "DumpToMatrix", "ns_per_pixel", refresh_ns / pixels);
+  printf("{\"geometry\":\"%s\",\"bench\":\"DumpToMatrix\","
+         "\"gpio_writes_per_refresh\":%llu}\n", g.name,
+         (unsigned long long)writes);
+
+  // Signage: a line of text on black.
+  frame.Clear();
+  frame.FillRect(0, 0, width, 13 < height ? 13 : height, 255, 255, 0);
+  Report(g, "DumpToMatrix:mostly-black", "ns_per_refresh",
+         NanosPerCall([&]() { frame.DumpToMatrix(&io, 0); }));
+}
+
+int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [-f <bdf-font>] [<geometry>...]\n", progname);
+  fprintf(stderr, "Geometries in this build:\n");
+  for (const Geometry &g : kGeometries) {
+    fprintf(stderr, "\t%s\n", g.name);
+  }
+  return 1;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const char *font_file = "../fonts/7x13.bdf";
+  int opt;
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    switch (opt) {
+    case 'f': font_file = optarg; break;
+    default: return usage(argv[0]);
+    }
+  }
+
+  rgb_matrix::Font font;
+  const bool have_font = font.LoadFont(font_file);
+  if (!have_font) {
+    fprintf(stderr, "Couldn't load font %s; skipping DrawText\n", font_file);
+  }
+
+  std::vector<const Geometry*> selected;
+  for (int i = optind; i < argc; ++i) {
+    const Geometry *found = NULL;
+    for (const Geometry &g : kGeometries) {
+      if (strcmp(g.name, argv[i]) == 0) found = &g;
+    }
+    if (found == NULL) {
+      fprintf(stderr, "Unknown geometry %s\n", argv[i]);
+      return usage(argv[0]);
+    }
+    selected.push_back(found);
+  }
+  if (selected.empty()) {
+    for (const Geometry &g : kGeometries) selected.push_back(&g);
+  }
+
+  // The GPIO setup of the Framebuffer is global and only done once, so
+  // each geometry is measured in its own process.
+  int failures = 0;
+  for (const Geometry *g : selected) {
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+      RunGeometry(*g, have_font ? &font : NULL);
+      _exit(0);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Benchmark of %s failed\n", g->name);
+      ++failures;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
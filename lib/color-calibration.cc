@@ -0,0 +1,225 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "color-calibration.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace rgb_matrix {
+namespace internal {
+static const int kMaxLUTSize = 65;
+
+ColorCalibration::ColorCalibration() : lut_size_(0) {
+  for (int c = 0; c < 3; ++c) {
+    gain_[c] = 1.0f;
+    gamma_[c] = 0.0f;
+  }
+}
+
+// Either one value for all channels or one per channel.
+static bool ParseTriple(const char *value, float result[3]) {
+  int consumed = 0;
+  if (sscanf(value, "%f,%f,%f%n", &result[0], &result[1], &result[2],
+             &consumed) == 3 && value[consumed] == '\0') {
+    return true;
+  }
+  if (sscanf(value, "%f%n", &result[0], &consumed) == 1
+      && value[consumed] == '\0') {
+    result[1] = result[2] = result[0];
+    return true;
+  }
+  return false;
+}
+
+static bool ReadDescriptionFile(const char *filename, std::string *content,
+                                std::string *err) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    err->append("Can't open color calibration file ").append(filename)
+      .append("\n");
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    content->append(line).append(" ");
+  }
+  fclose(f);
+  return true;
+}
+
+ColorCalibration *ColorCalibration::Create(const char *description,
+                                           std::string *err) {
+  std::string content;
+  if (description[0] == '@') {
+    if (!ReadDescriptionFile(description + 1, &content, err))
+      return NULL;
+  } else {
+    content = description;
+  }
+
+  ColorCalibration *result = new ColorCalibration();
+  const char *const kSeparators = " \t\r\n;";
+  char *const tokens = strdup(content.c_str());
+  char *saveptr = NULL;
+  bool success = true;
+  for (char *t = strtok_r(tokens, kSeparators, &saveptr); t && success;
+       t = strtok_r(NULL, kSeparators, &saveptr)) {
+    if (strncmp(t, "gain=", 5) == 0 && ParseTriple(t + 5, result->gain_)) {
+      for (float g : result->gain_) {
+        if (g < 0) success = false;
+      }
+      if (!success) err->append("Color calibration gain can't be negative\n");
+    } else if (strncmp(t, "gamma=", 6) == 0
+               && ParseTriple(t + 6, result->gamma_)) {
+      for (float g : result->gamma_) {
+        if (g <= 0) success = false;
+      }
+      if (!success) err->append("Color calibration gamma needs to be > 0\n");
+    } else if (strncmp(t, "lut=", 4) == 0) {
+      success = result->LoadCubeFile(t + 4, err);
+    } else {
+      err->append("Color calibration: can't parse '").append(t).append("'\n");
+      success = false;
+    }
+  }
+  free(tokens);
+  if (!success) {
+    delete result;
+    return NULL;
+  }
+  return result;
+}
+
+bool ColorCalibration::LoadCubeFile(const char *filename, std::string *err) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    err->append("Can't open 3D lookup table ").append(filename).append("\n");
+    return false;
+  }
+  std::string problem;
+  int size = 0;
+  char line[1024];
+  while (problem.empty() && fgets(line, sizeof(line), f)) {
+    float r, g, b;
+    int n;
+    if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line)
+        || strncmp(line, "TITLE", 5) == 0) {
+      continue;
+    } else if (sscanf(line, "LUT_3D_SIZE %d", &n) == 1) {
+      if (n < 2 || n > kMaxLUTSize) problem = "unsupported LUT_3D_SIZE";
+      size = n;
+    } else if (sscanf(line, "DOMAIN_MIN %f %f %f", &r, &g, &b) == 3) {
+      if (r != 0 || g != 0 || b != 0) problem = "only DOMAIN_MIN 0 0 0";
+    } else if (sscanf(line, "DOMAIN_MAX %f %f %f", &r, &g, &b) == 3) {
+      if (r != 1 || g != 1 || b != 1) problem = "only DOMAIN_MAX 1 1 1";
+    } else if (sscanf(line, "%f %f %f", &r, &g, &b) == 3) {
+      if (size == 0) {
+        problem = "values before LUT_3D_SIZE";
+        break;
+      }
+      const float rgb[3] = { r, g, b };
+      for (float v : rgb) {
+        lut_.push_back(roundf(255 * std::min(1.0f, std::max(0.0f, v))));
+      }
+    } else {
+      problem = "can't parse ";
+      problem.append(line, strcspn(line, "\r\n"));
+    }
+  }
+  fclose(f);
+  if (problem.empty() && (int)lut_.size() != 3 * size * size * size) {
+    problem = "needs LUT_3D_SIZE^3 entries";
+  }
+  if (!problem.empty()) {
+    err->append("3D lookup table ").append(filename).append(": ")
+      .append(problem).append("\n");
+    return false;
+  }
+  lut_size_ = size;
+  return true;
+}
+
+// Without gain and gamma, the values are computed exactly like the uncalibrated
+// mapping in the framebuffer, so that identity calibrations change nothing.
+void ColorCalibration::BuildTables(int bitplanes) {
+  const int max_value = (1 << bitplanes) - 1;
+  const float out_factor = max_value;
+  const int shift = bitplanes - 8;
+  for (int correct = 0; correct < 2; ++correct) {
+    for (int ch = 0; ch < 3; ++ch) {
+      std::vector<uint16_t> &table = table_[correct][ch];
+      table.resize(100 * 256);
+      for (int brightness = 1; brightness <= 100; ++brightness) {
+        for (int c = 0; c < 256; ++c) {
+          uint16_t *const entry = &table[(brightness - 1) * 256 + c];
+          if (!correct) {  // Scaled 8 bit value aligned to the top bitplanes.
+            const int scaled = c * brightness / 100;
+            const int value = (shift > 0) ? (scaled << shift)
+              : (scaled >> -shift);
+            *entry = std::min<float>(max_value, roundf(value * gain_[ch]));
+            continue;
+          }
+          double out;
+          if (gamma_[ch] > 0) {
+            out = powf(c * brightness / (255.0f * 100), gamma_[ch]);
+          } else {  // CIE1931 with lightness 0..100
+            const float l = (float) c * brightness / 255.0;
+            out = (l <= 8) ? l / 902.3 : pow((l + 16) / 116.0, 3);
+          }
+          *entry = roundf(out_factor * std::min(1.0, out * gain_[ch]));
+        }
+      }
+    }
+  }
+}
+
+// Trilinear interpolation between the points of the table.
+void ColorCalibration::ApplyLUT(uint8_t *r, uint8_t *g, uint8_t *b) const {
+  const int n = lut_size_;
+  int index0[3], weight[3];   // Lower point on each axis; weight 0..255
+  const uint8_t in[3] = { *r, *g, *b };
+  for (int axis = 0; axis < 3; ++axis) {
+    const int scaled = in[axis] * (n - 1);
+    index0[axis] = std::min(scaled / 255, n - 2);
+    weight[axis] = scaled - index0[axis] * 255;
+  }
+  const uint8_t *base
+    = &lut_[3 * ((index0[2] * n + index0[1]) * n + index0[0])];
+  const int step_r = 3, step_g = 3 * n, step_b = 3 * n * n;
+  uint8_t *const out[3] = { r, g, b };
+  for (int ch = 0; ch < 3; ++ch) {
+    const uint8_t *p = base + ch;
+    // Along red, then green, then blue. Values scaled by 255 each step.
+    const int c00 = p[0] * 255 + (p[step_r] - p[0]) * weight[0];
+    const int c10 = p[step_g] * 255
+      + (p[step_g + step_r] - p[step_g]) * weight[0];
+    const int c01 = p[step_b] * 255
+      + (p[step_b + step_r] - p[step_b]) * weight[0];
+    const int c11 = p[step_b + step_g] * 255
+      + (p[step_b + step_g + step_r] - p[step_b + step_g]) * weight[0];
+    const int c0 = c00 * 255 + (c10 - c00) * weight[1];
+    const int c1 = c01 * 255 + (c11 - c01) * weight[1];
+    const int64_t c = (int64_t)c0 * 255 + (int64_t)(c1 - c0) * weight[2];
+    *out[ch] = (c + 255 * 255 * 255 / 2) / (255 * 255 * 255);
+  }
+}
+}  // namespace internal
+}  // namespace rgb_matrix
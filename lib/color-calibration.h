@@ -0,0 +1,74 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_COLOR_CALIBRATION_H
+#define RPI_COLOR_CALIBRATION_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace rgb_matrix {
+namespace internal {
+// Per channel correction of the panels as given in --led-color-calibration,
+// a semicolon separated list of
+//   gain=<r>,<g>,<b>    Factor applied to the output luminance (e.g. 0.9).
+//   gamma=<r>,<g>,<b>   Power curve instead of CIE1931 luminance correction.
+//   lut=<file>          3D lookup table in the .cube format, applied first.
+// gain and gamma can also be given as one value for all channels. With a
+// leading '@', the name of a file containing the description.
+//
+// Gain and gamma are computed into one table per channel and brightness, so
+// they don't cost anything extra while drawing. The 3D table needs an
+// interpolation per pixel, while colors repeated next to each other are
+// only mapped once.
+class ColorCalibration {
+public:
+  // Returns NULL with the reason appended to "err" on failure.
+  static ColorCalibration *Create(const char *description, std::string *err);
+
+  // Compute the tables for output on "bitplanes". Needs to be called before
+  // Map().
+  void BuildTables(int bitplanes);
+
+  // Map the 8 bit color to the bitplanes, for "brightness" 1..100.
+  inline void Map(bool luminance_correct, uint8_t brightness,
+                  uint8_t r, uint8_t g, uint8_t b,
+                  uint16_t *red, uint16_t *green, uint16_t *blue) const {
+    if (lut_size_ > 0) ApplyLUT(&r, &g, &b);
+    const std::vector<uint16_t> *tables = table_[luminance_correct ? 1 : 0];
+    const int offset = (brightness - 1) * 256;
+    *red   = tables[0][offset + r];
+    *green = tables[1][offset + g];
+    *blue  = tables[2][offset + b];
+  }
+
+private:
+  ColorCalibration();
+
+  bool LoadCubeFile(const char *filename, std::string *err);
+  void ApplyLUT(uint8_t *r, uint8_t *g, uint8_t *b) const;
+
+  float gain_[3];
+  float gamma_[3];   // 0: CIE1931
+  int lut_size_;     // Points per axis; 0: no 3D table.
+  std::vector<uint8_t> lut_;   // RGB triples, red index changing fastest.
+
+  // [luminance correct][channel], each 100 brightness rows of 256 entries.
+  std::vector<uint16_t> table_[2][3];
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_COLOR_CALIBRATION_H
@@ -0,0 +1,186 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "compositor.h"
+#include "led-matrix.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace rgb_matrix {
+
+// -- Layer
+
+Compositor::Layer::Layer(int width, int height)
+  : width_(width), height_(height), pixels_(4 * width * height),
+    dirty_x0_(0), dirty_y0_(0), dirty_x1_(0), dirty_y1_(0) {
+}
+
+bool Compositor::Layer::ClipAndMark(int *x, int *y, int *width, int *height) {
+  const int x0 = std::max(*x, 0);
+  const int y0 = std::max(*y, 0);
+  const int x1 = std::min(*x + *width, width_);
+  const int y1 = std::min(*y + *height, height_);
+  if (x0 >= x1 || y0 >= y1) return false;
+  if (dirty_x0_ >= dirty_x1_) {
+    dirty_x0_ = x0; dirty_y0_ = y0; dirty_x1_ = x1; dirty_y1_ = y1;
+  } else {
+    dirty_x0_ = std::min(dirty_x0_, x0);
+    dirty_y0_ = std::min(dirty_y0_, y0);
+    dirty_x1_ = std::max(dirty_x1_, x1);
+    dirty_y1_ = std::max(dirty_y1_, y1);
+  }
+  *x = x0; *y = y0; *width = x1 - x0; *height = y1 - y0;
+  return true;
+}
+
+void Compositor::Layer::SetPixelRGBA(int x, int y, uint8_t red, uint8_t green,
+                                     uint8_t blue, uint8_t alpha) {
+  int width = 1, height = 1;
+  if (!ClipAndMark(&x, &y, &width, &height)) return;
+  uint8_t *pixel = PixelAt(x, y);
+  pixel[0] = red;
+  pixel[1] = green;
+  pixel[2] = blue;
+  pixel[3] = alpha;
+}
+
+void Compositor::Layer::SetPixel(int x, int y,
+                                 uint8_t red, uint8_t green, uint8_t blue) {
+  SetPixelRGBA(x, y, red, green, blue, 255);
+}
+
+void Compositor::Layer::FillRect(int x, int y, int width, int height,
+                                 uint8_t red, uint8_t green, uint8_t blue) {
+  if (!ClipAndMark(&x, &y, &width, &height)) return;
+  const uint8_t rgba[4] = { red, green, blue, 255 };
+  for (int row = y; row < y + height; ++row) {
+    uint8_t *pixel = PixelAt(x, row);
+    for (int i = 0; i < width; ++i, pixel += 4) {
+      memcpy(pixel, rgba, 4);
+    }
+  }
+}
+
+void Compositor::Layer::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+  FillRect(0, 0, width_, height_, red, green, blue);
+}
+
+void Compositor::Layer::Clear() {
+  int x = 0, y = 0, width = width_, height = height_;
+  ClipAndMark(&x, &y, &width, &height);
+  std::fill(pixels_.begin(), pixels_.end(), 0);
+}
+
+void Compositor::Layer::SetImageRGBA(int x, int y, int width, int height,
+                                     const uint8_t *rgba, int stride) {
+  const int orig_x = x, orig_y = y;
+  if (!ClipAndMark(&x, &y, &width, &height)) return;
+  rgba += (y - orig_y) * stride + 4 * (x - orig_x);
+  for (int row = y; row < y + height; ++row, rgba += stride) {
+    memcpy(PixelAt(x, row), rgba, 4 * width);
+  }
+}
+
+// -- Compositor
+
+void Compositor::Rect::Add(const Rect &other) {
+  if (other.empty()) return;
+  if (empty()) {
+    *this = other;
+    return;
+  }
+  x0 = std::min(x0, other.x0);
+  y0 = std::min(y0, other.y0);
+  x1 = std::max(x1, other.x1);
+  y1 = std::max(y1, other.y1);
+}
+
+Compositor::Compositor(int width, int height)
+  : width_(width), height_(height), screen_(width * height) {
+}
+
+Compositor::~Compositor() {
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    delete layers_[i];
+  }
+}
+
+Compositor::Layer *Compositor::AddLayer() {
+  layers_.push_back(new Layer(width_, height_));
+  return layers_.back();
+}
+
+// Rounded v / 255 without division; for v up to 255 * 255.
+static inline uint8_t Div255(int v) {
+  v += 128;
+  return (v + (v >> 8)) >> 8;
+}
+
+void Compositor::Blend(const Rect &region) {
+  const int count = region.x1 - region.x0;
+  for (int y = region.y0; y < region.y1; ++y) {
+    // Layers are blended bottom to top into the row of the result; it
+    // stays in cache while going through them.
+    Color *const out = &screen_[y * width_ + region.x0];
+    std::fill(out, out + count, Color());
+    for (size_t l = 0; l < layers_.size(); ++l) {
+      const uint8_t *pixel = layers_[l]->PixelAt(region.x0, y);
+      for (int i = 0; i < count; ++i, pixel += 4) {
+        const int alpha = pixel[3];
+        if (alpha == 0) continue;
+        if (alpha == 255) {
+          out[i] = Color(pixel[0], pixel[1], pixel[2]);
+          continue;
+        }
+        const int rest = 255 - alpha;
+        out[i].r = Div255(pixel[0] * alpha + out[i].r * rest);
+        out[i].g = Div255(pixel[1] * alpha + out[i].g * rest);
+        out[i].b = Div255(pixel[2] * alpha + out[i].b * rest);
+      }
+    }
+  }
+}
+
+void Compositor::Compose(FrameCanvas *canvas) {
+  Rect changed;
+  for (size_t l = 0; l < layers_.size(); ++l) {
+    Layer *const layer = layers_[l];
+    changed.Add(Rect(layer->dirty_x0_, layer->dirty_y0_,
+                     layer->dirty_x1_, layer->dirty_y1_));
+    layer->dirty_x0_ = layer->dirty_x1_ = 0;
+  }
+  if (!changed.empty()) Blend(changed);
+
+  Rect *target = NULL;
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    pending_[i].second.Add(changed);
+    if (pending_[i].first == canvas) target = &pending_[i].second;
+  }
+  if (target == NULL) {  // New to us: needs everything.
+    pending_.push_back(std::make_pair(canvas, Rect(0, 0, width_, height_)));
+    target = &pending_.back().second;
+  }
+
+  const Rect region = *target;
+  *target = Rect();
+  if (region.empty()) return;
+  for (int y = region.y0; y < region.y1; ++y) {
+    canvas->SetPixels(region.x0, y, region.x1 - region.x0, 1,
+                      &screen_[y * width_ + region.x0]);
+  }
+}
+
+}  // namespace rgb_matrix
@@ -3,16 +3,24 @@
 #include "content-streamer.h"
 #include "led-matrix.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
 
 #include "gpio-bits.h"
+#include "thread.h"
 
 namespace rgb_matrix {
 
@@ -32,7 +40,8 @@ struct FileHeader {
   uint32_t height;
   uint64_t future_use1;
   uint64_t is_wide_gpio : 1;
-  uint64_t flags_future_use : 63;
+  uint64_t is_delta_encoded : 1;  // Frames might be kEncodingDelta.
+  uint64_t flags_future_use : 62;
 };
 STATIC_ASSERT(file_header_size_changed, sizeof(FileHeader) == 32);
 
@@ -41,11 +50,43 @@ struct FrameHeader {
   uint32_t magic;  // kFrameMagic
   uint32_t size;
   uint32_t hold_time_us;  // How long this frame lasts in usec.
-  uint32_t future_use1;
-  uint64_t future_use2;
+  uint32_t encoding;      // One of the kEncoding* values.
+  uint64_t present_at_us; // Wall-clock time to show; 0 if not given.
   uint64_t future_use3;
 };
 STATIC_ASSERT(file_header_size_changed, sizeof(FrameHeader) == 32);
+
+// The full serialized frame.
+static const uint32_t kEncodingFull = 0;
+
+// The changes to the previous frame: a sequence of DeltaRuns, each followed
+// by "copy" gpio_bits_t words of new data. Unchanged words at the end
+// don't need a run, so an empty frame is the same as the previous one.
+static const uint32_t kEncodingDelta = 1;
+struct DeltaRun {
+  uint32_t skip;  // Words unchanged from the previous frame.
+  uint32_t copy;  // Changed words following.
+};
+
+// The index at the end of the stream is stored like a frame with this
+// magic value (so that it can be skipped when reading), containing an
+// IndexEntry per frame followed by the IndexFooter. The footer ends the
+// file, so it can be found from there.
+static const uint32_t kIndexMagicValue = 0x1D3E5A48;
+struct IndexEntry {
+  uint64_t offset;          // Of the FrameHeader in the stream.
+  uint64_t start_time_us;   // Sum of the hold times of frames before.
+  uint32_t full_frame;      // Last frame not delta encoded up to this one.
+  uint32_t hold_time_us;
+};
+STATIC_ASSERT(index_entry_size_changed, sizeof(IndexEntry) == 24);
+
+struct IndexFooter {
+  uint32_t magic;  // kIndexMagicValue
+  uint32_t frames;
+  uint64_t index_offset;  // Of the FrameHeader of the index.
+};
+STATIC_ASSERT(index_footer_size_changed, sizeof(IndexFooter) == 16);
 }
 
 FileStreamIO::FileStreamIO(int fd) : fd_(fd) {
@@ -63,6 +104,140 @@ ssize_t FileStreamIO::Append(const void *buf, const size_t count) {
   return write(fd_, buf, count);
 }
 
+bool FileStreamIO::Seek(uint64_t offset) {
+  return lseek(fd_, offset, SEEK_SET) == (off_t)offset;
+}
+
+int64_t FileStreamIO::Size() {
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+  return st.st_size;
+}
+
+// Asking the kernel to read ahead the next frames while the current one is
+// shown; a few, as the hold time of some frames can be very short.
+static constexpr int kReadAheadReads = 4;
+
+MmapStreamIO::MmapStreamIO(int fd)
+  : fd_(fd), mapped_(NULL), size_(0), pos_(0) {
+  struct stat st;
+  if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (m != MAP_FAILED) {
+      mapped_ = (char *)m;
+      size_ = st.st_size;
+      madvise(mapped_, size_, MADV_SEQUENTIAL);
+    }
+  }
+  if (!mapped_) posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+MmapStreamIO::~MmapStreamIO() {
+  if (mapped_) munmap(mapped_, size_);
+  close(fd_);
+}
+
+void MmapStreamIO::Rewind() {
+  pos_ = 0;
+  if (!mapped_) lseek(fd_, 0, SEEK_SET);
+}
+
+ssize_t MmapStreamIO::Read(void *buf, size_t count) {
+  if (!mapped_) return read(fd_, buf, count);
+  const size_t amount = std::min(count, size_ - pos_);
+  memcpy(buf, mapped_ + pos_, amount);
+  pos_ += amount;
+  ReadAhead(amount);
+  return amount;
+}
+
+ssize_t MmapStreamIO::Append(const void *, size_t) {
+  errno = EBADF;
+  return -1;
+}
+
+const char *MmapStreamIO::ReadInPlace(size_t count) {
+  if (!mapped_ || count > size_ - pos_) return NULL;
+  const char *result = mapped_ + pos_;
+  pos_ += count;
+  ReadAhead(count);
+  return result;
+}
+
+bool MmapStreamIO::Seek(uint64_t offset) {
+  if (!mapped_) return lseek(fd_, offset, SEEK_SET) == (off_t)offset;
+  if (offset > size_) return false;
+  pos_ = offset;
+  return true;
+}
+
+int64_t MmapStreamIO::Size() {
+  if (mapped_) return size_;
+  struct stat st;
+  if (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+  return st.st_size;
+}
+
+// Reads from the mapping are typically the same size each time, so let the
+// kernel fetch the next few of these.
+void MmapStreamIO::ReadAhead(size_t count) {
+  static const size_t kPageSize = sysconf(_SC_PAGESIZE);
+  const size_t start = pos_ / kPageSize * kPageSize;
+  const size_t end = std::min(size_, pos_ + kReadAheadReads * count);
+  if (end > start) madvise(mapped_ + start, end - start, MADV_WILLNEED);
+}
+
+SocketStreamIO::SocketStreamIO(int fd) : fd_(fd) {
+  // Frames are sent as a whole, so don't hold back their last bytes.
+  const int on = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+SocketStreamIO::~SocketStreamIO() { close(fd_); }
+
+SocketStreamIO *SocketStreamIO::Connect(const char *host, int port) {
+  char port_str[16];
+  snprintf(port_str, sizeof(port_str), "%d", port);
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *addresses;
+  const int err = getaddrinfo(host, port_str, &hints, &addresses);
+  if (err != 0) {
+    fprintf(stderr, "Can't resolve %s: %s\n", host, gai_strerror(err));
+    return NULL;
+  }
+  int fd = -1;
+  for (struct addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    fprintf(stderr, "Can't connect to %s:%d: %s\n", host, port,
+            strerror(errno));
+    return NULL;
+  }
+  return new SocketStreamIO(fd);
+}
+
+void SocketStreamIO::Rewind() {}
+
+ssize_t SocketStreamIO::Read(void *buf, size_t count) {
+  ssize_t r;
+  while ((r = recv(fd_, buf, count, 0)) < 0 && errno == EINTR) {}
+  return r;
+}
+
+ssize_t SocketStreamIO::Append(const void *buf, size_t count) {
+  ssize_t w;
+  // A receiver going away is reported as error, not with SIGPIPE.
+  while ((w = send(fd_, buf, count, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+  return w;
+}
+
 void MemStreamIO::Rewind() { pos_ = 0; }
 ssize_t MemStreamIO::Read(void *buf, size_t count) {
   const size_t amount = std::min(count, buffer_.size() - pos_);
@@ -74,6 +249,18 @@ ssize_t MemStreamIO::Append(const void *buf, size_t count) {
   buffer_.append((const char*)buf, count);
   return count;
 }
+const char *MemStreamIO::ReadInPlace(size_t count) {
+  if (count > buffer_.size() - pos_) return NULL;
+  const char *result = buffer_.data() + pos_;
+  pos_ += count;
+  return result;
+}
+bool MemStreamIO::Seek(uint64_t offset) {
+  if (offset > buffer_.size()) return false;
+  pos_ = offset;
+  return true;
+}
+int64_t MemStreamIO::Size() { return buffer_.size(); }
 
 // Read exactly count bytes including retries. Returns success.
 static bool FullRead(StreamIO *io, void *buf, const size_t count) {
@@ -100,8 +287,18 @@ static bool FullAppend(StreamIO *io, const void *buf, const size_t count) {
   return remaining == 0;
 }
 
-StreamWriter::StreamWriter(StreamIO *io) : io_(io), header_written_(false) {}
-bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
+StreamWriter::StreamWriter(StreamIO *io, bool delta_encoding)
+  : io_(io), delta_encoding_(delta_encoding), header_written_(false),
+    written_(0), time_us_(0), frames_(0), last_full_frame_(0) {}
+
+bool StreamWriter::Write(const void *data, size_t len) {
+  if (!FullAppend(io_, data, len)) return false;
+  written_ += len;
+  return true;
+}
+
+bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us,
+                          uint64_t present_at_us) {
   const char *data;
   size_t len;
   frame.Serialize(&data, &len);
@@ -111,10 +308,80 @@ bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   }
   FrameHeader h = {};
   h.magic = kFrameMagicValue;
-  h.size = len;
   h.hold_time_us = hold_time_us;
-  FullAppend(io_, &h, sizeof(h));
-  return FullAppend(io_, data, len) == (ssize_t)len;
+  h.encoding = kEncodingFull;
+  h.present_at_us = present_at_us;
+  const char *payload = data;
+  size_t payload_len = len;
+  if (delta_encoding_) {
+    if (previous_frame_.size() == len) {
+      EncodeDelta(data, len);
+      if (encoded_.size() < len) {  // Otherwise, the full frame is smaller.
+        h.encoding = kEncodingDelta;
+        payload = encoded_.data();
+        payload_len = encoded_.size();
+      }
+    }
+    previous_frame_.assign(data, len);
+  }
+  h.size = payload_len;
+
+  if (h.encoding == kEncodingFull) last_full_frame_ = frames_;
+  IndexEntry entry;
+  entry.offset = written_;
+  entry.start_time_us = time_us_;
+  entry.full_frame = last_full_frame_;
+  entry.hold_time_us = hold_time_us;
+  index_.append((const char *)&entry, sizeof(entry));
+  time_us_ += hold_time_us;
+  ++frames_;
+
+  Write(&h, sizeof(h));
+  return Write(payload, payload_len);
+}
+
+bool StreamWriter::WriteIndex() {
+  IndexFooter footer;
+  footer.magic = kIndexMagicValue;
+  footer.frames = frames_;
+  footer.index_offset = written_;
+  FrameHeader h = {};
+  h.magic = kIndexMagicValue;
+  h.size = index_.size() + sizeof(footer);
+  return Write(&h, sizeof(h))
+    && Write(index_.data(), index_.size())
+    && Write(&footer, sizeof(footer));
+}
+
+void StreamWriter::EncodeDelta(const char *data, size_t len) {
+  // Starting a new run costs a DeltaRun, so it only pays off if more
+  // unchanged words than that are skipped.
+  static constexpr size_t kMinSkip
+    = (sizeof(DeltaRun) + sizeof(gpio_bits_t) - 1) / sizeof(gpio_bits_t);
+  const gpio_bits_t *const current = (const gpio_bits_t *)data;
+  const gpio_bits_t *const previous
+    = (const gpio_bits_t *)previous_frame_.data();
+  const size_t words = len / sizeof(gpio_bits_t);
+  encoded_.clear();
+  size_t i = 0;
+  for (;;) {
+    const size_t skip_start = i;
+    while (i < words && current[i] == previous[i]) ++i;
+    if (i == words) break;
+    const size_t copy_start = i;
+    size_t equal = 0;  // Unchanged words at the end of the copy range.
+    while (i < words && equal <= kMinSkip) {
+      equal = (current[i] == previous[i]) ? equal + 1 : 0;
+      ++i;
+    }
+    i -= equal;  // These are skipped by the next run.
+    DeltaRun run;
+    run.skip = copy_start - skip_start;
+    run.copy = i - copy_start;
+    encoded_.append((const char *)&run, sizeof(run));
+    encoded_.append((const char *)(current + copy_start),
+                    run.copy * sizeof(gpio_bits_t));
+  }
 }
 
 void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
@@ -124,32 +391,86 @@ void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
   header.height = frame.height();
   header.buf_size = len;
   header.is_wide_gpio = (sizeof(gpio_bits_t) > 4);
-  FullAppend(io_, &header, sizeof(header));
+  header.is_delta_encoded = delta_encoding_;
+  Write(&header, sizeof(header));
   header_written_ = true;
 }
 
 StreamReader::StreamReader(StreamIO *io)
-  : io_(io), state_(STREAM_AT_BEGIN), header_frame_buffer_(NULL) {
+  : io_(io), width_(0), height_(0), delta_encoded_(false),
+    index_loaded_(false), state_(STREAM_AT_BEGIN),
+    header_frame_buffer_(NULL), position_(0) {
   io_->Rewind();
 }
 StreamReader::~StreamReader() { delete [] header_frame_buffer_; }
 
 void StreamReader::Rewind() {
   io_->Rewind();
+  position_ = 0;
   state_ = STREAM_AT_BEGIN;
 }
 
-bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
-  if (state_ == STREAM_AT_BEGIN && !ReadFileHeader(*frame)) return false;
-  if (state_ != STREAM_READING) return false;
+bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us,
+                           uint64_t *present_at_us) {
+  const char *data;
+  size_t len;
+  if (!GetNextData(*frame, &data, &len, hold_time_us, present_at_us))
+    return false;
+  return frame->Deserialize(data, len);
+}
 
-  // Read header and expected buffer size.
-  if (!FullRead(io_, header_frame_buffer_,
-                sizeof(FrameHeader) + frame_buf_size_)) {
+bool StreamReader::GetNextData(const FrameCanvas &frame,
+                               const char **data, size_t *len,
+                               uint32_t *hold_time_us,
+                               uint64_t *present_at_us) {
+  if (state_ == STREAM_AT_BEGIN && !ReadFileHeader()) return false;
+  if (state_ != STREAM_READING) return false;
+  if (width_ != frame.width() || height_ != frame.height()) {
+    fprintf(stderr, "This stream is for %dx%d, can't play on %dx%d. "
+            "Please use the same settings for record/replay\n",
+            width_, height_, frame.width(), frame.height());
+    state_ = STREAM_ERROR;
     return false;
   }
+  if (!ReadFrame(data, hold_time_us, present_at_us)) return false;
+  *len = frame_buf_size_;
+  return true;
+}
+
+bool StreamReader::Read(void *buf, size_t count) {
+  if (!FullRead(io_, buf, count)) return false;
+  position_ += count;
+  return true;
+}
+
+const char *StreamReader::ReadInPlace(size_t count) {
+  const char *result = io_->ReadInPlace(count);
+  if (result) position_ += count;
+  return result;
+}
 
-  const FrameHeader &h = *reinterpret_cast<FrameHeader*>(header_frame_buffer_);
+bool StreamReader::ReadFrame(const char **data, uint32_t *hold_time_us,
+                             uint64_t *present_at_us) {
+  // Read header, then the frame data; if possible without copying.
+  FrameHeader h;
+  for (;;) {
+    const char *in_place_header = ReadInPlace(sizeof(h));
+    if (in_place_header) {
+      memcpy(&h, in_place_header, sizeof(h));  // Might be unaligned.
+    } else if (!Read(&h, sizeof(h))) {
+      return false;
+    }
+    if (h.magic != kIndexMagicValue)
+      break;
+    // Not a frame, but the index; skip it.
+    if (!ReadInPlace(h.size)) {
+      for (size_t remaining = h.size; remaining > 0; /**/) {
+        const size_t chunk = std::min(remaining, frame_buf_size_);
+        if (!Read(header_frame_buffer_, chunk)) return false;
+        remaining -= chunk;
+      }
+    }
+  }
 
   // TODO: we might allow for this to be a kFileMagicValue, to allow people
   // to just concatenate streams. In that case, we just would need to read
@@ -160,28 +481,62 @@ bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
   }
 
   // In the future, we might allow larger buffers (audio?), but never smaller.
-  // For now, we need to make sure to exactly match the size, as our assumption
-  // above is that we can read the full header + frame in one FullRead().
-  if (h.size != frame_buf_size_)
+  // Only deltas are smaller; they are never larger than a full frame.
+  const bool is_delta = (h.encoding == kEncodingDelta);
+  if (is_delta ? (!delta_encoded_ || h.size > frame_buf_size_)
+      : (h.encoding != kEncodingFull || h.size != frame_buf_size_))
     return false;
 
+  const char *payload = ReadInPlace(h.size);
+  if (payload == NULL) {
+    if (!Read(header_frame_buffer_, h.size))
+      return false;
+    payload = header_frame_buffer_;
+  }
+
+  if (is_delta) {
+    if (!ApplyDelta(payload, h.size)) {
+      state_ = STREAM_ERROR;
+      return false;
+    }
+    payload = current_frame_.data();
+  } else if (delta_encoded_) {
+    current_frame_.assign(payload, frame_buf_size_);  // Base for next delta.
+  }
+
   if (hold_time_us) *hold_time_us = h.hold_time_us;
-  return frame->Deserialize(header_frame_buffer_ + sizeof(FrameHeader),
-                            frame_buf_size_);
+  if (present_at_us) *present_at_us = h.present_at_us;
+  *data = payload;
+  return true;
+}
+bool StreamReader::ApplyDelta(const char *delta, size_t len) {
+  if (current_frame_.size() != frame_buf_size_)
+    return false;  // No full frame to start with.
+  char *const out = &current_frame_[0];
+  const size_t words = frame_buf_size_ / sizeof(gpio_bits_t);
+  const char *const end = delta + len;
+  size_t pos = 0;
+  while (delta < end) {
+    DeltaRun run;
+    if ((size_t)(end - delta) < sizeof(run)) return false;
+    memcpy(&run, delta, sizeof(run));
+    delta += sizeof(run);
+    const size_t bytes = (size_t)run.copy * sizeof(gpio_bits_t);
+    if ((size_t)run.skip + run.copy > words - pos
+        || (size_t)(end - delta) < bytes)
+      return false;
+    pos += run.skip;
+    memcpy(out + pos * sizeof(gpio_bits_t), delta, bytes);
+    pos += run.copy;
+    delta += bytes;
+  }
+  return true;
 }
 
-bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
+bool StreamReader::ReadFileHeader() {
   FileHeader header;
-  FullRead(io_, &header, sizeof(header));
-  if (header.magic != kFileMagicValue) {
-    state_ = STREAM_ERROR;
-    return false;
-  }
-  if ((int)header.width != frame.width()
-      || (int)header.height != frame.height()) {
-    fprintf(stderr, "This stream is for %dx%d, can't play on %dx%d. "
-            "Please use the same settings for record/replay\n",
-            header.width, header.height, frame.width(), frame.height());
+  if (!Read(&header, sizeof(header)) || header.magic != kFileMagicValue
+      || header.buf_size == 0) {
     state_ = STREAM_ERROR;
     return false;
   }
@@ -195,9 +550,210 @@ bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
     return false;
   }
   state_ = STREAM_READING;
+  width_ = header.width;
+  height_ = header.height;
   frame_buf_size_ = header.buf_size;
+  delta_encoded_ = header.is_delta_encoded;
   if (!header_frame_buffer_)
-    header_frame_buffer_ = new char [ sizeof(FrameHeader) + header.buf_size ];
+    header_frame_buffer_ = new char [ header.buf_size ];
   return true;
 }
+
+static IndexEntry GetIndexEntry(const std::string &index, int i) {
+  IndexEntry entry;
+  memcpy(&entry, index.data() + i * sizeof(IndexEntry), sizeof(entry));
+  return entry;
+}
+
+bool StreamReader::LoadIndex() {
+  if (index_loaded_) return true;
+  if (state_ == STREAM_AT_BEGIN && !ReadFileHeader()) return false;
+  if (state_ != STREAM_READING) return false;
+
+  const int64_t size = io_->Size();
+  IndexFooter footer;
+  bool success = (size >= (int64_t)(sizeof(FileHeader) + sizeof(footer))
+                  && io_->Seek(size - sizeof(footer))
+                  && FullRead(io_, &footer, sizeof(footer))
+                  && footer.magic == kIndexMagicValue
+                  && footer.index_offset + sizeof(FrameHeader)
+                  + (uint64_t)footer.frames * sizeof(IndexEntry)
+                  + sizeof(footer) == (uint64_t)size);
+  if (success) {
+    index_.resize(footer.frames * sizeof(IndexEntry));
+    success = io_->Seek(footer.index_offset + sizeof(FrameHeader))
+      && FullRead(io_, &index_[0], index_.size());
+  }
+  io_->Seek(position_);  // Continue where we were.
+  if (!success) {
+    index_.clear();
+    return false;
+  }
+  index_loaded_ = true;
+  return true;
+}
+
+int StreamReader::GetFrameCount() {
+  return LoadIndex() ? index_.size() / sizeof(IndexEntry) : -1;
+}
+
+bool StreamReader::SeekToFrame(int frame) {
+  if (frame < 0 || frame >= GetFrameCount()) return false;
+  const IndexEntry target = GetIndexEntry(index_, frame);
+  const IndexEntry full = GetIndexEntry(index_, target.full_frame);
+  if (!io_->Seek(full.offset)) return false;
+  position_ = full.offset;
+  state_ = STREAM_READING;
+  // Deltas refer to the previous frame, so all since the last full frame
+  // need to be applied.
+  for (uint32_t i = target.full_frame; i < (uint32_t)frame; ++i) {
+    const char *data;
+    if (!ReadFrame(&data, NULL, NULL)) {
+      state_ = STREAM_ERROR;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool StreamReader::SeekToTime(uint64_t time_us) {
+  const int frames = GetFrameCount();
+  if (frames <= 0) return false;
+  // Last frame starting at or before time_us.
+  int low = 0, high = frames;
+  while (high - low > 1) {
+    const int middle = (low + high) / 2;
+    if (GetIndexEntry(index_, middle).start_time_us <= time_us) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  const IndexEntry entry = GetIndexEntry(index_, low);
+  if (time_us >= entry.start_time_us + entry.hold_time_us)
+    return false;  // After the end.
+  return SeekToFrame(low);
+}
+
+class StreamPrefetcher::PrefetchThread : public Thread {
+public:
+  PrefetchThread(StreamReader *reader,
+                 const std::vector<FrameCanvas*> &canvases)
+    : reader_(reader), free_(canvases), running_(true), exhausted_(false) {
+    pthread_cond_init(&changed_, NULL);
+  }
+  virtual ~PrefetchThread() {
+    Stop();
+    pthread_cond_destroy(&changed_);
+  }
+
+  void Stop() {
+    {
+      MutexLock l(&mutex_);
+      running_ = false;
+      pthread_cond_broadcast(&changed_);
+    }
+    WaitStopped();
+  }
+
+  virtual void Run() {
+    int frames_since_rewind = 0;
+    for (;;) {
+      FrameCanvas *canvas;
+      {
+        MutexLock l(&mutex_);
+        while (running_ && free_.empty()) mutex_.WaitOn(&changed_);
+        if (!running_) return;
+        canvas = free_.back();
+        free_.pop_back();
+      }
+      Frame frame = { canvas, 0, 0 };
+      const bool success = reader_->GetNext(canvas, &frame.hold_time_us,
+                                            &frame.present_at_us);
+      if (!success) reader_->Rewind();
+
+      MutexLock l(&mutex_);
+      if (success) {
+        ready_.push_back(frame);
+        ++frames_since_rewind;
+      } else {
+        free_.push_back(canvas);
+        const Frame end_of_stream = { NULL, 0, 0 };
+        ready_.push_back(end_of_stream);
+        if (frames_since_rewind == 0) {
+          exhausted_ = true;   // Nothing to read; don't loop endlessly.
+          pthread_cond_broadcast(&changed_);
+          return;
+        }
+        frames_since_rewind = 0;
+      }
+      pthread_cond_broadcast(&changed_);
+    }
+  }
+
+  FrameCanvas *GetNext(uint32_t *hold_time_us, uint64_t *present_at_us) {
+    MutexLock l(&mutex_);
+    while (running_ && !exhausted_ && ready_.empty())
+      mutex_.WaitOn(&changed_);
+    if (ready_.empty()) return NULL;
+    const Frame frame = ready_.front();
+    ready_.pop_front();
+    if (hold_time_us) *hold_time_us = frame.hold_time_us;
+    if (present_at_us) *present_at_us = frame.present_at_us;
+    return frame.canvas;
+  }
+
+  void Recycle(FrameCanvas *canvas) {
+    MutexLock l(&mutex_);
+    free_.push_back(canvas);
+    pthread_cond_broadcast(&changed_);
+  }
+
+  // Only after Stop().
+  void TakeCanvases(std::vector<FrameCanvas*> *canvases) {
+    canvases->insert(canvases->end(), free_.begin(), free_.end());
+    free_.clear();
+    for (const Frame &frame : ready_) {
+      if (frame.canvas) canvases->push_back(frame.canvas);
+    }
+    ready_.clear();
+  }
+
+private:
+  struct Frame {
+    FrameCanvas *canvas;  // NULL: end of stream.
+    uint32_t hold_time_us;
+    uint64_t present_at_us;
+  };
+
+  StreamReader *const reader_;
+  Mutex mutex_;
+  pthread_cond_t changed_;
+  std::vector<FrameCanvas*> free_;
+  std::deque<Frame> ready_;
+  bool running_;
+  bool exhausted_;
+};
+
+StreamPrefetcher::StreamPrefetcher(StreamReader *reader,
+                                   const std::vector<FrameCanvas*> &canvases)
+  : thread_(new PrefetchThread(reader, canvases)) {
+  thread_->Start();
+}
+
+StreamPrefetcher::~StreamPrefetcher() { delete thread_; }
+
+FrameCanvas *StreamPrefetcher::GetNext(uint32_t *hold_time_us,
+                                       uint64_t *present_at_us) {
+  return thread_->GetNext(hold_time_us, present_at_us);
+}
+
+void StreamPrefetcher::Recycle(FrameCanvas *canvas) {
+  thread_->Recycle(canvas);
+}
+
+void StreamPrefetcher::Stop(std::vector<FrameCanvas*> *canvases) {
+  thread_->Stop();
+  thread_->TakeCanvases(canvases);
+}
 }  // namespace rgb_matrix
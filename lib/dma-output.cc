@@ -0,0 +1,461 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "dma-output.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "gpio.h"
+
+// DMA channel to use. Needs to be one of the full channels (not 'lite'), as
+// we need the 2D mode. Channel 5 is not used by the kernel on current
+// Raspberry Pi OS.
+#define DMA_CHANNEL 5
+
+// Register offsets from the peripheral base. On the bus, the peripherals are
+// always seen at 0x7E000000.
+#define PERI_BUS_BASE            0x7E000000
+#define DMA_REGISTER_OFFSET        0x007000
+#define GPIO_REGISTER_OFFSET       0x200000
+#define PWM_REGISTER_OFFSET        0x20C000
+#define TIMER_REGISTER_OFFSET      0x003000
+
+#define GPIO_SET0_BUS  (PERI_BUS_BASE + GPIO_REGISTER_OFFSET + 0x1C)
+#define PWM_CTL_BUS    (PERI_BUS_BASE + PWM_REGISTER_OFFSET + 0x00)
+#define PWM_RNG1_BUS   (PERI_BUS_BASE + PWM_REGISTER_OFFSET + 0x10)
+#define PWM_FIFO_BUS   (PERI_BUS_BASE + PWM_REGISTER_OFFSET + 0x18)
+#define TIMER_CLO_BUS  (PERI_BUS_BASE + TIMER_REGISTER_OFFSET + 0x04)
+
+// DMA channel registers (word offsets).
+#define DMA_CS         (0x00 / 4)
+#define DMA_CONBLK_AD  (0x04 / 4)
+#define DMA_DEBUG      (0x20 / 4)
+#define DMA_ENABLE     (0xFF0 / 4)   // Global register, not per channel.
+
+#define DMA_CS_RESET         (1<<31)
+#define DMA_CS_WAIT_WRITES   (1<<28)
+#define DMA_CS_PANIC_PRIO(x) ((x)<<20)
+#define DMA_CS_PRIO(x)       ((x)<<16)
+#define DMA_CS_ERROR         (1<<8)
+#define DMA_CS_INT           (1<<2)
+#define DMA_CS_END           (1<<1)
+#define DMA_CS_ACTIVE        (1<<0)
+
+#define DMA_TI_PERMAP(x)     ((x)<<16)
+#define DMA_TI_SRC_INC       (1<<8)
+#define DMA_TI_DEST_DREQ     (1<<6)
+#define DMA_TI_DEST_INC      (1<<4)
+#define DMA_TI_WAIT_RESP     (1<<3)
+#define DMA_TI_TDMODE        (1<<1)
+
+#define DMA_PERMAP_PWM 5
+
+// PWM registers (see gpio.cc)
+#define PWM_CTL      (0x00 / 4)
+#define PWM_DMAC     (0x08 / 4)
+
+#define PWM_CTL_CLRF1 (1<<6)
+#define PWM_CTL_USEF1 (1<<5)
+#define PWM_CTL_POLA1 (1<<4)
+#define PWM_CTL_PWEN1 (1<<0)
+
+#define PWM_DMAC_ENAB      (1<<31)
+#define PWM_DMAC_PANIC(x)  ((x)<<8)
+#define PWM_DMAC_DREQ(x)   ((x)<<0)
+
+// Mailbox interface to the VideoCore to get memory usable by the DMA.
+#define MBOX_IOCTL _IOWR(100, 0, char *)
+#define MBOX_TAG_ALLOCATE 0x3000c
+#define MBOX_TAG_LOCK     0x3000d
+#define MBOX_TAG_UNLOCK   0x3000e
+#define MBOX_TAG_RELEASE  0x3000f
+
+#define MEM_FLAG_DIRECT            (1 << 2)  // 0xC alias; uncached.
+#define MEM_FLAG_L1_NONALLOCATING  (3 << 2)  // Pi1: 0x8 alias.
+#define BUS_TO_PHYS(x) ((x) & ~0xC0000000)
+
+// Number of control blocks per double row and bitplane.
+#define BLOCKS_PER_BITPLANE 7
+
+namespace rgb_matrix {
+namespace internal {
+// Layout as expected by the DMA hardware. Needs to be 32 byte aligned.
+struct DMAOutput::ControlBlock {
+  uint32_t ti;
+  uint32_t source_ad;
+  uint32_t dest_ad;
+  uint32_t txfr_len;
+  uint32_t stride;
+  uint32_t nextconbk;
+  uint32_t reserved[2];
+};
+
+// Data not dependent on the frame.
+struct DMAOutput::SharedData {
+  uint32_t zero;
+  uint32_t pwm_stop;
+  uint32_t pwm_start;
+  uint32_t frame_end_us;
+  uint32_t previous_frame_end_us;
+  uint32_t pwm_range[32];
+  uint32_t pulse[32][8 + 2];  // Pulse followed by two sentinels.
+  int pulse_words[32];
+};
+
+namespace {
+// Send property tag with up to three arguments to the mailbox.
+// Returns first value of the response or 0 on error.
+static uint32_t MailboxCall(int fd, uint32_t tag, int args,
+                            uint32_t a0, uint32_t a1 = 0, uint32_t a2 = 0) {
+  uint32_t msg[32] __attribute__((aligned(16)));
+  int i = 0;
+  msg[i++] = 0;     // Size, filled in below.
+  msg[i++] = 0;     // Process request.
+  msg[i++] = tag;
+  msg[i++] = args * sizeof(uint32_t);
+  msg[i++] = args * sizeof(uint32_t);
+  msg[i++] = a0;
+  if (args > 1) msg[i++] = a1;
+  if (args > 2) msg[i++] = a2;
+  msg[i++] = 0;     // End tag.
+  msg[0] = i * sizeof(uint32_t);
+  if (ioctl(fd, MBOX_IOCTL, msg) < 0) {
+    perror("DMA output: mailbox ioctl");
+    return 0;
+  }
+  return msg[5];
+}
+
+static void SplitBits(gpio_bits_t bits, uint32_t out[2]) {
+  out[0] = (uint64_t)bits & 0xFFFFFFFF;
+  out[1] = (uint64_t)bits >> 32;
+}
+}  // namespace
+
+DMAOutput *DMAOutput::Create(int double_rows, int bitplanes, int columns,
+                             const std::vector<int> &row_sequence,
+                             const std::vector<gpio_bits_t> &row_address,
+                             gpio_bits_t row_mask, gpio_bits_t strobe,
+                             const std::vector<int> &bitplane_timings) {
+  assert(bitplanes <= 32 && (int)bitplane_timings.size() >= bitplanes);
+  assert(2 * columns < (1 << 14));  // 2D mode limit.
+  DMAOutput *result = new DMAOutput(double_rows, bitplanes, columns,
+                                    row_sequence);
+  if (!result->Init(row_address, row_mask, strobe, bitplane_timings)) {
+    delete result;
+    return NULL;
+  }
+  return result;
+}
+
+DMAOutput::DMAOutput(int double_rows, int bitplanes, int columns,
+                     const std::vector<int> &row_sequence)
+  : double_rows_(double_rows), bitplanes_(bitplanes), columns_(columns),
+    row_sequence_(row_sequence),
+    mbox_fd_(-1), mem_handle_(0), mem_bus_address_(0), mem_size_(0),
+    mem_(NULL), dma_registers_(NULL), dma_channel_(NULL),
+    pwm_registers_(NULL), shared_(NULL), row_records_(NULL),
+    blocks_per_frame_(double_rows * bitplanes * BLOCKS_PER_BITPLANE + 2),
+    shown_frame_(-1) {
+  blocks_[0] = blocks_[1] = NULL;
+  records_[0] = records_[1] = NULL;
+  last_block_[0] = last_block_[1] = NULL;
+}
+
+bool DMAOutput::Init(const std::vector<gpio_bits_t> &row_address,
+                     gpio_bits_t row_mask, gpio_bits_t strobe,
+                     const std::vector<int> &bitplane_timings) {
+  dma_registers_ = MapPeripheralRegisters(DMA_REGISTER_OFFSET);
+  pwm_registers_ = MapPeripheralRegisters(PWM_REGISTER_OFFSET);
+  if (dma_registers_ == NULL || pwm_registers_ == NULL) {
+    fprintf(stderr, "DMA output: can't access DMA registers. "
+            "Need to run as root.\n");
+    return false;
+  }
+  dma_channel_ = dma_registers_ + DMA_CHANNEL * (0x100 / 4);
+  if (dma_channel_[DMA_CS] & DMA_CS_ACTIVE) {
+    fprintf(stderr, "DMA output: channel %d already in use.\n", DMA_CHANNEL);
+    return false;
+  }
+
+  // Memory layout: control blocks and records for two frames, shared data
+  // and row records.
+  const size_t block_bytes = blocks_per_frame_ * sizeof(ControlBlock);
+  const size_t records_per_frame = double_rows_ * bitplanes_ * (2*columns_+1);
+  const size_t row_records = double_rows_ * 4;
+  const size_t shared_bytes = (sizeof(SharedData) + 31) & ~31;
+  mem_size_ = 2 * block_bytes + shared_bytes
+    + (2 * records_per_frame + row_records) * sizeof(GPIORecord);
+  mem_size_ = (mem_size_ + 4095) & ~4095;
+
+  mbox_fd_ = open("/dev/vcio", 0);
+  if (mbox_fd_ < 0) {
+    perror("DMA output: can't open /dev/vcio");
+    return false;
+  }
+  mem_handle_ = MailboxCall(mbox_fd_, MBOX_TAG_ALLOCATE, 3, mem_size_, 4096,
+                            IsRaspberryPi1()
+                            ? MEM_FLAG_L1_NONALLOCATING : MEM_FLAG_DIRECT);
+  if (mem_handle_ == 0) {
+    fprintf(stderr, "DMA output: can't allocate %zu bytes of GPU memory.\n",
+            mem_size_);
+    return false;
+  }
+  mem_bus_address_ = MailboxCall(mbox_fd_, MBOX_TAG_LOCK, 1, mem_handle_);
+  if (mem_bus_address_ == 0) {
+    fprintf(stderr, "DMA output: can't lock GPU memory.\n");
+    return false;
+  }
+  const int mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
+  if (mem_fd < 0) {
+    perror("DMA output: can't open /dev/mem");
+    return false;
+  }
+  void *mapped = mmap(NULL, mem_size_, PROT_READ|PROT_WRITE, MAP_SHARED,
+                      mem_fd, BUS_TO_PHYS(mem_bus_address_));
+  close(mem_fd);
+  if (mapped == MAP_FAILED) {
+    perror("DMA output: mmap()");
+    return false;
+  }
+  mem_ = (uint8_t*) mapped;
+  memset(mem_, 0, mem_size_);
+
+  uint8_t *pos = mem_;
+  blocks_[0] = (ControlBlock*) pos;  pos += block_bytes;
+  blocks_[1] = (ControlBlock*) pos;  pos += block_bytes;
+  shared_ = (SharedData*) pos;       pos += shared_bytes;
+  records_[0] = (GPIORecord*) pos;   pos += records_per_frame*sizeof(GPIORecord);
+  records_[1] = (GPIORecord*) pos;   pos += records_per_frame*sizeof(GPIORecord);
+  row_records_ = (GPIORecord*) pos;
+
+  shared_->pwm_stop = PWM_CTL_USEF1 | PWM_CTL_POLA1 | PWM_CTL_CLRF1;
+  shared_->pwm_start = PWM_CTL_USEF1 | PWM_CTL_PWEN1 | PWM_CTL_POLA1;
+
+  timings_ = bitplane_timings;
+  SetPulseScale(100);
+
+  // Row address and strobe.
+  for (int row = 0; row < double_rows_; ++row) {
+    GPIORecord *r = row_records_ + 4 * row;
+    SplitBits(row_address[row] & row_mask, r[0].set);
+    SplitBits(~row_address[row] & row_mask, r[0].clr);
+    SplitBits(strobe, r[1].set);
+    SplitBits(strobe, r[2].clr);
+  }
+
+  // Only request data once the FIFO is empty; this is how we know that a
+  // pulse is finished.
+  pwm_registers_[PWM_DMAC] = PWM_DMAC_ENAB | PWM_DMAC_PANIC(7)
+    | PWM_DMAC_DREQ(1);
+  return true;
+}
+
+DMAOutput::~DMAOutput() {
+  Stop();
+  if (mem_) munmap(mem_, mem_size_);
+  if (mbox_fd_ >= 0) {
+    if (mem_bus_address_)
+      MailboxCall(mbox_fd_, MBOX_TAG_UNLOCK, 1, mem_handle_);
+    if (mem_handle_)
+      MailboxCall(mbox_fd_, MBOX_TAG_RELEASE, 1, mem_handle_);
+    close(mbox_fd_);
+  }
+}
+
+void DMAOutput::Stop() {
+  if (dma_channel_ && shown_frame_ >= 0) {
+    dma_channel_[DMA_CS] = DMA_CS_RESET;
+    usleep(100);
+  }
+  shown_frame_ = -1;
+  if (pwm_registers_) {
+    pwm_registers_[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_POLA1 | PWM_CTL_CLRF1;
+    pwm_registers_[PWM_DMAC] = 0;
+  }
+}
+
+void DMAOutput::SetPulseScale(int percent) {
+  // Same pulses as the HardwarePinPulser sends at full brightness; the clock
+  // divider stays the same, so we can only scale the range.
+  const int base = timings_[0];
+  for (int b = 0; b < bitplanes_; ++b) {
+    uint32_t range = 2 * (int64_t)timings_[b] * percent / (100 * base);
+    if (range < 1) range = 1;
+    const int words = (range < 16) ? 1 : 8;
+    shared_->pwm_range[b] = range / words;
+    // Followed by zero sentinels. A chain built before this change might
+    // still send the previous number of words, so zero all unused.
+    for (int i = 0; i < 8 + 2; ++i) {
+      shared_->pulse[b][i] = (i < words) ? range / words : 0;
+    }
+    shared_->pulse_words[b] = words + 2;
+  }
+}
+
+uint32_t DMAOutput::BusAddress(const void *p) const {
+  return mem_bus_address_ + ((const uint8_t*)p - mem_);
+}
+
+DMAOutput::GPIORecord *DMAOutput::ColumnRecords(int double_row, int bit) {
+  const int frame = (shown_frame_ == 0) ? 1 : 0;
+  return records_[frame]
+    + (double_row * bitplanes_ + bit) * (2 * columns_ + 1);
+}
+
+DMAOutput::ControlBlock *DMAOutput::BuildChain(int frame, int start_bit) {
+  // In 2D mode, we write records of five registers, going back to the start
+  // register after each record. All record lists have an extra empty record
+  // at the end, so it does not matter if the DMA engine does one transfer
+  // too many.
+  const uint32_t kRecordStride = ((uint32_t)(-(int)sizeof(GPIORecord)) << 16);
+  const uint32_t two_d = DMA_TI_TDMODE | DMA_TI_SRC_INC | DMA_TI_DEST_INC
+    | DMA_TI_WAIT_RESP;
+  ControlBlock *cb = blocks_[frame];
+  for (size_t r = 0; r < row_sequence_.size(); ++r) {
+    const int d_row = row_sequence_[r];
+    for (int b = start_bit; b < bitplanes_; ++b) {
+      // While the previous pulse is still going, clock in the columns.
+      cb->ti = two_d;
+      cb->source_ad = BusAddress(records_[frame]
+                                 + (d_row * bitplanes_ + b) * (2*columns_+1));
+      cb->dest_ad = GPIO_SET0_BUS;
+      cb->txfr_len = (2 * columns_) << 16 | sizeof(GPIORecord);
+      cb->stride = kRecordStride;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+
+      // Wait for the previous pulse: DREQ only comes once the FIFO is empty.
+      cb->ti = DMA_TI_DEST_DREQ | DMA_TI_PERMAP(DMA_PERMAP_PWM)
+        | DMA_TI_WAIT_RESP;
+      cb->source_ad = BusAddress(&shared_->zero);
+      cb->dest_ad = PWM_FIFO_BUS;
+      cb->txfr_len = sizeof(uint32_t);
+      cb->stride = 0;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+
+      cb->ti = DMA_TI_WAIT_RESP;
+      cb->source_ad = BusAddress(&shared_->pwm_stop);
+      cb->dest_ad = PWM_CTL_BUS;
+      cb->txfr_len = sizeof(uint32_t);
+      cb->stride = 0;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+
+      // Row address and strobe.
+      cb->ti = two_d;
+      cb->source_ad = BusAddress(row_records_ + 4 * d_row);
+      cb->dest_ad = GPIO_SET0_BUS;
+      cb->txfr_len = 3 << 16 | sizeof(GPIORecord);
+      cb->stride = kRecordStride;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+
+      // Send pulse.
+      cb->ti = DMA_TI_WAIT_RESP;
+      cb->source_ad = BusAddress(&shared_->pwm_range[b]);
+      cb->dest_ad = PWM_RNG1_BUS;
+      cb->txfr_len = sizeof(uint32_t);
+      cb->stride = 0;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+
+      cb->ti = DMA_TI_SRC_INC | DMA_TI_WAIT_RESP;
+      cb->source_ad = BusAddress(shared_->pulse[b]);
+      cb->dest_ad = PWM_FIFO_BUS;
+      cb->txfr_len = shared_->pulse_words[b] * sizeof(uint32_t);
+      cb->stride = 0;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+
+      cb->ti = DMA_TI_WAIT_RESP;
+      cb->source_ad = BusAddress(&shared_->pwm_start);
+      cb->dest_ad = PWM_CTL_BUS;
+      cb->txfr_len = sizeof(uint32_t);
+      cb->stride = 0;
+      cb->nextconbk = BusAddress(cb + 1);
+      ++cb;
+    }
+  }
+
+  // Frame done: remember the time for refresh statistics.
+  cb->ti = DMA_TI_SRC_INC | DMA_TI_DEST_INC | DMA_TI_WAIT_RESP;
+  cb->source_ad = BusAddress(&shared_->frame_end_us);
+  cb->dest_ad = BusAddress(&shared_->previous_frame_end_us);
+  cb->txfr_len = sizeof(uint32_t);
+  cb->stride = 0;
+  cb->nextconbk = BusAddress(cb + 1);
+  ++cb;
+
+  cb->ti = DMA_TI_WAIT_RESP;
+  cb->source_ad = TIMER_CLO_BUS;
+  cb->dest_ad = BusAddress(&shared_->frame_end_us);
+  cb->txfr_len = sizeof(uint32_t);
+  cb->stride = 0;
+  cb->nextconbk = BusAddress(blocks_[frame]);  // Loop.
+
+  return cb;
+}
+
+void DMAOutput::Show(int start_bit) {
+  const int frame = (shown_frame_ == 0) ? 1 : 0;
+  last_block_[frame] = BuildChain(frame, start_bit);
+
+  if (shown_frame_ < 0) {
+    dma_channel_[DMA_CS] = DMA_CS_RESET;
+    usleep(10);
+    dma_channel_[DMA_CS] = DMA_CS_INT | DMA_CS_END;
+    dma_channel_[DMA_DEBUG] = 7;  // Clear error flags.
+    dma_registers_[DMA_ENABLE] |= (1 << DMA_CHANNEL);
+    dma_channel_[DMA_CONBLK_AD] = BusAddress(blocks_[frame]);
+    dma_channel_[DMA_CS] = DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIO(15)
+      | DMA_CS_PRIO(15) | DMA_CS_ACTIVE;
+    shown_frame_ = frame;
+    return;
+  }
+
+  // Let the currently shown frame continue with the new one once done.
+  last_block_[shown_frame_]->nextconbk = BusAddress(blocks_[frame]);
+
+  // .. and wait until the DMA is there, so that the old one is free.
+  const uint32_t begin = BusAddress(blocks_[frame]);
+  const uint32_t end = BusAddress(blocks_[frame] + blocks_per_frame_);
+  for (;;) {
+    const uint32_t cs = dma_channel_[DMA_CS];
+    if ((cs & DMA_CS_ERROR) || !(cs & DMA_CS_ACTIVE)) {
+      fprintf(stderr, "DMA output: DMA stopped (CS=0x%08x, DEBUG=0x%08x)\n",
+              cs, dma_channel_[DMA_DEBUG]);
+      break;
+    }
+    const uint32_t current = dma_channel_[DMA_CONBLK_AD];
+    if (current >= begin && current < end) break;
+    usleep(100);
+  }
+  shown_frame_ = frame;
+}
+
+uint32_t DMAOutput::LastFrameMicroseconds() const {
+  if (shared_ == NULL || shared_->previous_frame_end_us == 0) return 0;
+  return shared_->frame_end_us - shared_->previous_frame_end_us;
+}
+
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,125 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_DMA_OUTPUT_H
+#define RPI_RGBMATRIX_DMA_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "gpio-bits.h"
+
+namespace rgb_matrix {
+namespace internal {
+
+// Refreshes the panel with the DMA engine instead of the CPU.
+//
+// A frame is pre-rendered into GPIO set/clear records which a chain of DMA
+// control blocks writes to the GPIO registers, one double row and bitplane
+// after the other. The output enable pulses are created by the PWM hardware
+// (like the HardwarePinPulser does), whose FIFO, via its DMA request signal,
+// also tells the DMA engine when a pulse is finished.
+// The chain loops endlessly over the current frame; there are two frames, so
+// one can be rendered while the other is shown.
+//
+// Requires the PWM clock and output enable pin to be set up already, which
+// happens when the HardwarePinPulser is created.
+class DMAOutput {
+public:
+  // Values to write to GPSET0, GPSET1, (reserved), GPCLR0, GPCLR1, which
+  // are subsequent registers. With one or two records per GPIO operation.
+  struct GPIORecord {
+    uint32_t set[2];
+    uint32_t reserved;
+    uint32_t clr[2];
+  };
+
+  // Create DMA output for frames of "double_rows" x "bitplanes" x
+  // "columns". Double rows are shown in the sequence given in
+  // "row_sequence" with the row address bits in "row_address" (one value
+  // per double row, applied with the "row_mask").
+  // The "bitplane_timings" in nanoseconds are the same as used to create
+  // the HardwarePinPulser.
+  // Returns NULL if that is not possible (e.g. not running as root); a
+  // message is printed to stderr then.
+  static DMAOutput *Create(int double_rows, int bitplanes, int columns,
+                           const std::vector<int> &row_sequence,
+                           const std::vector<gpio_bits_t> &row_address,
+                           gpio_bits_t row_mask, gpio_bits_t strobe,
+                           const std::vector<int> &bitplane_timings);
+  ~DMAOutput();  // Stops DMA and releases memory.
+
+  int columns() const { return columns_; }
+
+  // The 2 * columns() records for given double row and bitplane in the
+  // frame that is not shown right now, to be filled with a new frame.
+  GPIORecord *ColumnRecords(int double_row, int bit);
+
+  // Show the frame that has been filled with ColumnRecords(), from bitplane
+  // "start_bit" up. Waits until the DMA is showing it; the other frame is
+  // then available for filling.
+  void Show(int start_bit);
+
+  // Scale all pulses to "percent" (1..100) of the bitplane timings; takes
+  // effect with the next pulses sent.
+  void SetPulseScale(int percent);
+
+  // Time in microseconds the DMA took for the last full frame refresh.
+  // 0 if not known yet.
+  uint32_t LastFrameMicroseconds() const;
+
+private:
+  struct ControlBlock;
+  struct SharedData;
+
+  DMAOutput(int double_rows, int bitplanes, int columns,
+            const std::vector<int> &row_sequence);
+  bool Init(const std::vector<gpio_bits_t> &row_address,
+            gpio_bits_t row_mask, gpio_bits_t strobe,
+            const std::vector<int> &bitplane_timings);
+  void Stop();
+
+  // Convert pointer into our DMA memory to address as seen from the DMA.
+  uint32_t BusAddress(const void *p) const;
+
+  ControlBlock *BuildChain(int frame, int start_bit);
+
+  const int double_rows_;
+  const int bitplanes_;
+  const int columns_;
+  const std::vector<int> row_sequence_;
+  std::vector<int> timings_;
+
+  int mbox_fd_;
+  uint32_t mem_handle_;
+  uint32_t mem_bus_address_;
+  size_t mem_size_;
+  uint8_t *mem_;
+
+  volatile uint32_t *dma_registers_;
+  volatile uint32_t *dma_channel_;
+  volatile uint32_t *pwm_registers_;
+
+  SharedData *shared_;
+  GPIORecord *row_records_;   // Per double row: address, strobe on/off.
+  ControlBlock *blocks_[2];
+  GPIORecord *records_[2];
+  int blocks_per_frame_;
+  int shown_frame_;    // -1: not started yet.
+  ControlBlock *last_block_[2];
+};
+
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_DMA_OUTPUT_H
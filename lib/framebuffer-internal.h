@@ -18,29 +18,58 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "hardware-mapping.h"
+#include "thread.h"
 #include "../include/graphics.h"
 
 namespace rgb_matrix {
 class GPIO;
+class GPIOTrace;
 class PinPulser;
 namespace internal {
 class RowAddressSetter;
+class DMAOutput;
+class ColorCalibration;
+struct ColorLookup;
 
-// An opaque type used within the framebuffer that can be used
-// to copy between PixelMappers.
-struct PixelDesignator {
-  PixelDesignator() : gpio_word(-1), r_bit(0), g_bit(0), b_bit(0), mask(~0u){}
-  long gpio_word;
+// The GPIO bits with which a pixel's colors are set. Only few different
+// ones exist (one per sub-panel of each parallel chain, or per slot in a
+// packed word), so they are kept in a table of the PixelDesignatorMap.
+struct ColorBits {
+  ColorBits() : r_bit(0), g_bit(0), b_bit(0), mask(~0u) {}
   gpio_bits_t r_bit;
   gpio_bits_t g_bit;
   gpio_bits_t b_bit;
   gpio_bits_t mask;
 };
 
+// An opaque type used within the framebuffer that can be used
+// to copy between PixelMappers.
+// Kept small, as one is read for every pixel set.
+struct PixelDesignator {
+  PixelDesignator() : gpio_word(-1), color_bits(0) {}
+  int32_t gpio_word;
+  uint32_t color_bits;  // Index into the ColorBits of the map.
+};
+
 class PixelDesignatorMap {
 public:
-  PixelDesignatorMap(int width, int height, const PixelDesignator &fill_bits);
+  static constexpr int kMaxColorBits = 32;
+
+  // Version of what SaveToFile() writes, including what the PixelDesignators
+  // mean to the Framebuffer. Files of other versions are not loaded.
+  static constexpr uint32_t kFileFormatVersion = 2;
+
+  // The "color_bits" table are the "count" ColorBits PixelDesignators can
+  // refer to.
+  PixelDesignatorMap(int width, int height, const ColorBits &fill_bits,
+                     const ColorBits *color_bits, int count);
+  // A new map with the same color bits as "other", e.g. for a PixelMapper.
+  PixelDesignatorMap(int width, int height, const PixelDesignatorMap &other);
   ~PixelDesignatorMap();
 
   // Get a writable version of the PixelDesignator. Outside Framebuffer used
@@ -50,14 +79,50 @@ public:
   inline int width() const { return width_; }
   inline int height() const { return height_; }
 
+  const ColorBits &color_bits(const PixelDesignator &d) const {
+    return color_bits_[d.color_bits];
+  }
+
   // All bits that set red/green/blue pixels; used for Fill().
-  const PixelDesignator &GetFillColorBits() { return fill_bits_; }
+  const ColorBits &GetFillColorBits() const { return fill_bits_; }
+
+  // Store in "filename", to be loaded in a later run with the same "key",
+  // which has to describe everything that went into creating this map.
+  bool SaveToFile(const char *filename, const std::string &key) const;
+
+  // Map what was stored with SaveToFile() into memory. Returns NULL if not
+  // possible, if the file was created with a different "key" or if any of its
+  // PixelDesignators refers to color bits that don't exist. Whether they fit
+  // a Framebuffer is checked with Framebuffer::IsValidMap().
+  static PixelDesignatorMap *LoadFromFile(const char *filename,
+                                          const std::string &key);
 
 private:
+  friend class Framebuffer;  // Caches its row bands here.
+  struct FileHeader;
+
+  // Independent row bands computed by Framebuffer::GetIndependentRowBands().
+  // A new pixel mapping always is a new map, so these never get stale.
+  struct RowBands {
+    int band_height;
+    long row_words;
+    std::vector<std::vector<int> > groups;
+  };
+
+  PixelDesignatorMap(int width, int height, const ColorBits &fill_bits,
+                     const ColorBits *color_bits, int count,
+                     PixelDesignator *buffer, void *mapped, size_t mapped_len);
+
   const int width_;
   const int height_;
-  const PixelDesignator fill_bits_;  // Precalculated for fill.
+  const ColorBits fill_bits_;  // Precalculated for fill.
+  ColorBits color_bits_[kMaxColorBits];
   PixelDesignator *const buffer_;
+  void *const mapped_;       // If buffer_ is in a mmap()-ed file.
+  const size_t mapped_len_;
+
+  Mutex row_bands_mutex_;
+  std::vector<RowBands> row_bands_;
 };
 
 // Internal representation of the frame-buffer that as well can
@@ -67,43 +132,81 @@ private:
 class Framebuffer {
 public:
   // Maximum usable bitplanes.
-  //
+  static constexpr int kMaxBitPlanes = 16;
+
   // 11 bits seems to be a sweet spot in which we still get somewhat useful
-  // refresh rate and have good color richness. This is the default setting
+  // refresh rate and have good color richness. This is the default setting.
   // However, in low-light situations, we want to be able to scale down
   // brightness more, having more bits at the bottom.
-  // TODO(hzeller): make the default 15 bit or so, but slide the use of
-  //  timing to lower bits if fewer bits requested to not affect the overall
-  //  refresh in that case.
-  //  This needs to be balanced to not create too agressive timing however.
-  //  To be explored in a separete commit.
   //
-  // For now, if someone needs very low level of light, change this to
-  // say 13 and recompile. Run with --led-pwm-bits=13. Also, consider
-  // --led-pwm-dither-bits=2 to have the refresh rate not suffer too much.
-  static constexpr int kBitPlanes = 11;
+  // So the number of bitplanes can be chosen up to kMaxBitPlanes at
+  // construction time. The timing of the top kDefaultBitPlanes planes is
+  // always the same, with the lowest of these using --led-pwm-lsb-nanoseconds;
+  // additional planes below get half the time of the next higher one.
+  // That way, the usual pwm-bits see the same refresh rate as before, while
+  // the additional low bits only cost their clocking time.
   static constexpr int kDefaultBitPlanes = 11;
 
-  Framebuffer(int rows, int columns, int parallel,
+  // "bitplanes" is the number of bitplanes to store, 1..kMaxBitPlanes.
+  // All framebuffers of a matrix need to have the same number of bitplanes
+  // as chosen in InitGPIO().
+  // If "packed" is set, only the color bits are stored instead of full
+  // GPIO words (see comment at bitplane_buffer_ below).
+  // With "temporal_dither_bits" > 0, colors are mapped with that many bits
+  // more than "bitplanes" and 2^temporal_dither_bits variants of the frame
+  // are stored, to be shown one after another by DumpToMatrix(); together
+  // they show the additional bits. bitplanes + temporal_dither_bits needs
+  // to be at most kMaxBitPlanes.
+  // With "hugepages", the bitplane buffer is put into huge pages if the
+  // kernel has some reserved, to need fewer TLB entries while refreshing.
+  Framebuffer(int rows, int columns, int parallel, int bitplanes,
               int scan_mode,
               const char* led_sequence, bool inverse_color,
+              bool packed, int temporal_dither_bits, bool hugepages,
               PixelDesignatorMap **mapper);
   ~Framebuffer();
 
   // Initialize GPIO bits for output. Only call once.
   static void InitHardwareMapping(const char *named_hardware);
-  static void InitGPIO(GPIO *io, int rows, int parallel,
+  static void InitGPIO(GPIO *io, int rows, int parallel, int bitplanes,
                        bool allow_hardware_pulsing,
                        int pwm_lsb_nanoseconds,
                        int dither_bits,
                        int row_address_type);
   static void InitializePanels(GPIO *io, const char *panel_type, int columns);
 
+  // Output-enable pulse length of each bitplane for the given options.
+  static std::vector<int> ComputeBitplaneTimings(int bitplanes,
+                                                 int pwm_lsb_nanoseconds,
+                                                 int dither_bits);
+
+  // Replace the timings set up in InitGPIO() with ComputeBitplaneTimings().
+  // Only call from the refresh thread between calls to DumpToMatrix().
+  static void SetBitplaneTimings(const std::vector<int> &timings,
+                                 int dither_bits);
+
+  // Scale the output-enable pulses to given brightness in percent.
+  // In contrast to SetBrightness(), this applies to all frames
+  // immediately with the next refresh. Only call from the refresh thread
+  // between calls to DumpToMatrix().
+  static void SetOutputBrightness(uint8_t percent);
+
+  // Overshoot of waiting for the output-enable pulses since the last call,
+  // see PinPulser::TakeSleepOvershoot(). Only call from the refresh thread.
+  static int TakePulseOvershoot(uint32_t *total_us, uint32_t *max_us);
+
+  // Write "trace" as VCD with the signals named as in the hardware mapping.
+  static bool WriteTraceVCD(const GPIOTrace &trace, const char *filename);
+
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // simple comic-colors, 1 might be sufficient. Lower require less CPU.
-  // Returns boolean to signify if value was within range.
+  // Returns boolean to signify if value was within range, which is at most
+  // the number of bitplanes.
+  // Bitplanes that come into use are set dark: they were not drawn while
+  // unused, so the low bits of the content are lost until it is drawn again.
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits() { return pwm_bits_; }
+  int bitplanes() const { return bitplanes_; }
 
   // Map brightness of output linearly to input with CIE1931 profile.
   void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
@@ -116,20 +219,78 @@ public:
   }
   uint8_t brightness() { return brightness_; }
 
-  void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
+  // Map colors with per-channel curves instead of the plain CIE1931
+  // lookup; NULL for none. Owned by the caller. Affects newly set pixels.
+  void SetColorCalibration(const ColorCalibration *calibration) {
+    calibration_ = calibration;
+  }
+
+  // Output "variant" (modulo temporal_variants()) of the frame, starting
+  // with bitplane "pwm_bits_to_show".
+  void DumpToMatrix(GPIO *io, int pwm_bits_to_show, unsigned variant = 0);
+  int temporal_variants() const { return variants_; }
+
+  // Create a DMAOutput for the configuration given in InitGPIO() and the
+  // geometry of this framebuffer. Returns NULL with a message on stderr if
+  // not possible.
+  DMAOutput *CreateDMAOutput() const;
+
+  // Instead of DumpToMatrix(): render the double rows set in "rows" of this
+  // frame into the DMAOutput and show it there. Only the first temporal
+  // variant is rendered.
+  void RenderToDMA(DMAOutput *dma, uint64_t rows);
+
+  // Double rows written to since the last call, independent of the
+  // changed_rows() the user sees; to only render what changed.
+  uint64_t TakeRenderRows() { return render_rows_.exchange(0); }
+  uint64_t all_rows() const { return all_rows_; }
 
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
   void CopyFrom(const Framebuffer *other);
 
+  // Keep the memory read while refreshing resident, so that the refresh
+  // never waits for a page fault. Best effort; returns false if that is not
+  // allowed (e.g. after dropping privileges).
+  bool LockMemory() const;
+
+  // Each double row is tracked if it has been written to since the last
+  // ClearChanged(). Bit n in the returned mask represents double row n.
+  int double_rows() const { return double_rows_; }
+  uint64_t changed_rows() const { return changed_rows_.load(); }
+  void ClearChanged() { changed_rows_.store(0); }
+
+  // Copy only the double rows changed in "other". Does not change the
+  // changed-mask of this framebuffer.
+  void CopyChangedFrom(const Framebuffer *other);
+
+  // Like Serialize(), but only the data of the given double row, which is
+  // located at offset (double_row * len) in the full serialization.
+  void SerializeRow(int double_row, const char **data, size_t *len) const;
+
+  // Whether all the PixelDesignators in "map" are either unused or refer to
+  // a pixel in this framebuffer; e.g. for a map loaded from a file.
+  bool IsValidMap(PixelDesignatorMap *map) const;
+
+  // Split the visible rows into bands of "band_height" rows (band n starts
+  // at row n * band_height) and group the bands that share double rows in
+  // the bitplane buffer. Pixels in bands of different groups can be set
+  // concurrently. Bands without any mapped pixels are left out.
+  // Computed once per band height and mapping.
+  void GetIndependentRowBands(int band_height,
+                              std::vector<std::vector<int> > *groups) const;
+
   // Canvas-inspired methods, but we're not implementing this interface to not
   // have an unnecessary vtable.
   int width() const;
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
   void SetPixels(int x, int y, int width, int height, Color *colors);
+  void SetFrameRGB(const uint8_t *rgb, int stride);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
+  void FillRect(int x, int y, int width, int height,
+                uint8_t red, uint8_t green, uint8_t blue);
 
 private:
   static const struct HardwareMapping *hardware_mapping_;
@@ -142,24 +303,62 @@ private:
                                             gpio_bits_t default_g,
                                             gpio_bits_t default_b);
 
-  void InitDefaultDesignator(int x, int y, const char *led_sequence,
-                             PixelDesignator *designator);
+  static const ColorLookup *GetLuminanceCIE1931LookupTable(int bitplanes);
+
+  void InitDefaultDesignator(int x, int y, PixelDesignator *designator);
+  void InitPackedDesignator(int x, int y, PixelDesignator *designator);
+  void InitPackedExpansion(const char *led_sequence);
+  int ScanRow(int row_loop) const;  // Double row to show in given loop.
+  inline gpio_bits_t ExpandPacked(const gpio_bits_t **row_data,
+                                  gpio_bits_t *triples,
+                                  int *triples_left) const;
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
+  inline void MapSpanColors(const Color *colors, int count,
+                            uint16_t *red, uint16_t *green, uint16_t *blue);
+  // Value of a color from MapColors() to store in the given temporal variant.
+  inline uint16_t ShownValue(uint16_t value, int variant) const;
+
+  // Set "count" pixels starting at x, y. Needs to be fully within the canvas.
+  void SetPixelSpan(int x, int y, int count, const Color *colors);
+  // Same, all "count" pixels with the same already mapped color.
+  void FillPixelSpan(int x, int y, int count,
+                     uint16_t red, uint16_t green, uint16_t blue);
+
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
   const int columns_;  // Number of columns. Number of chained boards * 32.
+  const int bitplanes_;  // Bitplanes stored; 1..kMaxBitPlanes
+  const int temporal_bits_;  // Color bits beyond the bitplanes ..
+  const int variants_;       // .. shown with this many variants of the frame.
 
   const int scan_mode_;
   const bool inverse_color_;
+  const bool packed_;
 
   uint8_t pwm_bits_;   // PWM bits to display.
   bool do_luminance_correct_;
   uint8_t brightness_;
+  const ColorLookup *const luminance_lookup_;  // CIE1931 for our bitplanes.
+  const ColorCalibration *calibration_;        // Replaces the above if set.
 
   const int double_rows_;
+  const int slots_per_word_;  // In packed mode: color triples per word
+  const int plane_words_;  // words per bitplane of a double row.
+  const int variant_words_;  // words per variant of a double row.
+  const int row_words_;    // words per double row, all bitplanes and variants.
   const size_t buffer_size_;
+  size_t mapped_size_;     // bitplane_buffer_ mapping, at least buffer_size_.
+  const uint64_t all_rows_;  // changed_rows_ mask with all rows set.
+  std::atomic<uint64_t> changed_rows_;
+  std::atomic<uint64_t> render_rows_;   // Same, for TakeRenderRows().
+
+  // Per double row: bit b set if bitplane b might have color bits. Never
+  // missing a bit, but might have one too many after overwriting pixels with
+  // black; exact again after Clear(). Lets DumpToMatrix() skip clocking out
+  // black data if the panel shift registers already hold zeros.
+  std::atomic<uint32_t> *const lit_planes_;
 
   // The frame-buffer is organized in bitplanes.
   // Highest level (slowest to cycle through) are double rows.
@@ -167,8 +366,44 @@ private:
   // Each bitplane-column is pre-filled IoBits, of which the colors are set.
   // Of course, that means that we store unrelated bits in the frame-buffer,
   // but it allows easy access in the critical section.
+  // With temporal dithering, each double row has all bitplanes of each
+  // variant one after another; pixel positions point into the first.
+  //
+  // In packed mode, we only store the color bits: every column of a bitplane
+  // has two (top and bottom sub-panel) RGB triples of three bits for each
+  // parallel chain; these triples are stored densely next to each other in
+  // words. They are expanded to GPIO bits with packed_expand_ while clocking
+  // out. For large setups this is a lot less memory to go through.
   gpio_bits_t *bitplane_buffer_;
+  static gpio_bits_t packed_expand_[2 * 6][8];  // [slot in column][rgb]
   inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
+  inline void MarkChanged(long gpio_word) {
+    // Atomic as pixels of different double rows may be set concurrently;
+    // only the first write to a row since ClearChanged() pays for it.
+    const uint64_t row_bit = uint64_t(1) << (gpio_word / row_words_);
+    if (!(changed_rows_.load(std::memory_order_relaxed) & row_bit)) {
+      changed_rows_.fetch_or(row_bit, std::memory_order_relaxed);
+    }
+    if (!(render_rows_.load(std::memory_order_relaxed) & row_bit)) {
+      render_rows_.fetch_or(row_bit, std::memory_order_relaxed);
+    }
+  }
+  inline void MarkAllChanged() {
+    changed_rows_.store(all_rows_);
+    render_rows_.store(all_rows_);
+  }
+  // Bitplanes from min_bit_plane up to bitplanes_.
+  inline uint32_t PlaneRange(int min_bit_plane) const {
+    return ((1u << bitplanes_) - 1) & ~((1u << min_bit_plane) - 1);
+  }
+  // Same pattern: only the first color in a bitplane of a row pays.
+  inline void MarkLit(long gpio_word, uint32_t planes) {
+    std::atomic<uint32_t> &lit = lit_planes_[gpio_word / row_words_];
+    if ((lit.load(std::memory_order_relaxed) & planes) != planes) {
+      lit.fetch_or(planes, std::memory_order_relaxed);
+    }
+  }
+  void ComputeLitPlanes();  // From the bitplane buffer.
 
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
 };
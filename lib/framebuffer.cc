@@ -21,23 +21,54 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
 
+#include "color-calibration.h"
+#include "dma-output.h"
 #include "gpio.h"
+#include "thread.h"
 #include "../include/graphics.h"
 
+// The NEON span kernel deals with 32 bit GPIO words; the wide compute module
+// variant always uses the scalar version.
+#if defined(__ARM_NEON) && !defined(ENABLE_WIDE_GPIO_COMPUTE_MODULE)
+#  include <arm_neon.h>
+#  define USE_NEON_SPAN_KERNEL 1
+#endif
+
 namespace rgb_matrix {
 namespace internal {
 // We need one global instance of a timing correct pulser. There are different
 // implementations depending on the context.
 static PinPulser *sOutputEnablePulser = NULL;
 
+// Remembered for the DMAOutput, which needs the same timings.
+static std::vector<int> sBitplaneTimings;
+static bool sDithering = false;
+
+static gpio_bits_t sUsedColorBits = 0;  // Color bits of all parallel chains.
+
+// Clocks in the columns of one bitplane; specialized for the configuration
+// in InitGPIO(). NULL if there is no specialization; DumpToMatrix() uses the
+// generic code then.
+typedef void (*ClockOutFunction)(GPIO *io, const gpio_bits_t *row_data,
+                                 int columns, int slots_per_word,
+                                 const gpio_bits_t (*packed_expand)[8],
+                                 gpio_bits_t color_mask, gpio_bits_t clock);
+static ClockOutFunction sClockOutPlane = NULL;
+static ClockOutFunction sClockOutPackedPlane = NULL;
+
 #ifdef ONLY_SINGLE_SUB_PANEL
 #  define SUB_PANELS_ 1
 #else
@@ -51,13 +82,140 @@ PixelDesignator *PixelDesignatorMap::get(int x, int y) {
 }
 
 PixelDesignatorMap::PixelDesignatorMap(int width, int height,
-                                       const PixelDesignator &fill_bits)
+                                       const ColorBits &fill_bits,
+                                       const ColorBits *color_bits, int count)
+  : PixelDesignatorMap(width, height, fill_bits, color_bits, count,
+                       new PixelDesignator[width * height], NULL, 0) {
+}
+
+PixelDesignatorMap::PixelDesignatorMap(int width, int height,
+                                       const PixelDesignatorMap &other)
+  : PixelDesignatorMap(width, height, other.fill_bits_, other.color_bits_,
+                       kMaxColorBits, new PixelDesignator[width * height],
+                       NULL, 0) {
+}
+
+PixelDesignatorMap::PixelDesignatorMap(int width, int height,
+                                       const ColorBits &fill_bits,
+                                       const ColorBits *color_bits, int count,
+                                       PixelDesignator *buffer,
+                                       void *mapped, size_t mapped_len)
   : width_(width), height_(height), fill_bits_(fill_bits),
-    buffer_(new PixelDesignator[width * height]) {
+    buffer_(buffer), mapped_(mapped), mapped_len_(mapped_len) {
+  assert(count <= kMaxColorBits);
+  std::copy(color_bits, color_bits + count, color_bits_);
 }
 
 PixelDesignatorMap::~PixelDesignatorMap() {
-  delete [] buffer_;
+  if (mapped_) {
+    munmap(mapped_, mapped_len_);
+  } else {
+    delete [] buffer_;
+  }
+}
+
+// The file starts with this header, followed by the key and, aligned to
+// kDataAlign, width * height PixelDesignators.
+struct PixelDesignatorMap::FileHeader {
+  static constexpr uint32_t kMagic = 0x4d445052;  // "RPDM"
+  static constexpr size_t kDataAlign = 16;
+
+  uint32_t magic;
+  uint32_t version;          // kFileFormatVersion
+  uint32_t designator_size;
+  uint32_t color_bits_size;  // Different with 32 or 64 bit GPIO.
+  uint32_t width;
+  uint32_t height;
+  uint32_t key_len;
+  ColorBits fill_bits;
+  ColorBits color_bits[kMaxColorBits];
+
+  size_t data_offset() const {
+    const size_t end = sizeof(FileHeader) + key_len;
+    return (end + kDataAlign - 1) / kDataAlign * kDataAlign;
+  }
+};
+
+bool PixelDesignatorMap::SaveToFile(const char *filename,
+                                    const std::string &key) const {
+  FileHeader header;
+  header.magic = FileHeader::kMagic;
+  header.version = kFileFormatVersion;
+  header.designator_size = sizeof(PixelDesignator);
+  header.color_bits_size = sizeof(ColorBits);
+  header.width = width_;
+  header.height = height_;
+  header.key_len = key.size();
+  header.fill_bits = fill_bits_;
+  std::copy(color_bits_, color_bits_ + kMaxColorBits, header.color_bits);
+
+  // Written to a temporary file first, so that concurrently starting
+  // programs never see a partial file.
+  const std::string tmp_name = std::string(filename) + ".tmp";
+  FILE *out = fopen(tmp_name.c_str(), "wb");
+  if (!out) {
+    fprintf(stderr, "Can't write pixel mapper cache %s: %s\n",
+            tmp_name.c_str(), strerror(errno));
+    return false;
+  }
+  static const char kZeros[FileHeader::kDataAlign] = {};
+  const size_t padding = header.data_offset() - sizeof(header) - key.size();
+  bool success = fwrite(&header, sizeof(header), 1, out) == 1
+    && fwrite(key.data(), 1, key.size(), out) == key.size()
+    && fwrite(kZeros, 1, padding, out) == padding
+    && fwrite(buffer_, sizeof(PixelDesignator), width_ * height_, out)
+    == (size_t)(width_ * height_);
+  success &= (fclose(out) == 0);
+  if (success && rename(tmp_name.c_str(), filename) == 0)
+    return true;
+  fprintf(stderr, "Writing pixel mapper cache %s failed.\n", filename);
+  unlink(tmp_name.c_str());
+  return false;
+}
+
+PixelDesignatorMap *PixelDesignatorMap::LoadFromFile(const char *filename,
+                                                     const std::string &key) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+    close(fd);
+    return NULL;
+  }
+  const size_t len = st.st_size;
+  // Private, so that modifications (e.g. further pixel mappers applied)
+  // never end up in the file.
+  void *mapped = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return NULL;
+
+  const FileHeader *header = (const FileHeader *)mapped;
+  const char *const file_key = (const char *)mapped + sizeof(FileHeader);
+  if (header->magic != FileHeader::kMagic
+      || header->version != kFileFormatVersion
+      || header->designator_size != sizeof(PixelDesignator)
+      || header->color_bits_size != sizeof(ColorBits)
+      || header->key_len != key.size()
+      || header->key_len > len
+      || (uint64_t)len != header->data_offset()
+      + (uint64_t)header->width * header->height * sizeof(PixelDesignator)
+      || memcmp(file_key, key.data(), key.size()) != 0) {
+    munmap(mapped, len);
+    return NULL;  // Outdated or not ours.
+  }
+  PixelDesignator *buffer = (PixelDesignator *)((char *)mapped
+                                                + header->data_offset());
+  const size_t count = (size_t)header->width * header->height;
+  for (size_t i = 0; i < count; ++i) {
+    if (buffer[i].color_bits >= (uint32_t)kMaxColorBits) {
+      fprintf(stderr, "Pixel mapper cache %s is corrupt.\n", filename);
+      munmap(mapped, len);
+      return NULL;
+    }
+  }
+  return new PixelDesignatorMap(header->width, header->height,
+                                header->fill_bits, header->color_bits,
+                                kMaxColorBits, buffer, mapped, len);
 }
 
 // Different panel types use different techniques to set the row address.
@@ -67,6 +225,12 @@ public:
   virtual ~RowAddressSetter() {}
   virtual gpio_bits_t need_bits() const = 0;
   virtual void SetRowAddress(GPIO *io, int row) = 0;
+
+  // If the address can be set with a single write of the bits returned
+  // in "bits" (masked with need_bits()), returns true.
+  virtual bool GetDirectRowAddress(int row, gpio_bits_t *bits) const {
+    return false;
+  }
 };
 
 namespace {
@@ -103,6 +267,11 @@ public:
     last_row_ = row;
   }
 
+  virtual bool GetDirectRowAddress(int row, gpio_bits_t *bits) const {
+    *bits = row_lookup_[row];
+    return true;
+  }
+
 private:
   gpio_bits_t row_mask_;
   gpio_bits_t row_lookup_[32];
@@ -283,20 +452,201 @@ private:
 
 const struct HardwareMapping *Framebuffer::hardware_mapping_ = NULL;
 RowAddressSetter *Framebuffer::row_setter_ = NULL;
+gpio_bits_t Framebuffer::packed_expand_[2 * 6][8];
+
+namespace {
+// Same as WriteMaskedBits(out, color_mask | clock) followed by SetBits(clock)
+// as the generic code in DumpToMatrix() does; the bits to clear always
+// contain the clock.
+template <bool kWide, int kSlowdown>
+inline void ClockOutColumn(GPIO *io, gpio_bits_t out,
+                           gpio_bits_t color_mask, gpio_bits_t clock) {
+  io->ClearBitsFixed<kWide, kSlowdown>((~out & color_mask) | clock);
+  const gpio_bits_t set = out & color_mask;
+  if (set) io->SetBitsFixed<kWide, kSlowdown>(set);  // Save write if dark.
+  io->SetBitsFixed<kWide, kSlowdown>(clock);         // Rising edge.
+}
+
+// kPackedParallel is 0 for a regular framebuffer, otherwise the number of
+// parallel chains in the packed framebuffer.
+template <bool kWide, int kSlowdown, int kPackedParallel>
+void ClockOutPlane(GPIO *io, const gpio_bits_t *row_data,
+                   int columns, int slots_per_word,
+                   const gpio_bits_t (*packed_expand)[8],
+                   gpio_bits_t color_mask, gpio_bits_t clock) {
+  if (kPackedParallel == 0) {
+    int col = 0;
+    for (/**/; col + 4 <= columns; col += 4, row_data += 4) {
+      ClockOutColumn<kWide, kSlowdown>(io, row_data[0], color_mask, clock);
+      ClockOutColumn<kWide, kSlowdown>(io, row_data[1], color_mask, clock);
+      ClockOutColumn<kWide, kSlowdown>(io, row_data[2], color_mask, clock);
+      ClockOutColumn<kWide, kSlowdown>(io, row_data[3], color_mask, clock);
+    }
+    for (/**/; col < columns; ++col) {
+      ClockOutColumn<kWide, kSlowdown>(io, *row_data++, color_mask, clock);
+    }
+  } else {
+    gpio_bits_t triples = *row_data++;
+    int triples_left = slots_per_word;
+    for (int col = 0; col < columns; ++col) {
+      gpio_bits_t out = 0;
+      for (int slot = 0; slot < 2 * kPackedParallel; ++slot) {
+        out |= packed_expand[slot][triples & 0x07];
+        triples >>= 3;
+        if (--triples_left == 0) {
+          triples = *row_data++;
+          triples_left = slots_per_word;
+        }
+      }
+      ClockOutColumn<kWide, kSlowdown>(io, out, color_mask, clock);
+    }
+  }
+}
+
+template <bool kWide, int kSlowdown>
+ClockOutFunction SelectClockOutForParallel(int packed_parallel) {
+  switch (packed_parallel) {
+  case 0: return &ClockOutPlane<kWide, kSlowdown, 0>;
+  case 1: return &ClockOutPlane<kWide, kSlowdown, 1>;
+  case 2: return &ClockOutPlane<kWide, kSlowdown, 2>;
+  case 3: return &ClockOutPlane<kWide, kSlowdown, 3>;
+  case 4: return &ClockOutPlane<kWide, kSlowdown, 4>;
+  case 5: return &ClockOutPlane<kWide, kSlowdown, 5>;
+  case 6: return &ClockOutPlane<kWide, kSlowdown, 6>;
+  default: return NULL;
+  }
+}
 
-Framebuffer::Framebuffer(int rows, int columns, int parallel,
+template <bool kWide>
+ClockOutFunction SelectClockOutForSlowdown(int slowdown, int packed_parallel) {
+  switch (slowdown) {
+  case 0: return SelectClockOutForParallel<kWide, 0>(packed_parallel);
+  case 1: return SelectClockOutForParallel<kWide, 1>(packed_parallel);
+  case 2: return SelectClockOutForParallel<kWide, 2>(packed_parallel);
+  case 3: return SelectClockOutForParallel<kWide, 3>(packed_parallel);
+  case 4: return SelectClockOutForParallel<kWide, 4>(packed_parallel);
+  default: return NULL;
+  }
+}
+
+ClockOutFunction SelectClockOut(bool wide, int slowdown, int packed_parallel) {
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+  if (wide) return SelectClockOutForSlowdown<true>(slowdown, packed_parallel);
+#endif
+  return SelectClockOutForSlowdown<false>(slowdown, packed_parallel);
+}
+}  // namespace
+
+// Number of RGB triples that fit into one word of the packed layout.
+static constexpr int kPackedSlotsPerWord = (8 * sizeof(gpio_bits_t)) / 3;
+
+// GPIO bits for the red, green and blue pins of the given parallel chain and
+// sub-panel (0 = top, 1 = bottom).
+static void GetChainColorBits(const struct HardwareMapping &h,
+                              int chain, int sub_panel,
+                              gpio_bits_t *r, gpio_bits_t *g, gpio_bits_t *b) {
+  switch (chain * 2 + sub_panel) {
+  case 0:  *r = h.p0_r1; *g = h.p0_g1; *b = h.p0_b1; break;
+  case 1:  *r = h.p0_r2; *g = h.p0_g2; *b = h.p0_b2; break;
+  case 2:  *r = h.p1_r1; *g = h.p1_g1; *b = h.p1_b1; break;
+  case 3:  *r = h.p1_r2; *g = h.p1_g2; *b = h.p1_b2; break;
+  case 4:  *r = h.p2_r1; *g = h.p2_g1; *b = h.p2_b1; break;
+  case 5:  *r = h.p2_r2; *g = h.p2_g2; *b = h.p2_b2; break;
+  case 6:  *r = h.p3_r1; *g = h.p3_g1; *b = h.p3_b1; break;
+  case 7:  *r = h.p3_r2; *g = h.p3_g2; *b = h.p3_b2; break;
+  case 8:  *r = h.p4_r1; *g = h.p4_g1; *b = h.p4_b1; break;
+  case 9:  *r = h.p4_r2; *g = h.p4_g2; *b = h.p4_b2; break;
+  case 10: *r = h.p5_r1; *g = h.p5_g1; *b = h.p5_b1; break;
+  default: *r = h.p5_r2; *g = h.p5_g2; *b = h.p5_b2; break;
+  }
+}
+
+static size_t ReadHugePageSize() {
+  long kbytes = 0;
+  FILE *meminfo = fopen("/proc/meminfo", "r");
+  if (meminfo) {
+    char line[128];
+    while (fgets(line, sizeof(line), meminfo)) {
+      if (sscanf(line, "Hugepagesize: %ld kB", &kbytes) == 1) break;
+    }
+    fclose(meminfo);
+  }
+  return kbytes * 1024;
+}
+
+// Size of huge pages; 0 if the kernel has none.
+static size_t HugePageSize() {
+  static const size_t size = ReadHugePageSize();  // Thread-safe init.
+  return size;
+}
+
+// The bitplane buffer is read on every refresh, so it is mapped page
+// aligned and populated right away, instead of being faulted in while
+// refreshing. Returns the buffer and the size of the mapping.
+static gpio_bits_t *AllocateBitplaneBuffer(size_t bytes, bool hugepages,
+                                           size_t *mapped_size) {
+  static const int kFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+  void *buffer = MAP_FAILED;
+  size_t size = 0;
+  if (hugepages && HugePageSize() > 0) {
+    size = (bytes + HugePageSize() - 1) / HugePageSize() * HugePageSize();
+    buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, kFlags | MAP_HUGETLB,
+                  -1, 0);
+  }
+  if (hugepages && buffer == MAP_FAILED) {
+    static bool warned = false;
+    if (!warned) {
+      fprintf(stderr, "No huge pages available for the framebuffer "
+              "(see vm.nr_hugepages); using regular pages.\n");
+      warned = true;
+    }
+  }
+  if (buffer == MAP_FAILED) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size = (bytes + page - 1) / page * page;
+    buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, kFlags, -1, 0);
+  }
+  if (buffer == MAP_FAILED) {
+    fprintf(stderr, "Can't allocate framebuffer of %zu bytes: %s\n",
+            bytes, strerror(errno));
+    abort();
+  }
+  *mapped_size = size;
+  return (gpio_bits_t*) buffer;
+}
+
+Framebuffer::Framebuffer(int rows, int columns, int parallel, int bitplanes,
                          int scan_mode,
                          const char *led_sequence, bool inverse_color,
-                         PixelDesignatorMap **mapper)
+                         bool packed, int temporal_dither_bits,
+                         bool hugepages, PixelDesignatorMap **mapper)
   : rows_(rows),
     parallel_(parallel),
     height_(rows * parallel),
     columns_(columns),
+    bitplanes_(bitplanes),
+    temporal_bits_(temporal_dither_bits),
+    variants_(1 << temporal_dither_bits),
     scan_mode_(scan_mode),
     inverse_color_(inverse_color),
-    pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    packed_(packed),
+    pwm_bits_(bitplanes), do_luminance_correct_(true), brightness_(100),
+    luminance_lookup_(GetLuminanceCIE1931LookupTable(
+                        bitplanes + temporal_dither_bits)),
+    calibration_(NULL),
     double_rows_(rows / SUB_PANELS_),
-    buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
+    slots_per_word_(kPackedSlotsPerWord),
+    plane_words_(packed
+                 ? (columns * 2 * parallel + slots_per_word_ - 1) / slots_per_word_
+                 : columns),
+    variant_words_(plane_words_ * bitplanes),
+    row_words_(variant_words_ * variants_),
+    buffer_size_(double_rows_ * row_words_ * sizeof(gpio_bits_t)),
+    mapped_size_(0),
+    all_rows_(double_rows_ >= 64 ? ~uint64_t(0)
+              : (uint64_t(1) << double_rows_) - 1),
+    changed_rows_(0), render_rows_(0),
+    lit_planes_(new std::atomic<uint32_t>[double_rows_]),
     shared_mapper_(mapper) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
@@ -309,8 +659,15 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     abort();
   }
   assert(parallel >= 1 && parallel <= 6);
-
-  bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+  assert(temporal_bits_ >= 0 && bitplanes + temporal_bits_ <= kMaxBitPlanes);
+
+  // In packed mode, clocking out reads one word ahead, so have a spare one.
+  bitplane_buffer_ = AllocateBitplaneBuffer(
+    buffer_size_ + sizeof(gpio_bits_t), hugepages, &mapped_size_);
+  bitplane_buffer_[double_rows_ * row_words_] = 0;
+  for (int row = 0; row < double_rows_; ++row) {
+    lit_planes_[row].store(PlaneRange(0));  // Until Clear() below.
+  }
 
   // If we're the first Framebuffer created, the shared PixelMapper is
   // still NULL, so create one.
@@ -320,22 +677,65 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
   //
   // Newly created PixelMappers then can just re-arrange PixelDesignators
   // from the parent PixelMapper opaquely without having to know the details.
-  if (*shared_mapper_ == NULL) {
+  // The mapper might also have been provided pre-made (e.g. from a cache
+  // file), so the expansion table is set up independently.
+  if (packed_) InitPackedExpansion(led_sequence);
+  if (*shared_mapper_ == NULL && packed_) {
+    // All words have the same layout of RGB triples, so a Fill() can
+    // write the same value everywhere. The LED sequence is dealt with
+    // when expanding.
+    // Each slot in a word has its own color bits.
+    ColorBits fill_bits;
+    ColorBits slot_bits[PixelDesignatorMap::kMaxColorBits];
+    assert(slots_per_word_ <= PixelDesignatorMap::kMaxColorBits);
+    for (int i = 0; i < slots_per_word_; ++i) {
+      ColorBits &s = slot_bits[i];
+      s.r_bit = gpio_bits_t(1) << (3 * i + 0);
+      s.g_bit = gpio_bits_t(1) << (3 * i + 1);
+      s.b_bit = gpio_bits_t(1) << (3 * i + 2);
+      s.mask = ~(s.r_bit | s.g_bit | s.b_bit);
+      fill_bits.r_bit |= s.r_bit;
+      fill_bits.g_bit |= s.g_bit;
+      fill_bits.b_bit |= s.b_bit;
+    }
+    *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits,
+                                             slot_bits, slots_per_word_);
+    for (int y = 0; y < height_; ++y) {
+      for (int x = 0; x < columns_; ++x) {
+        InitPackedDesignator(x, y, (*shared_mapper_)->get(x, y));
+      }
+    }
+  }
+  else if (*shared_mapper_ == NULL) {
     // Gather all the bits for given color for fast Fill()s and use the right
     // bits according to the led sequence
     const struct HardwareMapping &h = *hardware_mapping_;
     gpio_bits_t r = h.p0_r1 | h.p0_r2 | h.p1_r1 | h.p1_r2 | h.p2_r1 | h.p2_r2 | h.p3_r1 | h.p3_r2 | h.p4_r1 | h.p4_r2 | h.p5_r1 | h.p5_r2;
     gpio_bits_t g = h.p0_g1 | h.p0_g2 | h.p1_g1 | h.p1_g2 | h.p2_g1 | h.p2_g2 | h.p3_g1 | h.p3_g2 | h.p4_g1 | h.p4_g2 | h.p5_g1 | h.p5_g2;
     gpio_bits_t b = h.p0_b1 | h.p0_b2 | h.p1_b1 | h.p1_b2 | h.p2_b1 | h.p2_b2 | h.p3_b1 | h.p3_b2 | h.p4_b1 | h.p4_b2 | h.p5_b1 | h.p5_b2;
-    PixelDesignator fill_bits;
+    ColorBits fill_bits;
     fill_bits.r_bit = GetGpioFromLedSequence('R', led_sequence, r, g, b);
     fill_bits.g_bit = GetGpioFromLedSequence('G', led_sequence, r, g, b);
     fill_bits.b_bit = GetGpioFromLedSequence('B', led_sequence, r, g, b);
 
-    *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits);
+    // The bits per chain and sub-panel, so that the LED sequence is only
+    // looked up once, not for every pixel.
+    ColorBits sub_panel_bits[6 * 2];
+    for (int i = 0; i < 6 * 2; ++i) {
+      gpio_bits_t r, g, b;
+      GetChainColorBits(h, i / 2, i % 2, &r, &g, &b);
+      ColorBits &d = sub_panel_bits[i];
+      d.r_bit = GetGpioFromLedSequence('R', led_sequence, r, g, b);
+      d.g_bit = GetGpioFromLedSequence('G', led_sequence, r, g, b);
+      d.b_bit = GetGpioFromLedSequence('B', led_sequence, r, g, b);
+      d.mask = ~(d.r_bit | d.g_bit | d.b_bit);
+    }
+
+    *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits,
+                                             sub_panel_bits, 6 * 2);
     for (int y = 0; y < height_; ++y) {
       for (int x = 0; x < columns_; ++x) {
-        InitDefaultDesignator(x, y, led_sequence, (*shared_mapper_)->get(x, y));
+        InitDefaultDesignator(x, y, (*shared_mapper_)->get(x, y));
       }
     }
   }
@@ -344,7 +744,8 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
 }
 
 Framebuffer::~Framebuffer() {
-  delete [] bitplane_buffer_;
+  munmap(bitplane_buffer_, mapped_size_);
+  delete [] lit_planes_;
 }
 
 // TODO: this should also be parsed from some special formatted string, e.g.
@@ -393,6 +794,7 @@ Framebuffer::~Framebuffer() {
 }
 
 /* static */ void Framebuffer::InitGPIO(GPIO *io, int rows, int parallel,
+                                        int bitplanes,
                                         bool allow_hardware_pulsing,
                                         int pwm_lsb_nanoseconds,
                                         int dither_bits,
@@ -404,8 +806,6 @@ Framebuffer::~Framebuffer() {
   // Tell GPIO about all bits we intend to use.
   gpio_bits_t all_used_bits = 0;
 
-  all_used_bits |= h.output_enable | h.clock | h.strobe;
-
   all_used_bits |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
   if (parallel >= 2) {
     all_used_bits |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
@@ -423,6 +823,9 @@ Framebuffer::~Framebuffer() {
     all_used_bits |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
   }
 
+  sUsedColorBits = all_used_bits;
+  all_used_bits |= h.output_enable | h.clock | h.strobe;
+
   const int double_rows = rows / SUB_PANELS_;
   switch (row_address_type) {
   case 0:
@@ -454,17 +857,77 @@ Framebuffer::~Framebuffer() {
                                              is_some_adafruit_hat);
   assert(result == all_used_bits);  // Impl: all bits declared in gpio.cc ?
 
-  std::vector<int> bitplane_timings;
-  uint32_t timing_ns = pwm_lsb_nanoseconds;
-  for (int b = 0; b < kBitPlanes; ++b) {
-    bitplane_timings.push_back(timing_ns);
-    if (b >= dither_bits) timing_ns *= 2;
-  }
+  const std::vector<int> bitplane_timings
+    = ComputeBitplaneTimings(bitplanes, pwm_lsb_nanoseconds, dither_bits);
+  sBitplaneTimings = bitplane_timings;
+  sDithering = (dither_bits > 0);
+  sClockOutPlane = SelectClockOut(io->uses_64_bit(), io->slowdown(), 0);
+  sClockOutPackedPlane = SelectClockOut(io->uses_64_bit(), io->slowdown(),
+                                        parallel);
   sOutputEnablePulser = PinPulser::Create(io, h.output_enable,
                                           allow_hardware_pulsing,
                                           bitplane_timings);
 }
 
+/* static */ std::vector<int> Framebuffer::ComputeBitplaneTimings(
+  int bitplanes, int pwm_lsb_nanoseconds, int dither_bits) {
+  // The pwm_lsb_nanoseconds are for the lowest of the default bitplanes;
+  // additional planes below that get shorter.
+  std::vector<int> bitplane_timings;
+  const int lsb_plane = std::max(0, bitplanes - kDefaultBitPlanes);
+  double timing_ns = pwm_lsb_nanoseconds / (double)(1 << lsb_plane);
+  for (int b = 0; b < bitplanes; ++b) {
+    bitplane_timings.push_back(std::max(1L, lround(timing_ns)));
+    if (b >= dither_bits) timing_ns *= 2;
+  }
+  return bitplane_timings;
+}
+
+/* static */ void Framebuffer::SetBitplaneTimings(
+  const std::vector<int> &timings, int dither_bits) {
+  if (sOutputEnablePulser == NULL) return;
+  sOutputEnablePulser->WaitPulseFinished();  // Last pulse of previous frame.
+  sOutputEnablePulser->SetTimings(timings);
+  sBitplaneTimings = timings;
+  sDithering = (dither_bits > 0);
+}
+
+/* static */ void Framebuffer::SetOutputBrightness(uint8_t percent) {
+  if (sOutputEnablePulser == NULL) return;
+  if (percent < 1) percent = 1;
+  if (percent > 100) percent = 100;
+  sOutputEnablePulser->WaitPulseFinished();  // Last pulse of previous frame.
+  sOutputEnablePulser->SetPulseScale(percent);
+}
+
+/* static */ int Framebuffer::TakePulseOvershoot(uint32_t *total_us,
+                                                uint32_t *max_us) {
+  if (sOutputEnablePulser == NULL) {
+    *total_us = *max_us = 0;
+    return 0;
+  }
+  return sOutputEnablePulser->TakeSleepOvershoot(total_us, max_us);
+}
+
+/* static */ bool Framebuffer::WriteTraceVCD(const GPIOTrace &trace,
+                                            const char *filename) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  std::vector<GPIOTrace::Signal> signals = {
+    { h.output_enable, "oe" }, { h.clock, "clk" }, { h.strobe, "strobe" },
+    { h.a, "a" }, { h.b, "b" }, { h.c, "c" }, { h.d, "d" }, { h.e, "e" },
+  };
+  // The chains are laid out the same way in the mapping.
+  const gpio_bits_t *chain_bits = &h.p0_r1;
+  const char *const kColorNames[] = { "r1", "g1", "b1", "r2", "g2", "b2" };
+  for (int p = 0; p < h.max_parallel_chains; ++p) {
+    for (int c = 0; c < 6; ++c) {
+      signals.push_back({ chain_bits[6 * p + c],
+            "p" + std::to_string(p) + "_" + kColorNames[c] });
+    }
+  }
+  return trace.WriteVCD(filename, signals);
+}
+
 // NOTE: first version for panel initialization sequence, need to refine
 // until it is more clear how different panel types are initialized to be
 // able to abstract this more.
@@ -567,15 +1030,37 @@ static void InitFM6127(GPIO *io, const struct HardwareMapping &h, int columns) {
 }
 
 bool Framebuffer::SetPWMBits(uint8_t value) {
-  if (value < 1 || value > kBitPlanes)
+  if (value < 1 || value > bitplanes_)
     return false;
+  if (value > pwm_bits_) {
+    // Whatever the planes below the pwm bits still have is from some earlier
+    // content, which must not show through.
+    const int first = bitplanes_ - value;
+    const int end = bitplanes_ - pwm_bits_;
+    const uint32_t exposed = PlaneRange(first) & ~PlaneRange(end);
+    const ColorBits &fill = (*shared_mapper_)->GetFillColorBits();
+    const gpio_bits_t dark = inverse_color_
+      ? (fill.r_bit | fill.g_bit | fill.b_bit) : 0;
+    for (int row = 0; row < double_rows_; ++row) {
+      for (int v = 0; v < variants_; ++v) {
+        gpio_bits_t *plane = ValueAt(row, 0, first) + v * variant_words_;
+        std::fill(plane, plane + (end - first) * plane_words_, dark);
+      }
+      if (dark) {
+        lit_planes_[row].fetch_or(exposed, std::memory_order_relaxed);
+      } else {
+        lit_planes_[row].fetch_and(~exposed, std::memory_order_relaxed);
+      }
+    }
+    MarkAllChanged();
+  }
   pwm_bits_ = value;
   return true;
 }
 
 inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
-  return &bitplane_buffer_[ double_row * (columns_ * kBitPlanes)
-                            + bit * columns_
+  return &bitplane_buffer_[ double_row * row_words_
+                            + bit * plane_words_
                             + column ];
 }
 
@@ -584,14 +1069,18 @@ void Framebuffer::Clear() {
     Fill(0, 0, 0);
   } else  {
     // Cheaper.
-    memset(bitplane_buffer_, 0,
-           sizeof(*bitplane_buffer_) * double_rows_ * columns_ * kBitPlanes);
+    memset(bitplane_buffer_, 0, buffer_size_);
+    MarkAllChanged();
+    for (int row = 0; row < double_rows_; ++row) {
+      lit_planes_[row].store(0, std::memory_order_relaxed);
+    }
   }
 }
 
 // Do CIE1931 luminance correction and scale to output bitplanes
-static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness) {
-  float out_factor = ((1 << internal::Framebuffer::kBitPlanes) - 1);
+static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness,
+                                  int bitplanes) {
+  float out_factor = ((1 << bitplanes) - 1);
   float v = (float) c * brightness / 255.0;
   return roundf(out_factor * ((v <= 8) ? v / 902.3 : pow((v + 16) / 116.0, 3)));
 }
@@ -599,27 +1088,36 @@ static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness) {
 struct ColorLookup {
   uint16_t color[256];
 };
-static ColorLookup *CreateLuminanceCIE1931LookupTable() {
-  ColorLookup *for_brightness = new ColorLookup[100];
-  for (int c = 0; c < 256; ++c)
-    for (int b = 0; b < 100; ++b)
-      for_brightness[b].color[c] = luminance_cie1931(c, b + 1);
-
-  return for_brightness;
+/* static */ const ColorLookup *
+Framebuffer::GetLuminanceCIE1931LookupTable(int bitplanes) {
+  // One table per number of bitplanes, created on first use. Canvases might
+  // be created from several threads, e.g. by a canvas pool.
+  static ColorLookup *lookup[kMaxBitPlanes + 1] = {};
+  static Mutex lookup_mutex;
+  MutexLock l(&lookup_mutex);
+  if (lookup[bitplanes] == NULL) {
+    ColorLookup *for_brightness = new ColorLookup[100];
+    for (int c = 0; c < 256; ++c)
+      for (int b = 0; b < 100; ++b)
+        for_brightness[b].color[c] = luminance_cie1931(c, b + 1, bitplanes);
+    lookup[bitplanes] = for_brightness;
+  }
+  return lookup[bitplanes];
 }
 
-static inline uint16_t CIEMapColor(uint8_t brightness, uint8_t c) {
-  static ColorLookup *luminance_lookup = CreateLuminanceCIE1931LookupTable();
+static inline uint16_t CIEMapColor(const ColorLookup *luminance_lookup,
+                                   uint8_t brightness, uint8_t c) {
   return luminance_lookup[brightness - 1].color[c];
 }
 
 // Non luminance correction. TODO: consider getting rid of this.
-static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
+static inline uint16_t DirectMapColor(int bitplanes,
+                                      uint8_t brightness, uint8_t c) {
   // simple scale down the color value
   c = c * brightness / 100;
 
   // shift to be left aligned with top-most bits.
-  constexpr int shift = internal::Framebuffer::kBitPlanes - 8;
+  const int shift = bitplanes - 8;
   return (shift > 0) ? (c << shift) : (c >> -shift);
 }
 
@@ -627,81 +1125,352 @@ inline void Framebuffer::MapColors(
   uint8_t r, uint8_t g, uint8_t b,
   uint16_t *red, uint16_t *green, uint16_t *blue) {
 
-  if (do_luminance_correct_) {
-    *red   = CIEMapColor(brightness_, r);
-    *green = CIEMapColor(brightness_, g);
-    *blue  = CIEMapColor(brightness_, b);
+  if (calibration_) {
+    calibration_->Map(do_luminance_correct_, brightness_, r, g, b,
+                      red, green, blue);
+  } else if (do_luminance_correct_) {
+    *red   = CIEMapColor(luminance_lookup_, brightness_, r);
+    *green = CIEMapColor(luminance_lookup_, brightness_, g);
+    *blue  = CIEMapColor(luminance_lookup_, brightness_, b);
   } else {
-    *red   = DirectMapColor(brightness_, r);
-    *green = DirectMapColor(brightness_, g);
-    *blue  = DirectMapColor(brightness_, b);
+    const int precision = bitplanes_ + temporal_bits_;
+    *red   = DirectMapColor(precision, brightness_, r);
+    *green = DirectMapColor(precision, brightness_, g);
+    *blue  = DirectMapColor(precision, brightness_, b);
   }
 
-  if (inverse_color_) {
+  if (inverse_color_ && temporal_bits_ == 0) {  // Otherwise in ShownValue().
     *red = ~(*red);
     *green = ~(*green);
     *blue = ~(*blue);
   }
 }
 
-void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
-  uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
-  const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
-
-  for (int b = kBitPlanes - pwm_bits_; b < kBitPlanes; ++b) {
-    uint16_t mask = 1 << b;
-    gpio_bits_t plane_bits = 0;
-    plane_bits |= ((red & mask) == mask)   ? fill.r_bit : 0;
-    plane_bits |= ((green & mask) == mask) ? fill.g_bit : 0;
-    plane_bits |= ((blue & mask) == mask)  ? fill.b_bit : 0;
+inline uint16_t Framebuffer::ShownValue(uint16_t value, int variant) const {
+  if (temporal_bits_ == 0) return value;  // MapColors() did everything.
+  // The variants round up for a different share of the dropped low bits,
+  // so that on average exactly these are shown.
+  const uint16_t shown = std::min((value + variant) >> temporal_bits_,
+                                  (1 << bitplanes_) - 1);
+  return inverse_color_ ? ~shown : shown;
+}
 
-    for (int row = 0; row < double_rows_; ++row) {
-      gpio_bits_t *row_data = ValueAt(row, 0, b);
-      for (int col = 0; col < columns_; ++col) {
-        *row_data++ = plane_bits;
+void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
+  uint16_t mapped_red, mapped_green, mapped_blue;
+  MapColors(r, g, b, &mapped_red, &mapped_green, &mapped_blue);
+  const ColorBits &fill = (*shared_mapper_)->GetFillColorBits();
+
+  // Bitplanes below the pwm bits keep what they had.
+  const uint32_t range = PlaneRange(bitplanes_ - pwm_bits_);
+  uint32_t lit = 0;
+  for (int v = 0; v < variants_; ++v) {
+    const uint16_t red = ShownValue(mapped_red, v);
+    const uint16_t green = ShownValue(mapped_green, v);
+    const uint16_t blue = ShownValue(mapped_blue, v);
+    lit |= (red | green | blue) & range;
+
+    for (int b = bitplanes_ - pwm_bits_; b < bitplanes_; ++b) {
+      uint16_t mask = 1 << b;
+      gpio_bits_t plane_bits = 0;
+      plane_bits |= ((red & mask) == mask)   ? fill.r_bit : 0;
+      plane_bits |= ((green & mask) == mask) ? fill.g_bit : 0;
+      plane_bits |= ((blue & mask) == mask)  ? fill.b_bit : 0;
+
+      for (int row = 0; row < double_rows_; ++row) {
+        gpio_bits_t *row_data = ValueAt(row, 0, b) + v * variant_words_;
+        for (int col = 0; col < plane_words_; ++col) {
+          *row_data++ = plane_bits;
+        }
       }
     }
   }
+  for (int row = 0; row < double_rows_; ++row) {
+    const uint32_t kept = lit_planes_[row].load(std::memory_order_relaxed);
+    lit_planes_[row].store((kept & ~range) | lit, std::memory_order_relaxed);
+  }
+  MarkAllChanged();
 }
 
 int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
 void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const PixelDesignator *designator = map->get(x, y);
   if (designator == NULL) return;
   const long pos = designator->gpio_word;
   if (pos < 0) return;  // non-used pixel marker.
+  const ColorBits &color_bits = map->color_bits(*designator);
+
+  uint16_t mapped_red, mapped_green, mapped_blue;
+  MapColors(r, g, b, &mapped_red, &mapped_green, &mapped_blue);
+  MarkChanged(pos);
+
+  const int min_bit_plane = bitplanes_ - pwm_bits_;
+  const gpio_bits_t r_bits = color_bits.r_bit;
+  const gpio_bits_t g_bits = color_bits.g_bit;
+  const gpio_bits_t b_bits = color_bits.b_bit;
+  const gpio_bits_t designator_mask = color_bits.mask;
+  const uint32_t end_mask = 1 << bitplanes_;
+  for (int v = 0; v < variants_; ++v) {
+    const uint16_t red = ShownValue(mapped_red, v);
+    const uint16_t green = ShownValue(mapped_green, v);
+    const uint16_t blue = ShownValue(mapped_blue, v);
+    MarkLit(pos, (red | green | blue) & PlaneRange(min_bit_plane));
+    gpio_bits_t *bits = bitplane_buffer_ + pos + v * variant_words_;
+    bits += (plane_words_ * min_bit_plane);
+    for (uint32_t mask = 1<<min_bit_plane; mask != end_mask; mask <<=1 ) {
+      gpio_bits_t color_bits = 0;
+      if (red & mask)   color_bits |= r_bits;
+      if (green & mask) color_bits |= g_bits;
+      if (blue & mask)  color_bits |= b_bits;
+      *bits = (*bits & designator_mask) | color_bits;
+      bits += plane_words_;
+    }
+  }
+}
 
-  uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
+// Number of pixels of a span we map colors for in one go.
+static constexpr int kSpanChunk = 64;
+
+// Write "count" pixels whose designators are consecutive words in the same
+// bitplane row and share the same color bits. We go bitplane by bitplane, so
+// all writes for one plane are to consecutive memory. The inner loop is
+// branch-free, which allows the compiler to vectorize it.
+static inline void WriteSpanBitplanes(gpio_bits_t *bits, int columns,
+                                      int min_bit_plane, int max_bit_plane,
+                                      const ColorBits &d, int count,
+                                      const uint16_t *red,
+                                      const uint16_t *green,
+                                      const uint16_t *blue) {
+  const gpio_bits_t r_bits = d.r_bit;
+  const gpio_bits_t g_bits = d.g_bit;
+  const gpio_bits_t b_bits = d.b_bit;
+  const gpio_bits_t designator_mask = d.mask;
+  bits += columns * min_bit_plane;
+  for (int b = min_bit_plane; b < max_bit_plane; ++b) {
+    int i = 0;
+#ifdef USE_NEON_SPAN_KERNEL
+    // Eight pixels at a time: test the plane bit of each color, widen the
+    // resulting 16 bit all-ones/all-zero lanes to 32 bit (sign extension)
+    // and use them to select the GPIO bits of the color.
+    const uint16x8_t plane_bit = vdupq_n_u16(1 << b);
+    const uint32x4_t r_bits_v = vdupq_n_u32(r_bits);
+    const uint32x4_t g_bits_v = vdupq_n_u32(g_bits);
+    const uint32x4_t b_bits_v = vdupq_n_u32(b_bits);
+    const uint32x4_t mask_v = vdupq_n_u32(designator_mask);
+    for (/**/; i + 8 <= count; i += 8) {
+      const int16x8_t r_set
+        = vreinterpretq_s16_u16(vtstq_u16(vld1q_u16(red + i), plane_bit));
+      const int16x8_t g_set
+        = vreinterpretq_s16_u16(vtstq_u16(vld1q_u16(green + i), plane_bit));
+      const int16x8_t b_set
+        = vreinterpretq_s16_u16(vtstq_u16(vld1q_u16(blue + i), plane_bit));
+
+      uint32x4_t low = vandq_u32(vld1q_u32(bits + i), mask_v);
+      low = vorrq_u32(low, vandq_u32(vreinterpretq_u32_s32(
+                                       vmovl_s16(vget_low_s16(r_set))),
+                                     r_bits_v));
+      low = vorrq_u32(low, vandq_u32(vreinterpretq_u32_s32(
+                                       vmovl_s16(vget_low_s16(g_set))),
+                                     g_bits_v));
+      low = vorrq_u32(low, vandq_u32(vreinterpretq_u32_s32(
+                                       vmovl_s16(vget_low_s16(b_set))),
+                                     b_bits_v));
+      vst1q_u32(bits + i, low);
+
+      uint32x4_t high = vandq_u32(vld1q_u32(bits + i + 4), mask_v);
+      high = vorrq_u32(high, vandq_u32(vreinterpretq_u32_s32(
+                                         vmovl_s16(vget_high_s16(r_set))),
+                                       r_bits_v));
+      high = vorrq_u32(high, vandq_u32(vreinterpretq_u32_s32(
+                                         vmovl_s16(vget_high_s16(g_set))),
+                                       g_bits_v));
+      high = vorrq_u32(high, vandq_u32(vreinterpretq_u32_s32(
+                                         vmovl_s16(vget_high_s16(b_set))),
+                                       b_bits_v));
+      vst1q_u32(bits + i + 4, high);
+    }
+#endif
+    for (/**/; i < count; ++i) {
+      const gpio_bits_t color_bits
+        = (-static_cast<gpio_bits_t>((red[i] >> b) & 1) & r_bits)
+        | (-static_cast<gpio_bits_t>((green[i] >> b) & 1) & g_bits)
+        | (-static_cast<gpio_bits_t>((blue[i] >> b) & 1) & b_bits);
+      bits[i] = (bits[i] & designator_mask) | color_bits;
+    }
+    bits += columns;
+  }
+}
 
-  gpio_bits_t *bits = bitplane_buffer_ + pos;
-  const int min_bit_plane = kBitPlanes - pwm_bits_;
-  bits += (columns_ * min_bit_plane);
-  const gpio_bits_t r_bits = designator->r_bit;
-  const gpio_bits_t g_bits = designator->g_bit;
-  const gpio_bits_t b_bits = designator->b_bit;
-  const gpio_bits_t designator_mask = designator->mask;
-  for (uint16_t mask = 1<<min_bit_plane; mask != 1<<kBitPlanes; mask <<=1 ) {
+// Like WriteSpanBitplanes(), but all pixels have the same color: the bits
+// are determined once per bitplane.
+static inline void WriteSolidBitplanes(gpio_bits_t *bits, int columns,
+                                       int min_bit_plane, int max_bit_plane,
+                                       const ColorBits &d, int count,
+                                       uint16_t red, uint16_t green,
+                                       uint16_t blue) {
+  bits += columns * min_bit_plane;
+  for (int b = min_bit_plane; b < max_bit_plane; ++b) {
     gpio_bits_t color_bits = 0;
-    if (red & mask)   color_bits |= r_bits;
-    if (green & mask) color_bits |= g_bits;
-    if (blue & mask)  color_bits |= b_bits;
-    *bits = (*bits & designator_mask) | color_bits;
-    bits += columns_;
+    if ((red >> b) & 1)   color_bits |= d.r_bit;
+    if ((green >> b) & 1) color_bits |= d.g_bit;
+    if ((blue >> b) & 1)  color_bits |= d.b_bit;
+    for (int i = 0; i < count; ++i) {
+      bits[i] = (bits[i] & d.mask) | color_bits;
+    }
+    bits += columns;
+  }
+}
+
+inline void Framebuffer::MapSpanColors(const Color *colors, int count,
+                                       uint16_t *red, uint16_t *green,
+                                       uint16_t *blue) {
+  // Images often have runs of the same color, so only map on change.
+  MapColors(colors[0].r, colors[0].g, colors[0].b, &red[0], &green[0], &blue[0]);
+  for (int i = 1; i < count; ++i) {
+    const Color &c = colors[i];
+    const Color &prev = colors[i-1];
+    if (c.r == prev.r && c.g == prev.g && c.b == prev.b) {
+      red[i] = red[i-1];
+      green[i] = green[i-1];
+      blue[i] = blue[i-1];
+    } else {
+      MapColors(c.r, c.g, c.b, &red[i], &green[i], &blue[i]);
+    }
+  }
+}
+
+void Framebuffer::SetPixelSpan(int x, int y, int count, const Color *colors) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const PixelDesignator *designators = map->get(x, y);
+  const int min_bit_plane = bitplanes_ - pwm_bits_;
+  uint16_t red[kSpanChunk], green[kSpanChunk], blue[kSpanChunk];
+  while (count > 0) {
+    const int chunk = std::min(count, kSpanChunk);
+    MapSpanColors(colors, chunk, red, green, blue);
+    for (int i = 0; i < chunk; /**/) {
+      const PixelDesignator &d = designators[i];
+      if (d.gpio_word < 0) {  // non-used pixel marker.
+        ++i;
+        continue;
+      }
+      // With most mappings, neighboring pixels are neighboring words in the
+      // framebuffer; collect as many of these as we can to write them at once.
+      int run = 1;
+      while (i + run < chunk) {
+        const PixelDesignator &next = designators[i + run];
+        if (next.gpio_word != d.gpio_word + run
+            || next.color_bits != d.color_bits)
+          break;
+        ++run;
+      }
+      MarkChanged(d.gpio_word);
+      if (variants_ == 1) {
+        uint32_t planes = 0;
+        for (int j = i; j < i + run; ++j) planes |= red[j] | green[j] | blue[j];
+        MarkLit(d.gpio_word, planes & PlaneRange(min_bit_plane));
+        WriteSpanBitplanes(bitplane_buffer_ + d.gpio_word, plane_words_,
+                           min_bit_plane, bitplanes_, map->color_bits(d), run,
+                           red + i, green + i, blue + i);
+      } else {
+        uint16_t v_red[kSpanChunk], v_green[kSpanChunk], v_blue[kSpanChunk];
+        for (int v = 0; v < variants_; ++v) {
+          uint32_t planes = 0;
+          for (int j = 0; j < run; ++j) {
+            v_red[j] = ShownValue(red[i + j], v);
+            v_green[j] = ShownValue(green[i + j], v);
+            v_blue[j] = ShownValue(blue[i + j], v);
+            planes |= v_red[j] | v_green[j] | v_blue[j];
+          }
+          MarkLit(d.gpio_word, planes & PlaneRange(min_bit_plane));
+          WriteSpanBitplanes(bitplane_buffer_ + d.gpio_word + v * variant_words_,
+                             plane_words_, min_bit_plane, bitplanes_,
+                             map->color_bits(d), run, v_red, v_green, v_blue);
+        }
+      }
+      i += run;
+    }
+    designators += chunk;
+    colors += chunk;
+    count -= chunk;
+  }
+}
+
+void Framebuffer::FillPixelSpan(int x, int y, int count,
+                                uint16_t red, uint16_t green, uint16_t blue) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const PixelDesignator *designators = map->get(x, y);
+  const int min_bit_plane = bitplanes_ - pwm_bits_;
+  for (int i = 0; i < count; /**/) {
+    const PixelDesignator &d = designators[i];
+    if (d.gpio_word < 0) {  // non-used pixel marker.
+      ++i;
+      continue;
+    }
+    int run = 1;  // Consecutive words, see SetPixelSpan()
+    while (i + run < count) {
+      const PixelDesignator &next = designators[i + run];
+      if (next.gpio_word != d.gpio_word + run
+          || next.color_bits != d.color_bits)
+        break;
+      ++run;
+    }
+    MarkChanged(d.gpio_word);
+    for (int v = 0; v < variants_; ++v) {
+      const uint16_t v_red = ShownValue(red, v);
+      const uint16_t v_green = ShownValue(green, v);
+      const uint16_t v_blue = ShownValue(blue, v);
+      MarkLit(d.gpio_word,
+              (v_red | v_green | v_blue) & PlaneRange(min_bit_plane));
+      WriteSolidBitplanes(bitplane_buffer_ + d.gpio_word + v * variant_words_,
+                          plane_words_, min_bit_plane, bitplanes_,
+                          map->color_bits(d), run, v_red, v_green, v_blue);
+    }
+    i += run;
+  }
+}
+
+void Framebuffer::FillRect(int x, int y, int width, int height,
+                           uint8_t r, uint8_t g, uint8_t b) {
+  const int x_start = std::max(x, 0);
+  const int x_end = std::min(x + width, (*shared_mapper_)->width());
+  const int y_start = std::max(y, 0);
+  const int y_end = std::min(y + height, (*shared_mapper_)->height());
+  if (x_start >= x_end) return;
+  uint16_t red, green, blue;
+  MapColors(r, g, b, &red, &green, &blue);
+  for (int row = y_start; row < y_end; ++row) {
+    FillPixelSpan(x_start, row, x_end - x_start, red, green, blue);
   }
 }
 
 void Framebuffer::SetPixels(int x, int y, int width, int height, Color *colors) {
+  // Clip to the visible area, then handle each remaining row as one span.
+  const int map_width = (*shared_mapper_)->width();
+  const int map_height = (*shared_mapper_)->height();
+  const int x_start = std::max(x, 0);
+  const int x_end = std::min(x + width, map_width);
+  if (x_start >= x_end) return;
   for (int iy = 0; iy < height; ++iy) {
-    for (int ix = 0; ix < width; ++ix) {
-      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
-      ++colors;
-    }
+    const int row = y + iy;
+    if (row < 0) continue;
+    if (row >= map_height) break;
+    SetPixelSpan(x_start, row, x_end - x_start,
+                 colors + iy * width + (x_start - x));
   }
 }
+
+void Framebuffer::SetFrameRGB(const uint8_t *rgb, int stride) {
+  // Color is just three bytes r, g, b, so we can take the image rows as is.
+  static_assert(sizeof(Color) == 3, "Color expected to be packed RGB");
+  const int map_width = (*shared_mapper_)->width();
+  const int map_height = (*shared_mapper_)->height();
+  for (int y = 0; y < map_height; ++y, rgb += stride) {
+    SetPixelSpan(0, y, map_width, reinterpret_cast<const Color*>(rgb));
+  }
+}
+
 // Strange LED-mappings such as RBG or so are handled here.
 gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
                                                 const char *led_sequence,
@@ -723,151 +1492,260 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
   return default_r;  // String too long, should've been caught earlier.
 }
 
-void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
-                                        PixelDesignator *d) {
-  const struct HardwareMapping &h = *hardware_mapping_;
+void Framebuffer::InitDefaultDesignator(int x, int y, PixelDesignator *d) {
   gpio_bits_t *bits = ValueAt(y % double_rows_, x, 0);
+  const int chain = std::min(y / rows_, 5);
+  const int sub_panel = (y - chain * rows_) < double_rows_ ? 0 : 1;
+  d->color_bits = chain * 2 + sub_panel;
   d->gpio_word = bits - bitplane_buffer_;
-  d->r_bit = d->g_bit = d->b_bit = 0;
-  if (y < rows_) {
-    if (y < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+}
+
+void Framebuffer::InitPackedDesignator(int x, int y, PixelDesignator *d) {
+  const int chain = y / rows_;
+  const int sub_panel = (y % rows_) < double_rows_ ? 0 : 1;
+  const int slot = x * 2 * parallel_ + chain * 2 + sub_panel;
+  d->gpio_word = ValueAt(y % double_rows_, slot / slots_per_word_, 0)
+    - bitplane_buffer_;
+  d->color_bits = slot % slots_per_word_;
+}
+
+void Framebuffer::InitPackedExpansion(const char *seq) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  for (int slot = 0; slot < 2 * parallel_; ++slot) {
+    gpio_bits_t r, g, b;
+    GetChainColorBits(h, slot / 2, slot % 2, &r, &g, &b);
+    const gpio_bits_t red = GetGpioFromLedSequence('R', seq, r, g, b);
+    const gpio_bits_t green = GetGpioFromLedSequence('G', seq, r, g, b);
+    const gpio_bits_t blue = GetGpioFromLedSequence('B', seq, r, g, b);
+    for (int rgb = 0; rgb < 8; ++rgb) {
+      packed_expand_[slot][rgb] = ((rgb & 1) ? red : 0)
+        | ((rgb & 2) ? green : 0)
+        | ((rgb & 4) ? blue : 0);
     }
   }
-  else if (y >= rows_ && y < 2 * rows_) {
-    if (y - rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+}
+
+void Framebuffer::Serialize(const char **data, size_t *len) const {
+  *data = reinterpret_cast<const char*>(bitplane_buffer_);
+  *len = buffer_size_;
+}
+
+void Framebuffer::SerializeRow(int double_row,
+                               const char **data, size_t *len) const {
+  assert(double_row >= 0 && double_row < double_rows_);
+  *data = reinterpret_cast<const char*>(bitplane_buffer_
+                                        + double_row * row_words_);
+  *len = row_words_ * sizeof(gpio_bits_t);
+}
+
+bool Framebuffer::IsValidMap(PixelDesignatorMap *map) const {
+  const long buffer_words = (long)double_rows_ * row_words_;
+  for (int y = 0; y < map->height(); ++y) {
+    for (int x = 0; x < map->width(); ++x) {
+      // Designators point to the first bitplane of the first variant.
+      const long pos = map->get(x, y)->gpio_word;
+      if (pos < 0) continue;
+      if (pos >= buffer_words || pos % row_words_ >= plane_words_)
+        return false;
     }
   }
-  else if (y >= 2*rows_ && y < 3 * rows_) {
-    if (y - 2*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+  return true;
+}
+
+// Union-find root, with path halving.
+static int FindSetRoot(std::vector<int> *parent, int i) {
+  std::vector<int> &p = *parent;
+  while (p[i] != i) i = p[i] = p[p[i]];
+  return i;
+}
+
+void Framebuffer::GetIndependentRowBands(
+  int band_height, std::vector<std::vector<int> > *groups) const {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  MutexLock l(&map->row_bands_mutex_);
+  for (const PixelDesignatorMap::RowBands &cached : map->row_bands_) {
+    if (cached.band_height == band_height && cached.row_words == row_words_) {
+      *groups = cached.groups;
+      return;
     }
   }
-  else if (y >= 3*rows_ && y < 4 * rows_) {
-    if (y - 3*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p3_r2, h.p3_g2, h.p3_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p3_r2, h.p3_g2, h.p3_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+
+  groups->clear();
+  const int bands = (map->height() + band_height - 1) / band_height;
+
+  // Union-find over the bands: bands touching the same double row are
+  // joined into the same set.
+  std::vector<int> parent(bands);
+  for (int i = 0; i < bands; ++i) parent[i] = i;
+  std::vector<int> row_owner(double_rows_, -1);
+  std::vector<bool> has_pixels(bands, false);
+  for (int y = 0; y < map->height(); ++y) {
+    const int band = y / band_height;
+    for (int x = 0; x < map->width(); ++x) {
+      const long pos = map->get(x, y)->gpio_word;
+      if (pos < 0) continue;
+      has_pixels[band] = true;
+      int &owner = row_owner[pos / row_words_];
+      if (owner < 0) {
+        owner = band;
+      } else {
+        parent[FindSetRoot(&parent, band)] = FindSetRoot(&parent, owner);
+      }
     }
   }
-  else if (y >= 4*rows_ && y < 5 * rows_){
-    if (y - 4*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-    }
 
-  }
-  else {
-    if (y - 5*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-    } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p5_r2, h.p5_g2, h.p5_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p5_r2, h.p5_g2, h.p5_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+  std::vector<int> group_of_root(bands, -1);
+  for (int band = 0; band < bands; ++band) {
+    if (!has_pixels[band]) continue;
+    int &group = group_of_root[FindSetRoot(&parent, band)];
+    if (group < 0) {
+      group = groups->size();
+      groups->push_back(std::vector<int>());
     }
+    (*groups)[group].push_back(band);
   }
-
-  d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
-}
-
-void Framebuffer::Serialize(const char **data, size_t *len) const {
-  *data = reinterpret_cast<const char*>(bitplane_buffer_);
-  *len = buffer_size_;
+  const PixelDesignatorMap::RowBands computed = { band_height, row_words_,
+                                                  *groups };
+  map->row_bands_.push_back(computed);
 }
 
 bool Framebuffer::Deserialize(const char *data, size_t len) {
   if (len != buffer_size_) return false;
   memcpy(bitplane_buffer_, data, len);
+  MarkAllChanged();
+  ComputeLitPlanes();
   return true;
 }
 
+void Framebuffer::ComputeLitPlanes() {
+  for (int row = 0; row < double_rows_; ++row) {
+    uint32_t planes = 0;
+    for (int b = 0; b < bitplanes_; ++b) {
+      gpio_bits_t any = 0;
+      for (int v = 0; v < variants_; ++v) {
+        const gpio_bits_t *plane = ValueAt(row, 0, b) + v * variant_words_;
+        for (int col = 0; col < plane_words_; ++col) any |= plane[col];
+      }
+      if (any) planes |= 1u << b;
+    }
+    lit_planes_[row].store(planes, std::memory_order_relaxed);
+  }
+}
+
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
   memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
+  MarkAllChanged();
+  for (int row = 0; row < double_rows_; ++row) {
+    lit_planes_[row].store(other->lit_planes_[row].load());
+  }
 }
 
-void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
-  const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
-  color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
-  if (parallel_ >= 2) {
-    color_clk_mask |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
+void Framebuffer::CopyChangedFrom(const Framebuffer *other) {
+  if (other == this) return;
+  const uint64_t changed = other->changed_rows_.load();
+  render_rows_.fetch_or(changed);
+  for (int row = 0; row < double_rows_; ++row) {
+    if (changed & (uint64_t(1) << row))
+      lit_planes_[row].store(other->lit_planes_[row].load());
   }
-  if (parallel_ >= 3) {
-    color_clk_mask |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
+  if (changed == all_rows_) {
+    memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
+    return;
   }
-  if (parallel_ >= 4) {
-    color_clk_mask |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
+  const size_t row_bytes = row_words_ * sizeof(gpio_bits_t);
+  for (int row = 0; row < double_rows_; ++row) {
+    if (!(changed & (uint64_t(1) << row))) continue;
+    // Neighboring changed rows are copied in one go.
+    int end = row + 1;
+    while (end < double_rows_ && (changed & (uint64_t(1) << end))) ++end;
+    memcpy(bitplane_buffer_ + row * row_words_,
+           other->bitplane_buffer_ + row * row_words_,
+           (end - row) * row_bytes);
+    row = end;
+  }
+}
+
+int Framebuffer::ScanRow(int row_loop) const {
+  switch (scan_mode_) {
+  case 0:  // progressive
+  default:
+    return row_loop;
+
+  case 1: {  // interlaced
+    const int half_double = double_rows_/2;
+    return ((row_loop < half_double)
+            ? (row_loop << 1)
+            : ((row_loop - half_double) << 1) + 1);
   }
-  if (parallel_ >= 5) {
-    color_clk_mask |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
   }
-  if (parallel_ >= 6) {
-    color_clk_mask |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
+}
+
+inline gpio_bits_t Framebuffer::ExpandPacked(const gpio_bits_t **row_data,
+                                             gpio_bits_t *triples,
+                                             int *triples_left) const {
+  const int slots_per_column = 2 * parallel_;
+  gpio_bits_t out = 0;
+  for (int slot = 0; slot < slots_per_column; ++slot) {
+    out |= packed_expand_[slot][*triples & 0x07];
+    *triples >>= 3;
+    if (--*triples_left == 0) {
+      *triples = *(*row_data)++;
+      *triples_left = slots_per_word_;
+    }
   }
+  return out;
+}
 
-  color_clk_mask |= h.clock;
+void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit, unsigned variant) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  const gpio_bits_t color_mask = sUsedColorBits;
+  const gpio_bits_t color_clk_mask = color_mask | h.clock;  // While clocking.
+  const ClockOutFunction clock_out = packed_
+    ? sClockOutPackedPlane : sClockOutPlane;
 
   // Depending if we do dithering, we might not always show the lowest bits.
-  const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
-
-  const uint8_t half_double = double_rows_/2;
-  for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
-    uint8_t d_row;
-    switch (scan_mode_) {
-    case 0:  // progressive
-    default:
-      d_row = row_loop;
-      break;
+  const int start_bit = std::max(pwm_low_bit, bitplanes_ - pwm_bits_);
+  const int variant_offset = (variant % variants_) * variant_words_;
 
-    case 1:  // interlaced
-      d_row = ((row_loop < half_double)
-               ? (row_loop << 1)
-               : ((row_loop - half_double) << 1) + 1);
-    }
+  // If the last data clocked in was black, the shift registers of the panels
+  // still hold it; black bitplanes then only need to be strobed and shown.
+  bool shifted_black = false;
+
+  for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+    const int d_row = ScanRow(row_loop);
+    const uint32_t lit = lit_planes_[d_row].load(std::memory_order_relaxed);
 
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
-    for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+    for (int b = start_bit; b < bitplanes_; ++b) {
+      const gpio_bits_t *row_data = ValueAt(d_row, 0, b) + variant_offset;
+      const bool black = !(lit & (1u << b));
       // While the output enable is still on, we can already clock in the next
       // data.
-      for (int col = 0; col < columns_; ++col) {
-        const gpio_bits_t &out = *row_data++;
-        io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
-        io->SetBits(h.clock);               // Rising edge: clock color in.
+      if (black && shifted_black) {
+        // Nothing to clock in.
+      } else if (clock_out) {
+        clock_out(io, row_data, columns_, slots_per_word_, packed_expand_,
+                  color_mask, h.clock);
+      } else if (packed_) {
+        gpio_bits_t triples = *row_data++;
+        int triples_left = slots_per_word_;
+        for (int col = 0; col < columns_; ++col) {
+          const gpio_bits_t out = ExpandPacked(&row_data, &triples,
+                                               &triples_left);
+          io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
+          io->SetBits(h.clock);               // Rising edge: clock color in.
+        }
+      } else {
+        for (int col = 0; col < columns_; ++col) {
+          const gpio_bits_t &out = *row_data++;
+          io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
+          io->SetBits(h.clock);               // Rising edge: clock color in.
+        }
       }
       io->ClearBits(color_clk_mask);    // clock back to normal.
+      shifted_black = black;
 
       // OE of the previous row-data must be finished before strobe.
       sOutputEnablePulser->WaitPulseFinished();
@@ -883,5 +1761,73 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
     }
   }
 }
+
+bool Framebuffer::LockMemory() const {
+  return mlock(bitplane_buffer_, mapped_size_) == 0
+    && mlock(lit_planes_, double_rows_ * sizeof(*lit_planes_)) == 0;
+}
+
+DMAOutput *Framebuffer::CreateDMAOutput() const {
+  if (sOutputEnablePulser == NULL || !sOutputEnablePulser->IsHardwareBased()) {
+    fprintf(stderr, "DMA output needs the hardware pulse generator; "
+            "output enable needs to be on GPIO 12 or 18 "
+            "(--led-no-hardware-pulse not given).\n");
+    return NULL;
+  }
+  if (sDithering) {
+    fprintf(stderr, "DMA output does not support --led-pwm-dither-bits.\n");
+    return NULL;
+  }
+  std::vector<int> row_sequence;
+  std::vector<gpio_bits_t> row_address(double_rows_);
+  for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+    row_sequence.push_back(ScanRow(row_loop));
+    if (!row_setter_->GetDirectRowAddress(row_loop, &row_address[row_loop])) {
+      fprintf(stderr, "DMA output only supports --led-row-addr-type=0.\n");
+      return NULL;
+    }
+  }
+  return DMAOutput::Create(double_rows_, bitplanes_, columns_,
+                           row_sequence, row_address,
+                           row_setter_->need_bits(),
+                           hardware_mapping_->strobe, sBitplaneTimings);
+}
+
+void Framebuffer::RenderToDMA(DMAOutput *dma, uint64_t rows) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  const gpio_bits_t color_mask = sUsedColorBits;
+  const int start_bit = bitplanes_ - pwm_bits_;
+  for (int d_row = 0; d_row < double_rows_; ++d_row) {
+    if (!(rows & (uint64_t(1) << d_row))) continue;
+    for (int b = start_bit; b < bitplanes_; ++b) {
+      const gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+      DMAOutput::GPIORecord *record = dma->ColumnRecords(d_row, b);
+      gpio_bits_t triples = 0;
+      int triples_left = 0;
+      if (packed_) {
+        triples = *row_data++;
+        triples_left = slots_per_word_;
+      }
+      for (int col = 0; col < columns_; ++col) {
+        const gpio_bits_t out = packed_
+          ? ExpandPacked(&row_data, &triples, &triples_left)
+          : *row_data++;
+        // Same as DumpToMatrix(): colors with clock low, then rising edge.
+        const uint64_t set = out & color_mask;
+        const uint64_t clr = (~out & color_mask) | h.clock;
+        record->set[0] = set & 0xFFFFFFFF;
+        record->set[1] = set >> 32;
+        record->clr[0] = clr & 0xFFFFFFFF;
+        record->clr[1] = clr >> 32;
+        ++record;
+        record->set[0] = (uint64_t)h.clock & 0xFFFFFFFF;
+        record->set[1] = (uint64_t)h.clock >> 32;
+        record->clr[0] = record->clr[1] = 0;
+        ++record;
+      }
+    }
+  }
+  dma->Show(start_bit);
+}
 }  // namespace internal
 }  // namespace rgb_matrix
@@ -0,0 +1,121 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "gpio-trace.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace rgb_matrix {
+static const int kMaxBits = 8 * sizeof(gpio_bits_t);
+
+// VCD identifiers are printable characters; one each is plenty here.
+static char Identifier(int index) { return '!' + index; }
+
+bool GPIOTrace::WriteVCD(const char *filename,
+                         const std::vector<Signal> &signals) const {
+  const size_t count = wrapped_ ? entries_.size() : next_;
+  const size_t first = wrapped_ ? next_ : 0;
+
+  gpio_bits_t used_bits = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Entry &e = entries_[(first + i) % entries_.size()];
+    if (e.event == kSetBits || e.event == kClearBits) used_bits |= e.bits;
+  }
+
+  FILE *out = fopen(filename, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Can't write GPIO trace %s: %s\n",
+            filename, strerror(errno));
+    return false;
+  }
+
+  fprintf(out, "$comment rpi-rgb-led-matrix GPIO trace, %zu operations $end\n"
+          "$timescale 1ns $end\n$scope module matrix $end\n", count);
+  for (int b = 0; b < kMaxBits; ++b) {
+    const gpio_bits_t bit = gpio_bits_t(1) << b;
+    if (!(used_bits & bit)) continue;
+    std::string name;
+    for (const Signal &s : signals) {
+      if (s.bit == bit) name = s.name;
+    }
+    if (name.empty()) name = "gpio" + std::to_string(b);
+    fprintf(out, "$var wire 1 %c %s $end\n", Identifier(b), name.c_str());
+  }
+  const char pulse_id = Identifier(kMaxBits);
+  const char wait_id = Identifier(kMaxBits + 1);
+  const char plane_id = Identifier(kMaxBits + 2);
+  fprintf(out, "$var wire 1 %c oe_pulse $end\n"
+          "$var wire 1 %c pulse_wait $end\n"
+          "$var reg 5 %c bitplane $end\n"
+          "$upscope $end\n$enddefinitions $end\n", pulse_id, wait_id, plane_id);
+
+  // The state before the first recorded operation is not known.
+  fprintf(out, "#0\n$dumpvars\n");
+  for (int b = 0; b < kMaxBits; ++b) {
+    if (used_bits & (gpio_bits_t(1) << b)) fprintf(out, "x%c\n", Identifier(b));
+  }
+  fprintf(out, "x%c\nx%c\nbx %c\n$end\n", pulse_id, wait_id, plane_id);
+
+  const uint64_t start_nanos = count ? entries_[first].nanos : 0;
+  uint64_t last_nanos = 0;
+  gpio_bits_t known = 0, level = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const Entry &e = entries_[(first + i) % entries_.size()];
+    const uint64_t t = e.nanos - start_nanos;
+    // Timestamp only needed if something changes.
+    auto time_stamp = [&]() {
+      if (t != last_nanos) fprintf(out, "#%" PRIu64 "\n", t);
+      last_nanos = t;
+    };
+    switch (e.event) {
+    case kSetBits:
+    case kClearBits: {
+      const gpio_bits_t value = (e.event == kSetBits) ? e.bits : 0;
+      // Only changes are of interest; repeated writes (slowdown) are not.
+      const gpio_bits_t changed = e.bits & ((level ^ value) | ~known);
+      for (int b = 0; b < kMaxBits; ++b) {
+        const gpio_bits_t bit = gpio_bits_t(1) << b;
+        if (changed & bit) {
+          time_stamp();
+          fprintf(out, "%c%c\n", (value & bit) ? '1' : '0', Identifier(b));
+        }
+      }
+      known |= e.bits;
+      level = (level & ~e.bits) | value;
+      break;
+    }
+    case kPulseStart:
+      time_stamp();
+      fprintf(out, "b");
+      for (int b = 4; b >= 0; --b) fputc((e.bits & (1 << b)) ? '1' : '0', out);
+      fprintf(out, " %c\n1%c\n", plane_id, pulse_id);
+      break;
+    case kPulseWait:
+      time_stamp();
+      fprintf(out, "1%c\n", wait_id);
+      break;
+    case kPulseDone:
+      time_stamp();
+      fprintf(out, "0%c\n0%c\n", wait_id, pulse_id);
+      break;
+    }
+  }
+  fclose(out);
+  fprintf(stderr, "Wrote %zu GPIO operations to %s\n", count, filename);
+  return true;
+}
+}  // namespace rgb_matrix
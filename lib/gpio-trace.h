@@ -0,0 +1,81 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_GPIO_TRACE_H
+#define RPI_GPIO_TRACE_H
+
+#include "gpio-bits.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+namespace rgb_matrix {
+// Records the last operations on the GPIO bus with timestamps into a ring
+// buffer allocated up front, to be looked at as VCD waveform, e.g. with
+// GTKWave. Recording is compiled in with -DGPIO_TRACE_VCD (see lib/Makefile);
+// each operation then additionally costs reading the clock.
+class GPIOTrace {
+public:
+  enum Event {
+    kSetBits,      // bits: set GPIO bits.
+    kClearBits,    // bits: cleared GPIO bits.
+    kPulseStart,   // bits: bitplane. Output enable pulse requested.
+    kPulseWait,    // Start waiting for the pulse to finish.
+    kPulseDone,    // Pulse finished.
+  };
+
+  struct Signal {
+    gpio_bits_t bit;
+    std::string name;
+  };
+
+  explicit GPIOTrace(size_t capacity)
+    : entries_(capacity), next_(0), wrapped_(false) {}
+
+  inline void Record(Event event, gpio_bits_t bits) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    Entry &e = entries_[next_];
+    e.nanos = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    e.event = event;
+    e.bits = bits;
+    if (++next_ == entries_.size()) {
+      next_ = 0;
+      wrapped_ = true;
+    }
+  }
+
+  // Write the recorded operations to "filename" in the Value Change Dump
+  // format. The GPIO bits are named with "signals"; other bits are shown as
+  // gpio<n>. Returns false with a message on stderr on failure.
+  bool WriteVCD(const char *filename,
+                const std::vector<Signal> &signals) const;
+
+private:
+  struct Entry {
+    uint64_t nanos;
+    gpio_bits_t bits;
+    Event event;
+  };
+
+  std::vector<Entry> entries_;
+  size_t next_;
+  bool wrapped_;
+};
+}  // namespace rgb_matrix
+#endif  // RPI_GPIO_TRACE_H
@@ -17,9 +17,11 @@
 #include <inttypes.h>
 
 #include "gpio.h"
+#include "thread.h"
 
 #include <assert.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +29,8 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 /*
  * nanosleep() takes longer than requested because of OS jitter.
  * In about 99.9% of the cases, this is <= 25 microcseconds on
@@ -61,6 +65,17 @@
  */
 #define DEBUG_SLEEP_JITTER 0
 
+/*
+ * The first time the timers are used on a board, the actual nanosleep()
+ * overshoot and busy-loop speed are measured and stored in this file;
+ * it replaces the per-model values above and busy_wait_nanos_rpi_*().
+ * Delete the file to calibrate again (e.g. after changing CPU clocks).
+ * Define as empty string to not persist the calibration.
+ */
+#ifndef TIMING_CALIBRATION_FILE
+#  define TIMING_CALIBRATION_FILE "/var/cache/rpi-rgb-led-matrix-timing"
+#endif
+
 // Raspberry 1 and 2 have different base addresses for the periphery
 #define BCM2708_PERI_BASE        0x20000000
 #define BCM2709_PERI_BASE        0x3F000000
@@ -74,6 +89,28 @@
 
 #define REGISTER_BLOCK_SIZE (4*1024)
 
+// Raspberry Pi 5: the GPIOs are in the RP1 I/O controller. Offsets are
+// within the GPIO block that is mapped by /dev/gpiomem0.
+#define RP1_GPIO_PHYS_BASE      0x1f000d0000ull
+#define RP1_GPIO_BLOCK_SIZE     0x30000
+#define RP1_IO_BANK0_OFFSET     0x00000   // Per GPIO: STATUS, CTRL
+#define RP1_SYS_RIO0_OFFSET     0x10000   // 'Registered IO' for fast access.
+#define RP1_PADS_BANK0_OFFSET   0x20000
+
+#define RP1_RIO_OUT             0x00
+#define RP1_RIO_OE              0x04
+#define RP1_RIO_SYNC_IN         0x08
+#define RP1_RIO_SET_ALIAS       0x2000    // Writes only set the 1 bits.
+#define RP1_RIO_CLR_ALIAS       0x3000    // Writes only clear the 1 bits.
+
+#define RP1_CTRL_FUNCSEL_MASK   0x1f
+#define RP1_FUNCSEL_SYS_RIO     5
+
+#define RP1_PADS_OUTPUT_DISABLE (1<<7)
+#define RP1_PADS_INPUT_ENABLE   (1<<6)
+
+#define RP1_NUM_GPIOS           28
+
 #define PWM_CTL      (0x00 / 4)
 #define PWM_STA      (0x04 / 4)
 #define PWM_RNG1     (0x10 / 4)
@@ -123,6 +160,7 @@ static volatile uint32_t *s_GPIO_registers = NULL;
 static volatile uint32_t *s_Timer1Mhz = NULL;
 static volatile uint32_t *s_PWM_registers = NULL;
 static volatile uint32_t *s_CLK_registers = NULL;
+static volatile uint32_t *s_RP1_registers = NULL;  // Only on a Pi 5.
 
 namespace rgb_matrix {
 static bool LinuxHasModuleLoaded(const char *name) {
@@ -143,8 +181,12 @@ static bool LinuxHasModuleLoaded(const char *name) {
 
 #define GPIO_BIT(x) (1ull << x)
 
+static void ConfigureInput(int gpio);
+static void ConfigureOutput(int gpio);
+
 GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
-               slowdown_(1)
+               slowdown_(1), memory_backed_(false), write_count_(0),
+               trace_(NULL)
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
              , uses_64_bit_(false)
 #endif
@@ -153,7 +195,7 @@ GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
 
 gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
                               bool adafruit_pwm_transition_hack_needed) {
-  if (s_GPIO_registers == NULL) {
+  if (s_GPIO_registers == NULL && !memory_backed_) {
     fprintf(stderr, "Attempt to init outputs but not yet Init()-ialized.\n");
     return 0;
   }
@@ -168,8 +210,10 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
   // can switch between the two modes "adafruit-hat" and "adafruit-hat-pwm"
   // without trouble.
   if (adafruit_pwm_transition_hack_needed) {
-    INP_GPIO(4);
-    INP_GPIO(18);
+    if (!memory_backed_) {
+      ConfigureInput(4);
+      ConfigureInput(18);
+    }
     // Even with PWM enabled, GPIO4 still can not be used, because it is
     // now connected to the GPIO18 and thus must stay an input.
     // So reserve this bit if it is not set in outputs.
@@ -177,6 +221,7 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
   }
 
   outputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+  if (s_RP1_registers) outputs &= GPIO_BIT(RP1_NUM_GPIOS) - 1;
 
   // We don't know exactly what GPIO pins are occupied by 1-wire (can we
   // easily do that ?), so let's complain only about the default GPIO.
@@ -194,9 +239,8 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
   const int kMaxAvailableBit = 31;
 #endif
   for (int b = 0; b <= kMaxAvailableBit; ++b) {
-    if (outputs & GPIO_BIT(b)) {
-      INP_GPIO(b);   // for writing, we first need to set as input.
-      OUT_GPIO(b);
+    if ((outputs & GPIO_BIT(b)) && !memory_backed_) {
+      ConfigureOutput(b);
     }
   }
   output_bits_ |= outputs;
@@ -204,12 +248,13 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
 }
 
 gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
-  if (s_GPIO_registers == NULL) {
+  if (s_GPIO_registers == NULL && !memory_backed_) {
     fprintf(stderr, "Attempt to init inputs but not yet Init()-ialized.\n");
     return 0;
   }
 
   inputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+  if (s_RP1_registers) inputs &= GPIO_BIT(RP1_NUM_GPIOS) - 1;
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
   const int kMaxAvailableBit = 45;
   uses_64_bit_ |= (inputs >> 32) != 0;
@@ -217,8 +262,8 @@ gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
   const int kMaxAvailableBit = 31;
 #endif
   for (int b = 0; b <= kMaxAvailableBit; ++b) {
-    if (inputs & GPIO_BIT(b)) {
-      INP_GPIO(b);
+    if ((inputs & GPIO_BIT(b)) && !memory_backed_) {
+      ConfigureInput(b);
     }
   }
   input_bits_ |= inputs;
@@ -231,7 +276,8 @@ enum RaspberryPiModel {
   PI_MODEL_1,
   PI_MODEL_2,
   PI_MODEL_3,
-  PI_MODEL_4
+  PI_MODEL_4,
+  PI_MODEL_5
 };
 
 static int ReadFileToBuffer(char *buffer, size_t size, const char *filename) {
@@ -284,6 +330,12 @@ static RaspberryPiModel DetermineRaspberryModel() {
   case 0x14: /* CM4 */
     return PI_MODEL_4;
 
+  case 0x17: /* Pi 5 */
+  case 0x18: /* CM5 */
+  case 0x19: /* Pi 500 */
+  case 0x1a: /* CM5 Lite */
+    return PI_MODEL_5;
+
   default:  /* a bunch of versions representing Pi 3 */
     return PI_MODEL_3;
   }
@@ -305,6 +357,7 @@ static uint32_t *mmap_bcm_register(off_t register_offset) {
   case PI_MODEL_2: base = BCM2709_PERI_BASE; break;
   case PI_MODEL_3: base = BCM2709_PERI_BASE; break;
   case PI_MODEL_4: base = BCM2711_PERI_BASE; break;
+  case PI_MODEL_5: return NULL;  // Peripherals are not BCM compatible.
   }
 
   int mem_fd;
@@ -342,9 +395,69 @@ static uint32_t *mmap_bcm_register(off_t register_offset) {
   return result;
 }
 
+static uint32_t *mmap_rp1_gpio_registers() {
+  // /dev/gpiomem0 gives access to just the GPIO block, even as non-root.
+  off_t offset = 0;
+  int mem_fd = open("/dev/gpiomem0", O_RDWR|O_SYNC);
+  if (mem_fd < 0 && sizeof(off_t) >= 8) {
+    mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
+    offset = (off_t)RP1_GPIO_PHYS_BASE;
+  }
+  if (mem_fd < 0) return NULL;
+
+  uint32_t *result = (uint32_t*) mmap(NULL, RP1_GPIO_BLOCK_SIZE,
+                                      PROT_READ|PROT_WRITE, MAP_SHARED,
+                                      mem_fd, offset);
+  close(mem_fd);
+  if (result == MAP_FAILED) {
+    perror("mmap RP1 GPIO: ");
+    return NULL;
+  }
+  return result;
+}
+
+// -- GPIO pin configuration for either BCM or RP1 GPIO.
+
+static void RP1ConfigurePin(int gpio, bool output) {
+  volatile uint32_t *const ctrl
+    = s_RP1_registers + (RP1_IO_BANK0_OFFSET / 4) + 2 * gpio + 1;
+  volatile uint32_t *const pad
+    = s_RP1_registers + (RP1_PADS_BANK0_OFFSET / 4) + 1 + gpio;
+  volatile uint32_t *const rio = s_RP1_registers + (RP1_SYS_RIO0_OFFSET / 4);
+  const uint32_t oe_alias = output ? RP1_RIO_SET_ALIAS : RP1_RIO_CLR_ALIAS;
+  rio[(oe_alias + RP1_RIO_OE) / 4] = (1u << gpio);
+  *pad = (*pad & ~RP1_PADS_OUTPUT_DISABLE) | RP1_PADS_INPUT_ENABLE;
+  *ctrl = (*ctrl & ~RP1_CTRL_FUNCSEL_MASK) | RP1_FUNCSEL_SYS_RIO;
+}
+
+static void ConfigureInput(int gpio) {
+  if (s_RP1_registers) {
+    RP1ConfigurePin(gpio, false);
+  } else {
+    INP_GPIO(gpio);
+  }
+}
+
+static void ConfigureOutput(int gpio) {
+  if (s_RP1_registers) {
+    RP1ConfigurePin(gpio, true);
+  } else {
+    INP_GPIO(gpio);   // for writing, we first need to set as input.
+    OUT_GPIO(gpio);
+  }
+}
+
 static bool mmap_all_bcm_registers_once() {
   if (s_GPIO_registers != NULL) return true;  // alrady done.
 
+  if (GetPiModel() == PI_MODEL_5) {
+    // Only GPIO; no BCM timer, PWM or DMA. Timing falls back to the
+    // operating system clock.
+    s_RP1_registers = mmap_rp1_gpio_registers();
+    s_GPIO_registers = s_RP1_registers;
+    return s_GPIO_registers != NULL;
+  }
+
   // The common GPIO registers.
   s_GPIO_registers = mmap_bcm_register(GPIO_REGISTER_OFFSET);
   if (s_GPIO_registers == NULL) {
@@ -373,6 +486,20 @@ bool GPIO::Init(int slowdown) {
   if (!mmap_all_bcm_registers_once())
     return false;
 
+  if (s_RP1_registers) {
+    volatile uint32_t *const rio = s_RP1_registers + (RP1_SYS_RIO0_OFFSET / 4);
+    gpio_set_bits_low_ = rio + (RP1_RIO_SET_ALIAS + RP1_RIO_OUT) / 4;
+    gpio_clr_bits_low_ = rio + (RP1_RIO_CLR_ALIAS + RP1_RIO_OUT) / 4;
+    gpio_read_bits_low_ = rio + RP1_RIO_SYNC_IN / 4;
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+    // There are no GPIOs beyond 27, so the upper bits are always zero.
+    gpio_set_bits_high_ = gpio_set_bits_low_;
+    gpio_clr_bits_high_ = gpio_clr_bits_low_;
+    gpio_read_bits_high_ = gpio_read_bits_low_;
+#endif
+    return true;
+  }
+
   gpio_set_bits_low_ = s_GPIO_registers + (0x1C / sizeof(uint32_t));
   gpio_clr_bits_low_ = s_GPIO_registers + (0x28 / sizeof(uint32_t));
   gpio_read_bits_low_ = s_GPIO_registers + (0x34 / sizeof(uint32_t));
@@ -386,6 +513,21 @@ bool GPIO::Init(int slowdown) {
   return true;
 }
 
+void GPIO::InitMemoryBacked(int slowdown) {
+  // Separate words for each register, so writes are not folded together.
+  static volatile uint32_t memory_registers[6];
+  slowdown_ = slowdown;
+  memory_backed_ = true;
+  gpio_set_bits_low_ = &memory_registers[0];
+  gpio_clr_bits_low_ = &memory_registers[1];
+  gpio_read_bits_low_ = &memory_registers[2];
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+  gpio_set_bits_high_ = &memory_registers[3];
+  gpio_clr_bits_high_ = &memory_registers[4];
+  gpio_read_bits_high_ = &memory_registers[5];
+#endif
+}
+
 bool GPIO::IsPi4() {
   return GetPiModel() == PI_MODEL_4;
 }
@@ -411,8 +553,9 @@ class TimerBasedPinPulser : public PinPulser {
 public:
   TimerBasedPinPulser(GPIO *io, gpio_bits_t bits,
                       const std::vector<int> &nano_specs)
-    : io_(io), bits_(bits), nano_specs_(nano_specs) {
-    if (!s_Timer1Mhz) {
+    : io_(io), bits_(bits), full_nano_specs_(nano_specs),
+      nano_specs_(nano_specs), percent_(100) {
+    if (!s_Timer1Mhz && !s_RP1_registers) {
       fprintf(stderr, "FYI: not running as root which means we can't properly "
               "control timing unless this is a real-time kernel. Expect color "
               "degradation. Consider running as root with sudo.\n");
@@ -425,17 +568,96 @@ public:
     io_->SetBits(bits_);
   }
 
+  virtual void SetPulseScale(int percent) {
+    percent_ = percent;
+    for (size_t i = 0; i < nano_specs_.size(); ++i) {
+      nano_specs_[i] = (long)full_nano_specs_[i] * percent / 100;
+    }
+  }
+
+  virtual void SetTimings(const std::vector<int> &nano_specs) {
+    full_nano_specs_ = nano_specs;
+    SetPulseScale(percent_);
+  }
+
+private:
+  GPIO *const io_;
+  const gpio_bits_t bits_;
+  std::vector<int> full_nano_specs_;
+  std::vector<int> nano_specs_;
+  int percent_;
+};
+
+// Pulser for a memory backed GPIO: does the same writes as the
+// TimerBasedPinPulser, but doesn't wait.
+class MemoryPinPulser : public PinPulser {
+public:
+  MemoryPinPulser(GPIO *io, gpio_bits_t bits) : io_(io), bits_(bits) {}
+
+  virtual void SendPulse(int time_spec_number) {
+    io_->ClearBits(bits_);
+    io_->SetBits(bits_);
+  }
+
+  virtual void SetPulseScale(int percent) {}
+  virtual void SetTimings(const std::vector<int> &nano_specs) {}
+
 private:
   GPIO *const io_;
   const gpio_bits_t bits_;
-  const std::vector<int> nano_specs_;
 };
 
-// Check that 3 shows up in isolcpus
-static bool HasIsolCPUs() {
+#ifdef GPIO_TRACE_VCD
+// Records the pulses of another PinPulser in the GPIOTrace.
+class TracingPinPulser : public PinPulser {
+public:
+  TracingPinPulser(PinPulser *delegate, GPIOTrace *trace)
+    : delegate_(delegate), trace_(trace) {}
+  virtual ~TracingPinPulser() { delete delegate_; }
+
+  virtual void SendPulse(int time_spec_number) {
+    trace_->Record(GPIOTrace::kPulseStart, time_spec_number);
+    delegate_->SendPulse(time_spec_number);
+  }
+  virtual void WaitPulseFinished() {
+    trace_->Record(GPIOTrace::kPulseWait, 0);
+    delegate_->WaitPulseFinished();
+    trace_->Record(GPIOTrace::kPulseDone, 0);
+  }
+  virtual void SetPulseScale(int percent) { delegate_->SetPulseScale(percent); }
+  virtual void SetTimings(const std::vector<int> &nano_specs) {
+    delegate_->SetTimings(nano_specs);
+  }
+  virtual bool IsHardwareBased() const { return delegate_->IsHardwareBased(); }
+  virtual int TakeSleepOvershoot(uint32_t *total_us, uint32_t *max_us) {
+    return delegate_->TakeSleepOvershoot(total_us, max_us);
+  }
+
+private:
+  PinPulser *const delegate_;
+  GPIOTrace *const trace_;
+};
+#endif
+
+static int s_refresh_cpu = -2;  // -2: not set, use DefaultRefreshCpu().
+
+
+// Check that "cpu" shows up in isolcpus. The kernel gives that as a list of
+// ranges such as "1-2,3".
+static bool IsIsolatedCPU(int cpu) {
   char buf[256];
-  ReadFileToBuffer(buf, sizeof(buf), "/sys/devices/system/cpu/isolated");
-  return index(buf, '3') != NULL;
+  if (ReadFileToBuffer(buf, sizeof(buf), "/sys/devices/system/cpu/isolated") < 0)
+    return false;
+  for (const char *range = buf; *range; ) {
+    char *end;
+    const long first = strtol(range, &end, 10);
+    if (end == range) break;
+    long last = first;
+    if (*end == '-') last = strtol(end + 1, &end, 10);
+    if (cpu >= first && cpu <= last) return true;
+    range = (*end == ',') ? end + 1 : end;
+  }
+  return false;
 }
 
 static void busy_wait_nanos_rpi_1(long nanos);
@@ -465,6 +687,133 @@ static void DisableRealtimeThrottling() {
   WriteTo("/proc/sys/kernel/sched_rt_runtime_us", "999000");
 }
 
+// -- Timing calibration.
+
+// Measured values; 0 if not calibrated.
+static uint32_t s_calibrated_jitter_us = 0;
+static uint32_t s_busy_loop_picos = 0;  // Time per busy_wait_loop() iteration.
+
+// Not inlined, so that calibration and use run the very same loop.
+static void __attribute__((noinline)) busy_wait_loop(uint32_t iterations) {
+  for (; iterations != 0; --iterations) {
+    asm("");
+  }
+}
+
+static void busy_wait_nanos_calibrated(long nanos) {
+  if (nanos < 20) return;
+  busy_wait_loop((uint64_t)(nanos - 20) * 1000 / s_busy_loop_picos);
+}
+
+// Identifies the board and clock the calibration was done with: the clock
+// of the core the refresh (and so the calibration) runs on.
+static void GetCalibrationKey(char *model, size_t model_size,
+                              char *max_khz, size_t khz_size) {
+  ReadFileToBuffer(model, model_size, "/proc/device-tree/model");
+  const int cpu = RefreshCpu() >= 0 ? RefreshCpu() : DefaultRefreshCpu();
+  char max_freq[128];
+  snprintf(max_freq, sizeof(max_freq),
+           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_max_freq", cpu);
+  ReadFileToBuffer(max_khz, khz_size, max_freq);
+  // Normalize to single line strings.
+  model[strcspn(model, "\n")] = '\0';
+  max_khz[strcspn(max_khz, "\n")] = '\0';
+}
+
+static bool LoadTimingCalibration(const char *filename) {
+  if (!filename[0]) return false;
+  FILE *f = fopen(filename, "r");
+  if (!f) return false;
+  char model[256], max_khz[32];
+  GetCalibrationKey(model, sizeof(model), max_khz, sizeof(max_khz));
+  bool model_matches = false, khz_matches = false;
+  uint32_t jitter_us = 0, loop_picos = 0;
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "model=", 6) == 0) {
+      model_matches = (strcmp(line + 6, model) == 0);
+    } else if (strncmp(line, "max_khz=", 8) == 0) {
+      khz_matches = (strcmp(line + 8, max_khz) == 0);
+    } else {
+      sscanf(line, "jitter_us=%u", &jitter_us);
+      sscanf(line, "busy_loop_picos=%u", &loop_picos);
+    }
+  }
+  fclose(f);
+  if (!model_matches || !khz_matches || jitter_us == 0 || loop_picos == 0)
+    return false;  // Calibrated on a different board or clock.
+  s_calibrated_jitter_us = jitter_us;
+  s_busy_loop_picos = loop_picos;
+  return true;
+}
+
+static void SaveTimingCalibration(const char *filename) {
+  if (!filename[0]) return;
+  FILE *f = fopen(filename, "w");
+  if (!f) return;  // Best effort; we'll calibrate again next time.
+  char model[256], max_khz[32];
+  GetCalibrationKey(model, sizeof(model), max_khz, sizeof(max_khz));
+  fprintf(f, "# rpi-rgb-led-matrix timing calibration. "
+          "Delete to calibrate again.\n"
+          "model=%s\nmax_khz=%s\njitter_us=%u\nbusy_loop_picos=%u\n",
+          model, max_khz, s_calibrated_jitter_us, s_busy_loop_picos);
+  fclose(f);
+}
+
+// Measures under the same conditions the refresh thread later runs in, i.e.
+// realtime priority on the last core.
+class TimingCalibration : public Thread {
+public:
+  TimingCalibration() : jitter_us(0), busy_loop_picos(0) {}
+
+  virtual void Run() {
+    usleep(10000);  // Let Start() apply priority and affinity.
+
+    static const uint32_t kLoops = 1000000;
+    uint32_t fastest_us = UINT_MAX;
+    for (int i = 0; i < 5; ++i) {
+      const uint32_t start = GetMicrosecondCounter();
+      busy_wait_loop(kLoops);
+      fastest_us = std::min(fastest_us,
+                            (uint32_t)(GetMicrosecondCounter() - start));
+    }
+    busy_loop_picos = std::max(1u, (uint32_t)((uint64_t)fastest_us * 1000000 / kLoops));
+
+    static const int kSleeps = 2000;
+    static const long kSleepUs = 50;
+    std::vector<uint32_t> overshoot(kSleeps);
+    for (int i = 0; i < kSleeps; ++i) {
+      const struct timespec sleep_time = { 0, kSleepUs * 1000 };
+      const uint32_t start = GetMicrosecondCounter();
+      nanosleep(&sleep_time, NULL);
+      const int32_t over = (int32_t)(GetMicrosecondCounter() - start) - kSleepUs;
+      overshoot[i] = over > 0 ? over : 0;
+    }
+    std::sort(overshoot.begin(), overshoot.end());
+    // Same policy as the fixed values: single core at the 99.9%-ile, with
+    // cores to spare we can burn more busy-wait cycles and cover everything.
+    const size_t index = (GetNumCores() == 1) ? kSleeps * 999 / 1000
+      : kSleeps - 1;
+    jitter_us = std::min(200u, overshoot[index] + 1);  // +1: timer resolution
+  }
+
+  uint32_t jitter_us;
+  uint32_t busy_loop_picos;
+};
+
+static void CalibrateTimers() {
+  if (LoadTimingCalibration(TIMING_CALIBRATION_FILE)) return;
+  fprintf(stderr, "Calibrating timing for this board (once)...\n");
+  TimingCalibration calibration;
+  const int cpu = RefreshCpu();
+  calibration.Start(99, cpu >= 0 ? (1<<cpu) : 0);  // Like the refresh thread.
+  calibration.WaitStopped();
+  s_calibrated_jitter_us = calibration.jitter_us;
+  s_busy_loop_picos = calibration.busy_loop_picos;
+  SaveTimingCalibration(TIMING_CALIBRATION_FILE);
+}
+
 bool Timers::Init() {
   if (!mmap_all_bcm_registers_once())
     return false;
@@ -475,21 +824,38 @@ bool Timers::Init() {
   case PI_MODEL_2: busy_wait_impl = busy_wait_nanos_rpi_2; break;
   case PI_MODEL_3: busy_wait_impl = busy_wait_nanos_rpi_3; break;
   case PI_MODEL_4: busy_wait_impl = busy_wait_nanos_rpi_4; break;
+  case PI_MODEL_5: busy_wait_impl = busy_wait_nanos_rpi_4; break;
   }
 
   DisableRealtimeThrottling();
-  // If we have it, we run the update thread on core3. No perf-compromises:
-  WriteTo("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor",
-          "performance");
+  // The core the update thread runs on: no perf-compromises.
+  const int cpu = RefreshCpu();
+  if (cpu >= 0) {
+    char governor[128];
+    snprintf(governor, sizeof(governor),
+             "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    WriteTo(governor, "performance");
+  }
 
-  if (GetPiModel() != PI_MODEL_1 && !HasIsolCPUs()) {
-    fprintf(stderr, "Suggestion: to slightly improve display update, add\n\tisolcpus=3\n"
-            "at the end of /boot/cmdline.txt and reboot (see README.md)\n");
+  if (GetPiModel() != PI_MODEL_1 && cpu >= 0 && !IsIsolatedCPU(cpu)) {
+    fprintf(stderr, "Suggestion: to slightly improve display update, add\n\tisolcpus=%d\n"
+            "at the end of /boot/cmdline.txt and reboot (see README.md)\n", cpu);
   }
+
+  // Measuring requires the 1Mhz timer, i.e. running as root. The Pi 5 does
+  // not have it, but a fast enough operating system clock.
+  static bool calibration_done = false;
+  if ((s_Timer1Mhz || s_RP1_registers) && !calibration_done) {
+    CalibrateTimers();
+    calibration_done = true;
+  }
+  if (s_busy_loop_picos) busy_wait_impl = busy_wait_nanos_calibrated;
   return true;
 }
 
 static uint32_t JitterAllowanceMicroseconds() {
+  if (s_calibrated_jitter_us) return s_calibrated_jitter_us;
+
   // If this is a Raspberry Pi with more than one core, we add a bit of
   // additional overhead measured up to the 99.999%-ile: we can allow to burn
   // a bit more busy-wait CPU cycles to get the timing accurate as we have
@@ -499,7 +865,7 @@ static uint32_t JitterAllowanceMicroseconds() {
     return EMPIRICAL_NANOSLEEP_OVERHEAD_US;  // 99.9%-ile
   case PI_MODEL_2: case PI_MODEL_3:
     return EMPIRICAL_NANOSLEEP_OVERHEAD_US + 35;  // 99.999%-ile
-  case PI_MODEL_4:
+  case PI_MODEL_4: case PI_MODEL_5:
     return EMPIRICAL_NANOSLEEP_OVERHEAD_US + 10;  // this one is fast.
   }
   return EMPIRICAL_NANOSLEEP_OVERHEAD_US;
@@ -516,13 +882,13 @@ void Timers::sleep_nanos(long nanos) {
   // remaining time with busy wait. If we don't have the timer available
   // (not running as root), we just use nanosleep() for larger values.
 
-  if (s_Timer1Mhz) {
+  if (s_Timer1Mhz || s_RP1_registers) {
     static long kJitterAllowanceNanos = JitterAllowanceMicroseconds() * 1000;
     if (nanos > kJitterAllowanceNanos + MINIMUM_NANOSLEEP_TIME_US*1000) {
-      const uint32_t before = *s_Timer1Mhz;
+      const uint32_t before = GetMicrosecondCounter();
       struct timespec sleep_time = { 0, nanos - kJitterAllowanceNanos };
       nanosleep(&sleep_time, NULL);
-      const uint32_t after = *s_Timer1Mhz;
+      const uint32_t after = GetMicrosecondCounter();
       const long nanoseconds_passed = 1000 * (uint32_t)(after - before);
       if (nanoseconds_passed > nanos) {
         return;  // darn, missed it.
@@ -604,6 +970,9 @@ public:
     return false;
 #else
     const bool can_handle = gpio_mask==GPIO_BIT(18) || gpio_mask==GPIO_BIT(12);
+    if (can_handle && s_RP1_registers) {
+      return false;  // RP1 has a different PWM; timer based pulses for now.
+    }
     if (can_handle && (s_PWM_registers == NULL || s_CLK_registers == NULL)) {
       // Instead of silently not using the hardware pin pulser and falling back
       // to timing based loops, complain loudly and request the user to make
@@ -623,7 +992,8 @@ public:
   }
 
   HardwarePinPulser(gpio_bits_t pins, const std::vector<int> &specs)
-    : triggered_(false) {
+    : specs_(specs), percent_(100), triggered_(false),
+      overshoot_sleeps_(0), overshoot_total_us_(0), overshoot_max_us_(0) {
     assert(CanHandle(pins));
     assert(s_CLK_registers && s_PWM_registers && s_Timer1Mhz);
 
@@ -644,12 +1014,6 @@ public:
       exit(1);
     }
 
-    for (size_t i = 0; i < specs.size(); ++i) {
-      // Hints how long to nanosleep, already corrected for system overhead.
-      sleep_hints_us_.push_back(specs[i]/1000 - JitterAllowanceMicroseconds());
-    }
-
-    const int base = specs[0];
     // Get relevant registers
     fifo_ = s_PWM_registers + PWM_FIFO;
 
@@ -662,10 +1026,53 @@ public:
     } else {
       assert(false); // should've been caught by CanHandle()
     }
-    InitPWMDivider((base/2) / PWM_BASE_TIME_NS);
-    for (size_t i = 0; i < specs.size(); ++i) {
-      pwm_range_.push_back(2 * specs[i] / base);
+    SetPulseScale(100);
+  }
+
+  virtual bool IsHardwareBased() const { return true; }
+
+  virtual int TakeSleepOvershoot(uint32_t *total_us, uint32_t *max_us) {
+    const int sleeps = overshoot_sleeps_;
+    *total_us = overshoot_total_us_;
+    *max_us = overshoot_max_us_;
+    overshoot_sleeps_ = 0;
+    overshoot_total_us_ = overshoot_max_us_ = 0;
+    return sleeps;
+  }
+
+  virtual void SetTimings(const std::vector<int> &specs) {
+    specs_ = specs;
+    SetPulseScale(percent_);
+  }
+
+  virtual void SetPulseScale(int percent) {
+    percent_ = percent;
+    const int base = specs_[0];
+    const uint32_t full_divider = (base/2) / PWM_BASE_TIME_NS;
+    // Scaling primarily happens with the clock divider, which keeps the
+    // ratios between the pulses exact. Once the divider gets too coarse (or
+    // the shortest pulse is too short for the clock in the first place), the
+    // ranges are calculated from the actual PWM clock period.
+    uint32_t divider = full_divider * percent / 100;
+    if (divider < 2) divider = 2;
+
+    sleep_hints_us_.clear();
+    pwm_range_.clear();
+    for (size_t i = 0; i < specs_.size(); ++i) {
+      // Hints how long to nanosleep, already corrected for system overhead.
+      sleep_hints_us_.push_back((long)specs_[i] * percent / 100 / 1000
+                                - JitterAllowanceMicroseconds());
+      uint32_t range;
+      if (divider == full_divider) {
+        range = 2 * specs_[i] / base;
+      } else {
+        range = (uint32_t) ((double)specs_[i] * percent / 100
+                            / (divider * PWM_BASE_TIME_NS) + 0.5);
+        if (range < 1) range = 1;
+      }
+      pwm_range_.push_back(range);
     }
+    InitPWMDivider(divider);
   }
 
   virtual void SendPulse(int c) {
@@ -729,6 +1136,16 @@ public:
         struct timespec sleep_time = { 0, 1000 * to_sleep_us };
         nanosleep(&sleep_time, NULL);
 
+        // The pulse ends JitterAllowanceMicroseconds() after the sleep hint.
+        const int overshoot_us = (int)(*s_Timer1Mhz - start_time_)
+          - (sleep_hint_us_ + (int)JitterAllowanceMicroseconds());
+        if (overshoot_us > 0) {
+          overshoot_total_us_ += overshoot_us;
+          if ((uint32_t)overshoot_us > overshoot_max_us_)
+            overshoot_max_us_ = overshoot_us;
+        }
+        ++overshoot_sleeps_;
+
 #if DEBUG_SLEEP_JITTER
         {
           // Record histogram of realtime jitter how much longer we actually
@@ -779,12 +1196,18 @@ private:
   }
 
 private:
+  std::vector<int> specs_;
+  int percent_;
   std::vector<uint32_t> pwm_range_;
   std::vector<int> sleep_hints_us_;
   volatile uint32_t *fifo_;
   uint32_t start_time_;
   int sleep_hint_us_;
   bool triggered_;
+
+  int overshoot_sleeps_;
+  uint32_t overshoot_total_us_;
+  uint32_t overshoot_max_us_;
 };
 
 } // end anonymous namespace
@@ -793,14 +1216,34 @@ private:
 PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
                              bool allow_hardware_pulsing,
                              const std::vector<int> &nano_wait_spec) {
-  if (!Timers::Init()) return NULL;
-  if (allow_hardware_pulsing && HardwarePinPulser::CanHandle(gpio_mask)) {
-    return new HardwarePinPulser(gpio_mask, nano_wait_spec);
+  PinPulser *result;
+  if (io->memory_backed()) {
+    result = new MemoryPinPulser(io, gpio_mask);
+  } else if (!Timers::Init()) {
+    return NULL;
+  } else if (allow_hardware_pulsing && HardwarePinPulser::CanHandle(gpio_mask)) {
+    result = new HardwarePinPulser(gpio_mask, nano_wait_spec);
   } else {
-    return new TimerBasedPinPulser(io, gpio_mask, nano_wait_spec);
+    result = new TimerBasedPinPulser(io, gpio_mask, nano_wait_spec);
   }
+#ifdef GPIO_TRACE_VCD
+  if (io->trace()) result = new TracingPinPulser(result, io->trace());
+#endif
+  return result;
 }
 
+volatile uint32_t *MapPeripheralRegisters(uint32_t register_offset) {
+  return mmap_bcm_register(register_offset);
+}
+
+bool IsRaspberryPi1() { return GetPiModel() == PI_MODEL_1; }
+
+void SetRefreshCpu(int cpu) { s_refresh_cpu = cpu; }
+int RefreshCpu() {
+  return s_refresh_cpu == -2 ? DefaultRefreshCpu() : s_refresh_cpu;
+}
+int DefaultRefreshCpu() { return GetNumCores() - 1; }
+
 // For external use, e.g. in the matrix for extra time.
 uint32_t GetMicrosecondCounter() {
   if (s_Timer1Mhz) return *s_Timer1Mhz;
@@ -814,4 +1257,19 @@ uint32_t GetMicrosecondCounter() {
   return epoch_usec & 0xFFFFFFFF;
 }
 
+void SleepUntilMicroseconds(uint32_t deadline_us) {
+  // Like Timers::sleep_nanos(): nanosleep() the larger part, leaving the
+  // jitter allowance to finish with busy wait, but guided by the counter.
+  const int32_t remaining_us = deadline_us - GetMicrosecondCounter();
+  const int32_t sleep_us = remaining_us - (int32_t)JitterAllowanceMicroseconds();
+  if (sleep_us > MINIMUM_NANOSLEEP_TIME_US) {
+    struct timespec sleep_time = { sleep_us / 1000000,
+                                   (sleep_us % 1000000) * 1000 };
+    nanosleep(&sleep_time, NULL);
+  }
+  while ((int32_t)(deadline_us - GetMicrosecondCounter()) > 0) {
+    // busy wait the remaining time.
+  }
+}
+
 } // namespace rgb_matrix
@@ -17,6 +17,7 @@
 #define RPI_GPIO_INTERNAL_H
 
 #include "gpio-bits.h"
+#include "gpio-trace.h"
 
 #include <vector>
 
@@ -32,6 +33,23 @@ public:
   // (e.g. due to a permission problem).
   bool Init(int slowdown);
 
+  // Instead of Init(): write to plain memory instead of the GPIO registers,
+  // e.g. to benchmark the output without hardware. Pulses of PinPulsers
+  // created for this GPIO don't wait.
+  void InitMemoryBacked(int slowdown);
+  bool memory_backed() const { return memory_backed_; }
+
+  // Number of register writes so far. Only counted if compiled with
+  // -DCOUNT_GPIO_WRITES (as the benchmark in lib/Makefile is), zero
+  // otherwise.
+  uint64_t write_count() const { return write_count_; }
+
+  // Record all writes and pulses of PinPulsers created afterwards for this
+  // GPIO in "trace". Only if compiled with -DGPIO_TRACE_VCD, otherwise
+  // nothing is recorded. Does not take ownership.
+  void SetTrace(GPIOTrace *trace) { trace_ = trace; }
+  GPIOTrace *trace() const { return trace_; }
+
   // Initialize outputs.
   // Returns the bits that were available and could be set for output.
   // (never use the optional adafruit_hack_needed parameter, it is used
@@ -69,6 +87,39 @@ public:
     SetBits(value & mask);
   }
 
+  // Variants of SetBits() and ClearBits() for tight loops, in which the
+  // register width and the slowdown are known at compile time; they must
+  // match uses_64_bit() and slowdown(). Unlike SetBits() and ClearBits(),
+  // these always write, even if "value" is zero.
+  template <bool kWide, int kSlowdown>
+  inline void SetBitsFixed(gpio_bits_t value) {
+    for (int i = 0; i <= kSlowdown; ++i) {
+      NoteWrite(GPIOTrace::kSetBits, value);
+      *gpio_set_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+      if (kWide) *gpio_set_bits_high_ = static_cast<uint32_t>(value >> 32);
+#endif
+    }
+  }
+  template <bool kWide, int kSlowdown>
+  inline void ClearBitsFixed(gpio_bits_t value) {
+    for (int i = 0; i <= kSlowdown; ++i) {
+      NoteWrite(GPIOTrace::kClearBits, value);
+      *gpio_clr_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+      if (kWide) *gpio_clr_bits_high_ = static_cast<uint32_t>(value >> 32);
+#endif
+    }
+  }
+
+  int slowdown() const { return slowdown_; }
+  gpio_bits_t input_bits() const { return input_bits_; }
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+  bool uses_64_bit() const { return uses_64_bit_; }
+#else
+  bool uses_64_bit() const { return false; }
+#endif
+
   inline gpio_bits_t Read() const { return ReadRegisters() & input_bits_; }
 
   // Return if this is appears to be a Pi4
@@ -83,7 +134,17 @@ private:
             );
   }
 
+  inline void NoteWrite(GPIOTrace::Event event, gpio_bits_t value) {
+#ifdef COUNT_GPIO_WRITES
+    ++write_count_;
+#endif
+#ifdef GPIO_TRACE_VCD
+    if (trace_) trace_->Record(event, value);
+#endif
+  }
+
   inline void WriteSetBits(gpio_bits_t value) {
+    NoteWrite(GPIOTrace::kSetBits, value);
     *gpio_set_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
     if (uses_64_bit_)
@@ -92,6 +153,7 @@ private:
   }
 
   inline void WriteClrBits(gpio_bits_t value) {
+    NoteWrite(GPIOTrace::kClearBits, value);
     *gpio_clr_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
     if (uses_64_bit_)
@@ -104,6 +166,9 @@ private:
   gpio_bits_t input_bits_;
   gpio_bits_t reserved_bits_;
   int slowdown_;
+  bool memory_backed_;
+  uint64_t write_count_;
+  GPIOTrace *trace_;
 
   volatile uint32_t *gpio_set_bits_low_;
   volatile uint32_t *gpio_clr_bits_low_;
@@ -138,12 +203,55 @@ public:
 
   // If SendPulse() is asynchronously implemented, wait for pulse to finish.
   virtual void WaitPulseFinished() {}
+
+  // Scale all pulses to "percent" (1..100) of the length given in
+  // nano_wait_spec at creation time. This allows to change the overall
+  // brightness without touching the data to be displayed.
+  // Must only be called while no pulse is in flight.
+  virtual void SetPulseScale(int percent) = 0;
+
+  // Replace the pulse lengths given at creation with "nano_wait_spec" (same
+  // number of entries); the last SetPulseScale() still applies.
+  // Must only be called while no pulse is in flight.
+  virtual void SetTimings(const std::vector<int> &nano_wait_spec) = 0;
+
+  // If the pulses are generated by the PWM hardware.
+  virtual bool IsHardwareBased() const { return false; }
+
+  // How much longer than needed WaitPulseFinished() slept, accumulated since
+  // the last call: the number of sleeps and the total and maximum overshoot
+  // in microseconds. Only measured by pulsers that sleep while waiting.
+  virtual int TakeSleepOvershoot(uint32_t *total_us, uint32_t *max_us) {
+    *total_us = *max_us = 0;
+    return 0;
+  }
 };
 
 // Get rolling over microsecond counter. We get this from a hardware register
 // if possible and a terrible slow fallback otherwise.
 uint32_t GetMicrosecondCounter();
 
+// Wait until GetMicrosecondCounter() reaches "deadline_us". Sleeps for the
+// bulk of the time and only busy-waits for the last few microseconds that
+// nanosleep() might overshoot, so is cheap on the CPU for longer waits.
+void SleepUntilMicroseconds(uint32_t deadline_us);
+
+// For other hardware backends within this library: map the 4k block of
+// registers at "register_offset" from the peripheral base of this Pi.
+// Returns NULL if not possible (e.g. not running as root).
+volatile uint32_t *MapPeripheralRegisters(uint32_t register_offset);
+
+// If this is one of the single core Raspberry Pi 1 or Zero models.
+bool IsRaspberryPi1();
+
+// The CPU the refresh thread is pinned to, -1 if it is not pinned. If not
+// set, this is DefaultRefreshCpu(), the last core. The timing calibration
+// runs on it and it gets the "performance" CPU governor, so this needs to be
+// set before the first PinPulser is created.
+void SetRefreshCpu(int cpu);
+int RefreshCpu();
+int DefaultRefreshCpu();
+
 }  // end namespace rgb_matrix
 
 #endif  // RPI_GPIO_INGERNALH
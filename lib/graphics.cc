@@ -151,9 +151,18 @@ void DrawLine(Canvas *c, int x0, int y0, int x1, int y1, const Color &color) {
     }
     gradient = (dy << shift) / dx ;
 
+    // Pixels of the same row are drawn as one span.
+    int span_start = x0;
     for (x = x0 , y = 0x8000 + (y0 << shift); x <= x1; ++x, y += gradient) {
-      c->SetPixel(x, y >> shift, color.r, color.g, color.b);
+      if (x == x1 || ((y + gradient) >> shift) != (y >> shift)) {
+        c->DrawHLine(span_start, y >> shift, x - span_start + 1,
+                     color.r, color.g, color.b);
+        span_start = x + 1;
+      }
     }
+  } else if (dx == 0 && dy != 0) {
+    c->FillRect(x0, std::min(y0, y1), 1, abs(dy) + 1,
+                color.r, color.g, color.b);
   } else if (dy != 0) {
     // y variation is bigger than x variation
     if (y1 < y0) {
@@ -88,6 +88,13 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     OPT_COPY_IF_SET(pixel_mapper_config);
     OPT_COPY_IF_SET(panel_type);
     OPT_COPY_IF_SET(limit_refresh_rate_hz);
+    OPT_COPY_IF_SET(packed_framebuffer);
+    OPT_COPY_IF_SET(dma_output);
+    OPT_COPY_IF_SET(pixel_mapper_cache);
+    OPT_COPY_IF_SET(multiplex_table);
+    OPT_COPY_IF_SET(color_calibration);
+    OPT_COPY_IF_SET(pwm_temporal_dither_bits);
+    OPT_COPY_IF_SET(hugepage_framebuffer);
 #undef OPT_COPY_IF_SET
   }
 
@@ -100,7 +107,13 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     RT_OPT_COPY_IF_SET(do_gpio_init);
     RT_OPT_COPY_IF_SET(drop_priv_user);
     RT_OPT_COPY_IF_SET(drop_priv_group);
+    RT_OPT_COPY_IF_SET(refresh_scheduling);
+    RT_OPT_COPY_IF_SET(refresh_priority);
 #undef RT_OPT_COPY_IF_SET
+    // 0 is a valid CPU, so that one has its own 'set' field. lock_memory
+    // is off by default, so false and true are both taken as given.
+    if (rt_opts->refresh_cpu_set) default_rt.refresh_cpu = rt_opts->refresh_cpu;
+    default_rt.lock_memory = rt_opts->lock_memory;
   }
 
   rgb_matrix::RGBMatrix::Options matrix_options = default_opts;
@@ -134,6 +147,13 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_OPT(pixel_mapper_config);
     ACTUAL_VALUE_BACK_TO_OPT(panel_type);
     ACTUAL_VALUE_BACK_TO_OPT(limit_refresh_rate_hz);
+    ACTUAL_VALUE_BACK_TO_OPT(packed_framebuffer);
+    ACTUAL_VALUE_BACK_TO_OPT(dma_output);
+    ACTUAL_VALUE_BACK_TO_OPT(pixel_mapper_cache);
+    ACTUAL_VALUE_BACK_TO_OPT(multiplex_table);
+    ACTUAL_VALUE_BACK_TO_OPT(color_calibration);
+    ACTUAL_VALUE_BACK_TO_OPT(pwm_temporal_dither_bits);
+    ACTUAL_VALUE_BACK_TO_OPT(hugepage_framebuffer);
 #undef ACTUAL_VALUE_BACK_TO_OPT
   }
 
@@ -145,7 +165,12 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_RT_OPT(do_gpio_init);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_priv_user);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_priv_group);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(refresh_cpu);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(refresh_scheduling);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(refresh_priority);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(lock_memory);
 #undef ACTUAL_VALUE_BACK_TO_RT_OPT
+    rt_opts->refresh_cpu_set = true;
   }
 
   rgb_matrix::RGBMatrix *matrix
@@ -200,11 +225,51 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *m) {
   return from_canvas(to_matrix(m)->CreateFrameCanvas());
 }
 
+struct LedCanvas *led_matrix_acquire_offscreen_canvas(struct RGBLedMatrix *m) {
+  return from_canvas(to_matrix(m)->AcquireFrameCanvas());
+}
+
+bool led_matrix_release_offscreen_canvas(struct RGBLedMatrix *matrix,
+                                         struct LedCanvas *canvas) {
+  return to_matrix(matrix)->ReleaseFrameCanvas(to_canvas(canvas));
+}
+
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas) {
   return from_canvas(to_matrix(matrix)->SwapOnVSync(to_canvas(canvas)));
 }
 
+bool led_matrix_enqueue_canvas(struct RGBLedMatrix *matrix,
+                               struct LedCanvas *canvas,
+                               unsigned framerate_fraction) {
+  return to_matrix(matrix)->EnqueueFrame(to_canvas(canvas),
+                                         framerate_fraction);
+}
+
+struct LedCanvas *led_matrix_reclaim_canvas(struct RGBLedMatrix *matrix,
+                                            uint32_t *presented_at_us) {
+  return from_canvas(to_matrix(matrix)->ReclaimFrame(presented_at_us));
+}
+
+struct LedCanvas *led_matrix_swap_on_vsync_at(struct RGBLedMatrix *matrix,
+                                              struct LedCanvas *canvas,
+                                              uint32_t present_at_us,
+                                              uint32_t *presented_at_us) {
+  return from_canvas(to_matrix(matrix)->SwapOnVSyncAt(to_canvas(canvas),
+                                                      present_at_us,
+                                                      presented_at_us));
+}
+
+bool led_matrix_enqueue_canvas_at(struct RGBLedMatrix *matrix,
+                                  struct LedCanvas *canvas,
+                                  uint32_t present_at_us) {
+  return to_matrix(matrix)->EnqueueFrameAt(to_canvas(canvas), present_at_us);
+}
+
+uint32_t led_matrix_get_microsecond_counter(void) {
+  return rgb_matrix::GetMicrosecondCounter();
+}
+
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix,
                                uint8_t brightness) {
   to_matrix(matrix)->SetBrightness(brightness);
@@ -214,6 +279,60 @@ uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix) {
   return to_matrix(matrix)->brightness();
 }
 
+void led_matrix_set_output_brightness(struct RGBLedMatrix *matrix,
+                                      uint8_t brightness) {
+  to_matrix(matrix)->SetOutputBrightness(brightness);
+}
+
+uint8_t led_matrix_get_output_brightness(struct RGBLedMatrix *matrix) {
+  return to_matrix(matrix)->output_brightness();
+}
+
+void led_matrix_get_refresh_stats(struct RGBLedMatrix *matrix,
+                                  struct LedRefreshStats *stats) {
+  static_assert(LED_REFRESH_HISTOGRAM_BUCKETS
+                == rgb_matrix::RGBMatrix::RefreshStats::kHistogramBuckets
+                && LED_REFRESH_HISTOGRAM_BUCKET_US
+                == rgb_matrix::RGBMatrix::RefreshStats::kHistogramBucketUs,
+                "C and C++ refresh histogram mismatch");
+  rgb_matrix::RGBMatrix::RefreshStats s;
+  to_matrix(matrix)->GetRefreshStats(&s);
+  stats->refreshes = s.refreshes;
+  stats->total_refresh_us = s.total_refresh_us;
+  stats->min_refresh_us = s.min_refresh_us;
+  stats->max_refresh_us = s.max_refresh_us;
+  memcpy(stats->refresh_histogram, s.refresh_histogram,
+         sizeof(stats->refresh_histogram));
+  stats->over_budget = s.over_budget;
+  stats->swaps = s.swaps;
+  stats->total_swap_latency_us = s.total_swap_latency_us;
+  stats->max_swap_latency_us = s.max_swap_latency_us;
+  stats->pulse_sleeps = s.pulse_sleeps;
+  stats->total_pulse_overshoot_us = s.total_pulse_overshoot_us;
+  stats->max_pulse_overshoot_us = s.max_pulse_overshoot_us;
+}
+
+void led_matrix_reset_refresh_stats(struct RGBLedMatrix *matrix) {
+  to_matrix(matrix)->ResetRefreshStats();
+}
+
+int led_matrix_get_refresh_cpu(struct RGBLedMatrix *matrix) {
+  return to_matrix(matrix)->GetRefreshCpu();
+}
+
+uint64_t led_matrix_request_inputs(struct RGBLedMatrix *matrix, uint64_t bits) {
+  return to_matrix(matrix)->RequestInputs(bits);
+}
+
+uint64_t led_matrix_await_input_change(struct RGBLedMatrix *matrix,
+                                       int timeout_ms) {
+  return to_matrix(matrix)->AwaitInputChange(timeout_ms);
+}
+
+int led_matrix_input_event_fd(struct RGBLedMatrix *matrix) {
+  return to_matrix(matrix)->InputEventFd();
+}
+
 void led_canvas_get_size(const struct LedCanvas *canvas,
                          int *width, int *height) {
   rgb_matrix::FrameCanvas *c = to_canvas((struct LedCanvas*)canvas);
@@ -240,6 +359,17 @@ void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b)
   to_canvas(canvas)->Fill(r, g, b);
 }
 
+void led_canvas_fill_rect(struct LedCanvas *canvas, int x, int y,
+                          int width, int height,
+                          uint8_t r, uint8_t g, uint8_t b) {
+  to_canvas(canvas)->FillRect(x, y, width, height, r, g, b);
+}
+
+void led_canvas_set_frame_rgb(struct LedCanvas *canvas,
+                              const uint8_t *rgb, int stride) {
+  to_canvas(canvas)->SetFrameRGB(rgb, stride);
+}
+
 struct LedFont *load_font(const char *bdf_font_file) {
   rgb_matrix::Font* font = new rgb_matrix::Font();
   font->LoadFont(bdf_font_file);
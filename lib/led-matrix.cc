@@ -16,29 +16,47 @@
 #include "led-matrix.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <grp.h>
 #include <pwd.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "gpio.h"
 #include "thread.h"
+#include "dma-output.h"
+#include "worker-pool.h"
+#include "color-calibration.h"
 #include "framebuffer-internal.h"
 #include "multiplex-mappers-internal.h"
+#include "seqlock-internal.h"
+#include "spsc-queue-internal.h"
 
 // Leave this in here for a while. Setting things from old defines.
 #if defined(ADAFRUIT_RGBMATRIX_HAT)
 #  error "ADAFRUIT_RGBMATRIX_HAT has long been deprecated. Please use the Options struct or --led-gpio-mapping=adafruit-hat commandline flag"
 #endif
 
+#ifndef SCHED_DEADLINE
+#  define SCHED_DEADLINE 6   // Not known to older libc headers.
+#endif
+
 #if defined(ADAFRUIT_RGBMATRIX_HAT_PWM)
 #  error "ADAFRUIT_RGBMATRIX_HAT_PWM has long been deprecated. Please use the Options struct or --led-gpio-mapping=adafruit-hat-pwm commandline flag"
 #endif
@@ -72,13 +90,37 @@ public:
 
   bool StartRefresh();
 
+  // Placement and scheduling of the refresh thread, see RuntimeOptions.
+  struct RefreshScheduling {
+    int cpu;           // -1: not pinned.
+    int policy;        // SCHED_OTHER, SCHED_FIFO or SCHED_DEADLINE.
+    int priority;      // SCHED_FIFO priority; also while measuring for deadline.
+    bool lock_memory;
+  };
+  // Needs to be called before StartRefresh() to have an effect.
+  void SetRefreshScheduling(const RefreshScheduling &scheduling) {
+    scheduling_ = scheduling;
+  }
+  int GetRefreshCpu() const;
+
   FrameCanvas *CreateFrameCanvas();
-  FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
+  FrameCanvas *AcquireFrameCanvas();
+  bool ReleaseFrameCanvas(FrameCanvas *canvas);
+  // If "timed", swap at "present_at_us" instead of frame fractions.
+  FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction,
+                           bool timed, uint32_t present_at_us,
+                           uint32_t *presented_at_us);
+  bool EnqueueFrame(FrameCanvas *canvas, unsigned framerate_fraction,
+                    bool timed, uint32_t present_at_us);
+  FrameCanvas *ReclaimFrame(uint32_t *presented_at_us);
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();   // return the pwm-bits of the currently active buffer.
 
+  RefreshSettings GetRefreshSettings() const;
+  bool Reconfigure(const RefreshSettings &settings);
+
   void set_luminance_correct(bool on);
   bool luminance_correct() const;
 
@@ -87,8 +129,16 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Brightness in percent applied while refreshing. 1%..100%.
+  void SetOutputBrightness(uint8_t brightness);
+  uint8_t output_brightness() const { return output_brightness_; }
+
+  void GetRefreshStats(RefreshStats *stats);
+  void ResetRefreshStats();
+
   uint64_t RequestInputs(uint64_t);
   uint64_t AwaitInputChange(int timeout_ms);
+  int InputEventFd();
 
   uint64_t RequestOutputs(uint64_t output_bits);
   void OutputGPIO(uint64_t output_bits);
@@ -98,61 +148,158 @@ private:
   friend class RGBMatrix;
 
   // Apply pixel mappers that have been passed down via a configuration
-  // string.
-  void ApplyNamedPixelMappers(const char *pixel_mapper_config,
-                              int chain, int parallel);
+  // string to "map". Returns false if one of them is not known.
+  static bool ApplyNamedPixelMappers(const char *pixel_mapper_config,
+                                     int chain, int parallel,
+                                     internal::PixelDesignatorMap **map);
+
+  // Build the pixel map from scratch for the given mapper configuration.
+  // Returns NULL if the configuration is not valid.
+  internal::PixelDesignatorMap *BuildPixelMap(const char *pixel_mapper_config);
+
+  // The map of the plain panels, before any mapper is applied.
+  internal::PixelDesignatorMap *BuildPanelPixelMap();
+
+  std::string PixelMapperCacheKey(
+    const Options &options,
+    const internal::MultiplexMapper *multiplex_mapper) const;
+
+  // Settings of the matrix that a canvas starts out with.
+  void ApplyFrameSettings(FrameCanvas *canvas);
+
+  // Released canvases kept for AcquireFrameCanvas(); beyond that, they are
+  // deleted.
+  static constexpr size_t kMaxPooledFrames = 8;
 
   Options params_;
   bool do_luminance_correct_;
+  uint8_t output_brightness_;
+  const int bitplanes_;  // Fixed at creation, pwm_bits can be up to that.
 
   FrameCanvas *active_;
 
   GPIO *io_;
   Mutex active_frame_sync_;
   UpdateThread *updater_;
-  std::vector<FrameCanvas*> created_frames_;
+  std::vector<FrameCanvas*> created_frames_;  // Including pooled_frames_.
+  std::vector<FrameCanvas*> pooled_frames_;
+  size_t frames_warned_about_;
   internal::PixelDesignatorMap *shared_pixel_mapper_;
   uint64_t user_output_bits_;
+
+  // Kept to build the pixel map again on Reconfigure().
+  const internal::MultiplexMapper *multiplex_mapper_;
+  internal::MultiplexMapper *table_mapper_;  // Owned by us.
+  std::string pixel_mapper_config_;  // params_ points to it.
+
+  internal::ColorCalibration *color_calibration_;  // NULL if not configured.
+
+  RefreshScheduling scheduling_;
 };
 
 using namespace internal;
 
+#ifdef GPIO_TRACE_VCD
+#ifndef GPIO_TRACE_ENTRIES
+#define GPIO_TRACE_ENTRIES (1 << 20)
+#endif
+// The output pulser is global, so is the trace of the bus it is part of.
+static GPIOTrace *s_gpio_trace = NULL;
+#endif
+
+// SCHED_DEADLINE can only be set with sched_setattr(), which has no wrapper
+// in libc. This is the struct sched_attr it takes.
+struct SchedulingAttributes {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;    // Nanoseconds, as the following.
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
+// Switch the calling thread to SCHED_DEADLINE. Returns false with errno set
+// if that is not possible.
+static bool SetDeadlineScheduling(uint32_t runtime_us, uint32_t period_us) {
+#ifdef SYS_sched_setattr
+  SchedulingAttributes attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.sched_policy = SCHED_DEADLINE;
+  attr.sched_runtime = runtime_us * 1000ULL;
+  attr.sched_deadline = attr.sched_period = period_us * 1000ULL;
+  return syscall(SYS_sched_setattr, 0, &attr, 0) == 0;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+static uint64_t ThreadCpuNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 // Pump pixels to screen. Needs to be high priority real-time because jitter
 class RGBMatrix::Impl::UpdateThread : public Thread {
 public:
+  // Frames that can be queued with EnqueueFrame().
+  static constexpr unsigned kFrameQueueDepth = 4;
+
   UpdateThread(GPIO *io, FrameCanvas *initial_frame,
                int pwm_dither_bits, bool show_refresh,
-               int limit_refresh_hz)
-    : io_(io), show_refresh_(show_refresh),
+               int limit_refresh_hz, bool use_dma,
+               const RefreshScheduling &scheduling)
+    : io_(io), show_refresh_(show_refresh), use_dma_(use_dma),
       target_frame_usec_(limit_refresh_hz < 1 ? 0 : 1e6/limit_refresh_hz),
       running_(true),
+      swap_requested_(false),
       current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+      requested_frame_multiple_(1), requested_timed_(false),
+      requested_present_at_us_(0), requested_at_us_(0), presented_at_us_(0),
+      current_presented_us_(GetMicrosecondCounter()),
+      requested_output_brightness_(100), reset_stats_(false),
+      reconfiguration_(NULL), reconfig_requested_(false),
+      scheduling_(scheduling), cpu_(-1), placed_(false),
+      deadline_running_(false), deadline_failed_(false) {
+    memset(&stats_, 0, sizeof(stats_));
     pthread_cond_init(&frame_done_, NULL);
+    pthread_cond_init(&dma_wake_, NULL);
+    pthread_cond_init(&reconfig_done_, NULL);
+    pthread_cond_init(&placed_cond_, NULL);
+    ResetDeadlineSamples();
     pthread_cond_init(&input_change_, NULL);
-    switch (pwm_dither_bits) {
-    case 0:
-      start_bit_[0] = 0; start_bit_[1] = 0;
-      start_bit_[2] = 0; start_bit_[3] = 0;
-      break;
-    case 1:
-      start_bit_[0] = 0; start_bit_[1] = 1;
-      start_bit_[2] = 0; start_bit_[3] = 1;
-      break;
-    case 2:
-      start_bit_[0] = 0; start_bit_[1] = 1;
-      start_bit_[2] = 2; start_bit_[3] = 2;
-      break;
-    }
+    input_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    SetDitherBits(pwm_dither_bits);
+  }
+  virtual ~UpdateThread() {
+    if (input_event_fd_ >= 0) close(input_event_fd_);
   }
 
   void Stop() {
-    MutexLock l(&running_mutex_);
-    running_ = false;
+    running_.store(false);
   }
 
   virtual void Run() {
+    PlaceThread();
+    if (use_dma_) {
+      // For --led-show-refresh, compare to what the CPU would do.
+      const uint32_t cpu_refresh_us = show_refresh_ ? MeasureCPURefresh() : 0;
+      DMAOutput *dma = current_frame_.load()->framebuffer()->CreateDMAOutput();
+      if (dma != NULL) {
+        RunDMA(dma, cpu_refresh_us);
+        delete dma;
+        return;
+      }
+      fprintf(stderr, "Falling back to CPU refresh.\n");
+    }
+
     unsigned frame_count = 0;
+    unsigned queued_shown = 0;         // Refreshes of the current frame ..
+    unsigned queued_show_for = 1;      // .. and how many it should get.
     unsigned low_bit_sequence = 0;
     uint32_t largest_time = 0;
     gpio_bits_t last_gpio_bits = 0;
@@ -162,49 +309,118 @@ public:
     static const int kHoldffTimeUs = 2000 * 1000;
     uint32_t initial_holdoff_start = GetMicrosecondCounter();
     bool max_measure_enabled = false;
+    uint8_t output_brightness = 100;
+
+    uint32_t last_boundary_us = 0;
+    bool have_boundary = false;
 
     while (running()) {
       const uint32_t start_time_us = GetMicrosecondCounter();
+      const bool measure = MeasuringForDeadline();
+      const uint64_t start_cpu_ns = measure ? ThreadCpuNanos() : 0;
+
+      current_frame_.load(std::memory_order_relaxed)->framebuffer()
+        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4],
+                       low_bit_sequence / dither_period_);
+
+      const uint32_t dumped_us = GetMicrosecondCounter();
+      const bool over_budget = target_frame_usec_ &&
+        (dumped_us - start_time_us) > target_frame_usec_;
+      if (deadline_running_) {
+        // Done for this period; the kernel wakes us up for the next one.
+        sched_yield();
+      } else if (target_frame_usec_ && !over_budget) {
+        // Most of the remaining frame time is spent sleeping, not spinning.
+        SleepUntilMicroseconds(start_time_us + target_frame_usec_);
+      }
 
-      current_frame_->framebuffer()
-        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4]);
+      // From here to the next DumpToMatrix() is the refresh boundary at which
+      // frames are exchanged.
+      const uint32_t boundary_us = GetMicrosecondCounter();
 
-      // SwapOnVSync() exchange.
-      {
+      if (reset_stats_.exchange(false)) {
+        memset(&stats_, 0, sizeof(stats_));
+        have_boundary = false;
+      }
+      if (have_boundary) {
+        RecordRefresh(boundary_us - last_boundary_us, over_budget);
+      }
+      last_boundary_us = boundary_us;
+      have_boundary = true;
+
+      // EnqueueFrame() exchange; no locking involved.
+      if (TakeQueuedFrame(boundary_us, ++queued_shown >= queued_show_for,
+                          &queued_show_for)) {
+        queued_shown = 0;
+      }
+
+      // SwapOnVSync() exchange. Only needs the lock if someone is waiting.
+      if (swap_requested_.load(std::memory_order_acquire)) {
         MutexLock l(&frame_sync_);
-        // Do fast equality test first (likely due to frame_count reset).
-        if (frame_count == requested_frame_multiple_
-            || frame_count % requested_frame_multiple_ == 0) {
+        bool due;
+        if (requested_timed_) {
+          due = TimeReached(boundary_us, requested_present_at_us_);
+        } else if (frame_count == requested_frame_multiple_
+                   || frame_count % requested_frame_multiple_ == 0) {
+          // Do fast equality test first (likely due to frame_count reset).
           // We reset to avoid frame hick-up every couple of weeks
           // run-time iff requested_frame_multiple_ is not a factor of 2^32.
           frame_count = 0;
+          due = true;
+        } else {
+          due = false;
+        }
+        if (due) {
           if (next_frame_ != NULL) {
-            current_frame_ = next_frame_;
+            current_frame_.store(next_frame_);
+            current_presented_us_ = boundary_us;
             next_frame_ = NULL;
+            RecordSwap(boundary_us - requested_at_us_);
           }
+          presented_at_us_ = boundary_us;
+          swap_requested_.store(false, std::memory_order_relaxed);
           pthread_cond_signal(&frame_done_);
         }
       }
 
+      if (reconfig_requested_.load(std::memory_order_acquire)) {
+        ApplyReconfiguration();
+      }
+
+      const uint8_t requested_brightness = requested_output_brightness_.load(
+        std::memory_order_relaxed);
+
+      if (requested_brightness != output_brightness) {
+        Framebuffer::SetOutputBrightness(requested_brightness);
+        output_brightness = requested_brightness;
+      }
+
       // Read input bits.
       const gpio_bits_t inputs = io_->Read();
       if (inputs != last_gpio_bits) {
         last_gpio_bits = inputs;
-        MutexLock l(&input_sync_);
-        gpio_inputs_ = inputs;
-        pthread_cond_signal(&input_change_);
+        PublishInputs(inputs);
       }
 
+      uint32_t overshoot_total_us, overshoot_max_us;
+      const int sleeps = Framebuffer::TakePulseOvershoot(&overshoot_total_us,
+                                                         &overshoot_max_us);
+      stats_.pulse_sleeps += sleeps;
+      stats_.total_pulse_overshoot_us += overshoot_total_us;
+      stats_.max_pulse_overshoot_us = std::max(stats_.max_pulse_overshoot_us,
+                                               overshoot_max_us);
+      published_stats_.Write(stats_);
+
       ++frame_count;
       ++low_bit_sequence;
-
-      if (target_frame_usec_) {
-        while ((GetMicrosecondCounter() - start_time_us) < target_frame_usec_) {
-          // busy wait. We have our dedicated core, so ok to burn cycles.
-        }
-      }
+      if (scheduling_.cpu < 0) cpu_.store(sched_getcpu());
 
       const uint32_t end_time_us = GetMicrosecondCounter();
+      if (measure) {
+        SampleForDeadline(ThreadCpuNanos() - start_cpu_ns,
+                          (dumped_us - start_time_us)
+                          + (end_time_us - boundary_us));
+      }
       if (show_refresh_) {
         uint32_t usec = end_time_us - start_time_us;
         printf("\b\b\b\b\b\b\b\b%6.1fHz", 1e6 / usec);
@@ -221,44 +437,505 @@ public:
     }
   }
 
-  FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned frame_fraction) {
+  // Average time of a refresh done by the CPU.
+  uint32_t MeasureCPURefresh() {
+    static const int kRefreshes = 20;
+    Framebuffer *const frame = current_frame_.load()->framebuffer();
+    const uint32_t start_us = GetMicrosecondCounter();
+    for (int i = 0; i < kRefreshes; ++i) frame->DumpToMatrix(io_, 0);
+    return (GetMicrosecondCounter() - start_us) / kRefreshes;
+  }
+
+  // The DMA refreshes the panel on its own; we only need to render frames
+  // into it. Frame multiples, dithering and refresh limits are not applied.
+  // Only double rows that changed are rendered again; in between, the thread
+  // sleeps until woken up by a swap, a queued frame or a reconfiguration.
+  void RunDMA(DMAOutput *dma, uint32_t cpu_refresh_us) {
+    gpio_bits_t last_gpio_bits = 0;
+    uint8_t output_brightness = 100;
+    FrameCanvas *rendered = NULL;   // Frame last rendered into the DMA.
+    // The DMA has two buffers. Rows rendered last time are only in the
+    // other one, so need to be rendered into this one as well.
+    uint64_t behind = 0;
+    bool reconfigured = false;
+
+    if (show_refresh_ && cpu_refresh_us > 0) {
+      printf("CPU refresh: %.1fHz; DMA refresh: ", 1e6 / cpu_refresh_us);
+    }
+
+    while (running()) {
+      const uint32_t now_us = GetMicrosecondCounter();
+      unsigned framerate_fraction;  // Not applied.
+      bool swapped = TakeQueuedFrame(now_us, true, &framerate_fraction);
+      bool sync_done = false;
+      if (swap_requested_.load(std::memory_order_acquire)) {
+        MutexLock l(&frame_sync_);
+        if (!requested_timed_
+            || TimeReached(now_us, requested_present_at_us_)) {
+          if (next_frame_ != NULL) {
+            current_frame_.store(next_frame_);
+            next_frame_ = NULL;
+            RecordSwap(now_us - requested_at_us_);
+            swapped = true;
+          }
+          sync_done = true;
+        }
+      }
+
+      FrameCanvas *const current = current_frame_.load();
+      Framebuffer *const frame = current->framebuffer();
+      uint64_t rows = frame->TakeRenderRows();
+      if (current != rendered || reconfigured) {
+        rows = frame->all_rows();
+        rendered = current;
+        reconfigured = false;
+      }
+
+      if (rows || behind || sync_done) {
+        frame->RenderToDMA(dma, rows | behind);  // Waits.
+        behind = rows;
+        const uint32_t rendered_us = GetMicrosecondCounter();
+        if (swapped) current_presented_us_ = rendered_us;
+        if (reset_stats_.exchange(false)) memset(&stats_, 0, sizeof(stats_));
+        published_stats_.Write(stats_);
+        if (sync_done) {
+          MutexLock l(&frame_sync_);
+          presented_at_us_ = rendered_us;
+          swap_requested_.store(false, std::memory_order_relaxed);
+          pthread_cond_signal(&frame_done_);
+        }
+      }
+
+      if (reconfig_requested_.load(std::memory_order_acquire)) {
+        ApplyReconfiguration();
+        reconfigured = true;
+      }
+
+      const uint8_t requested_brightness = requested_output_brightness_.load(
+        std::memory_order_relaxed);
+
+      if (requested_brightness != output_brightness) {
+        dma->SetPulseScale(requested_brightness);
+        output_brightness = requested_brightness;
+      }
+
+      const gpio_bits_t inputs = io_->Read();
+      if (inputs != last_gpio_bits) {
+        last_gpio_bits = inputs;
+        PublishInputs(inputs);
+      }
+      if (scheduling_.cpu < 0) cpu_.store(sched_getcpu());
+
+      if (show_refresh_ && dma->LastFrameMicroseconds() > 0) {
+        printf("\b\b\b\b\b\b\b\b%6.1fHz",
+               1e6 / dma->LastFrameMicroseconds());
+      }
+
+      if (!reconfigured && behind == 0) WaitForDMAWork();
+    }
+  }
+
+  // Sleep until there might be something to render. Drawing directly onto
+  // the active canvas and inputs are picked up by waking up regularly.
+  void WaitForDMAWork() {
+    static const int kIdleWakeMs = 10;
+    static const int kPollMs = 1;   // Inputs, frames not due yet.
+    MutexLock l(&frame_sync_);
+    if (reconfig_requested_.load(std::memory_order_relaxed)) return;
+    int timeout_ms = io_->input_bits() ? kPollMs : kIdleWakeMs;
+    if (swap_requested_.load(std::memory_order_relaxed)) {
+      if (!requested_timed_
+          || TimeReached(GetMicrosecondCounter(), requested_present_at_us_))
+        return;
+      timeout_ms = kPollMs;
+    }
+    if (queued_frames_.Peek() != NULL) timeout_ms = kPollMs;
+    frame_sync_.WaitOn(&dma_wake_, timeout_ms);
+  }
+
+  // If "timed", the swap happens at "present_at_us" instead of the next
+  // multiple of "frame_fraction".
+  FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned frame_fraction,
+                           bool timed, uint32_t present_at_us,
+                           uint32_t *presented_at_us) {
     MutexLock l(&frame_sync_);
-    FrameCanvas *previous = current_frame_;
+    FrameCanvas *previous = current_frame_.load();
     next_frame_ = other;
     requested_frame_multiple_ = frame_fraction;
+    requested_timed_ = timed;
+    requested_present_at_us_ = present_at_us;
+    requested_at_us_ = GetMicrosecondCounter();
+    swap_requested_.store(true, std::memory_order_release);
+    if (use_dma_) pthread_cond_signal(&dma_wake_);
     frame_sync_.WaitOn(&frame_done_);
+    if (presented_at_us) *presented_at_us = presented_at_us_;
     return previous;
   }
 
+  // Only to be called from one thread.
+  bool EnqueueFrame(FrameCanvas *canvas, unsigned frame_fraction,
+                    bool timed, uint32_t present_at_us) {
+    const QueuedFrame queued = { canvas, frame_fraction, timed, present_at_us,
+                                 GetMicrosecondCounter() };
+    if (!queued_frames_.Push(queued)) return false;
+    if (use_dma_) {
+      MutexLock l(&frame_sync_);
+      pthread_cond_signal(&dma_wake_);
+    }
+    return true;
+  }
+
+  // Only to be called from one thread.
+  FrameCanvas *ReclaimFrame(uint32_t *presented_at_us) {
+    ShownFrame result;
+    if (!reclaimable_.Pop(&result)) return NULL;
+    if (presented_at_us) *presented_at_us = result.presented_at_us;
+    return result.canvas;
+  }
+
+  void GetRefreshStats(RGBMatrix::RefreshStats *stats) const {
+    published_stats_.Read(stats);
+  }
+  void ResetRefreshStats() { reset_stats_.store(true); }
+
+  // Takes effect with the next refresh.
+  void SetOutputBrightness(uint8_t brightness) {
+    requested_output_brightness_.store(brightness);
+  }
+
+  // Settings swapped in between two refreshes by Reconfigure().
+  struct Reconfiguration {
+    std::vector<int> bitplane_timings;  // Not applied with DMA output.
+    int dither_bits;
+    int limit_refresh_hz;
+    int pwm_bits;
+    std::vector<FrameCanvas*> frames;   // All frames, to set pwm_bits in.
+  };
+
+  // Apply "config" at the next refresh boundary. Waits until done.
+  void Reconfigure(const Reconfiguration &config) {
+    MutexLock l(&frame_sync_);
+    reconfiguration_ = &config;
+    reconfig_requested_.store(true, std::memory_order_release);
+    if (use_dma_) pthread_cond_signal(&dma_wake_);
+    while (reconfiguration_ != NULL) {
+      frame_sync_.WaitOn(&reconfig_done_);
+    }
+  }
+
   gpio_bits_t AwaitInputChange(int timeout_ms) {
     MutexLock l(&input_sync_);
     input_sync_.WaitOn(&input_change_, timeout_ms);
     return gpio_inputs_;
   }
 
+  int input_event_fd() const { return input_event_fd_; }
+
+  // If "canvas" is shown, queued or waiting to be reclaimed. To be called
+  // from the thread calling EnqueueFrame() and ReclaimFrame().
+  bool HoldsFrame(const FrameCanvas *canvas) const {
+    bool found = false;
+    // A frame moves from the queue to current_frame_ to reclaimable_, each
+    // time set in the new place before taken from the old one. Looking in
+    // the same order, it can't slip through.
+    queued_frames_.ForEach([&](const QueuedFrame &f) {
+        found |= (f.canvas == canvas);
+      });
+    found |= (current_frame_.load() == canvas);
+    reclaimable_.ForEach([&](const ShownFrame &f) {
+        found |= (f.canvas == canvas);
+      });
+    return found;
+  }
+
+  // Wait until the refresh thread has been placed on its CPU.
+  void WaitPlaced() {
+    MutexLock l(&frame_sync_);
+    while (!placed_) {
+      frame_sync_.WaitOn(&placed_cond_);
+    }
+  }
+  int cpu() const { return cpu_.load(); }
+
 private:
+  // Number of refreshes measured before switching to SCHED_DEADLINE, after
+  // leaving out a few to not pick up start-up glitches.
+  static constexpr int kDeadlineSamples = 100;
+  static constexpr int kDeadlineHoldoff = 10;
+  static constexpr uint32_t kMinDeadlinePeriodUs = 100;  // Kernel default.
+  static constexpr uint32_t kMinDeadlineRuntimeUs = 10;
+
+  // Pin and schedule the calling refresh thread. Done from within, so that
+  // it is in place before the first refresh.
+  void PlaceThread() {
+    int err;
+    if (scheduling_.cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(scheduling_.cpu, &cpus);
+      if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))) {
+        fprintf(stderr, "Can't run the refresh on CPU %d: %s\n",
+                scheduling_.cpu, strerror(err));
+      }
+    }
+    if (scheduling_.policy != SCHED_OTHER && !SetFifoScheduling()) {
+      fprintf(stderr, "Can't set realtime priority=%d of the refresh: %s.\n"
+              "\tYou are probably not running as root ?\n"
+              "\tThis will seriously mess with color stability and flicker\n"
+              "\tof the matrix.\n",
+              scheduling_.priority, strerror(errno));
+      deadline_failed_ = true;  // Would not work either.
+    }
+    if (scheduling_.lock_memory) LockStack();
+
+    MutexLock l(&frame_sync_);
+    cpu_.store(sched_getcpu());
+    placed_ = true;
+    pthread_cond_signal(&placed_cond_);
+  }
+
+  // Also used while measuring the refresh for SCHED_DEADLINE.
+  bool SetFifoScheduling() {
+    struct sched_param p;
+    p.sched_priority = scheduling_.priority;
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &p);
+    errno = err;
+    return err == 0;
+  }
+
+  // The stack of this thread did not exist yet when StartRefresh() locked
+  // the memory; lock (and so fault in) the part of it that we use.
+  static void LockStack() {
+    static const uintptr_t kStackBytes = 64 * 1024;
+    char here;
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t top = ((uintptr_t)&here + page) & ~(page - 1);
+    (void) mlock((void*)(top - kStackBytes), kStackBytes);  // Best effort.
+  }
+
+  bool MeasuringForDeadline() const {
+    return scheduling_.policy == SCHED_DEADLINE
+      && !deadline_running_ && !deadline_failed_;
+  }
+
+  void ResetDeadlineSamples() {
+    deadline_samples_ = -kDeadlineHoldoff;
+    max_cpu_us_ = max_wall_us_ = 0;
+  }
+
+  // Collect the longest refresh, then switch to SCHED_DEADLINE with some
+  // runtime to spare for it. The period is the limited refresh time;
+  // without a limit, a tenth of the core is left to others.
+  void SampleForDeadline(uint64_t cpu_ns, uint32_t wall_us) {
+    if (deadline_samples_++ < 0) return;
+    max_cpu_us_ = std::max<uint32_t>(max_cpu_us_, cpu_ns / 1000 + 1);
+    max_wall_us_ = std::max(max_wall_us_, wall_us);
+    if (deadline_samples_ < kDeadlineSamples) return;
+
+    uint32_t runtime_us = std::max(kMinDeadlineRuntimeUs, max_cpu_us_ * 5 / 4);
+    const uint32_t period_us = std::max(kMinDeadlinePeriodUs,
+      target_frame_usec_ ? target_frame_usec_
+      : std::max(runtime_us, max_wall_us_) * 10 / 9 + 1);
+    runtime_us = std::min(runtime_us, period_us);
+    if (SetDeadlineScheduling(runtime_us, period_us)) {
+      deadline_running_ = true;
+      return;
+    }
+    fprintf(stderr, "Can't switch the refresh to SCHED_DEADLINE "
+            "(runtime %uusec, period %uusec): %s. Staying with SCHED_FIFO.\n",
+            runtime_us, period_us, strerror(errno));
+    if (scheduling_.cpu >= 0) {
+      fprintf(stderr, "\tDeadline tasks can't be pinned to a CPU unless it "
+              "is an exclusive cpuset; try without --led-refresh-cpu.\n");
+    }
+    deadline_failed_ = true;
+  }
+
+  void PublishInputs(gpio_bits_t inputs) {
+    {
+      MutexLock l(&input_sync_);
+      gpio_inputs_ = inputs;
+      pthread_cond_signal(&input_change_);
+    }
+    if (input_event_fd_ >= 0) {
+      // Non-blocking; if the counter is ever full, the fd is readable anyway.
+      const uint64_t one = 1;
+      if (write(input_event_fd_, &one, sizeof(one)) < 0) {}
+    }
+  }
+
+  struct QueuedFrame {
+    FrameCanvas *canvas;
+    unsigned framerate_fraction;
+    bool timed;                // If set, show at present_at_us instead.
+    uint32_t present_at_us;
+    uint32_t enqueued_at_us;
+  };
+  struct ShownFrame {
+    FrameCanvas *canvas;
+    uint32_t presented_at_us;
+  };
+
+  void RecordRefresh(uint32_t refresh_us, bool over_budget) {
+    typedef RGBMatrix::RefreshStats Stats;
+    if (stats_.refreshes == 0 || refresh_us < stats_.min_refresh_us)
+      stats_.min_refresh_us = refresh_us;
+    stats_.max_refresh_us = std::max(stats_.max_refresh_us, refresh_us);
+    ++stats_.refreshes;
+    stats_.total_refresh_us += refresh_us;
+    const uint32_t bucket = std::min<uint32_t>(
+      refresh_us / Stats::kHistogramBucketUs, Stats::kHistogramBuckets - 1);
+    ++stats_.refresh_histogram[bucket];
+    if (over_budget) ++stats_.over_budget;
+  }
+
+  void RecordSwap(uint32_t latency_us) {
+    ++stats_.swaps;
+    stats_.total_swap_latency_us += latency_us;
+    stats_.max_swap_latency_us = std::max(stats_.max_swap_latency_us,
+                                          latency_us);
+  }
+
+  // If time "now_us" is at or after "time_us". Both are wrapping.
+  static bool TimeReached(uint32_t now_us, uint32_t time_us) {
+    return (int32_t)(now_us - time_us) >= 0;
+  }
+
   inline bool running() {
-    MutexLock l(&running_mutex_);
-    return running_;
+    return running_.load(std::memory_order_relaxed);
+  }
+
+  // Which lowest bitplane to show in a sequence of four refreshes.
+  // The temporal dither variant only advances once per repetition of that
+  // pattern, so that every variant is shown with every start bit equally
+  // often; otherwise some variants would always lose the same low planes.
+  void SetDitherBits(int pwm_dither_bits) {
+    switch (pwm_dither_bits) {
+    case 0:
+      start_bit_[0] = 0; start_bit_[1] = 0;
+      start_bit_[2] = 0; start_bit_[3] = 0;
+      dither_period_ = 1;
+      break;
+    case 1:
+      start_bit_[0] = 0; start_bit_[1] = 1;
+      start_bit_[2] = 0; start_bit_[3] = 1;
+      dither_period_ = 2;
+      break;
+    case 2:
+      start_bit_[0] = 0; start_bit_[1] = 1;
+      start_bit_[2] = 2; start_bit_[3] = 2;
+      dither_period_ = 4;
+      break;
+    }
+  }
+
+  // Refresh thread only, between refreshes.
+  void ApplyReconfiguration() {
+    MutexLock l(&frame_sync_);
+    const Reconfiguration &config = *reconfiguration_;
+    if (!use_dma_) {
+      Framebuffer::SetBitplaneTimings(config.bitplane_timings,
+                                      config.dither_bits);
+    }
+    SetDitherBits(config.dither_bits);
+    target_frame_usec_ = (config.limit_refresh_hz < 1
+                          ? 0 : 1e6 / config.limit_refresh_hz);
+    for (FrameCanvas *frame : config.frames) {
+      frame->framebuffer()->SetPWMBits(config.pwm_bits);
+    }
+    if (deadline_running_) {
+      // The refresh takes a different time now; measure it again.
+      SetFifoScheduling();
+      deadline_running_ = false;
+    }
+    ResetDeadlineSamples();
+    reconfiguration_ = NULL;
+    reconfig_requested_.store(false, std::memory_order_relaxed);
+    pthread_cond_signal(&reconfig_done_);
+  }
+
+  // If the next frame from EnqueueFrame() is due at "now_us" and there is
+  // room to hand back the current one, make it the current frame. Untimed
+  // frames are due if "fraction_done". Refresh thread only.
+  bool TakeQueuedFrame(uint32_t now_us, bool fraction_done,
+                       unsigned *framerate_fraction) {
+    const QueuedFrame *next = queued_frames_.Peek();
+    if (next == NULL || reclaimable_.Full())
+      return false;
+    if (next->timed ? !TimeReached(now_us, next->present_at_us)
+        : !fraction_done)
+      return false;
+    const ShownFrame shown = {
+      current_frame_.load(std::memory_order_relaxed), current_presented_us_
+    };
+    reclaimable_.Push(shown);
+    RecordSwap(now_us - next->enqueued_at_us);
+    current_frame_.store(next->canvas);
+    current_presented_us_ = now_us;
+    *framerate_fraction = next->timed ? 1 : next->framerate_fraction;
+    QueuedFrame taken;
+    queued_frames_.Pop(&taken);
+    return true;
   }
 
   GPIO *const io_;
   const bool show_refresh_;
-  const uint32_t target_frame_usec_;
-  uint32_t start_bit_[4];
+  const bool use_dma_;
+  uint32_t target_frame_usec_;  // Refresh thread only, as ..
+  uint32_t start_bit_[4];       // .. this ..
+  unsigned dither_period_;      // .. and this.
 
-  Mutex running_mutex_;
-  bool running_;
+  std::atomic<bool> running_;
 
   Mutex input_sync_;
   pthread_cond_t input_change_;
   gpio_bits_t gpio_inputs_;
+  int input_event_fd_;  // Signaled on each change of gpio_inputs_.
 
+  // SwapOnVSync() handshake. Only touched by the refresh thread if
+  // swap_requested_ is set.
   Mutex frame_sync_;
   pthread_cond_t frame_done_;
-  FrameCanvas *current_frame_;
+  pthread_cond_t dma_wake_;   // Wakes up RunDMA() for new work.
+  std::atomic<bool> swap_requested_;
+  std::atomic<FrameCanvas*> current_frame_;
   FrameCanvas *next_frame_;
   unsigned requested_frame_multiple_;
+  bool requested_timed_;
+  uint32_t requested_present_at_us_;
+  uint32_t requested_at_us_;
+  uint32_t presented_at_us_;
+  uint32_t current_presented_us_;  // Refresh thread only.
+
+  std::atomic<uint8_t> requested_output_brightness_;
+
+  // EnqueueFrame() frames to be shown, and frames shown before that can be
+  // re-used. There can be more of the latter, so that it is not the
+  // first to fill up if the user does not reclaim often.
+  SPSCQueue<QueuedFrame, kFrameQueueDepth> queued_frames_;
+  SPSCQueue<ShownFrame, 2 * kFrameQueueDepth> reclaimable_;
+
+  RGBMatrix::RefreshStats stats_;   // Refresh thread only. Published in ..
+  SeqLock<RGBMatrix::RefreshStats> published_stats_;  // .. for other threads.
+  std::atomic<bool> reset_stats_;
+
+  // Reconfigure() handshake, protected by frame_sync_.
+  const Reconfiguration *reconfiguration_;
+  std::atomic<bool> reconfig_requested_;
+  pthread_cond_t reconfig_done_;
+
+  // Set by PlaceThread(); cpu_ is updated while running if not pinned.
+  const RefreshScheduling scheduling_;
+  std::atomic<int> cpu_;
+  bool placed_;                  // Protected by frame_sync_.
+  pthread_cond_t placed_cond_;
+
+  // Measuring the refresh for SCHED_DEADLINE. Refresh thread only.
+  bool deadline_running_;
+  bool deadline_failed_;
+  int deadline_samples_;
+  uint32_t max_cpu_us_;
+  uint32_t max_wall_us_;
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -282,6 +959,7 @@ RGBMatrix::Options::Options() :
 #endif
 
   pwm_dither_bits(0),
+  pwm_temporal_dither_bits(0),
   brightness(100),
 
 #ifdef RGB_SCAN_INTERLACED
@@ -312,12 +990,18 @@ RGBMatrix::Options::Options() :
 #endif
   led_rgb_sequence("RGB"),
   pixel_mapper_config(NULL),
+  pixel_mapper_cache(NULL),
+  multiplex_table(NULL),
   panel_type(NULL),
+  color_calibration(NULL),
 #ifdef FIXED_FRAME_MICROSECONDS
-  limit_refresh_rate_hz(1e6 / FIXED_FRAME_MICROSECONDS)
+  limit_refresh_rate_hz(1e6 / FIXED_FRAME_MICROSECONDS),
 #else
-  limit_refresh_rate_hz(0)
+  limit_refresh_rate_hz(0),
 #endif
+  packed_framebuffer(false),
+  dma_output(false),
+  hugepage_framebuffer(false)
 {
   // Nothing to see here.
 }
@@ -337,6 +1021,7 @@ static void PrintOptions(const RGBMatrix::Options &o) {
   P_INT(pwm_bits);
   P_INT(pwm_lsb_nanoseconds);
   P_INT(pwm_dither_bits);
+  P_INT(pwm_temporal_dither_bits);
   P_INT(brightness);
   P_INT(scan_mode);
   P_INT(row_address_type);
@@ -346,48 +1031,123 @@ static void PrintOptions(const RGBMatrix::Options &o) {
   P_BOOL(inverse_colors);
   P_STR(led_rgb_sequence);
   P_STR(pixel_mapper_config);
+  P_STR(pixel_mapper_cache);
+  P_STR(multiplex_table);
   P_STR(panel_type);
+  P_STR(color_calibration);
   P_INT(limit_refresh_rate_hz);
+  P_BOOL(packed_framebuffer);
+  P_BOOL(dma_output);
+  P_BOOL(hugepage_framebuffer);
 #undef P_INT
 #undef P_STR
 #undef P_BOOL
 }
 #endif  // DEBUG_MATRIX_OPTIONS
 
+// Everything that determines the final PixelDesignatorMap.
+std::string RGBMatrix::Impl::PixelMapperCacheKey(
+  const Options &o, const MultiplexMapper *multiplex_mapper) const {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "format=%d;rows=%d;cols=%d;chain=%d;parallel=%d;multiplexing=%d;"
+           "bitplanes=%d;packed=%d;temporal=%d;hardware=%s;sequence=%s;"
+           "mapper=",
+           PixelDesignatorMap::kFileFormatVersion, o.rows, o.cols, o.chain_length, o.parallel, o.multiplexing,
+           bitplanes_, o.packed_framebuffer ? 1 : 0,
+           o.pwm_temporal_dither_bits,
+           o.hardware_mapping ? o.hardware_mapping : "",
+           o.led_rgb_sequence ? o.led_rgb_sequence : "");
+  return std::string(buffer)
+    + (o.pixel_mapper_config ? o.pixel_mapper_config : "")
+    + ";multiplex=" + (multiplex_mapper ? multiplex_mapper->GetName() : "");
+}
+
 RGBMatrix::Impl::Impl(GPIO *io, const Options &options)
-  : params_(options), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL),
-    user_output_bits_(0) {
+  : params_(options), output_brightness_(100),
+    bitplanes_(std::max((int)Framebuffer::kDefaultBitPlanes, options.pwm_bits)),
+    io_(NULL), updater_(NULL), frames_warned_about_(0),
+    shared_pixel_mapper_(NULL),
+    user_output_bits_(0), multiplex_mapper_(NULL), table_mapper_(NULL),
+    pixel_mapper_config_(options.pixel_mapper_config
+                         ? options.pixel_mapper_config : ""),
+    color_calibration_(NULL) {
+  scheduling_.cpu = DefaultRefreshCpu();
+  scheduling_.policy = SCHED_FIFO;
+  scheduling_.priority = 99;
+  scheduling_.lock_memory = false;
   assert(params_.Validate(NULL));
 #if DEBUG_MATRIX_OPTIONS
   PrintOptions(params_);
 #endif
-  const MultiplexMapper *multiplex_mapper = NULL;
-  if (params_.multiplexing > 0) {
+  params_.pixel_mapper_config = pixel_mapper_config_.c_str();
+  if (params_.multiplex_table != NULL && *params_.multiplex_table != '\0') {
+    std::string err;
+    table_mapper_ = CreateTableMultiplexMapper(params_.multiplex_table,
+                                               params_.cols, params_.rows,
+                                               &err);
+    multiplex_mapper_ = table_mapper_;
+  } else if (params_.multiplexing > 0) {
     const MuxMapperList &multiplexers = GetRegisteredMultiplexMappers();
     if (params_.multiplexing <= (int) multiplexers.size()) {
       // TODO: we could also do a find-by-name here, but not sure if worthwhile
-      multiplex_mapper = multiplexers[params_.multiplexing - 1];
+      multiplex_mapper_ = multiplexers[params_.multiplexing - 1];
     }
   }
 
-  if (multiplex_mapper) {
+  if (multiplex_mapper_) {
     // The multiplexers might choose to have a different physical layout.
     // We need to configure that first before setting up the hardware.
-    multiplex_mapper->EditColsRows(&params_.cols, &params_.rows);
+    multiplex_mapper_->EditColsRows(&params_.cols, &params_.rows);
   }
 
   Framebuffer::InitHardwareMapping(params_.hardware_mapping);
 
+  if (params_.color_calibration && *params_.color_calibration) {
+    std::string err;
+    color_calibration_ = ColorCalibration::Create(params_.color_calibration,
+                                                  &err);
+    if (color_calibration_) {
+      color_calibration_->BuildTables(bitplanes_
+                                      + params_.pwm_temporal_dither_bits);
+    } else {
+      fprintf(stderr, "%s", err.c_str());  // Validate() should've caught it.
+    }
+  }
+
+  const char *const cache_file = params_.pixel_mapper_cache;
+  const bool use_cache = (cache_file != NULL && *cache_file != '\0');
+  const std::string cache_key
+    = use_cache ? PixelMapperCacheKey(options, multiplex_mapper_) : "";
+  if (use_cache) {
+    shared_pixel_mapper_ = PixelDesignatorMap::LoadFromFile(cache_file,
+                                                            cache_key);
+  }
+  bool mapping_cached = (shared_pixel_mapper_ != NULL);
+
   active_ = CreateFrameCanvas();
+  if (mapping_cached
+      && !active_->framebuffer()->IsValidMap(shared_pixel_mapper_)) {
+    fprintf(stderr, "Pixel mapper cache %s does not fit this matrix; "
+            "rebuilding it.\n", cache_file);
+    delete shared_pixel_mapper_;
+    shared_pixel_mapper_ = BuildPanelPixelMap();
+    mapping_cached = false;
+  }
   active_->Clear();
   SetGPIO(io, true);
 
-  // We need to apply the mapping for the panels first.
-  ApplyPixelMapper(multiplex_mapper);
+  if (!mapping_cached) {
+    // We need to apply the mapping for the panels first.
+    ApplyPixelMapper(multiplex_mapper_);
+
+    // .. followed by higher level mappers that might arrange panels.
+    ApplyNamedPixelMappers(params_.pixel_mapper_config,
+                           params_.chain_length, params_.parallel,
+                           &shared_pixel_mapper_);
 
-  // .. followed by higher level mappers that might arrange panels.
-  ApplyNamedPixelMappers(options.pixel_mapper_config,
-                         params_.chain_length, params_.parallel);
+    if (use_cache) shared_pixel_mapper_->SaveToFile(cache_file, cache_key);
+  }
 }
 
 RGBMatrix::Impl::~Impl() {
@@ -400,11 +1160,16 @@ RGBMatrix::Impl::~Impl() {
   // Make sure LEDs are off.
   active_->Clear();
   if (io_) active_->framebuffer()->DumpToMatrix(io_, 0);
+#ifdef GPIO_TRACE_VCD
+  if (io_) Framebuffer::WriteTraceVCD(*s_gpio_trace, GPIO_TRACE_VCD);
+#endif
 
   for (size_t i = 0; i < created_frames_.size(); ++i) {
     delete created_frames_[i];
   }
   delete shared_pixel_mapper_;
+  delete table_mapper_;
+  delete color_calibration_;
 }
 
 RGBMatrix::~RGBMatrix() {
@@ -425,10 +1190,44 @@ void RGBMatrix::Impl::OutputGPIO(uint64_t output_bits) {
   io_->WriteMaskedBits(output_bits, user_output_bits_);
 }
 
-void RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
-                                             int chain, int parallel) {
+static bool ApplyPixelMapperTo(const PixelMapper *mapper,
+                               PixelDesignatorMap **map) {
+  if (mapper == NULL) return true;
+  const int old_width = (*map)->width();
+  const int old_height = (*map)->height();
+  int new_width, new_height;
+  if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
+    return false;
+  }
+  PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
+    new_width, new_height, **map);
+  for (int y = 0; y < new_height; ++y) {
+    for (int x = 0; x < new_width; ++x) {
+      int orig_x = -1, orig_y = -1;
+      mapper->MapVisibleToMatrix(old_width, old_height,
+                                 x, y, &orig_x, &orig_y);
+      if (orig_x < 0 || orig_y < 0 ||
+          orig_x >= old_width || orig_y >= old_height) {
+        fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
+                "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
+        continue;
+      }
+      const internal::PixelDesignator *orig_designator;
+      orig_designator = (*map)->get(orig_x, orig_y);
+      *new_mapper->get(x, y) = *orig_designator;
+    }
+  }
+  delete *map;
+  *map = new_mapper;
+  return true;
+}
+
+bool RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
+                                             int chain, int parallel,
+                                             PixelDesignatorMap **map) {
   if (pixel_mapper_config == NULL || strlen(pixel_mapper_config) == 0)
-    return;
+    return true;
+  bool success = true;
   char *const writeable_copy = strdup(pixel_mapper_config);
   const char *const end = writeable_copy + strlen(writeable_copy);
   char *s = writeable_copy;
@@ -443,22 +1242,54 @@ void RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
       fprintf(stderr, "Stray parameter ':%s' without mapper name ?\n", optional_param_start);
     }
     if (*s) {
-      ApplyPixelMapper(FindPixelMapper(s, chain, parallel, optional_param_start));
+      const PixelMapper *mapper = FindPixelMapper(s, chain, parallel,
+                                                  optional_param_start);
+      if (mapper == NULL) success = false;
+      ApplyPixelMapperTo(mapper, map);
     }
     s = semicolon + 1;
   }
   free(writeable_copy);
+  return success;
+}
+
+PixelDesignatorMap *RGBMatrix::Impl::BuildPanelPixelMap() {
+  // A Framebuffer without mapping creates the one of the plain panels.
+  PixelDesignatorMap *map = NULL;
+  delete new Framebuffer(params_.rows, params_.cols * params_.chain_length,
+                         params_.parallel, bitplanes_, params_.scan_mode,
+                         params_.led_rgb_sequence, params_.inverse_colors,
+                         params_.packed_framebuffer,
+                         params_.pwm_temporal_dither_bits, false, &map);
+  return map;
+}
+
+PixelDesignatorMap *RGBMatrix::Impl::BuildPixelMap(
+  const char *pixel_mapper_config) {
+  PixelDesignatorMap *map = BuildPanelPixelMap();
+  ApplyPixelMapperTo(multiplex_mapper_, &map);
+  if (!ApplyNamedPixelMappers(pixel_mapper_config,
+                              params_.chain_length, params_.parallel, &map)) {
+    delete map;
+    return NULL;
+  }
+  return map;
 }
 
 void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
   if (io != NULL && io_ == NULL) {
     io_ = io;
-    Framebuffer::InitGPIO(io_, params_.rows, params_.parallel,
+#ifdef GPIO_TRACE_VCD
+    if (s_gpio_trace == NULL) s_gpio_trace = new GPIOTrace(GPIO_TRACE_ENTRIES);
+    io_->SetTrace(s_gpio_trace);
+#endif
+    Framebuffer::InitGPIO(io_, params_.rows, params_.parallel, bitplanes_,
                           !params_.disable_hardware_pulsing,
                           params_.pwm_lsb_nanoseconds, params_.pwm_dither_bits,
                           params_.row_address_type);
     Framebuffer::InitializePanels(io_, params_.panel_type,
                                   params_.cols * params_.chain_length);
+    Framebuffer::SetOutputBrightness(output_brightness_);
   }
   if (start_thread) {
     StartRefresh();
@@ -469,42 +1300,64 @@ bool RGBMatrix::Impl::StartRefresh() {
   if (updater_ == NULL && io_ != NULL) {
     updater_ = new UpdateThread(io_, active_, params_.pwm_dither_bits,
                                 params_.show_refresh_rate,
-                                params_.limit_refresh_rate_hz);
-    // If we have multiple processors, the kernel
-    // jumps around between these, creating some global flicker.
-    // So let's tie it to the last CPU available.
-    // The Raspberry Pi2 has 4 cores, our attempt to bind it to
-    //   core #3 will succeed.
-    // The Raspberry Pi1 only has one core, so this affinity
-    //   call will simply fail and we keep using the only core.
-    updater_->Start(99, (1<<3));  // Prio: high. Also: put on last CPU.
+                                params_.limit_refresh_rate_hz,
+                                params_.dma_output, scheduling_);
+    updater_->SetOutputBrightness(output_brightness_);
+    // Everything the refresh touches is allocated by now. Not MCL_FUTURE:
+    // after dropping privileges, RLIMIT_MEMLOCK would make later
+    // allocations of the application fail. Frames created later are locked
+    // in CreateFrameCanvas().
+    if (scheduling_.lock_memory && mlockall(MCL_CURRENT) != 0) {
+      fprintf(stderr, "Can't lock memory for the refresh: %s\n",
+              strerror(errno));
+    }
+    // If we have multiple processors, the kernel jumps around between
+    // these, creating some global flicker. So the thread pins itself to
+    // scheduling_.cpu, by default the last one; on single core Pis, that is
+    // the only one.
+    updater_->Start();
+    updater_->WaitPlaced();
   }
   return updater_ != NULL;
 }
 
+int RGBMatrix::Impl::GetRefreshCpu() const {
+  return updater_ ? updater_->cpu() : -1;
+}
+
 FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
   FrameCanvas *result =
     new FrameCanvas(new Framebuffer(params_.rows,
                                     params_.cols * params_.chain_length,
                                     params_.parallel,
+                                    bitplanes_,
                                     params_.scan_mode,
                                     params_.led_rgb_sequence,
                                     params_.inverse_colors,
+                                    params_.packed_framebuffer,
+                                    params_.pwm_temporal_dither_bits,
+                                    params_.hugepage_framebuffer,
                                     &shared_pixel_mapper_));
   if (created_frames_.empty()) {
     // First time. Get defaults from initial Framebuffer.
     do_luminance_correct_ = result->framebuffer()->luminance_correct();
   }
 
-  result->framebuffer()->SetPWMBits(params_.pwm_bits);
-  result->framebuffer()->set_luminance_correct(do_luminance_correct_);
-  result->framebuffer()->SetBrightness(params_.brightness);
+  ApplyFrameSettings(result);
+  result->framebuffer()->SetColorCalibration(color_calibration_);
+  if (scheduling_.lock_memory && updater_ != NULL) {
+    result->framebuffer()->LockMemory();  // Already touched, so best effort.
+  }
 
   created_frames_.push_back(result);
 
-  if (created_frames_.size() % 500 == 0) {
+  // Frames given back with ReleaseFrameCanvas() can bring the count down
+  // again, so only tell about new highs.
+  if (created_frames_.size() % 500 == 0
+      && created_frames_.size() > frames_warned_about_) {
+    frames_warned_about_ = created_frames_.size();
     if (created_frames_.size() == 500) {
-      fprintf(stderr, "CreateFrameCanvas() called %d times; Usually you only want to call it once (or at most a few times) for double-buffering. These frames will not be freed until the end of the program.\n"
+      fprintf(stderr, "CreateFrameCanvas() called %d times; Usually you only want to call it once (or at most a few times) for double-buffering. These frames will not be freed until the end of the program unless given back with ReleaseFrameCanvas().\n"
               "Typical reasons: \n"
               "  * Accidentally called CreateFrameCanvas() inside your inner loop (move outside the loop. Create offscreen-canvas once, then re-use. See SwapOnVSync() examples).\n"
               "  * Used to pre-compute many frames (use led_matrix::StreamWriter instead for such use-case. See e.g. led-image-viewer)\n",
@@ -518,20 +1371,93 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
   return result;
 }
 
+void RGBMatrix::Impl::ApplyFrameSettings(FrameCanvas *canvas) {
+  canvas->framebuffer()->SetPWMBits(params_.pwm_bits);
+  canvas->framebuffer()->set_luminance_correct(do_luminance_correct_);
+  canvas->framebuffer()->SetBrightness(params_.brightness);
+}
+
+FrameCanvas *RGBMatrix::Impl::AcquireFrameCanvas() {
+  if (pooled_frames_.empty()) return CreateFrameCanvas();
+  FrameCanvas *result = pooled_frames_.back();
+  pooled_frames_.pop_back();
+  ApplyFrameSettings(result);  // The user might have changed them.
+  result->Clear();
+  return result;
+}
+
+bool RGBMatrix::Impl::ReleaseFrameCanvas(FrameCanvas *canvas) {
+  std::vector<FrameCanvas*>::iterator found
+    = std::find(created_frames_.begin(), created_frames_.end(), canvas);
+  if (found == created_frames_.end()) {
+    fprintf(stderr, "ReleaseFrameCanvas(): not a canvas of this matrix.\n");
+    return false;
+  }
+  if (canvas == active_ || (updater_ && updater_->HoldsFrame(canvas))
+      || std::find(pooled_frames_.begin(), pooled_frames_.end(), canvas)
+      != pooled_frames_.end()) {
+    return false;  // Still in use or released before.
+  }
+  if (pooled_frames_.size() < kMaxPooledFrames) {
+    pooled_frames_.push_back(canvas);
+  } else {
+    created_frames_.erase(found);
+    delete canvas;
+  }
+  return true;
+}
+
 FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
-                                          unsigned frame_fraction) {
+                                          unsigned frame_fraction,
+                                          bool timed, uint32_t present_at_us,
+                                          uint32_t *presented_at_us) {
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
   if (!updater_) return NULL;
-  FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction);
+  FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction,
+                                                      timed, present_at_us,
+                                                      presented_at_us);
   if (other) active_ = other;
   return previous;
 }
 
+void RGBMatrix::Impl::GetRefreshStats(RefreshStats *stats) {
+  if (updater_) {
+    updater_->GetRefreshStats(stats);
+  } else {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+void RGBMatrix::Impl::ResetRefreshStats() {
+  if (updater_) updater_->ResetRefreshStats();
+}
+
+bool RGBMatrix::Impl::EnqueueFrame(FrameCanvas *canvas,
+                                   unsigned frame_fraction,
+                                   bool timed, uint32_t present_at_us) {
+  if (frame_fraction == 0) frame_fraction = 1;
+  if (!updater_ || canvas == NULL) return false;
+  if (!updater_->EnqueueFrame(canvas, frame_fraction, timed, present_at_us))
+    return false;
+  active_ = canvas;
+  return true;
+}
+
+FrameCanvas *RGBMatrix::Impl::ReclaimFrame(uint32_t *presented_at_us) {
+  if (!updater_) return NULL;
+  return updater_->ReclaimFrame(presented_at_us);
+}
+
 uint64_t RGBMatrix::Impl::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
 }
 
+int RGBMatrix::Impl::InputEventFd() {
+  if (!updater_) return -1;
+  return updater_->input_event_fd();
+}
+
 bool RGBMatrix::Impl::SetPWMBits(uint8_t value) {
   const bool success = active_->framebuffer()->SetPWMBits(value);
   if (success) {
@@ -561,35 +1487,98 @@ uint8_t RGBMatrix::Impl::brightness() {
   return params_.brightness;
 }
 
+void RGBMatrix::Impl::SetOutputBrightness(uint8_t brightness) {
+  if (brightness < 1) brightness = 1;
+  if (brightness > 100) brightness = 100;
+  output_brightness_ = brightness;
+  if (updater_) {
+    updater_->SetOutputBrightness(brightness);
+  } else if (io_) {
+    Framebuffer::SetOutputBrightness(brightness);  // No refresh running.
+  }
+}
+
 bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
-  if (mapper == NULL) return true;
-  using internal::PixelDesignatorMap;
-  const int old_width = shared_pixel_mapper_->width();
-  const int old_height = shared_pixel_mapper_->height();
-  int new_width, new_height;
-  if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
+  return ApplyPixelMapperTo(mapper, &shared_pixel_mapper_);
+}
+
+RGBMatrix::RefreshSettings RGBMatrix::Impl::GetRefreshSettings() const {
+  RefreshSettings result;
+  result.pwm_bits = params_.pwm_bits;
+  result.pwm_dither_bits = params_.pwm_dither_bits;
+  result.pwm_lsb_nanoseconds = params_.pwm_lsb_nanoseconds;
+  result.limit_refresh_rate_hz = params_.limit_refresh_rate_hz;
+  result.pixel_mapper_config = pixel_mapper_config_.c_str();
+  return result;
+}
+
+bool RGBMatrix::Impl::Reconfigure(const RefreshSettings &s) {
+  if (s.pwm_bits < 1 || s.pwm_bits > bitplanes_) {
+    fprintf(stderr, "Reconfigure: pwm-bits %d not in range 1..%d\n",
+            s.pwm_bits, bitplanes_);
     return false;
   }
-  PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
-    new_width, new_height, shared_pixel_mapper_->GetFillColorBits());
-  for (int y = 0; y < new_height; ++y) {
-    for (int x = 0; x < new_width; ++x) {
-      int orig_x = -1, orig_y = -1;
-      mapper->MapVisibleToMatrix(old_width, old_height,
-                                 x, y, &orig_x, &orig_y);
-      if (orig_x < 0 || orig_y < 0 ||
-          orig_x >= old_width || orig_y >= old_height) {
-        fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
-                "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
-        continue;
-      }
-      const internal::PixelDesignator *orig_designator;
-      orig_designator = shared_pixel_mapper_->get(orig_x, orig_y);
-      *new_mapper->get(x, y) = *orig_designator;
+  if (s.pwm_dither_bits < 0 || s.pwm_dither_bits > 2) {
+    fprintf(stderr, "Reconfigure: pwm-dither-bits %d not in range 0..2\n",
+            s.pwm_dither_bits);
+    return false;
+  }
+  if (s.pwm_lsb_nanoseconds < 50 || s.pwm_lsb_nanoseconds > 3000) {
+    fprintf(stderr, "Reconfigure: pwm-lsb-nanoseconds %d not in range "
+            "50..3000\n", s.pwm_lsb_nanoseconds);
+    return false;
+  }
+  if (s.limit_refresh_rate_hz < 0) {
+    fprintf(stderr, "Reconfigure: negative limit-refresh %d\n",
+            s.limit_refresh_rate_hz);
+    return false;
+  }
+  if (params_.dma_output
+      && (s.pwm_dither_bits != params_.pwm_dither_bits
+          || s.pwm_lsb_nanoseconds != params_.pwm_lsb_nanoseconds)) {
+    fprintf(stderr, "Reconfigure: pwm-dither-bits and pwm-lsb-nanoseconds "
+            "are fixed with DMA output\n");
+    return false;
+  }
+
+  // Expensive part done while the refresh goes on with the old settings.
+  PixelDesignatorMap *new_map = NULL;
+  if (s.pixel_mapper_config != NULL
+      && pixel_mapper_config_ != s.pixel_mapper_config) {
+    new_map = BuildPixelMap(s.pixel_mapper_config);
+    if (new_map == NULL) return false;
+  }
+
+  UpdateThread::Reconfiguration config;
+  config.bitplane_timings = Framebuffer::ComputeBitplaneTimings(
+    bitplanes_, s.pwm_lsb_nanoseconds, s.pwm_dither_bits);
+  config.dither_bits = s.pwm_dither_bits;
+  config.limit_refresh_hz = s.limit_refresh_rate_hz;
+  config.pwm_bits = s.pwm_bits;
+  config.frames = created_frames_;
+  if (updater_) {
+    updater_->Reconfigure(config);
+  } else {
+    if (io_ && !params_.dma_output) {   // Nobody refreshing, apply directly.
+      Framebuffer::SetBitplaneTimings(config.bitplane_timings,
+                                      config.dither_bits);
+    }
+    for (FrameCanvas *frame : created_frames_) {
+      frame->framebuffer()->SetPWMBits(s.pwm_bits);
     }
   }
-  delete shared_pixel_mapper_;
-  shared_pixel_mapper_ = new_mapper;
+
+  // The pixel map is only used while drawing, not by the refresh.
+  if (new_map) {
+    delete shared_pixel_mapper_;
+    shared_pixel_mapper_ = new_map;
+    pixel_mapper_config_ = s.pixel_mapper_config;
+    params_.pixel_mapper_config = pixel_mapper_config_.c_str();
+  }
+  params_.pwm_bits = s.pwm_bits;
+  params_.pwm_dither_bits = s.pwm_dither_bits;
+  params_.pwm_lsb_nanoseconds = s.pwm_lsb_nanoseconds;
+  params_.limit_refresh_rate_hz = s.limit_refresh_rate_hz;
   return true;
 }
 
@@ -650,6 +1639,44 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
     return NULL;
   }
 
+  RGBMatrix::Impl::RefreshScheduling scheduling;
+  const char *policy = runtime_options.refresh_scheduling;
+  if (policy == NULL || strcasecmp(policy, "fifo") == 0) {
+    scheduling.policy = SCHED_FIFO;
+  } else if (strcasecmp(policy, "deadline") == 0) {
+    scheduling.policy = SCHED_DEADLINE;
+  } else if (strcasecmp(policy, "other") == 0) {
+    scheduling.policy = SCHED_OTHER;
+  } else {
+    fprintf(stderr, "--led-refresh-sched=%s: expected one of fifo, "
+            "deadline or other\n", policy);
+    return NULL;
+  }
+  if (scheduling.policy != SCHED_OTHER
+      && (runtime_options.refresh_priority < 1
+          || runtime_options.refresh_priority > 99)) {
+    fprintf(stderr, "--led-refresh-priority=%d is outside usable range "
+            "1..99\n", runtime_options.refresh_priority);
+    return NULL;
+  }
+  const int cores = std::min(32L, sysconf(_SC_NPROCESSORS_CONF));
+  if (runtime_options.refresh_cpu < -1
+      || runtime_options.refresh_cpu >= cores) {
+    fprintf(stderr, "--led-refresh-cpu=%d: this machine has CPUs 0..%d\n",
+            runtime_options.refresh_cpu, cores - 1);
+    return NULL;
+  }
+  if (runtime_options.refresh_cpu >= 0) {
+    scheduling.cpu = runtime_options.refresh_cpu;
+  } else {
+    // The deadline scheduler wants to place the thread itself.
+    scheduling.cpu = (scheduling.policy == SCHED_DEADLINE)
+      ? -1 : std::min(DefaultRefreshCpu(), cores - 1);
+  }
+  scheduling.priority = runtime_options.refresh_priority;
+  scheduling.lock_memory = runtime_options.lock_memory;
+  SetRefreshCpu(scheduling.cpu);  // Before the timing is calibrated.
+
   static GPIO io;  // This static var is a little bit icky.
   if (runtime_options.do_gpio_init
       && !io.Init(runtime_options.gpio_slowdown)) {
@@ -663,6 +1690,7 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
   }
 
   RGBMatrix::Impl *result = new RGBMatrix::Impl(NULL, options);
+  result->SetRefreshScheduling(scheduling);
   // Allowing daemon also means we are allowed to start the thread now.
   const bool allow_daemon = !(runtime_options.daemon < 0);
   if (runtime_options.do_gpio_init)
@@ -699,14 +1727,46 @@ RGBMatrix *RGBMatrix::CreateFromFlags(int *argc, char ***argv,
 FrameCanvas *RGBMatrix::CreateFrameCanvas() {
   return impl_->CreateFrameCanvas();
 }
+FrameCanvas *RGBMatrix::AcquireFrameCanvas() {
+  return impl_->AcquireFrameCanvas();
+}
+bool RGBMatrix::ReleaseFrameCanvas(FrameCanvas *canvas) {
+  return impl_->ReleaseFrameCanvas(canvas);
+}
 FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned framerate_fraction) {
-  return impl_->SwapOnVSync(other, framerate_fraction);
+  return impl_->SwapOnVSync(other, framerate_fraction, false, 0, NULL);
+}
+FrameCanvas *RGBMatrix::SwapOnVSyncAt(FrameCanvas *other,
+                                      uint32_t present_at_us,
+                                      uint32_t *presented_at_us) {
+  return impl_->SwapOnVSync(other, 1, true, present_at_us, presented_at_us);
+}
+bool RGBMatrix::EnqueueFrame(FrameCanvas *canvas,
+                             unsigned framerate_fraction) {
+  return impl_->EnqueueFrame(canvas, framerate_fraction, false, 0);
+}
+bool RGBMatrix::EnqueueFrameAt(FrameCanvas *canvas, uint32_t present_at_us) {
+  return impl_->EnqueueFrame(canvas, 1, true, present_at_us);
+}
+FrameCanvas *RGBMatrix::ReclaimFrame(uint32_t *presented_at_us) {
+  return impl_->ReclaimFrame(presented_at_us);
 }
+void RGBMatrix::GetRefreshStats(RefreshStats *stats) {
+  impl_->GetRefreshStats(stats);
+}
+void RGBMatrix::ResetRefreshStats() { impl_->ResetRefreshStats(); }
+int RGBMatrix::GetRefreshCpu() const { return impl_->GetRefreshCpu(); }
 bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   return impl_->ApplyPixelMapper(mapper);
 }
 bool RGBMatrix::SetPWMBits(uint8_t value) { return impl_->SetPWMBits(value); }
+RGBMatrix::RefreshSettings RGBMatrix::GetRefreshSettings() const {
+  return impl_->GetRefreshSettings();
+}
+bool RGBMatrix::Reconfigure(const RefreshSettings &settings) {
+  return impl_->Reconfigure(settings);
+}
 uint8_t RGBMatrix::pwmbits() { return impl_->pwmbits(); }
 
 void RGBMatrix::set_luminance_correct(bool on) {
@@ -719,12 +1779,20 @@ void RGBMatrix::SetBrightness(uint8_t brightness) {
 }
 uint8_t RGBMatrix::brightness() { return impl_->brightness(); }
 
+void RGBMatrix::SetOutputBrightness(uint8_t brightness) {
+  impl_->SetOutputBrightness(brightness);
+}
+uint8_t RGBMatrix::output_brightness() { return impl_->output_brightness(); }
+
 uint64_t RGBMatrix::RequestInputs(uint64_t all_interested_bits) {
   return impl_->RequestInputs(all_interested_bits);
 }
 uint64_t RGBMatrix::AwaitInputChange(int timeout_ms) {
   return impl_->AwaitInputChange(timeout_ms);
 }
+int RGBMatrix::InputEventFd() {
+  return impl_->InputEventFd();
+}
 
 uint64_t RGBMatrix::RequestOutputs(uint64_t all_interested_bits) {
   return impl_->RequestOutputs(all_interested_bits);
@@ -756,6 +1824,11 @@ void RGBMatrix::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   impl_->active_->Fill(red, green, blue);
 }
 
+void RGBMatrix::FillRect(int x, int y, int width, int height,
+                         uint8_t red, uint8_t green, uint8_t blue) {
+  impl_->active_->FillRect(x, y, width, height, red, green, blue);
+}
+
 // FrameCanvas implementation of Canvas
 FrameCanvas::~FrameCanvas() { delete frame_; }
 int FrameCanvas::width() const { return frame_->width(); }
@@ -772,6 +1845,10 @@ void FrameCanvas::Clear() { return frame_->Clear(); }
 void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   frame_->Fill(red, green, blue);
 }
+void FrameCanvas::FillRect(int x, int y, int width, int height,
+                           uint8_t red, uint8_t green, uint8_t blue) {
+  frame_->FillRect(x, y, width, height, red, green, blue);
+}
 bool FrameCanvas::SetPWMBits(uint8_t value) { return frame_->SetPWMBits(value); }
 uint8_t FrameCanvas::pwmbits() { return frame_->pwmbits(); }
 
@@ -791,4 +1868,51 @@ bool FrameCanvas::Deserialize(const char *data, size_t len) {
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
+int FrameCanvas::NumSegments() const { return frame_->double_rows(); }
+uint64_t FrameCanvas::ChangedSegments() const {
+  return frame_->changed_rows();
+}
+void FrameCanvas::ClearChanged() { frame_->ClearChanged(); }
+void FrameCanvas::CopyChangedFrom(const FrameCanvas &other) {
+  frame_->CopyChangedFrom(other.frame_);
+}
+void FrameCanvas::SerializeSegment(int segment,
+                                   const char **data, size_t *len) const {
+  frame_->SerializeRow(segment, data, len);
+}
+// Parallel drawing happens on all but the core the refresh thread is pinned
+// to (--led-refresh-cpu, as set when the matrix was created); if it is not
+// pinned, on all cores. The calling thread is one of the drawing threads.
+static WorkerPool *GetDrawingWorkers() {
+  static WorkerPool *const pool = []() {
+    const int refresh_cpu = RefreshCpu();
+    const int cores = std::min(31L, sysconf(_SC_NPROCESSORS_ONLN));
+    uint32_t mask = (1u << cores) - 1;
+    int drawing_cores = cores;
+    if (refresh_cpu >= 0 && refresh_cpu < cores && cores > 1) {
+      mask &= ~(1u << refresh_cpu);
+      --drawing_cores;
+    }
+    return new WorkerPool(std::max(0, drawing_cores - 1), mask);
+  }();
+  return pool;
+}
+
+void FrameCanvas::ParallelForRows(
+  int band_height, const std::function<void(int y_begin, int y_end)> &fn) {
+  if (band_height < 1) band_height = 1;
+  std::vector<std::vector<int> > groups;
+  frame_->GetIndependentRowBands(band_height, &groups);
+  const int height = frame_->height();
+  GetDrawingWorkers()->Run(groups.size(), [&](int group) {
+    for (int band : groups[group]) {
+      const int y_begin = band * band_height;
+      fn(y_begin, std::min(y_begin + band_height, height));
+    }
+  });
+}
+
+void FrameCanvas::SetFrameRGB(const uint8_t *rgb, int stride) {
+  frame_->SetFrameRGB(rgb, stride);
+}
 }  // end namespace rgb_matrix
@@ -13,6 +13,7 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
 
+#include <string>
 #include <vector>
 
 #include "pixel-mapper.h"
@@ -34,5 +35,13 @@ public:
 typedef std::vector<const MultiplexMapper*> MuxMapperList;
 const MuxMapperList &GetRegisteredMultiplexMappers();
 
+// Create a multiplex mapper from a table description as given in
+// --led-multiplex-table, or from the file named after a leading '@'.
+// Returns a new mapper to be deleted by the caller or NULL with an
+// explanation appended to "err".
+MultiplexMapper *CreateTableMultiplexMapper(const char *description,
+                                            int panel_cols, int panel_rows,
+                                            std::string *err);
+
 }  // namespace internal
 }  // namespace rgb_matrix
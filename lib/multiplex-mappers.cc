@@ -15,6 +15,10 @@
 
 #include "multiplex-mappers-internal.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 namespace rgb_matrix {
 namespace internal {
 // A Pixel Mapper maps physical pixels locations to the internal logical
@@ -454,6 +458,143 @@ public:
   }
 };
 
+/*
+ * Multiplexing described by a table instead of code, so that new panel
+ * types can be used without writing a mapper. The panel is made of tiles of
+ * tile_width x tile_height visible pixels; for each of these (row by row)
+ * the table has the position within the corresponding tile of the
+ * underlying matrix, which has "stretch" times the width and 1/stretch the
+ * height.
+ */
+class TableMultiplexMapper : public MultiplexMapperBase {
+public:
+  TableMultiplexMapper(const std::string &name, int stretch,
+                       int tile_width, int tile_height,
+                       const std::vector<int> &table)
+    : MultiplexMapperBase("Table", stretch), description_(name),
+      tile_width_(tile_width), tile_height_(tile_height), table_(table) {
+  }
+
+  // The full table, so that it can be told apart from other tables.
+  virtual const char *GetName() const { return description_.c_str(); }
+
+  void MapSinglePanel(int x, int y, int *matrix_x, int *matrix_y) const {
+    const int entry = 2 * ((y % tile_height_) * tile_width_
+                           + (x % tile_width_));
+    *matrix_x = (x / tile_width_) * tile_width_ * panel_stretch_factor_
+      + table_[entry];
+    *matrix_y = (y / tile_height_) * tile_height_ / panel_stretch_factor_
+      + table_[entry + 1];
+  }
+
+private:
+  const std::string description_;
+  const int tile_width_;
+  const int tile_height_;
+  const std::vector<int> table_;  // Pairs of x, y.
+};
+
+static bool ReadTableFile(const char *filename, std::string *content,
+                          std::string *err) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    err->append("Can't open multiplex table file ").append(filename)
+      .append("\n");
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    content->append(line).append(" ");
+  }
+  fclose(f);
+  return true;
+}
+
+MultiplexMapper *CreateTableMultiplexMapper(const char *description,
+                                            int panel_cols, int panel_rows,
+                                            std::string *err) {
+  std::string content;
+  if (description[0] == '@') {
+    if (!ReadTableFile(description + 1, &content, err))
+      return NULL;
+  } else {
+    content = description;
+  }
+
+  int stretch = 1;
+  int tile_width = 0, tile_height = 0;
+  std::vector<int> table;
+  // Canonical form used as name, so that e.g. the pixel mapper cache
+  // notices changes in a table file.
+  std::string canonical;
+  const char *const kSeparators = " \t\r\n;";
+  char *const tokens = strdup(content.c_str());
+  char *saveptr = NULL;
+  bool success = true;
+  for (char *t = strtok_r(tokens, kSeparators, &saveptr); t && success;
+       t = strtok_r(NULL, kSeparators, &saveptr)) {
+    int a, b, consumed = 0;
+    if (sscanf(t, "stretch=%d%n", &a, &consumed) == 1
+        && t[consumed] == '\0') {
+      stretch = a;
+    } else if (sscanf(t, "tile=%dx%d%n", &a, &b, &consumed) == 2
+               && t[consumed] == '\0') {
+      tile_width = a;
+      tile_height = b;
+    } else if (sscanf(t, "%d,%d%n", &a, &b, &consumed) == 2
+               && t[consumed] == '\0') {
+      table.push_back(a);
+      table.push_back(b);
+    } else {
+      err->append("Multiplex table: can't parse '").append(t).append("'\n");
+      success = false;
+    }
+  }
+  free(tokens);
+  if (!success) return NULL;
+
+  if (stretch < 1 || tile_width < 1 || tile_height < 1
+      || tile_height % stretch != 0) {
+    err->append("Multiplex table needs tile=<width>x<height> with the "
+                "height divisible by stretch=<factor>.\n");
+    return NULL;
+  }
+  if (panel_cols % tile_width != 0 || panel_rows % tile_height != 0) {
+    err->append("Multiplex table tile size has to divide the panel size "
+                "given with --led-cols and --led-rows.\n");
+    return NULL;
+  }
+  const int matrix_width = tile_width * stretch;
+  const int matrix_height = tile_height / stretch;
+  if ((int)table.size() != 2 * tile_width * tile_height) {
+    err->append("Multiplex table needs exactly one x,y for each pixel "
+                "of the tile.\n");
+    return NULL;
+  }
+  std::vector<bool> used(matrix_width * matrix_height, false);
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "Table:%d;%dx%d", stretch,
+           tile_width, tile_height);
+  canonical = buffer;
+  for (size_t i = 0; i < table.size(); i += 2) {
+    const int x = table[i], y = table[i + 1];
+    if (x < 0 || x >= matrix_width || y < 0 || y >= matrix_height
+        || used[y * matrix_width + x]) {
+      snprintf(buffer, sizeof(buffer), "%d,%d", x, y);
+      err->append("Multiplex table: position ").append(buffer)
+        .append(" outside the stretched tile or used twice.\n");
+      return NULL;
+    }
+    used[y * matrix_width + x] = true;
+    snprintf(buffer, sizeof(buffer), ";%d,%d", x, y);
+    canonical.append(buffer);
+  }
+  return new TableMultiplexMapper(canonical, stretch,
+                                  tile_width, tile_height, table);
+}
+
 /*
  * Here is where the registration happens.
  * If you add an instance of the mapper here, it will automatically be
@@ -23,10 +23,12 @@
 #include <grp.h>
 #include <pwd.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "multiplex-mappers-internal.h"
 #include "framebuffer-internal.h"
+#include "color-calibration.h"
 
 #include "gpio.h"
 
@@ -41,7 +43,11 @@ RuntimeOptions::RuntimeOptions() :
   drop_privileges(1),   // Encourage good practice: drop privileges by default.
   do_gpio_init(true),
   drop_priv_user("daemon"),
-  drop_priv_group("daemon")
+  drop_priv_group("daemon"),
+  refresh_cpu(-1),
+  refresh_scheduling("fifo"),
+  refresh_priority(99),
+  lock_memory(false)
 {
   // Nothing to see here.
 }
@@ -155,9 +161,18 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeStringFlag("pixel-mapper", it, end,
                             &mopts->pixel_mapper_config, &err))
         continue;
+      if (ConsumeStringFlag("pixel-mapper-cache", it, end,
+                            &mopts->pixel_mapper_cache, &err))
+        continue;
+      if (ConsumeStringFlag("multiplex-table", it, end,
+                            &mopts->multiplex_table, &err))
+        continue;
       if (ConsumeStringFlag("panel-type", it, end,
                             &mopts->panel_type, &err))
         continue;
+      if (ConsumeStringFlag("color-calibration", it, end,
+                            &mopts->color_calibration, &err))
+        continue;
       if (ConsumeIntFlag("rows", it, end, &mopts->rows, &err))
         continue;
       if (ConsumeIntFlag("cols", it, end, &mopts->cols, &err))
@@ -180,6 +195,9 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeIntFlag("pwm-dither-bits", it, end,
                          &mopts->pwm_dither_bits, &err))
         continue;
+      if (ConsumeIntFlag("pwm-temporal-dither", it, end,
+                         &mopts->pwm_temporal_dither_bits, &err))
+        continue;
       if (ConsumeIntFlag("row-addr-type", it, end,
                          &mopts->row_address_type, &err))
         continue;
@@ -190,6 +208,13 @@ static bool FlagInit(int &argc, char **&argv,
         continue;
       if (ConsumeBoolFlag("inverse", it, &mopts->inverse_colors))
         continue;
+      if (ConsumeBoolFlag("packed-framebuffer", it,
+                          &mopts->packed_framebuffer))
+        continue;
+      if (ConsumeBoolFlag("dma", it, &mopts->dma_output))
+        continue;
+      if (ConsumeBoolFlag("hugepages", it, &mopts->hugepage_framebuffer))
+        continue;
       // We don't have a swap_green_blue option anymore, but we simulate the
       // flag for a while.
       bool swap_green_blue;
@@ -236,6 +261,18 @@ static bool FlagInit(int &argc, char **&argv,
                             &ropts->drop_priv_group, &err)) {
         continue;
       }
+      if (ConsumeIntFlag("refresh-cpu", it, end, &ropts->refresh_cpu, &err))
+        continue;
+      if (ConsumeStringFlag("refresh-sched", it, end,
+                            &ropts->refresh_scheduling, &err)) {
+        continue;
+      }
+      if (ConsumeIntFlag("refresh-priority", it, end,
+                         &ropts->refresh_priority, &err)) {
+        continue;
+      }
+      if (ConsumeBoolFlag("lock-memory", it, &ropts->lock_memory))
+        continue;
 
       if (strncmp(*it, OPTION_PREFIX, OPTION_PREFIX_LEN) == 0) {
         fprintf(stderr, "Option %s starts with %s but it is unknown. Typo?\n",
@@ -317,9 +354,11 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
 #endif
           "(Default: %d).\n"
           "\t--led-multiplexing=<0..%d> : Mux type: 0=direct; %s (Default: 0)\n"
+          "\t--led-multiplex-table=<table|@file>: Multiplexing given as table instead.\n"
           "\t--led-pixel-mapper        : Semicolon-separated list of pixel-mappers to arrange pixels.\n"
           "\t                            Optional params after a colon e.g. \"U-mapper;Rotate:90\"\n"
           "\t                            Available: %s. Default: \"\"\n"
+          "\t--led-pixel-mapper-cache=<file>: Keep pixel mapping in file for faster start.\n"
           "\t--led-pwm-bits=<1..%d>    : PWM bits (Default: %d).\n"
           "\t--led-brightness=<percent>: Brightness in percent (Default: %d).\n"
           "\t--led-scan-mode=<0..1>    : 0 = progressive; 1 = interlaced "
@@ -337,20 +376,32 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "(Default: %d)\n"
           "\t--led-pwm-dither-bits=<0..2> : Time dithering of lower bits "
           "(Default: 0)\n"
+          "\t--led-pwm-temporal-dither=<0..2> : Additional color bits shown "
+          "over several refreshes (Default: 0)\n"
           "\t--led-%shardware-pulse   : %sse hardware pin-pulse generation.\n"
-          "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A', 'FM6127'\n",
+          "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A', 'FM6127'\n"
+          "\t--led-color-calibration=<spec|@file>: Per-channel correction, e.g. \"gain=1,0.9,0.85;gamma=2.2;lut=panel.cube\"\n"
+          "\t--led-%spacked-framebuffer : %store only color bits in framebuffer; "
+          "less memory, more CPU while refreshing.\n"
+          "\t--led-%sdma               : %sefresh with DMA instead of CPU.\n"
+          "\t--led-%shugepages         : %sut framebuffers into huge pages.\n",
           d.hardware_mapping,
           d.rows, d.cols, d.chain_length, d.parallel,
           (int) muxers.size(), CreateAvailableMultiplexString(muxers).c_str(),
           available_mappers.c_str(),
-          internal::Framebuffer::kBitPlanes, d.pwm_bits,
+          internal::Framebuffer::kMaxBitPlanes, d.pwm_bits,
           d.brightness, d.scan_mode,
           d.show_refresh_rate ? "no-" : "", d.show_refresh_rate ? "Don't s" : "S",
           d.limit_refresh_rate_hz,
           d.inverse_colors ? "no-" : "",    d.inverse_colors ? "off" : "on",
           d.pwm_lsb_nanoseconds,
           !d.disable_hardware_pulsing ? "no-" : "",
-          !d.disable_hardware_pulsing ? "Don't u" : "U");
+          !d.disable_hardware_pulsing ? "Don't u" : "U",
+          d.packed_framebuffer ? "no-" : "",
+          d.packed_framebuffer ? "Don't s" : "S",
+          d.dma_output ? "no-" : "", d.dma_output ? "Don't r" : "R",
+          d.hugepage_framebuffer ? "no-" : "",
+          d.hugepage_framebuffer ? "Don't p" : "P");
 
   fprintf(out, "\t--led-slowdown-gpio=<0..4>: "
           "Slowdown GPIO. Needed for faster Pis/slower panels "
@@ -375,6 +426,19 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
             "Drop privileges to this groupname or GID (Default: '%s')\n",
             r.drop_priv_group);
   }
+  fprintf(out, "\t--led-refresh-cpu=<cpu>   : "
+          "CPU core to run the refresh on; -1: last core (Default: %d)\n",
+          r.refresh_cpu);
+  fprintf(out, "\t--led-refresh-sched=<..>  : "
+          "Refresh scheduling: fifo, deadline or other (Default: %s)\n",
+          r.refresh_scheduling);
+  fprintf(out, "\t--led-refresh-priority=<1..99>: "
+          "Realtime priority with fifo scheduling (Default: %d)\n",
+          r.refresh_priority);
+  fprintf(out, "\t--led-%slock-memory%s      : %sock memory against page "
+          "faults while refreshing.\n",
+          r.lock_memory ? "no-" : "", r.lock_memory ? "" : "   ",
+          r.lock_memory ? "Don't l" : "L");
 }
 
 bool RGBMatrix::Options::Validate(std::string *err_in) const {
@@ -406,6 +470,18 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
+  if (multiplex_table != NULL && *multiplex_table != '\0') {
+    if (multiplexing != 0) {
+      err->append("Only one of --led-multiplexing and --led-multiplex-table "
+                  "can be given.\n");
+      success = false;
+    }
+    internal::MultiplexMapper *table_mapper
+      = internal::CreateTableMultiplexMapper(multiplex_table, cols, rows, err);
+    if (table_mapper == NULL) success = false;
+    delete table_mapper;
+  }
+
   if (row_address_type < 0 || row_address_type > 4) {
     err->append("Row address type values can be 0 (default), 1 (AB addressing), 2 (direct row select), 3 (ABC address), 4 (ABC Shift + DE direct).\n");
     success = false;
@@ -430,11 +506,11 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
-  if (pwm_bits <= 0 || pwm_bits > internal::Framebuffer::kBitPlanes) {
+  if (pwm_bits <= 0 || pwm_bits > internal::Framebuffer::kMaxBitPlanes) {
     char buffer[256];
     snprintf(buffer, sizeof(buffer),
              "Invalid range of pwm-bits (1..%d allowed).\n",
-             internal::Framebuffer::kBitPlanes);
+             internal::Framebuffer::kMaxBitPlanes);
     err->append(buffer);
     success = false;
   }
@@ -454,6 +530,27 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
+  const int bitplanes = std::max((int)internal::Framebuffer::kDefaultBitPlanes,
+                                 pwm_bits);
+  if (pwm_temporal_dither_bits < 0 || pwm_temporal_dither_bits > 2
+      || bitplanes + pwm_temporal_dither_bits
+      > internal::Framebuffer::kMaxBitPlanes) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "Invalid range of pwm-temporal-dither (0..2 allowed, and "
+             "pwm-bits plus that at most %d).\n",
+             internal::Framebuffer::kMaxBitPlanes);
+    err->append(buffer);
+    success = false;
+  }
+
+  if (color_calibration != NULL && *color_calibration != '\0') {
+    internal::ColorCalibration *calibration
+      = internal::ColorCalibration::Create(color_calibration, err);
+    if (calibration == NULL) success = false;
+    delete calibration;
+  }
+
   if (led_rgb_sequence == NULL || strlen(led_rgb_sequence) != 3) {
     err->append("led-sequence needs to be three characters long.\n");
     success = false;
@@ -0,0 +1,56 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_SEQLOCK_INTERNAL_H
+#define RPI_RGBMATRIX_SEQLOCK_INTERNAL_H
+
+#include <string.h>
+
+#include <atomic>
+
+namespace rgb_matrix {
+namespace internal {
+// Publish a plain data struct from one writer thread to any number of
+// readers without locks. The writer never waits; readers retry if they
+// happened to read while it was written.
+template <typename T>
+class SeqLock {
+public:
+  SeqLock() : sequence_(0) { memset(&value_, 0, sizeof(value_)); }
+
+  // Only to be called from a single writer thread.
+  void Write(const T &value) {
+    const unsigned seq = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(seq + 1, std::memory_order_relaxed);  // Odd: writing.
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&value_, &value, sizeof(value_));
+    sequence_.store(seq + 2, std::memory_order_release);
+  }
+
+  void Read(T *value) const {
+    unsigned before, after;
+    do {
+      before = sequence_.load(std::memory_order_acquire);
+      memcpy(value, &value_, sizeof(value_));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+  }
+
+private:
+  std::atomic<unsigned> sequence_;
+  T value_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_SEQLOCK_INTERNAL_H
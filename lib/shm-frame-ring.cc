@@ -0,0 +1,211 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "shm-frame-ring.h"
+#include "led-matrix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+namespace rgb_matrix {
+static const uint32_t kMagic = 0x4c524e47;  // "LRNG"
+static const size_t kSlotAlign = 64;
+
+// Layout as documented in the header. Atomics on plain 32 bit words, so
+// these work between processes.
+struct SharedFrameRing::Header {
+  uint32_t magic;
+  uint32_t width, height, slots;
+  std::atomic<uint32_t> latest;
+  std::atomic<uint32_t> sequence[kMaxSlots];
+};
+static const size_t kHeaderWords = 5 + SharedFrameRing::kMaxSlots;
+
+static size_t HeaderSize() {
+  return (4 * kHeaderWords + kSlotAlign - 1) / kSlotAlign * kSlotAlign;
+}
+static uint64_t SlotSize(uint32_t width, uint32_t height) {
+  return (3ULL * width * height + kSlotAlign - 1) / kSlotAlign * kSlotAlign;
+}
+
+static void FutexWake(std::atomic<uint32_t> *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+static void FutexWait(std::atomic<uint32_t> *word, uint32_t value,
+                      int timeout_ms) {
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  syscall(SYS_futex, word, FUTEX_WAIT, value,
+          timeout_ms < 0 ? NULL : &timeout, NULL, 0);
+}
+
+SharedFrameRing::SharedFrameRing(const char *name, bool owner,
+                                 void *mem, size_t size,
+                                 int width, int height, int slots)
+  : name_(strdup(name)), owner_(owner), mem_(mem), size_(size),
+    header_((Header*)mem), width_(width), height_(height), slots_(slots),
+    writing_(0), shown_(0) {
+  static_assert(sizeof(Header) == 4 * kHeaderWords, "Plain word layout");
+}
+
+SharedFrameRing *SharedFrameRing::Create(const char *name,
+                                         int width, int height, int slots,
+                                         mode_t mode) {
+  if (width <= 0 || height <= 0 || slots < 2 || slots > kMaxSlots) {
+    fprintf(stderr, "Invalid frame ring %dx%d with %d slots\n",
+            width, height, slots);
+    return NULL;
+  }
+  shm_unlink(name);  // Start fresh, it might have a different size.
+  const int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, mode);
+  if (fd < 0) {
+    fprintf(stderr, "Can't create frame ring %s: %s\n", name, strerror(errno));
+    return NULL;
+  }
+  fchmod(fd, mode);  // Independent of umask.
+  const size_t size = HeaderSize() + slots * SlotSize(width, height);
+  void *mem = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Can't map frame ring %s: %s\n", name, strerror(errno));
+    shm_unlink(name);
+    return NULL;
+  }
+  Header *header = (Header*) mem;  // ftruncate() zeroed it.
+  header->width = width;
+  header->height = height;
+  header->slots = slots;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = kMagic;
+  return new SharedFrameRing(name, true, mem, size, width, height, slots);
+}
+
+SharedFrameRing *SharedFrameRing::Open(const char *name) {
+  const int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open frame ring %s: %s\n", name, strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  void *mem = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= HeaderSize()) {
+    mem = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Can't map frame ring %s\n", name);
+    return NULL;
+  }
+  // Whoever can write the ring can change its header any time, so the
+  // geometry is only read once here and checked against what is mapped.
+  const Header *header = (const Header*) mem;
+  const uint32_t magic = header->magic;
+  std::atomic_thread_fence(std::memory_order_acquire);  // Pairs with Create()
+  const uint32_t width = header->width;
+  const uint32_t height = header->height;
+  const uint32_t slots = header->slots;
+  if (magic != kMagic || slots < 2 || slots > (uint32_t)kMaxSlots
+      || width == 0 || height == 0 || width > INT16_MAX || height > INT16_MAX
+      || HeaderSize() + slots * SlotSize(width, height)
+      > (uint64_t)st.st_size) {
+    fprintf(stderr, "%s is not a valid frame ring\n", name);
+    munmap(mem, st.st_size);
+    return NULL;
+  }
+  SharedFrameRing *result = new SharedFrameRing(name, false, mem, st.st_size,
+                                                width, height, slots);
+  // New producers continue the numbering; consumers only want what's next.
+  result->writing_ = result->shown_ = header->latest.load();
+  return result;
+}
+
+SharedFrameRing::~SharedFrameRing() {
+  munmap(mem_, size_);
+  if (owner_) shm_unlink(name_);
+  free(name_);
+}
+
+int SharedFrameRing::width() const { return width_; }
+int SharedFrameRing::height() const { return height_; }
+
+const uint8_t *SharedFrameRing::Slot(int slot) const {
+  return (const uint8_t*)mem_ + HeaderSize() + slot * SlotSize(width_, height_);
+}
+
+uint8_t *SharedFrameRing::BeginFrame() {
+  ++writing_;
+  if (writing_ == 0) ++writing_;  // Zero means 'no frame'.
+  // The parity is set explicitly rather than counted, so that a slot left
+  // odd by a producer that died while writing is fine for the next one.
+  std::atomic<uint32_t> &seq = header_->sequence[writing_ % slots_];
+  seq.store(seq.load(std::memory_order_relaxed) | 1,
+            std::memory_order_relaxed);  // Odd: writing.
+  std::atomic_thread_fence(std::memory_order_release);
+  return const_cast<uint8_t*>(Slot(writing_ % slots_));
+}
+
+void SharedFrameRing::EndFrame() {
+  std::atomic<uint32_t> &seq = header_->sequence[writing_ % slots_];
+  seq.store((seq.load(std::memory_order_relaxed) | 1) + 1,
+            std::memory_order_release);  // Even: done.
+  header_->latest.store(writing_, std::memory_order_release);
+  FutexWake(&header_->latest);
+}
+
+bool SharedFrameRing::GetNewest(FrameCanvas *canvas, int timeout_ms) {
+  if (canvas->width() != width_ || canvas->height() != height_) {
+    fprintf(stderr, "Frame ring %s is %dx%d, but the canvas %dx%d\n",
+            name_, width_, height_, canvas->width(), canvas->height());
+    return false;
+  }
+  for (;;) {
+    const uint32_t latest = header_->latest.load(std::memory_order_acquire);
+    if (latest == shown_) {
+      FutexWait(&header_->latest, latest, timeout_ms);
+      if (header_->latest.load(std::memory_order_acquire) == shown_)
+        return false;  // Timeout (or spurious wakeup, same thing to caller).
+      continue;
+    }
+    const int slot = latest % slots_;
+    const uint32_t before
+      = header_->sequence[slot].load(std::memory_order_acquire);
+    if (before & 1) {   // Producer lapped us and is already rewriting it.
+      sched_yield();
+      continue;
+    }
+    canvas->SetFrameRGB(Slot(slot), 3 * width_);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->sequence[slot].load(std::memory_order_relaxed) != before)
+      continue;  // Changed while we were reading; take the newer one.
+    shown_ = latest;
+    return true;
+  }
+}
+}  // namespace rgb_matrix
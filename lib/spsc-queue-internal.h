@@ -0,0 +1,92 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_SPSC_QUEUE_INTERNAL_H
+#define RPI_RGBMATRIX_SPSC_QUEUE_INTERNAL_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+namespace rgb_matrix {
+namespace internal {
+// A fixed size queue without locks for exactly one producer and one consumer
+// thread. "N" must be a power of two.
+template <typename T, unsigned N>
+class SPSCQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "N must be power of two");
+
+public:
+  SPSCQueue() : head_(0), tail_(0) {}
+
+  // -- Producer side.
+
+  // Add "value" to the end of the queue. Returns false if full.
+  bool Push(const T &value) {
+    const unsigned tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == N)
+      return false;
+    items_[tail % N] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // -- Consumer side.
+
+  // Returns the next element without removing it or NULL if empty.
+  const T *Peek() const {
+    const unsigned head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return NULL;
+    return &items_[head % N];
+  }
+
+  // Remove the next element and store it in "value". Returns false if empty.
+  bool Pop(T *value) {
+    const T *next = Peek();
+    if (next == NULL) return false;
+    *value = *next;
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+    return true;
+  }
+
+  // -- Both sides. Only exact for the side which would be blocked: the
+  // consumer sees an empty queue correctly, the producer a full one.
+  bool Empty() const {
+    return head_.load(std::memory_order_acquire)
+      == tail_.load(std::memory_order_acquire);
+  }
+  bool Full() const {
+    return tail_.load(std::memory_order_acquire)
+      - head_.load(std::memory_order_acquire) == N;
+  }
+
+  // Call "f" with each element. Elements in the queue for the whole time of
+  // the call are seen; others added or removed meanwhile might be or not.
+  template <typename F> void ForEach(F f) const {
+    const unsigned tail = tail_.load(std::memory_order_acquire);
+    for (unsigned i = head_.load(std::memory_order_acquire); i != tail; ++i) {
+      f(items_[i % N]);
+    }
+  }
+
+private:
+  // Free running positions; only the lower bits index into items_.
+  std::atomic<unsigned> head_;  // Written by consumer.
+  std::atomic<unsigned> tail_;  // Written by producer.
+  T items_[N];
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_SPSC_QUEUE_INTERNAL_H
@@ -0,0 +1,99 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "worker-pool.h"
+
+namespace rgb_matrix {
+namespace internal {
+class WorkerPool::Worker : public Thread {
+public:
+  Worker(WorkerPool *pool) : pool_(pool) {}
+
+  virtual void Run() {
+    unsigned seen_generation = 0;
+    for (;;) {
+      {
+        MutexLock l(&pool_->mutex_);
+        while (pool_->generation_ == seen_generation && !pool_->shutdown_) {
+          pool_->mutex_.WaitOn(&pool_->start_);
+        }
+        if (pool_->shutdown_) return;
+        seen_generation = pool_->generation_;
+      }
+      pool_->WorkOnTasks();
+      MutexLock l(&pool_->mutex_);
+      if (--pool_->busy_workers_ == 0) pthread_cond_signal(&pool_->done_);
+    }
+  }
+
+private:
+  WorkerPool *const pool_;
+};
+
+WorkerPool::WorkerPool(int workers, uint32_t cpu_affinity_mask)
+  : generation_(0), busy_workers_(0), shutdown_(false), fn_(NULL), tasks_(0),
+    next_task_(0) {
+  pthread_cond_init(&start_, NULL);
+  pthread_cond_init(&done_, NULL);
+  for (int i = 0; i < workers; ++i) {
+    Worker *worker = new Worker(this);
+    worker->Start(0, cpu_affinity_mask);
+    workers_.push_back(worker);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    MutexLock l(&mutex_);
+    shutdown_ = true;
+    pthread_cond_broadcast(&start_);
+  }
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    delete workers_[i];  // Waits for the thread to finish.
+  }
+  pthread_cond_destroy(&start_);
+  pthread_cond_destroy(&done_);
+}
+
+void WorkerPool::WorkOnTasks() {
+  int task;
+  while ((task = next_task_.fetch_add(1)) < tasks_) {
+    (*fn_)(task);
+  }
+}
+
+void WorkerPool::Run(int tasks, const std::function<void(int)> &fn) {
+  if (workers_.empty() || tasks <= 1) {
+    for (int i = 0; i < tasks; ++i) fn(i);
+    return;
+  }
+
+  MutexLock run_lock(&run_mutex_);
+  {
+    MutexLock l(&mutex_);
+    fn_ = &fn;
+    tasks_ = tasks;
+    next_task_.store(0);
+    busy_workers_ = workers_.size();
+    ++generation_;
+    pthread_cond_broadcast(&start_);
+  }
+  WorkOnTasks();
+  MutexLock l(&mutex_);
+  while (busy_workers_ > 0) {
+    mutex_.WaitOn(&done_);
+  }
+}
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,63 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_WORKER_POOL_H
+#define RPI_RGBMATRIX_WORKER_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "thread.h"
+
+namespace rgb_matrix {
+namespace internal {
+// A fixed set of threads that, together with the caller, work through a
+// number of independent tasks.
+class WorkerPool {
+public:
+  // Start "workers" threads with the given "cpu_affinity_mask" (see
+  // Thread::Start()); with zero workers, all tasks are run by the caller.
+  WorkerPool(int workers, uint32_t cpu_affinity_mask);
+  ~WorkerPool();
+
+  // Call fn(task) for each task in [0 .. tasks) and return once all are
+  // done. Calls from multiple threads are serialized; must not be called
+  // from within "fn".
+  void Run(int tasks, const std::function<void(int task)> &fn);
+
+private:
+  class Worker;
+
+  void WorkOnTasks();
+
+  std::vector<Worker*> workers_;
+  Mutex run_mutex_;     // One Run() at a time.
+
+  Mutex mutex_;         // Protects the following.
+  pthread_cond_t start_;
+  pthread_cond_t done_;
+  unsigned generation_; // Incremented with each Run().
+  int busy_workers_;
+  bool shutdown_;
+  const std::function<void(int)> *fn_;
+  int tasks_;
+
+  std::atomic<int> next_task_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_WORKER_POOL_H
@@ -0,0 +1,109 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Projection of the six square faces of a LED cube onto the panel chain.
+#ifndef RPI_CUBE_CANVAS_H
+#define RPI_CUBE_CANVAS_H
+
+#include "graphics.h"
+#include "led-matrix.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+// The faces of the cube are panels in the chain: face i is shown on the
+// panel at x = i * face_size. Each panel can be mounted rotated; the
+// projection from face to panel pixels is precomputed once into a lookup
+// table, so face frames can be converted once when loaded and then shown
+// with one bulk SetPixels() call per face.
+class CubeCanvas {
+public:
+  static constexpr int kFaces = 6;
+
+  // Faces of "face_size" x "face_size" pixels.
+  explicit CubeCanvas(int face_size) : face_size_(face_size) {
+    for (int f = 0; f < kFaces; ++f) rotation_[f] = 0;
+    BuildTables();
+  }
+
+  int face_size() const { return face_size_; }
+
+  // Set clockwise rotation of the panels from a comma separated list of
+  // 0, 90, 180 or 270 degrees, one per face. Missing values are 0.
+  // Returns false and prints a message on invalid input.
+  bool SetRotations(const char *spec) {
+    for (int f = 0; f < kFaces; ++f) rotation_[f] = 0;
+    for (int f = 0; *spec && f < kFaces; ++f) {
+      char *end;
+      const long angle = strtol(spec, &end, 10);
+      if (end == spec || (*end && *end != ',')
+          || angle < 0 || angle >= 360 || angle % 90 != 0) {
+        fprintf(stderr, "Invalid face rotation '%s'; "
+                "expected list of 0, 90, 180 or 270\n", spec);
+        return false;
+      }
+      rotation_[f] = angle;
+      spec = (*end == ',') ? end + 1 : end;
+    }
+    BuildTables();
+    return true;
+  }
+
+  // Convert row-major "face_size" x "face_size" pixels of "face" into the
+  // order they are to be written to its panel.
+  void Project(int face, const rgb_matrix::Color *face_pixels,
+               std::vector<rgb_matrix::Color> *panel_pixels) const {
+    const std::vector<int> &lut = lut_[face];
+    panel_pixels->resize(lut.size());
+    for (size_t i = 0; i < lut.size(); ++i) {
+      (*panel_pixels)[i] = face_pixels[lut[i]];
+    }
+  }
+
+  // Show pixels prepared with Project() on the panel of "face".
+  void Draw(int face, const std::vector<rgb_matrix::Color> &panel_pixels,
+            rgb_matrix::FrameCanvas *canvas) const {
+    canvas->SetPixels(face * face_size_, 0, face_size_, face_size_,
+                      const_cast<rgb_matrix::Color*>(panel_pixels.data()));
+  }
+
+private:
+  // For each panel pixel the index of the face pixel to be shown there.
+  void BuildTables() {
+    const int n = face_size_;
+    for (int f = 0; f < kFaces; ++f) {
+      lut_[f].resize(n * n);
+      for (int y = 0; y < n; ++y) {
+        for (int x = 0; x < n; ++x) {
+          int fx, fy;
+          switch (rotation_[f]) {
+          case 90:  fx = y;         fy = n - 1 - x; break;
+          case 180: fx = n - 1 - x; fy = n - 1 - y; break;
+          case 270: fx = n - 1 - y; fy = x;         break;
+          default:  fx = x;         fy = y;         break;
+          }
+          lut_[f][y * n + x] = fy * n + fx;
+        }
+      }
+    }
+  }
+
+  const int face_size_;
+  int rotation_[kFaces];
+  std::vector<int> lut_[kFaces];
+};
+
+#endif  // RPI_CUBE_CANVAS_H
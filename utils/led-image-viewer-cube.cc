@@ -4,6 +4,7 @@
 #include "content-streamer.h"
 
 #include <fcntl.h>
+#include <getopt.h>
 #include <math.h>
 #include <signal.h>
 #include <stdio.h>
@@ -42,7 +43,8 @@ struct ImageParams {
 
 struct FileInfo {
   ImageParams params;      // Each file might have specific timing settings
-  std::vector<Magick::Image> image_sequence;
+  // Frames already projected onto the panel, ready for CubeCanvas::Draw()
+  std::vector<std::vector<rgb_matrix::Color> > image_sequence;
   std::size_t image_sequence_index;
   bool is_multi_frame;
 
@@ -124,32 +126,32 @@ static bool LoadImageAndScale(const char *filename,
   return true;
 }
 
-static bool DrawImageOnCanvas(const Magick::Image &img,rgb_matrix::FrameCanvas *canvas,int x_offset, int y_offset) {
-
-  for (size_t y = 0; y < img.rows(); ++y) {
-    for (size_t x = 0; x < img.columns(); ++x) {
+// Convert image to packed pixels of the face and project them with "cube"
+// onto the panel. Transparent and uncovered pixels are black.
+static void ProjectImage(const Magick::Image &img, const CubeCanvas &cube,
+                         int face, std::vector<rgb_matrix::Color> *result) {
+  const size_t n = cube.face_size();
+  std::vector<rgb_matrix::Color> face_pixels(n * n);
+  for (size_t y = 0; y < std::min(img.rows(), n); ++y) {
+    for (size_t x = 0; x < std::min(img.columns(), n); ++x) {
       const Magick::Color &c = img.pixelColor(x, y);
       if (c.alphaQuantum() < 255) {
-        canvas->SetPixel(x + x_offset, y + y_offset,
-                          ScaleQuantumToChar(c.redQuantum()),
-                          ScaleQuantumToChar(c.greenQuantum()),
-                          ScaleQuantumToChar(c.blueQuantum()));
+        face_pixels[y * n + x] =
+          rgb_matrix::Color(ScaleQuantumToChar(c.redQuantum()),
+                            ScaleQuantumToChar(c.greenQuantum()),
+                            ScaleQuantumToChar(c.blueQuantum()));
       }
     }
   }
-  
-  return true;
+  cube.Project(face, face_pixels.data(), result);
 }
 
-void DisplayAnimation(std::vector<FileInfo*> file_imgs, rgb_matrix::RGBMatrix *matrix, rgb_matrix::FrameCanvas *offscreen_canvas, int panel_width) {
+void DisplayAnimation(std::vector<FileInfo*> file_imgs, rgb_matrix::RGBMatrix *matrix, rgb_matrix::FrameCanvas *offscreen_canvas, const CubeCanvas &cube) {
   
   const tmillis_t override_anim_delay = file_imgs[0]->params.anim_delay_ms;
 
   std::size_t i = 0;
-  int x_offset=0;
-  int y_offset=0;
   FileInfo *p_file_info = NULL;
-  Magick::Image *p_image = NULL;
 
   uint32_t delay_us = 130000;
 
@@ -161,14 +163,8 @@ void DisplayAnimation(std::vector<FileInfo*> file_imgs, rgb_matrix::RGBMatrix *m
     for (i = 0;i < file_imgs.size();i++) {
       p_file_info = file_imgs[i];
 
-      p_image = &p_file_info->image_sequence[p_file_info->image_sequence_index];
-
-      //set offset
-      x_offset = i * panel_width;
-      
-      //printf("i: %i, x_offset: %i, y_offset: %i \n",i, x_offset, y_offset);
-
-      DrawImageOnCanvas(*p_image,offscreen_canvas,x_offset,y_offset);
+      cube.Draw(i, p_file_info->image_sequence[p_file_info->image_sequence_index],
+                offscreen_canvas);
 
       //reset index if last image
       if(++p_file_info->image_sequence_index == p_file_info->image_sequence.size()) {
@@ -187,6 +183,19 @@ void DisplayAnimation(std::vector<FileInfo*> file_imgs, rgb_matrix::RGBMatrix *m
 
 }
 
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] <face-image>...\n", progname);
+  fprintf(stderr, "Show up to %d images or animations on the faces of a "
+          "cube, one per panel in the chain.\n", CubeCanvas::kFaces);
+  fprintf(stderr, "Options:\n"
+          "\t-R <rotations>     : Comma separated clockwise rotation of each "
+          "panel,\n"
+          "\t                     0, 90, 180 or 270. Default: all 0.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
 int main(int argc, char *argv[]) {
 
   Magick::InitializeMagick(*argv);
@@ -200,9 +209,24 @@ int main(int argc, char *argv[]) {
   runtime_opt.drop_priv_group = getenv("SUDO_GID");
   if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,&matrix_options, &runtime_opt)) {
     fprintf(stderr, "Failed to read runtime options\n");
-    return -1;
+    return usage(argv[0]);
   }
 
+  const char *rotations = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "R:")) != -1) {
+    switch (opt) {
+    case 'R': rotations = optarg; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  // Faces are as large as the panels are high.
+  CubeCanvas cube(matrix_options.rows);
+  if (rotations && !cube.SetRotations(rotations))
+    return usage(argv[0]);
+
 
   // We remember ImageParams for each image
   std::map<const void *, struct ImageParams> filename_params;
@@ -223,8 +247,6 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  int panel_width = matrix_options.cols;
-
   rgb_matrix::FrameCanvas *offscreen_canvas = matrix->CreateFrameCanvas();
 
   //ununsed variables
@@ -241,21 +263,33 @@ int main(int argc, char *argv[]) {
   for (int imgarg = optind; imgarg < argc; ++imgarg) {
     const char *filename = argv[imgarg];
     FileInfo *file_info = NULL;
+    if (img_index == CubeCanvas::kFaces) {
+      fprintf(stderr, "Only %d faces; ignoring %s and following.\n",
+              CubeCanvas::kFaces, filename);
+      break;
+    }
 
     std::string err_msg;
-    //std::vector<Magick::Image> image_sequence;
+    std::vector<Magick::Image> image_sequence;
     file_info = new FileInfo();
     
     //load image/animations into vector
-    if(LoadImageAndScale(filename, matrix_options.rows, matrix_options.cols,fill_width, fill_height, &file_info->image_sequence, &err_msg)) {
+    if(LoadImageAndScale(filename, cube.face_size(), cube.face_size(),fill_width, fill_height, &image_sequence, &err_msg)) {
 
       file_info->image_sequence_index = 0;
       file_info->params = filename_params[filename];
-      file_info->is_multi_frame = file_info->image_sequence.size() > 1;
+      file_info->is_multi_frame = image_sequence.size() > 1;
+
+      // Convert once, so that showing is only copying.
+      file_info->image_sequence.resize(image_sequence.size());
+      for (size_t i = 0; i < image_sequence.size(); ++i) {
+        ProjectImage(image_sequence[i], cube, img_index,
+                     &file_info->image_sequence[i]);
+      }
 
       //calculate delay time
-      for (size_t i = 0; i < file_info->image_sequence.size(); ++i) {
-        const Magick::Image &img = file_info->image_sequence[i];
+      for (size_t i = 0; i < image_sequence.size(); ++i) {
+        const Magick::Image &img = image_sequence[i];
         int64_t delay_time_us;
         if (file_info->is_multi_frame) {
           //printf("img %i, multi-frame \r\n",img_index);
@@ -306,7 +340,7 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, InterruptHandler);
 
   do {
-    DisplayAnimation(file_imgs, matrix, offscreen_canvas,panel_width);
+    DisplayAnimation(file_imgs, matrix, offscreen_canvas, cube);
   } while (do_forever && !interrupt_received);
 
   if (interrupt_received) {
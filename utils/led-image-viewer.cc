@@ -22,7 +22,9 @@
 #include "led-matrix.h"
 #include "pixel-mapper.h"
 #include "content-streamer.h"
+#include "thread.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
 #include <signal.h>
@@ -35,6 +37,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
@@ -44,6 +47,8 @@
 
 using rgb_matrix::Canvas;
 using rgb_matrix::FrameCanvas;
+using rgb_matrix::Mutex;
+using rgb_matrix::MutexLock;
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::StreamReader;
 
@@ -66,6 +71,18 @@ struct FileInfo {
   rgb_matrix::StreamIO *content_stream;
 };
 
+// Everything, besides the file's own ImageParams, that determines how a file
+// is turned into frames.
+struct LoadOptions {
+  const RGBMatrix::Options *matrix_options;
+  const RGBMatrix *matrix;
+  const char *cache_dir;     // NULL: no cache.
+  bool do_center;
+  bool fill_width;
+  bool fill_height;
+  rgb_matrix::StreamWriter *stream_output;  // -O; NULL when displaying.
+};
+
 volatile bool interrupt_received = false;
 static void InterruptHandler(int signo) {
   interrupt_received = true;
@@ -85,27 +102,45 @@ static void SleepMillis(tmillis_t milli_seconds) {
   nanosleep(&ts, NULL);
 }
 
-static void StoreInStream(const Magick::Image &img, int delay_time_us,
-                          bool do_center,
-                          rgb_matrix::FrameCanvas *scratch,
-                          rgb_matrix::StreamWriter *output) {
-  scratch->Clear();
-  const int x_offset = do_center ? (scratch->width() - img.columns()) / 2 : 0;
-  const int y_offset = do_center ? (scratch->height() - img.rows()) / 2 : 0;
+static void DrawImage(const Magick::Image &img, bool do_center,
+                      rgb_matrix::FrameCanvas *canvas) {
+  canvas->Clear();
+  const int x_offset = do_center ? (canvas->width() - img.columns()) / 2 : 0;
+  const int y_offset = do_center ? (canvas->height() - img.rows()) / 2 : 0;
   for (size_t y = 0; y < img.rows(); ++y) {
     for (size_t x = 0; x < img.columns(); ++x) {
       const Magick::Color &c = img.pixelColor(x, y);
       if (c.alphaQuantum() < 255) {
-        scratch->SetPixel(x + x_offset, y + y_offset,
-                          ScaleQuantumToChar(c.redQuantum()),
-                          ScaleQuantumToChar(c.greenQuantum()),
-                          ScaleQuantumToChar(c.blueQuantum()));
+        canvas->SetPixel(x + x_offset, y + y_offset,
+                         ScaleQuantumToChar(c.redQuantum()),
+                         ScaleQuantumToChar(c.greenQuantum()),
+                         ScaleQuantumToChar(c.blueQuantum()));
       }
     }
   }
+}
+
+static void StoreInStream(const Magick::Image &img, int delay_time_us,
+                          bool do_center,
+                          rgb_matrix::FrameCanvas *scratch,
+                          rgb_matrix::StreamWriter *output) {
+  DrawImage(img, do_center, scratch);
   output->Stream(*scratch, delay_time_us);
 }
 
+// How long to show "img" as part of a file with the given "params".
+static int64_t FrameDelayUs(const Magick::Image &img, bool is_multi_frame,
+                            const ImageParams &params) {
+  int64_t delay_time_us;
+  if (is_multi_frame) {
+    delay_time_us = img.animationDelay() * 10000; // unit in 1/100s
+  } else {
+    delay_time_us = params.wait_ms * 1000;  // single image.
+  }
+  if (delay_time_us <= 0) delay_time_us = 100 * 1000;  // 1/10sec
+  return delay_time_us;
+}
+
 static void CopyStream(rgb_matrix::StreamReader *r,
                        rgb_matrix::StreamWriter *w,
                        rgb_matrix::FrameCanvas *scratch) {
@@ -115,6 +150,165 @@ static void CopyStream(rgb_matrix::StreamReader *r,
   }
 }
 
+// Open "filename" as a stream. Returns NULL if it is none that is compatible
+// with "scratch".
+static FileInfo *LoadStream(const char *filename,
+                            rgb_matrix::FrameCanvas *scratch) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return NULL;
+  FileInfo *file_info = new FileInfo();
+  file_info->content_stream = new rgb_matrix::MmapStreamIO(fd);
+  StreamReader reader(file_info->content_stream);
+  if (!reader.GetNext(scratch, NULL)) {  // header+size ok
+    delete file_info->content_stream;
+    delete file_info;
+    return NULL;
+  }
+  file_info->is_multi_frame = reader.GetNext(scratch, NULL);
+  return file_info;
+}
+
+// Append modification time and size of "filename" to the cache "key".
+static void AppendFileStamp(const char *filename, std::string *key) {
+  struct stat st;
+  char buffer[128];
+  if (stat(filename, &st) != 0) {
+    snprintf(buffer, sizeof(buffer), "(missing)");
+  } else {
+    snprintf(buffer, sizeof(buffer), "(mtime=%lld.%09ld;size=%lld)",
+             (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec,
+             (long long)st.st_size);
+  }
+  key->append(filename).append(buffer);
+}
+
+// Calibrated frames look just like uncalibrated ones, so the key needs the
+// --led-color-calibration and the state of the files it refers to.
+static void AppendCalibrationKey(const char *calibration, std::string *key) {
+  key->append(";calibration=").append(calibration ? calibration : "");
+  if (calibration == NULL) return;
+  std::string description = calibration;
+  if (calibration[0] == '@') {
+    key->append(";calibration-file=");
+    AppendFileStamp(calibration + 1, key);
+    description.clear();
+    FILE *f = fopen(calibration + 1, "r");
+    char line[1024];
+    while (f && fgets(line, sizeof(line), f)) description.append(line);
+    if (f) fclose(f);
+  }
+  char *const tokens = strdup(description.c_str());
+  char *saveptr = NULL;
+  for (char *t = strtok_r(tokens, " \t\r\n;", &saveptr); t;
+       t = strtok_r(NULL, " \t\r\n;", &saveptr)) {
+    if (strncmp(t, "lut=", 4) == 0) {
+      key->append(";lut=");
+      AppendFileStamp(t + 4, key);
+    }
+  }
+  free(tokens);
+}
+
+// The frames rendered from images are kept as streams in the cache
+// directory, so that the next start doesn't need to load and scale them
+// again. The name is a hash of everything that determines the content: the
+// file, its modification time and the options affecting the rendering.
+// Returns an empty string if the file can't be found.
+static std::string CacheFilename(const char *cache_dir, const char *filename,
+                                 const RGBMatrix::Options &o,
+                                 const RGBMatrix *matrix,
+                                 const ImageParams &params, bool do_center) {
+  struct stat st;
+  if (stat(filename, &st) != 0) return "";
+  char *const real_path = realpath(filename, NULL);
+  std::string key = std::string("file=") + (real_path ? real_path : filename);
+  free(real_path);
+  char buffer[512];
+  snprintf(buffer, sizeof(buffer),
+           ";mtime=%lld.%09ld;size=%lld;canvas=%dx%d;rows=%d;cols=%d;chain=%d;"
+           "parallel=%d;pwm-bits=%d;brightness=%d;scan=%d;row-addr=%d;"
+           "multiplexing=%d;inverse=%d;packed=%d;temporal=%d;center=%d;"
+           "wait=%lld;",
+           (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec,
+           (long long)st.st_size, matrix->width(), matrix->height(),
+           o.rows, o.cols, o.chain_length, o.parallel, o.pwm_bits,
+           o.brightness, o.scan_mode, o.row_address_type, o.multiplexing,
+           o.inverse_colors, o.packed_framebuffer,
+           o.pwm_temporal_dither_bits, do_center,
+           (long long)params.wait_ms);
+  key.append(buffer);
+  key.append("hardware=").append(o.hardware_mapping ? o.hardware_mapping : "");
+  key.append(";sequence=").append(o.led_rgb_sequence ? o.led_rgb_sequence : "");
+  key.append(";mapper=").append(o.pixel_mapper_config
+                                ? o.pixel_mapper_config : "");
+  key.append(";multiplex-table=").append(o.multiplex_table
+                                         ? o.multiplex_table : "");
+  AppendCalibrationKey(o.color_calibration, &key);
+
+  uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (const char c : key) {
+    hash = (hash ^ (uint8_t)c) * 0x100000001b3ULL;
+  }
+  snprintf(buffer, sizeof(buffer), "%s/%016llx.stream",
+           cache_dir, (unsigned long long)hash);
+  return buffer;
+}
+
+// Store the "content" in the cache. Written to a temporary file first, so
+// that an interrupted run doesn't leave a broken cache file.
+static void WriteCacheFile(const std::string &cache_file,
+                           rgb_matrix::StreamIO *content,
+                           rgb_matrix::FrameCanvas *scratch) {
+  const std::string tmp_file = cache_file + ".tmp";
+  int fd = open(tmp_file.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("Couldn't write to cache");
+    return;
+  }
+  bool success;
+  {
+    rgb_matrix::FileStreamIO out(fd);
+    rgb_matrix::StreamWriter writer(&out);
+    StreamReader reader(content);
+    CopyStream(&reader, &writer, scratch);
+    success = writer.WriteIndex();
+  }
+  content->Rewind();
+  if (!success || rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+    fprintf(stderr, "Couldn't write cache file %s\n", cache_file.c_str());
+    unlink(tmp_file.c_str());
+  }
+}
+
+// Scale an image of "img_width" x "img_height", so that it fits in
+// "target_width" and "target_height"; which are updated with the new size.
+static void ScaleToFit(int img_width, int img_height,
+                       bool fill_width, bool fill_height,
+                       int *target_width, int *target_height) {
+  const float width_fraction = (float)*target_width / img_width;
+  const float height_fraction = (float)*target_height / img_height;
+  if (fill_width && fill_height) {
+    // Scrolling diagonally. Fill as much as we can get in available space.
+    // Largest scale fraction determines that.
+    const float larger_fraction = (width_fraction > height_fraction)
+      ? width_fraction
+      : height_fraction;
+    *target_width = (int) roundf(larger_fraction * img_width);
+    *target_height = (int) roundf(larger_fraction * img_height);
+  }
+  else if (fill_height) {
+    // Horizontal scrolling: Make things fit in vertical space.
+    // While the height constraint stays the same, we can expand to full
+    // width as we scroll along that axis.
+    *target_width = (int) roundf(height_fraction * img_width);
+  }
+  else if (fill_width) {
+    // dito, vertical. Make things fit in horizontal space.
+    *target_height = (int) roundf(width_fraction * img_height);
+  }
+
+}
+
 // Load still image or animation.
 // Scale, so that it fits in "width" and "height" and store in "result".
 static bool LoadImageAndScale(const char *filename,
@@ -142,43 +336,111 @@ static bool LoadImageAndScale(const char *filename,
     result->push_back(frames[0]);   // just a single still image.
   }
 
-  const int img_width = (*result)[0].columns();
-  const int img_height = (*result)[0].rows();
-  const float width_fraction = (float)target_width / img_width;
-  const float height_fraction = (float)target_height / img_height;
-  if (fill_width && fill_height) {
-    // Scrolling diagonally. Fill as much as we can get in available space.
-    // Largest scale fraction determines that.
-    const float larger_fraction = (width_fraction > height_fraction)
-      ? width_fraction
-      : height_fraction;
-    target_width = (int) roundf(larger_fraction * img_width);
-    target_height = (int) roundf(larger_fraction * img_height);
+  ScaleToFit((*result)[0].columns(), (*result)[0].rows(),
+             fill_width, fill_height, &target_width, &target_height);
+  for (size_t i = 0; i < result->size(); ++i) {
+    (*result)[i].scale(Magick::Geometry(target_width, target_height));
   }
-  else if (fill_height) {
-    // Horizontal scrolling: Make things fit in vertical space.
-    // While the height constraint stays the same, we can expand to full
-    // width as we scroll along that axis.
-    target_width = (int) roundf(height_fraction * img_width);
+
+  return true;
+}
+
+// Ok, not an image. Let's see if "filename" is one of our streams.
+static FileInfo *LoadStreamFile(const char *filename,
+                                rgb_matrix::FrameCanvas *scratch,
+                                std::string *err_msg) {
+  FileInfo *file_info = NULL;
+  if (access(filename, R_OK) != 0) {
+    perror("Opening file");
+  } else if ((file_info = LoadStream(filename, scratch)) == NULL) {
+    *err_msg += "; Can't read as image or compatible stream";
   }
-  else if (fill_width) {
-    // dito, vertical. Make things fit in horizontal space.
-    target_height = (int) roundf(width_fraction * img_height);
+  return file_info;
+}
+
+// Load "filename" as image (from the cache if possible) or as stream, ready
+// to be shown. Frames are also written to "options.stream_output" if set.
+// Returns NULL if it can't be read, with the reason in "err_msg".
+static FileInfo *LoadFile(const char *filename, const ImageParams &params,
+                          const LoadOptions &options,
+                          rgb_matrix::FrameCanvas *scratch,
+                          std::string *err_msg) {
+  const RGBMatrix *const matrix = options.matrix;
+  rgb_matrix::StreamWriter *const global_stream_writer = options.stream_output;
+  FileInfo *file_info = NULL;
+
+  std::string cache_file;
+  if (options.cache_dir) {
+    cache_file = CacheFilename(options.cache_dir, filename,
+                               *options.matrix_options, matrix, params,
+                               options.do_center);
+    if (!cache_file.empty()) {
+      file_info = LoadStream(cache_file.c_str(), scratch);
+    }
   }
 
-  for (size_t i = 0; i < result->size(); ++i) {
-    (*result)[i].scale(Magick::Geometry(target_width, target_height));
+  std::vector<Magick::Image> image_sequence;
+  if (file_info) {
+    file_info->params = params;
+    if (global_stream_writer) {
+      StreamReader reader(file_info->content_stream);
+      CopyStream(&reader, global_stream_writer, scratch);
+    }
+  } else if (LoadImageAndScale(filename, matrix->width(), matrix->height(),
+                               options.fill_width, options.fill_height,
+                               &image_sequence, err_msg)) {
+    file_info = new FileInfo();
+    file_info->params = params;
+    file_info->content_stream = new rgb_matrix::MemStreamIO();
+    file_info->is_multi_frame = image_sequence.size() > 1;
+    rgb_matrix::StreamWriter out(file_info->content_stream);
+    for (size_t i = 0; i < image_sequence.size(); ++i) {
+      const Magick::Image &img = image_sequence[i];
+      const int64_t delay_time_us = FrameDelayUs(img, file_info->is_multi_frame,
+                                                 file_info->params);
+      StoreInStream(img, delay_time_us, options.do_center, scratch,
+                    (global_stream_writer && cache_file.empty())
+                    ? global_stream_writer : &out);
+    }
+    if (!cache_file.empty()) {
+      WriteCacheFile(cache_file, file_info->content_stream, scratch);
+      if (global_stream_writer) {
+        StreamReader reader(file_info->content_stream);
+        CopyStream(&reader, global_stream_writer, scratch);
+      }
+    }
+  } else if ((file_info = LoadStreamFile(filename, scratch, err_msg))) {
+    file_info->params = params;
+    if (global_stream_writer) {
+      StreamReader reader(file_info->content_stream);
+      CopyStream(&reader, global_stream_writer, scratch);
+    }
   }
+  return file_info;
+}
 
-  return true;
+// Parameter adjustments once we know how many files are shown.
+static void AdjustParams(size_t file_count, ImageParams *params) {
+  if (file_count == 1) {
+    // Single image: show forever.
+    params->wait_ms = distant_future;
+  } else if (params->loops < 0 && params->anim_duration_ms == distant_future) {
+    // Forever animation ? Set to loop only once, otherwise that animation
+    // would just run forever, stopping all the images after it.
+    params->loops = 1;
+  }
 }
 
-void DisplayAnimation(const FileInfo *file,
-                      RGBMatrix *matrix, FrameCanvas *offscreen_canvas) {
+// Show the file using the spare "canvases" to read frames ahead; these are
+// given back when done, though not necessarily the same ones.
+void DisplayAnimation(const FileInfo *file, RGBMatrix *matrix,
+                      std::vector<FrameCanvas*> *canvases) {
   const tmillis_t duration_ms = (file->is_multi_frame
                                  ? file->params.anim_duration_ms
                                  : file->params.wait_ms);
   rgb_matrix::StreamReader reader(file->content_stream);
+  rgb_matrix::StreamPrefetcher prefetcher(&reader, *canvases);
+  canvases->clear();
   int loops = file->params.loops;
   const tmillis_t end_time_ms = GetTimeInMillis() + duration_ms;
   const tmillis_t override_anim_delay = file->params.anim_delay_ms;
@@ -188,18 +450,458 @@ void DisplayAnimation(const FileInfo *file,
          && GetTimeInMillis() < end_time_ms;
        ++k) {
     uint32_t delay_us = 0;
+    FrameCanvas *next_frame;
+    // The prefetcher returns NULL once at the end of the stream.
     while (!interrupt_received && GetTimeInMillis() <= end_time_ms
-           && reader.GetNext(offscreen_canvas, &delay_us)) {
+           && (next_frame = prefetcher.GetNext(&delay_us)) != NULL) {
       const tmillis_t anim_delay_ms =
         override_anim_delay >= 0 ? override_anim_delay : delay_us / 1000;
       const tmillis_t start_wait_ms = GetTimeInMillis();
-      offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas,
-                                             file->params.vsync_multiple);
+      prefetcher.Recycle(matrix->SwapOnVSync(next_frame,
+                                             file->params.vsync_multiple));
       const tmillis_t time_already_spent = GetTimeInMillis() - start_wait_ms;
       SleepMillis(anim_delay_ms - time_already_spent);
     }
-    reader.Rewind();
   }
+  prefetcher.Stop(canvases);
+}
+
+// For -S: reads the frames of an image file in chunks of kFramesPerRead
+// just ahead of display, instead of all of them with readImages(), so that
+// memory is bounded by a chunk, not by the file. Each chunk is one
+// readImages() pass, so the file is opened and decoded up to the chunk once
+// per kFramesPerRead frames instead of once per frame. Animations are put together frame by
+// frame like coalesceImages() does. If a "cache_file" is given, the first
+// pass through the frames is stored there.
+class ImageFrameReader {
+public:
+  ImageFrameReader(const char *filename, const ImageParams &params,
+                   const LoadOptions &options, const std::string &cache_file)
+    : filename_(filename), params_(params), options_(options),
+      cache_file_(cache_file), chunk_pos_(0), next_chunk_start_(0),
+      file_done_(false), is_multi_frame_(false), dispose_(0),
+      cache_io_(NULL), cache_writer_(NULL) {}
+  ~ImageFrameReader() { DiscardCache(); }
+
+  // Read the first frames. Returns false if this is not an image.
+  bool Open(std::string *err_msg) {
+    chunk_.clear();
+    chunk_pos_ = 0;
+    next_chunk_start_ = 0;
+    file_done_ = false;
+    if (!ReadChunk(err_msg)) return false;
+    is_multi_frame_ = (chunk_.size() > 1);
+
+    const Magick::Image &first = chunk_[0];
+    int img_width = first.columns();
+    int img_height = first.rows();
+    if (is_multi_frame_) {
+      const Magick::Geometry page = first.page();
+      if (page.width() > 0 && page.height() > 0) {
+        img_width = page.width();
+        img_height = page.height();
+      }
+      composition_ = Magick::Image(Magick::Geometry(img_width, img_height),
+                                   Magick::Color("none"));
+      dispose_ = 0;
+    }
+    target_width_ = options_.matrix->width();
+    target_height_ = options_.matrix->height();
+    ScaleToFit(img_width, img_height, options_.fill_width, options_.fill_height,
+               &target_width_, &target_height_);
+    if (!cache_file_.empty() && cache_writer_ == NULL) StartCache();
+    return true;
+  }
+
+  bool is_multi_frame() const { return is_multi_frame_; }
+
+  // Render the next frame into "canvas". Returns false at the end.
+  bool GetNext(FrameCanvas *canvas, uint32_t *hold_time_us) {
+    std::string ignored_err;
+    if (chunk_pos_ == chunk_.size()
+        && (file_done_ || !ReadChunk(&ignored_err))) {
+      FinishCache();
+      return false;
+    }
+    const Magick::Image &frame = chunk_[chunk_pos_++];
+    Magick::Image shown = is_multi_frame_ ? Coalesce(frame) : frame;
+    shown.scale(Magick::Geometry(target_width_, target_height_));
+    DrawImage(shown, options_.do_center, canvas);
+    *hold_time_us = FrameDelayUs(frame, is_multi_frame_, params_);
+    if (cache_writer_) cache_writer_->Stream(*canvas, *hold_time_us);
+    return true;
+  }
+
+  void Rewind() {
+    if (file_done_ && next_chunk_start_ == (int)chunk_.size()) {
+      // All frames fit into one chunk: no need to read them again.
+      chunk_pos_ = 0;
+      if (is_multi_frame_) {
+        composition_ = Magick::Image(Magick::Geometry(composition_.columns(),
+                                                      composition_.rows()),
+                                     Magick::Color("none"));
+        dispose_ = 0;
+      }
+    } else {
+      std::string ignored_err;
+      Open(&ignored_err);
+    }
+  }
+
+private:
+  static const int kFramesPerRead = 16;
+
+  // Replace "chunk_" with the next frames of the file. Returns false if
+  // there are none.
+  bool ReadChunk(std::string *err_msg) {
+    chunk_.clear();
+    chunk_pos_ = 0;
+    char range[32];
+    snprintf(range, sizeof(range), "[%d-%d]",
+             next_chunk_start_, next_chunk_start_ + kFramesPerRead - 1);
+    try {
+      readImages(&chunk_, filename_ + range);
+    } catch (std::exception& e) {
+      if (e.what()) *err_msg = e.what();
+      if (chunk_.empty()) file_done_ = true;
+    }
+    while (!chunk_.empty()
+           && (chunk_.back().columns() == 0 || chunk_.back().rows() == 0)) {
+      chunk_.pop_back();
+    }
+    next_chunk_start_ += chunk_.size();
+    if ((int)chunk_.size() < kFramesPerRead) file_done_ = true;
+    return !chunk_.empty();
+  }
+
+  // Put "frame" onto what was shown before, after the previous frame's
+  // disposal.
+  const Magick::Image &Coalesce(const Magick::Image &frame) {
+    switch (dispose_) {
+    case 2:  // Background: clear where the previous frame was.
+      composition_.composite(Magick::Image(Magick::Geometry(dispose_area_[2],
+                                                            dispose_area_[3]),
+                                           Magick::Color("none")),
+                             dispose_area_[0], dispose_area_[1],
+                             Magick::CopyCompositeOp);
+      break;
+    case 3:  // Previous: back to what was there before the previous frame.
+      composition_ = before_;
+      break;
+    }
+    dispose_ = frame.gifDisposeMethod();
+    if (dispose_ == 3) before_ = composition_;
+    const Magick::Geometry page = frame.page();
+    composition_.composite(frame, page.xOff(), page.yOff(),
+                           Magick::OverCompositeOp);
+    dispose_area_[0] = page.xOff();
+    dispose_area_[1] = page.yOff();
+    dispose_area_[2] = frame.columns();
+    dispose_area_[3] = frame.rows();
+    return composition_;
+  }
+
+  // Like WriteCacheFile(), a temporary file is renamed once complete.
+  void StartCache() {
+    const std::string tmp_file = cache_file_ + ".tmp";
+    int fd = open(tmp_file.c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0644);
+    if (fd < 0) {
+      perror("Couldn't write to cache");
+      cache_file_.clear();
+      return;
+    }
+    cache_io_ = new rgb_matrix::FileStreamIO(fd);
+    cache_writer_ = new rgb_matrix::StreamWriter(cache_io_);
+  }
+
+  void FinishCache() {
+    if (cache_writer_ == NULL) return;
+    const std::string tmp_file = cache_file_ + ".tmp";
+    const bool success = cache_writer_->WriteIndex();
+    delete cache_writer_;
+    delete cache_io_;
+    cache_writer_ = NULL;
+    cache_io_ = NULL;
+    if (!success || rename(tmp_file.c_str(), cache_file_.c_str()) != 0) {
+      fprintf(stderr, "Couldn't write cache file %s\n", cache_file_.c_str());
+      unlink(tmp_file.c_str());
+    }
+    cache_file_.clear();
+  }
+
+  // Not all frames seen, e.g. skipped early: no cache file.
+  void DiscardCache() {
+    if (cache_writer_ == NULL) return;
+    delete cache_writer_;
+    delete cache_io_;
+    cache_writer_ = NULL;
+    cache_io_ = NULL;
+    unlink((cache_file_ + ".tmp").c_str());
+  }
+
+  const std::string filename_;
+  const ImageParams params_;
+  const LoadOptions &options_;
+  std::string cache_file_;   // Empty once written.
+
+  std::vector<Magick::Image> chunk_;  // Frames as read from the file.
+  size_t chunk_pos_;                  // The next one to be shown.
+  int next_chunk_start_;              // File index of the frame after chunk_.
+  bool file_done_;                    // No frames after chunk_.
+  bool is_multi_frame_;
+  int target_width_;
+  int target_height_;
+
+  Magick::Image composition_;  // Animation: what is shown.
+  Magick::Image before_;       // Before the frame that is disposed to it.
+  unsigned int dispose_;       // Disposal method of the last frame shown.
+  int dispose_area_[4];        // x, y, width, height of the last frame.
+
+  rgb_matrix::StreamIO *cache_io_;
+  rgb_matrix::StreamWriter *cache_writer_;
+};
+
+// Whether "filename" can be shown; only reads what is needed to tell.
+static bool CanLoad(const char *filename, rgb_matrix::FrameCanvas *scratch) {
+  try {
+    Magick::Image img;
+    img.subRange(1);
+    img.ping(filename);
+    if (img.columns() > 0) return true;
+  } catch (std::exception&) {
+    // Not an image; maybe a stream.
+  }
+  FileInfo *file_info = LoadStream(filename, scratch);
+  if (file_info == NULL) return false;
+  delete file_info->content_stream;
+  delete file_info;
+  return true;
+}
+
+// For -S: instead of loading all files up front, this thread loads one file
+// at a time while it is shown and renders its frames into the few given
+// canvases just ahead of display.
+class PlaylistLoader : public rgb_matrix::Thread {
+public:
+  struct Frame {
+    FrameCanvas *canvas;      // NULL: end of the playlist.
+    uint32_t hold_time_us;
+    int serial;               // Counts up with each file shown.
+    bool is_multi_frame;
+    ImageParams params;
+  };
+
+  // All file parameters need to be in "params". Canvases are not owned;
+  // "scratch" is used for loading.
+  PlaylistLoader(const std::vector<const char *> &filenames,
+                 const std::map<const void *, ImageParams> &params,
+                 const LoadOptions &options, bool forever, bool shuffle,
+                 const std::vector<FrameCanvas*> &canvases,
+                 FrameCanvas *scratch)
+    : filenames_(filenames), params_(params), options_(options),
+      forever_(forever), shuffle_(shuffle), scratch_(scratch),
+      free_(canvases), running_(true), skipped_serial_(0) {
+    pthread_cond_init(&changed_, NULL);
+  }
+  virtual ~PlaylistLoader() {
+    Stop();
+    pthread_cond_destroy(&changed_);
+  }
+
+  void Stop() {
+    {
+      MutexLock l(&mutex_);
+      running_ = false;
+      pthread_cond_broadcast(&changed_);
+    }
+    WaitStopped();
+  }
+
+  virtual void Run() {
+    // As with loading up front, the parameters depend on the number of files
+    // that can actually be shown; which only matters up to two.
+    size_t file_count = 0;
+    for (size_t i = 0; i < filenames_.size() && file_count < 2; ++i) {
+      if (CanLoad(filenames_[i], scratch_)) ++file_count;
+    }
+
+    std::vector<const char *> order = filenames_;
+    int serial = 0;
+    bool any_shown;
+    do {
+      if (shuffle_) std::random_shuffle(order.begin(), order.end());
+      any_shown = false;
+      for (const char *filename : order) {
+        if (!PlayFile(filename, file_count, ++serial, &any_shown)) return;
+      }
+    } while (forever_ && any_shown);
+
+    // End of the playlist.
+    Frame end_of_playlist = {};
+    Publish(end_of_playlist);
+  }
+
+  // Get the next frame to show, blocks until it is ready. Returns false
+  // once the playlist is done (or none of its files could be shown).
+  bool GetNext(Frame *frame) {
+    MutexLock l(&mutex_);
+    while (running_ && ready_.empty()) mutex_.WaitOn(&changed_);
+    if (ready_.empty() || ready_.front().canvas == NULL) return false;
+    *frame = ready_.front();
+    ready_.pop_front();
+    return true;
+  }
+
+  // Give back a canvas that is not shown anymore.
+  void Recycle(FrameCanvas *canvas) {
+    MutexLock l(&mutex_);
+    free_.push_back(canvas);
+    pthread_cond_broadcast(&changed_);
+  }
+
+  // Done showing the file with "serial"; drop what is read ahead of it and
+  // continue with the next file.
+  void SkipFile(int serial) {
+    MutexLock l(&mutex_);
+    skipped_serial_ = std::max(skipped_serial_, serial);
+    while (!ready_.empty() && ready_.front().canvas != NULL
+           && ready_.front().serial <= skipped_serial_) {
+      free_.push_back(ready_.front().canvas);
+      ready_.pop_front();
+    }
+    pthread_cond_broadcast(&changed_);
+  }
+
+private:
+  // Show "filename", decoding images frame by frame; cached renderings and
+  // streams are read from their file. Files that can't be read are skipped.
+  // Returns false if stopped.
+  bool PlayFile(const char *filename, size_t file_count, int serial,
+                bool *any_shown) {
+    const ImageParams &file_params = params_.find(filename)->second;
+    ImageParams params = file_params;
+    AdjustParams(file_count, &params);
+
+    std::string cache_file;
+    FileInfo *file = NULL;
+    if (options_.cache_dir) {
+      cache_file = CacheFilename(options_.cache_dir, filename,
+                                 *options_.matrix_options, options_.matrix,
+                                 file_params, options_.do_center);
+      if (!cache_file.empty()) {
+        file = LoadStream(cache_file.c_str(), scratch_);
+      }
+    }
+    std::string err_msg;
+    if (file == NULL) {
+      ImageFrameReader image(filename, file_params, options_, cache_file);
+      if (image.Open(&err_msg)) {
+        return PlayFrames(&image, params, image.is_multi_frame(), serial,
+                          any_shown);
+      }
+      file = LoadStreamFile(filename, scratch_, &err_msg);
+    }
+    if (file == NULL) {
+      fprintf(stderr, "%s skipped: Unable to open (%s)\n",
+              filename, err_msg.c_str());
+      return true;
+    }
+    StreamReader reader(file->content_stream);
+    const bool running = PlayFrames(&reader, params, file->is_multi_frame,
+                                    serial, any_shown);
+    delete file->content_stream;
+    delete file;
+    return running;
+  }
+
+  // Read the frames of "source" for all loops. Returns false if stopped.
+  template <class FrameSource>
+  bool PlayFrames(FrameSource *source, const ImageParams &params,
+                  bool is_multi_frame, int serial, bool *any_shown) {
+    const int loops = params.loops;
+    for (int k = 0; loops < 0 || k < loops; ++k) {
+      int frames = 0;
+      for (;;) {
+        FrameCanvas *const canvas = WaitForCanvas(serial);
+        if (canvas == NULL) return IsRunning();   // Stopped or skipped.
+        Frame frame = { canvas, 0, serial, is_multi_frame, params };
+        if (!source->GetNext(canvas, &frame.hold_time_us)) {
+          Recycle(canvas);
+          break;
+        }
+        ++frames;
+        *any_shown = true;
+        Publish(frame);
+      }
+      if (frames == 0) break;  // Nothing in there.
+      source->Rewind();
+    }
+    return true;
+  }
+
+  FrameCanvas *WaitForCanvas(int serial) {
+    MutexLock l(&mutex_);
+    while (running_ && free_.empty() && serial > skipped_serial_)
+      mutex_.WaitOn(&changed_);
+    if (!running_ || serial <= skipped_serial_) return NULL;
+    FrameCanvas *const canvas = free_.back();
+    free_.pop_back();
+    return canvas;
+  }
+
+  void Publish(const Frame &frame) {
+    MutexLock l(&mutex_);
+    if (frame.canvas && frame.serial <= skipped_serial_) {
+      free_.push_back(frame.canvas);  // Skipped while reading it.
+    } else {
+      ready_.push_back(frame);
+    }
+    pthread_cond_broadcast(&changed_);
+  }
+
+  bool IsRunning() {
+    MutexLock l(&mutex_);
+    return running_;
+  }
+
+  const std::vector<const char *> filenames_;
+  const std::map<const void *, ImageParams> params_;
+  const LoadOptions options_;
+  const bool forever_;
+  const bool shuffle_;
+  FrameCanvas *const scratch_;
+
+  Mutex mutex_;
+  pthread_cond_t changed_;
+  std::vector<FrameCanvas*> free_;
+  std::deque<Frame> ready_;
+  bool running_;
+  int skipped_serial_;   // Files up to this one are done.
+};
+
+// Show the frames coming from the "loader" until the playlist is done.
+// Returns false if there was nothing to show.
+bool DisplayPlaylist(PlaylistLoader *loader, RGBMatrix *matrix) {
+  int serial = 0;
+  tmillis_t end_time_ms = 0;
+  PlaylistLoader::Frame frame;
+  while (!interrupt_received && loader->GetNext(&frame)) {
+    const ImageParams &params = frame.params;
+    if (frame.serial != serial) {  // Next file.
+      serial = frame.serial;
+      end_time_ms = GetTimeInMillis() + (frame.is_multi_frame
+                                         ? params.anim_duration_ms
+                                         : params.wait_ms);
+    }
+    const tmillis_t anim_delay_ms = params.anim_delay_ms >= 0
+      ? params.anim_delay_ms : frame.hold_time_us / 1000;
+    const tmillis_t start_wait_ms = GetTimeInMillis();
+    loader->Recycle(matrix->SwapOnVSync(frame.canvas, params.vsync_multiple));
+    const tmillis_t time_already_spent = GetTimeInMillis() - start_wait_ms;
+    SleepMillis(anim_delay_ms - time_already_spent);
+    if (GetTimeInMillis() > end_time_ms) loader->SkipFile(serial);
+  }
+  return serial > 0;
 }
 
 static int usage(const char *progname) {
@@ -208,7 +910,13 @@ static int usage(const char *progname) {
 
   fprintf(stderr, "Options:\n"
           "\t-O<streamfile>            : Output to stream-file instead of matrix (Don't need to be root).\n"
+          "\t-z                        : With -O: store only changes between frames; much smaller.\n"
+          "\t-k<cache-dir>             : Keep images, rendered for the display, in this directory,\n"
+          "\t                            so that loading is fast next time.\n"
           "\t-C                        : Center images.\n"
+          "\t-S                        : Streaming: load each file just before it is shown\n"
+          "\t                            instead of all up front. Starts right away and\n"
+          "\t                            only keeps the frames about to be shown in memory.\n"
 
           "\nThese options affect images FOLLOWING them on the command line,\n"
           "so it is possible to have different options for each image\n"
@@ -264,6 +972,7 @@ int main(int argc, char *argv[]) {
   bool do_forever = false;
   bool do_center = false;
   bool do_shuffle = false;
+  bool do_streaming = false;
 
   // We remember ImageParams for each image, which will change whenever
   // there is a flag modifying them. This map keeps track of filenames
@@ -281,9 +990,11 @@ int main(int argc, char *argv[]) {
   }
 
   const char *stream_output = NULL;
+  bool stream_delta_encoding = false;
+  const char *cache_dir = NULL;
 
   int opt;
-  while ((opt = getopt(argc, argv, "w:t:l:fr:c:P:LhCR:sO:V:D:")) != -1) {
+  while ((opt = getopt(argc, argv, "w:t:l:fr:c:P:LhCR:sSO:zk:V:D:")) != -1) {
     switch (opt) {
     case 'w':
       img_param.wait_ms = roundf(atof(optarg) * 1000.0f);
@@ -306,6 +1017,9 @@ int main(int argc, char *argv[]) {
     case 's':
       do_shuffle = true;
       break;
+    case 'S':
+      do_streaming = true;
+      break;
     case 'r':
       fprintf(stderr, "Instead of deprecated -r, use --led-rows=%s instead.\n",
               optarg);
@@ -331,6 +1045,12 @@ int main(int argc, char *argv[]) {
     case 'O':
       stream_output = strdup(optarg);
       break;
+    case 'z':
+      stream_delta_encoding = true;
+      break;
+    case 'k':
+      cache_dir = strdup(optarg);
+      break;
     case 'V':
       img_param.vsync_multiple = atoi(optarg);
       if (img_param.vsync_multiple < 1) img_param.vsync_multiple = 1;
@@ -372,13 +1092,59 @@ int main(int argc, char *argv[]) {
   rgb_matrix::StreamIO *stream_io = NULL;
   rgb_matrix::StreamWriter *global_stream_writer = NULL;
   if (stream_output) {
-    int fd = open(stream_output, O_CREAT|O_WRONLY, 0644);
+    int fd = open(stream_output, O_CREAT|O_WRONLY|O_TRUNC, 0644);
     if (fd < 0) {
       perror("Couldn't open output stream");
       return 1;
     }
     stream_io = new rgb_matrix::FileStreamIO(fd);
-    global_stream_writer = new rgb_matrix::StreamWriter(stream_io);
+    global_stream_writer = new rgb_matrix::StreamWriter(stream_io,
+                                                        stream_delta_encoding);
+  }
+
+  if (cache_dir && mkdir(cache_dir, 0755) != 0 && errno != EEXIST) {
+    perror("Can't create cache directory");
+    cache_dir = NULL;
+  }
+  LoadOptions load_options;
+  load_options.matrix_options = &matrix_options;
+  load_options.matrix = matrix;
+  load_options.cache_dir = cache_dir;
+  load_options.do_center = do_center;
+  load_options.fill_width = fill_width;
+  load_options.fill_height = fill_height;
+  load_options.stream_output = global_stream_writer;
+
+  // Frames are read ahead into these while the current one is shown.
+  static constexpr int kPrefetchFrames = 4;
+
+  if (do_streaming && stream_output) {
+    fprintf(stderr, "Note: -S (streaming) does not have an effect when generating streams.\n");
+  } else if (do_streaming) {
+    signal(SIGTERM, InterruptHandler);
+    signal(SIGINT, InterruptHandler);
+
+    std::vector<const char *> filenames(argv + optind, argv + argc);
+    std::vector<FrameCanvas*> canvases;
+    for (int i = 0; i < kPrefetchFrames; ++i) {
+      canvases.push_back(matrix->CreateFrameCanvas());
+    }
+    bool any_shown;
+    {
+      PlaylistLoader loader(filenames, filename_params, load_options,
+                            do_forever, do_shuffle, canvases,
+                            offscreen_canvas);
+      loader.Start();
+      any_shown = DisplayPlaylist(&loader, matrix);
+    }
+    if (interrupt_received) {
+      fprintf(stderr, "Caught signal. Exiting.\n");
+    } else if (!any_shown) {
+      fprintf(stderr, "No image could be loaded.\n");
+    }
+    matrix->Clear();
+    delete matrix;
+    return any_shown || interrupt_received ? 0 : 1;
   }
 
   const tmillis_t start_load = GetTimeInMillis();
@@ -388,55 +1154,9 @@ int main(int argc, char *argv[]) {
   std::vector<FileInfo*> file_imgs;
   for (int imgarg = optind; imgarg < argc; ++imgarg) {
     const char *filename = argv[imgarg];
-    FileInfo *file_info = NULL;
-
     std::string err_msg;
-    std::vector<Magick::Image> image_sequence;
-    if (LoadImageAndScale(filename, matrix->width(), matrix->height(),
-                          fill_width, fill_height, &image_sequence, &err_msg)) {
-      file_info = new FileInfo();
-      file_info->params = filename_params[filename];
-      file_info->content_stream = new rgb_matrix::MemStreamIO();
-      file_info->is_multi_frame = image_sequence.size() > 1;
-      rgb_matrix::StreamWriter out(file_info->content_stream);
-      for (size_t i = 0; i < image_sequence.size(); ++i) {
-        const Magick::Image &img = image_sequence[i];
-        int64_t delay_time_us;
-        if (file_info->is_multi_frame) {
-          delay_time_us = img.animationDelay() * 10000; // unit in 1/100s
-        } else {
-          delay_time_us = file_info->params.wait_ms * 1000;  // single image.
-        }
-        if (delay_time_us <= 0) delay_time_us = 100 * 1000;  // 1/10sec
-        StoreInStream(img, delay_time_us, do_center, offscreen_canvas,
-                      global_stream_writer ? global_stream_writer : &out);
-      }
-    } else {
-      // Ok, not an image. Let's see if it is one of our streams.
-      int fd = open(filename, O_RDONLY);
-      if (fd >= 0) {
-        file_info = new FileInfo();
-        file_info->params = filename_params[filename];
-        file_info->content_stream = new rgb_matrix::FileStreamIO(fd);
-        StreamReader reader(file_info->content_stream);
-        if (reader.GetNext(offscreen_canvas, NULL)) {  // header+size ok
-          file_info->is_multi_frame = reader.GetNext(offscreen_canvas, NULL);
-          reader.Rewind();
-          if (global_stream_writer) {
-            CopyStream(&reader, global_stream_writer, offscreen_canvas);
-          }
-        } else {
-          err_msg += "; Can't read as image or compatible stream";
-          delete file_info->content_stream;
-          delete file_info;
-          file_info = NULL;
-        }
-      }
-      else {
-        perror("Opening file");
-      }
-    }
-
+    FileInfo *file_info = LoadFile(filename, filename_params[filename],
+                                   load_options, offscreen_canvas, &err_msg);
     if (file_info) {
       file_imgs.push_back(file_info);
     } else {
@@ -446,6 +1166,7 @@ int main(int argc, char *argv[]) {
   }
 
   if (stream_output) {
+    global_stream_writer->WriteIndex();
     delete global_stream_writer;
     delete stream_io;
     if (file_imgs.size()) {
@@ -465,18 +1186,9 @@ int main(int argc, char *argv[]) {
     // e.g. if all files could not be interpreted as image.
     fprintf(stderr, "No image could be loaded.\n");
     return 1;
-  } else if (file_imgs.size() == 1) {
-    // Single image: show forever.
-    file_imgs[0]->params.wait_ms = distant_future;
-  } else {
-    for (size_t i = 0; i < file_imgs.size(); ++i) {
-      ImageParams &params = file_imgs[i]->params;
-      // Forever animation ? Set to loop only once, otherwise that animation
-      // would just run forever, stopping all the images after it.
-      if (params.loops < 0 && params.anim_duration_ms == distant_future) {
-        params.loops = 1;
-      }
-    }
+  }
+  for (size_t i = 0; i < file_imgs.size(); ++i) {
+    AdjustParams(file_imgs.size(), &file_imgs[i]->params);
   }
 
   fprintf(stderr, "Loading took %.3fs; now: Display.\n",
@@ -485,12 +1197,18 @@ int main(int argc, char *argv[]) {
   signal(SIGTERM, InterruptHandler);
   signal(SIGINT, InterruptHandler);
 
+  std::vector<FrameCanvas*> canvases;
+  canvases.push_back(offscreen_canvas);
+  for (int i = 1; i < kPrefetchFrames; ++i) {
+    canvases.push_back(matrix->CreateFrameCanvas());
+  }
+
   do {
     if (do_shuffle) {
       std::random_shuffle(file_imgs.begin(), file_imgs.end());
     }
     for (size_t i = 0; i < file_imgs.size() && !interrupt_received; ++i) {
-      DisplayAnimation(file_imgs[i], matrix, offscreen_canvas);
+      DisplayAnimation(file_imgs[i], matrix, &canvases);
     }
   } while (do_forever && !interrupt_received);
 
@@ -0,0 +1,196 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Receive content-streamer streams over TCP and show them. The content is
+// rendered elsewhere, e.g. one machine rendering all parts of a video wall
+// made of several Pis, each running this receiver. Frames streamed with a
+// presentation time are shown at that wall-clock time, so with clocks
+// synchronized (NTP, PTP) all parts of the wall change at the same time.
+
+#include "led-matrix.h"
+#include "content-streamer.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <vector>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+using rgb_matrix::StreamPrefetcher;
+using rgb_matrix::StreamReader;
+
+static volatile int listen_fd = -1;
+static volatile int connection_fd = -1;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+  // Wake up the blocking accept() or receive.
+  if (connection_fd >= 0) shutdown(connection_fd, SHUT_RDWR);
+  if (listen_fd >= 0) shutdown(listen_fd, SHUT_RDWR);
+}
+
+static uint64_t GetWallClockMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Receive streams over TCP and show them.\n");
+  fprintf(stderr, "Options:\n"
+          "\t-p <port>          : Port to listen on. Default: 9000.\n"
+          "\t-o <offset-us>     : Show timed frames this much later, e.g. to "
+          "compensate for\n"
+          "\t                     a known clock difference. Default: 0.\n"
+          "\t-D                 : Don't drop timed frames that arrive late; "
+          "show them anyway.\n"
+          );
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static int ListenOn(int port) {
+  const int fd = socket(AF_INET6, SOCK_STREAM, 0);  // Also accepts IPv4.
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  struct sockaddr_in6 address = {};
+  address.sin6_family = AF_INET6;
+  address.sin6_addr = in6addr_any;
+  address.sin6_port = htons(port);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0
+      || listen(fd, 1) != 0) {
+    fprintf(stderr, "Can't listen on port %d: %s\n", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Show all frames of the stream; returns number of frames shown.
+static int ShowStream(StreamReader *reader, RGBMatrix *matrix,
+                      std::vector<FrameCanvas*> *canvases,
+                      int64_t offset_us, bool drop_late) {
+  StreamPrefetcher prefetcher(reader, *canvases);
+  canvases->clear();
+  int frames_shown = 0;
+  uint32_t present_at = rgb_matrix::GetMicrosecondCounter();
+  uint32_t hold_time_us;
+  uint64_t wall_clock_time_us;
+  FrameCanvas *frame;
+  while (!interrupt_received
+         && (frame = prefetcher.GetNext(&hold_time_us,
+                                        &wall_clock_time_us)) != NULL) {
+    if (wall_clock_time_us != 0) {
+      // Convert to the time base of the matrix.
+      const int64_t due_in_us =
+        (int64_t)(wall_clock_time_us - GetWallClockMicros()) + offset_us;
+      if (drop_late && due_in_us + hold_time_us < 0) {
+        prefetcher.Recycle(frame);  // Already time for the next one.
+        continue;
+      }
+      present_at = rgb_matrix::GetMicrosecondCounter() + due_in_us;
+    }
+    prefetcher.Recycle(matrix->SwapOnVSyncAt(frame, present_at));
+    present_at += hold_time_us;  // Next frame if it comes without time.
+    ++frames_shown;
+  }
+  prefetcher.Stop(canvases);
+  return frames_shown;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  int port = 9000;
+  int64_t offset_us = 0;
+  bool drop_late = true;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:o:D")) != -1) {
+    switch (opt) {
+    case 'p': port = atoi(optarg); break;
+    case 'o': offset_us = atoll(optarg); break;
+    case 'D': drop_late = false; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  listen_fd = ListenOn(port);
+  if (listen_fd < 0)
+    return 1;
+
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options, runtime_opt);
+  if (matrix == NULL)
+    return 1;
+
+  // Frames are received ahead into these while the current one is shown.
+  static constexpr int kPrefetchFrames = 4;
+  std::vector<FrameCanvas*> canvases;
+  for (int i = 0; i < kPrefetchFrames; ++i) {
+    canvases.push_back(matrix->CreateFrameCanvas());
+  }
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  fprintf(stderr, "Size: %dx%d. Listening on port %d\n",
+          matrix->width(), matrix->height(), port);
+  while (!interrupt_received) {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      if (!interrupt_received) perror("accept");
+      break;
+    }
+    connection_fd = fd;
+    rgb_matrix::SocketStreamIO stream_io(fd);
+    StreamReader reader(&stream_io);
+    const int frames = ShowStream(&reader, matrix, &canvases,
+                                  offset_us, drop_late);
+    connection_fd = -1;
+    fprintf(stderr, "Connection closed after %d frames.\n", frames);
+  }
+
+  if (interrupt_received) {
+    fprintf(stderr, "Caught signal. Exiting.\n");
+  }
+
+  matrix->Clear();
+  delete matrix;
+  close(listen_fd);
+  return 0;
+}
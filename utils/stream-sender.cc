@@ -0,0 +1,215 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Send content-streamer streams to stream-receivers, stamping each frame
+// with the wall-clock time it is to be shown. With several receivers, e.g.
+// the Pis of a video wall each getting the stream of their part, frame N of
+// every stream gets the same time, so with synchronized clocks (NTP, PTP)
+// all parts change at the same refresh.
+
+#include "led-matrix.h"
+#include "content-streamer.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using rgb_matrix::FrameCanvas;
+using rgb_matrix::RGBMatrix;
+using rgb_matrix::StreamReader;
+using rgb_matrix::StreamWriter;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+  interrupt_received = true;
+}
+
+static uint64_t GetWallClockMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options] <host>[:<port>]=<stream-file> ...\n",
+          progname);
+  fprintf(stderr, "Send streams to stream-receivers, each frame stamped with "
+          "the\nwall-clock time to show it. Frame N of all streams is shown "
+          "at the same time.\n");
+  fprintf(stderr, "Options:\n"
+          "\t-l <lead-ms>       : Time from sending the first frame to "
+          "showing it. Needs\n"
+          "\t                     to cover the transfer. Default: 200.\n"
+          "\t-L                 : Loop the streams forever.\n"
+          "\t-z                 : Send delta encoded (less bandwidth if "
+          "parts stay the same).\n"
+          );
+  fprintf(stderr, "\nThe streams need to be made for the panel options "
+          "given; these are only\nused for the frame size, no "
+          "hardware is accessed.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+struct Target {
+  Target() : input(NULL), reader(NULL), output(NULL), writer(NULL),
+             frame(NULL) {}
+  std::string name;
+  rgb_matrix::StreamIO *input;
+  StreamReader *reader;
+  rgb_matrix::StreamIO *output;
+  StreamWriter *writer;
+  FrameCanvas *frame;
+};
+
+// Parse "host[:port]=file", open the file and connect. Returns success.
+static bool OpenTarget(const char *spec, RGBMatrix *matrix, bool delta,
+                       Target *target) {
+  const char *equal = strchr(spec, '=');
+  if (equal == NULL || equal == spec || equal[1] == '\0') {
+    fprintf(stderr, "Expected <host>[:<port>]=<file>, got '%s'\n", spec);
+    return false;
+  }
+  target->name.assign(spec, equal - spec);
+  std::string host = target->name;
+  int port = 9000;
+  const size_t colon = host.rfind(':');
+  if (colon != std::string::npos && host.find(':') == colon) {
+    port = atoi(host.c_str() + colon + 1);  // One colon: not an IPv6 address.
+    host.resize(colon);
+  } else if (host[0] == '[' && host.find("]:") != std::string::npos) {
+    port = atoi(host.c_str() + host.find("]:") + 2);  // [IPv6]:port
+    host = host.substr(1, host.find("]:") - 1);
+  }
+  const char *filename = equal + 1;
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    perror(filename);
+    return false;
+  }
+  target->input = new rgb_matrix::MmapStreamIO(fd);
+  target->reader = new StreamReader(target->input);
+  target->output = rgb_matrix::SocketStreamIO::Connect(host.c_str(), port);
+  if (target->output == NULL)
+    return false;
+  target->writer = new StreamWriter(target->output, delta);
+  target->frame = matrix->CreateFrameCanvas();
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+
+  int lead_ms = 200;
+  bool do_loop = false;
+  bool delta = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "l:Lz")) != -1) {
+    switch (opt) {
+    case 'l': lead_ms = atoi(optarg); break;
+    case 'L': do_loop = true; break;
+    case 'z': delta = true; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Expected at least one <host>[:<port>]=<stream-file>\n");
+    return usage(argv[0]);
+  }
+
+  // We only need the matrix to create canvases of the right size.
+  runtime_opt.do_gpio_init = false;
+  runtime_opt.daemon = -1;
+  runtime_opt.drop_privileges = -1;
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options, runtime_opt);
+  if (matrix == NULL)
+    return 1;
+
+  std::vector<Target> targets(argc - optind);
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (!OpenTarget(argv[optind + i], matrix, delta, &targets[i]))
+      return 1;
+  }
+
+  signal(SIGTERM, InterruptHandler);
+  signal(SIGINT, InterruptHandler);
+
+  // The hold times of the first stream decide the timing for all.
+  const uint64_t start_us = GetWallClockMicros() + lead_ms * 1000LL;
+  uint64_t elapsed_us = 0;
+  int frames_sent = 0;
+  bool ok = true;
+  while (ok && !interrupt_received) {
+    uint32_t hold_time_us = 0;
+    bool all_read = true;
+    for (size_t i = 0; i < targets.size(); ++i) {
+      uint32_t hold;
+      if (!targets[i].reader->GetNext(targets[i].frame, &hold)) {
+        all_read = false;
+        break;
+      }
+      if (i == 0) hold_time_us = hold;
+    }
+    if (!all_read) {
+      if (!do_loop || frames_sent == 0)
+        break;
+      for (size_t i = 0; i < targets.size(); ++i)
+        targets[i].reader->Rewind();
+      continue;
+    }
+    const uint64_t present_at_us = start_us + elapsed_us;
+    for (size_t i = 0; i < targets.size() && ok; ++i) {
+      if (!targets[i].writer->Stream(*targets[i].frame, hold_time_us,
+                                     present_at_us)) {
+        fprintf(stderr, "Can't send to %s\n", targets[i].name.c_str());
+        ok = false;
+      }
+    }
+    elapsed_us += hold_time_us;
+    ++frames_sent;
+
+    // Hold back if too far ahead; the receivers only keep a few frames.
+    const int64_t ahead_us = present_at_us - GetWallClockMicros();
+    if (ahead_us > 2 * lead_ms * 1000LL)
+      usleep(ahead_us - lead_ms * 1000LL);
+  }
+
+  fprintf(stderr, "Sent %d frames to %d receiver%s.\n", frames_sent,
+          (int)targets.size(), targets.size() == 1 ? "" : "s");
+  for (size_t i = 0; i < targets.size(); ++i) {
+    delete targets[i].writer;
+    delete targets[i].output;
+    delete targets[i].reader;
+    delete targets[i].input;
+  }
+  delete matrix;
+  return ok ? 0 : 1;
+}
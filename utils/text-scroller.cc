@@ -20,6 +20,7 @@
 #include <fstream>
 #include <streambuf>
 #include <string>
+#include <vector>
 
 #include <getopt.h>
 #include <math.h>
@@ -113,6 +114,85 @@ static bool ReadLineOnChange(const char *filename, std::string *out,
   return true;
 }
 
+// Off-screen RGB image holding the rendered text, so that scrolling is only
+// copying the visible window of it into the frame.
+class RGBStrip : public Canvas {
+public:
+  RGBStrip(int width, int height)
+    : width_(width), height_(height), pixels_(3 * width * height) {}
+
+  virtual int width() const { return width_; }
+  virtual int height() const { return height_; }
+  virtual void SetPixel(int x, int y, uint8_t red, uint8_t green,
+                        uint8_t blue) {
+    if (x < 0 || x >= width_ || y < 0 || y >= height_) return;
+    uint8_t *pixel = &pixels_[3 * (y * width_ + x)];
+    pixel[0] = red;
+    pixel[1] = green;
+    pixel[2] = blue;
+  }
+  virtual void Clear() { Fill(0, 0, 0); }
+  virtual void Fill(uint8_t red, uint8_t green, uint8_t blue) {
+    for (size_t i = 0; i < pixels_.size(); i += 3) {
+      pixels_[i] = red;
+      pixels_[i + 1] = green;
+      pixels_[i + 2] = blue;
+    }
+  }
+
+  // Top left pixel of the window starting at column "x" and the stride to
+  // use with FrameCanvas::SetFrameRGB()
+  const uint8_t *Window(int x) const { return &pixels_[3 * x]; }
+  int stride() const { return 3 * width_; }
+
+private:
+  const int width_;
+  const int height_;
+  std::vector<uint8_t> pixels_;
+};
+
+// A canvas without pixels; to determine the length of a text.
+class NullCanvas : public Canvas {
+public:
+  virtual int width() const { return 0; }
+  virtual int height() const { return 0; }
+  virtual void SetPixel(int, int, uint8_t, uint8_t, uint8_t) {}
+  virtual void Clear() {}
+  virtual void Fill(uint8_t, uint8_t, uint8_t) {}
+};
+
+// Render the text into a strip wide enough for all positions it scrolls
+// through, starting at "x_orig", on a display of "width" x "height".
+// The window to show for text position "x" starts at column "*text_x" - x;
+// the length of the text is returned in "*length".
+static RGBStrip *RenderText(const std::string &line, const Font &font,
+                            const Font *outline_font, int letter_spacing,
+                            const Color &color, const Color &bg_color,
+                            const Color &outline_color, int y_orig,
+                            int x_orig, int width, int height,
+                            int *length, int *text_x) {
+  NullCanvas null_canvas;
+  *length = rgb_matrix::DrawText(&null_canvas, font, 0, 0, color, NULL,
+                                 line.c_str(), letter_spacing);
+  const int x_min = std::min(x_orig - *length, -*length);
+  const int x_max = std::max(x_orig, width);
+  *text_x = x_max + 1;  // One more to the left for the outline.
+  RGBStrip *strip = new RGBStrip(x_max - x_min + 1 + width, height);
+  strip->Fill(bg_color.r, bg_color.g, bg_color.b);
+  if (outline_font) {
+    // The outline font, we need to write with a negative (-2) text-spacing,
+    // as we want to have the same letter pitch as the regular text that
+    // we then write on top.
+    rgb_matrix::DrawText(strip, *outline_font,
+                         *text_x - 1, y_orig + font.baseline(),
+                         outline_color, NULL,
+                         line.c_str(), letter_spacing - 2);
+  }
+  rgb_matrix::DrawText(strip, font, *text_x, y_orig + font.baseline(),
+                       color, NULL, line.c_str(), letter_spacing);
+  return strip;
+}
+
 int main(int argc, char *argv[]) {
   RGBMatrix::Options matrix_options;
   rgb_matrix::RuntimeOptions runtime_opt;
@@ -261,8 +341,13 @@ int main(int argc, char *argv[]) {
   }
 
   int x = x_orig;
-  int y = y_orig;
   int length = 0;
+  // The text is rendered once and only re-rendered if it changes.
+  int text_x;
+  RGBStrip *strip = RenderText(line, font, outline_font, letter_spacing,
+                               color, bg_color, outline_color, y_orig, x_orig,
+                               canvas->width(), canvas->height(),
+                               &length, &text_x);
 
   struct timespec next_frame = {0, 0};
 
@@ -270,28 +355,19 @@ int main(int argc, char *argv[]) {
   while (!interrupt_received && loops != 0) {
     if (input_file && ReadLineOnChange(input_file, &line, &last_change)) {
       x = x_orig;
+      delete strip;
+      strip = RenderText(line, font, outline_font, letter_spacing,
+                         color, bg_color, outline_color, y_orig, x_orig,
+                         canvas->width(), canvas->height(), &length, &text_x);
     }
     ++frame_counter;
-    offscreen_canvas->Fill(bg_color.r, bg_color.g, bg_color.b);
     const bool draw_on_frame = (blink_on <= 0)
       || (frame_counter % (blink_on + blink_off) < (uint64_t)blink_on);
 
     if (draw_on_frame) {
-      if (outline_font) {
-        // The outline font, we need to write with a negative (-2) text-spacing,
-        // as we want to have the same letter pitch as the regular text that
-        // we then write on top.
-        rgb_matrix::DrawText(offscreen_canvas, *outline_font,
-                             x - 1, y + font.baseline(),
-                             outline_color, NULL,
-                             line.c_str(), letter_spacing - 2);
-      }
-
-      // length = holds how many pixels our text takes up
-      length = rgb_matrix::DrawText(offscreen_canvas, font,
-                                    x, y + font.baseline(),
-                                    color, NULL,
-                                    line.c_str(), letter_spacing);
+      offscreen_canvas->SetFrameRGB(strip->Window(text_x - x), strip->stride());
+    } else {
+      offscreen_canvas->Fill(bg_color.r, bg_color.g, bg_color.b);
     }
 
     x += scroll_direction;
@@ -319,6 +395,7 @@ int main(int argc, char *argv[]) {
   // Finished. Shut down the RGB matrix.
   canvas->Clear();
   delete canvas;
+  delete strip;
 
   return 0;
 }
@@ -45,11 +45,19 @@ extern "C" {
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "led-matrix.h"
 #include "content-streamer.h"
 
+using rgb_matrix::Color;
 using rgb_matrix::FrameCanvas;
 using rgb_matrix::RGBMatrix;
 using rgb_matrix::StreamWriter;
@@ -60,17 +68,19 @@ static void InterruptHandler(int) {
   interrupt_received = true;
 }
 
-struct LedPixel {
-  uint8_t r, g, b;
-};
+// The RGB24 output of the scaler is exactly laid out as a row of Colors, so
+// we can hand it to the canvas in bulk.
 void CopyFrame(AVFrame *pFrame, FrameCanvas *canvas,
                int offset_x, int offset_y,
                int width, int height) {
+  if (offset_x == 0 && offset_y == 0
+      && width == canvas->width() && height == canvas->height()) {
+    canvas->SetFrameRGB(pFrame->data[0], pFrame->linesize[0]);
+    return;
+  }
   for (int y = 0; y < height; ++y) {
-    LedPixel *pix = (LedPixel*) (pFrame->data[0] + y*pFrame->linesize[0]);
-    for (int x = 0; x < width; ++x, ++pix) {
-      canvas->SetPixel(x + offset_x, y + offset_y, pix->r, pix->g, pix->b);
-    }
+    Color *row = (Color*) (pFrame->data[0] + y*pFrame->linesize[0]);
+    canvas->SetPixels(offset_x, y + offset_y, width, 1, row);
   }
 }
 
@@ -94,6 +104,7 @@ static int usage(const char *progname, const char *msg = NULL) {
   fprintf(stderr, "Options:\n"
           "\t-F                 : Full screen without black bars; aspect ratio might suffer\n"
           "\t-O<streamfile>     : Output to stream-file instead of matrix (don't need to be root).\n"
+          "\t-z                 : With -O: store only changes between frames; much smaller.\n"
           "\t-s <count>         : Skip these number of frames in the beginning.\n"
           "\t-c <count>         : Only show this number of frames (excluding skipped frames).\n"
           "\t-V<vsync-multiple> : Instead of native video framerate, playback framerate\n"
@@ -101,6 +112,7 @@ static int usage(const char *progname, const char *msg = NULL) {
           "\t                     this can result in more smooth playback. Choose multiple for desired framerate.\n"
           "\t                     (Tip: use --led-limit-refresh for stable rate)\n"
 	  "\t-T <threads>       : Number of threads used to decode (default 1, max=%d)\n"
+          "\t-H                 : Use hardware decoder if available (V4L2 M2M, e.g. h264_v4l2m2m).\n"
           "\t-v                 : verbose; prints video metadata and other info.\n"
           "\t-f                 : Loop forever.\n",
 	  (int)std::thread::hardware_concurrency());
@@ -110,38 +122,31 @@ static int usage(const char *progname, const char *msg = NULL) {
   return 1;
 }
 
-static void add_nanos(struct timespec *accumulator, long nanoseconds) {
-  accumulator->tv_nsec += nanoseconds;
-  while (accumulator->tv_nsec > 1000000000) {
-    accumulator->tv_nsec -= 1000000000;
-    accumulator->tv_sec += 1;
-  }
-}
-
 // Convert deprecated color formats to new and manually set the color range.
 // YUV has funny ranges (16-235), while the YUVJ are 0-255. SWS prefers to
 // deal with the YUV range, but then requires to set the output range.
 // https://libav.org/documentation/doxygen/master/pixfmt_8h.html#a9a8e335cf3be472042bc9f0cf80cd4c5
-SwsContext *CreateSWSContext(const AVCodecContext *codec_ctx,
+SwsContext *CreateSWSContext(AVPixelFormat src_pix_fmt,
+                             int src_width, int src_height,
                              int display_width, int display_height) {
   AVPixelFormat pix_fmt;
   bool src_range_extended_yuvj = true;
   // Remap deprecated to new pixel format.
-  switch (codec_ctx->pix_fmt) {
+  switch (src_pix_fmt) {
   case AV_PIX_FMT_YUVJ420P: pix_fmt = AV_PIX_FMT_YUV420P; break;
   case AV_PIX_FMT_YUVJ422P: pix_fmt = AV_PIX_FMT_YUV422P; break;
   case AV_PIX_FMT_YUVJ444P: pix_fmt = AV_PIX_FMT_YUV444P; break;
   case AV_PIX_FMT_YUVJ440P: pix_fmt = AV_PIX_FMT_YUV440P; break;
   default:
     src_range_extended_yuvj = false;
-    pix_fmt = codec_ctx->pix_fmt;
+    pix_fmt = src_pix_fmt;
   }
-  SwsContext *swsCtx = sws_getContext(codec_ctx->width, codec_ctx->height,
+  SwsContext *swsCtx = sws_getContext(src_width, src_height,
                                       pix_fmt,
                                       display_width, display_height,
                                       AV_PIX_FMT_RGB24, SWS_BILINEAR,
                                       NULL, NULL, NULL);
-  if (src_range_extended_yuvj) {
+  if (swsCtx && src_range_extended_yuvj) {
     // Manually set the source range to be extended. Read modify write.
     int dontcare[4];
     int src_range, dst_range;
@@ -157,6 +162,336 @@ SwsContext *CreateSWSContext(const AVCodecContext *codec_ctx,
   return swsCtx;
 }
 
+// Video is played in a pipeline of threads, so that each can use its own
+// core: demux+decode, then scale+copy to a canvas, then display. These are
+// the number of frames buffered between the stages.
+static constexpr int kDecodedFrames = 3;
+static constexpr int kCanvases = 4;
+
+// Hands items from one stage of the pipeline to the next; blocks if full
+// or empty. Once closed, it doesn't block anymore: Push() fails if full,
+// Pop() if empty.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  bool Push(const T &item) {
+    std::unique_lock<std::mutex> l(mutex_);
+    changed_.wait(l, [this]() { return closed_ || items_.size() < capacity_; });
+    if (items_.size() >= capacity_) return false;
+    items_.push_back(item);
+    changed_.notify_all();
+    return true;
+  }
+
+  bool Pop(T *item) {
+    std::unique_lock<std::mutex> l(mutex_);
+    changed_.wait(l, [this]() { return closed_ || !items_.empty(); });
+    if (items_.empty()) return false;
+    *item = items_.front();
+    items_.pop_front();
+    changed_.notify_all();
+    return true;
+  }
+
+  void Close() {
+    std::unique_lock<std::mutex> l(mutex_);
+    closed_ = true;
+    changed_.notify_all();
+  }
+
+  bool closed() {
+    std::unique_lock<std::mutex> l(mutex_);
+    return closed_;
+  }
+
+private:
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  std::deque<T> items_;
+  bool closed_ = false;
+};
+
+static uint64_t GetMonotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Time spent working on frames in a stage, not counting the time waiting
+// for the other stages.
+struct StageTiming {
+  void Add(uint64_t us) { busy_us += us; ++frames; }
+  double AverageMillis() const {
+    return frames ? busy_us / 1000.0 / frames : 0;
+  }
+  uint64_t busy_us = 0;
+  long frames = 0;
+};
+
+// Frames are presented at the time given by their presentation timestamp
+// (PTS), relative to the time the first frame was shown.
+class PresentationClock {
+public:
+  // Start the clock, so that the frame at "offset_us" is due "now_us".
+  void Start(uint32_t now_us, uint64_t offset_us) {
+    start_us_.store(now_us - (uint32_t)offset_us);
+    started_.store(true);
+  }
+  bool started() const { return started_.load(); }
+
+  // Time to present the frame at the given offset.
+  uint32_t PresentationTime(uint64_t offset_us) const {
+    return start_us_.load() + (uint32_t)offset_us;
+  }
+
+  // How late the frame at "offset_us" is now; negative if early.
+  int32_t LateMicros(uint64_t offset_us) const {
+    return (int32_t)(rgb_matrix::GetMicrosecondCounter()
+                     - PresentationTime(offset_us));
+  }
+
+private:
+  std::atomic<bool> started_{false};
+  std::atomic<uint32_t> start_us_{0};
+};
+
+// What the stages need to know about the video to be played.
+struct PlaybackContext {
+  AVFormatContext *format_context;
+  AVCodecContext *codec_context;
+  int video_stream;
+  AVRational time_base;   // Of the PTS in the video stream.
+  long frame_wait_nanos;  // If there is no PTS.
+  unsigned int frame_skip;
+  int64_t framecount_limit;
+  bool loop;              // Start over at the end.
+  bool drop_late;         // Drop frames that are too late to show.
+  AVFrame *output_frame;  // Scaled frame, only to be used by ConvertStage.
+  int display_offset_x, display_offset_y;
+  int display_width, display_height;
+  PresentationClock clock;
+};
+
+struct DecodedFrame {
+  AVFrame *frame;
+  uint64_t offset_us;  // Presentation time relative to the first frame.
+};
+
+struct ConvertedFrame {
+  FrameCanvas *canvas;
+  uint64_t offset_us;
+};
+
+// Read packets, decode them into the frames from "free_frames" and pass
+// them on to "decoded", which is closed when done.
+static void DecodeStage(const PlaybackContext *playback,
+                        BoundedQueue<AVFrame*> *free_frames,
+                        BoundedQueue<DecodedFrame> *decoded,
+                        StageTiming *timing) {
+  AVCodecContext *const codec_context = playback->codec_context;
+  AVPacket *packet = av_packet_alloc();
+  AVFrame *decode_frame = NULL;  // Decode video into this
+  const uint64_t frame_wait_us = playback->frame_wait_nanos / 1000;
+  const AVRational microseconds = { 1, 1000000 };
+  uint64_t loop_start_us = 0;  // Offset of the current loop.
+  uint64_t frame_offset_us = 0;
+  bool running = true;
+  do {
+    int64_t first_pts = AV_NOPTS_VALUE;
+    int64_t frames_left = playback->framecount_limit;
+    unsigned int frames_to_skip = playback->frame_skip;
+    if (playback->loop) {
+      av_seek_frame(playback->format_context, playback->video_stream, 0,
+                    AVSEEK_FLAG_ANY);
+      avcodec_flush_buffers(codec_context);
+    }
+
+    int decode_in_flight = 0;
+    bool state_reading = true;
+    uint64_t start_us = GetMonotonicMicros();
+
+    while (running && frames_left > 0 && !decoded->closed()) {
+      if (state_reading &&
+          av_read_frame(playback->format_context, packet) != 0) {
+        state_reading = false;  // ran out of packets from input
+      }
+
+      if (!state_reading && decode_in_flight == 0)
+        break;  // Decoder fully drained.
+
+      // Is this a packet from the video stream?
+      if (state_reading && packet->stream_index != playback->video_stream) {
+        av_packet_unref(packet);
+        continue;  // Not interested in that.
+      }
+
+      if (state_reading) {
+        // Decode video frame
+        if (avcodec_send_packet(codec_context, packet) == 0) {
+          ++decode_in_flight;
+        }
+        av_packet_unref(packet);
+      } else {
+        avcodec_send_packet(codec_context, nullptr); // Trigger decode drain
+      }
+
+      while (decode_in_flight && frames_left > 0) {
+        if (decode_frame == NULL) {
+          const uint64_t wait_start_us = GetMonotonicMicros();
+          if (!free_frames->Pop(&decode_frame)) {
+            running = false;
+            break;
+          }
+          start_us += GetMonotonicMicros() - wait_start_us;
+        }
+        if (avcodec_receive_frame(codec_context, decode_frame) != 0)
+          break;
+        --decode_in_flight;
+
+        if (frames_to_skip) {
+          frames_to_skip--;
+          av_frame_unref(decode_frame);
+          continue;
+        }
+
+        // Offset from the timestamp, if there is a plausible one. Otherwise
+        // the frame follows the previous one.
+        const int64_t pts = decode_frame->best_effort_timestamp;
+        if (pts != AV_NOPTS_VALUE && first_pts == AV_NOPTS_VALUE) {
+          first_pts = pts;
+        }
+        uint64_t offset_us = frame_offset_us + frame_wait_us;
+        if (pts != AV_NOPTS_VALUE && pts >= first_pts) {
+          offset_us = loop_start_us + av_rescale_q(pts - first_pts,
+                                                   playback->time_base,
+                                                   microseconds);
+        }
+        frame_offset_us = offset_us;
+        const DecodedFrame frame = { decode_frame, offset_us };
+        decode_frame = NULL;
+        --frames_left;
+        const uint64_t now_us = GetMonotonicMicros();
+        timing->Add(now_us - start_us);
+        if (!decoded->Push(frame)) {
+          running = false;
+          break;
+        }
+        start_us = GetMonotonicMicros();
+      }
+    }
+    loop_start_us = frame_offset_us + frame_wait_us;
+  } while (running && playback->loop && !decoded->closed());
+  decoded->Close();
+  av_packet_free(&packet);
+}
+
+// Scale the decoded frames and copy them to canvases from "free_canvases",
+// passed on to "converted", which is closed when done.
+// Frames too late to be shown are dropped before spending time on them.
+static void ConvertStage(const PlaybackContext *playback,
+                         BoundedQueue<DecodedFrame> *decoded,
+                         BoundedQueue<AVFrame*> *free_frames,
+                         BoundedQueue<FrameCanvas*> *free_canvases,
+                         BoundedQueue<ConvertedFrame> *converted,
+                         StageTiming *scale_timing,
+                         StageTiming *copy_timing,
+                         long *dropped_frames) {
+  AVFrame *const output_frame = playback->output_frame;
+  const int32_t frame_wait_us = playback->frame_wait_nanos / 1000;
+  SwsContext *sws_ctx = NULL;
+  int sws_format = AV_PIX_FMT_NONE, sws_width = 0, sws_height = 0;
+  DecodedFrame decoded_frame;
+  FrameCanvas *canvas;
+  while (decoded->Pop(&decoded_frame)) {
+    AVFrame *const frame = decoded_frame.frame;
+    // Late more than a frame: the next one is due already.
+    if (playback->drop_late && playback->clock.started()
+        && playback->clock.LateMicros(decoded_frame.offset_us) > frame_wait_us) {
+      ++*dropped_frames;
+      av_frame_unref(frame);
+      free_frames->Push(frame);
+      continue;
+    }
+
+    const uint64_t start_us = GetMonotonicMicros();
+    // The decoded format is only known for sure once we have a frame; in
+    // particular with hardware decoders.
+    if (!sws_ctx || frame->format != sws_format
+        || frame->width != sws_width || frame->height != sws_height) {
+      sws_freeContext(sws_ctx);
+      sws_format = frame->format;
+      sws_width = frame->width;
+      sws_height = frame->height;
+      sws_ctx = CreateSWSContext((AVPixelFormat)sws_format,
+                                 sws_width, sws_height,
+                                 playback->display_width,
+                                 playback->display_height);
+      if (!sws_ctx) {
+        fprintf(stderr, "Trouble doing scaling to %dx%d :(\n",
+                playback->display_width, playback->display_height);
+        av_frame_unref(frame);
+        free_frames->Push(frame);
+        break;
+      }
+    }
+
+    // Convert the image from its native format to RGB. Frames of a V4L2
+    // hardware decoder are read right from the decoder's buffers.
+    sws_scale(sws_ctx, (uint8_t const * const *)frame->data,
+              frame->linesize, 0, frame->height,
+              output_frame->data, output_frame->linesize);
+    scale_timing->Add(GetMonotonicMicros() - start_us);
+    av_frame_unref(frame);
+    free_frames->Push(frame);
+
+    if (!free_canvases->Pop(&canvas))
+      break;
+    const uint64_t copy_start_us = GetMonotonicMicros();
+    CopyFrame(output_frame, canvas,
+              playback->display_offset_x, playback->display_offset_y,
+              playback->display_width, playback->display_height);
+    copy_timing->Add(GetMonotonicMicros() - copy_start_us);
+    const ConvertedFrame result = { canvas, decoded_frame.offset_us };
+    if (!converted->Push(result)) {
+      free_canvases->Push(canvas);
+      break;
+    }
+  }
+  sws_freeContext(sws_ctx);
+  converted->Close();
+}
+
+// Open the V4L2 memory-to-memory hardware decoder for the codec if there
+// is one (e.g. h264_v4l2m2m on the Raspberry Pi). Its frames are in memory
+// shared with the hardware, so they go to the scaler without a copy.
+// Returns NULL if not available.
+static AVCodecContext *OpenHardwareDecoder(const AVCodec *software_codec,
+                                           const AVStream *stream) {
+  const std::string name = std::string(software_codec->name) + "_v4l2m2m";
+  const AVCodec *codec = avcodec_find_decoder_by_name(name.c_str());
+  if (!codec) {
+    fprintf(stderr, "No hardware decoder %s; decoding in software.\n",
+            name.c_str());
+    return NULL;
+  }
+  AVCodecContext *codec_context = avcodec_alloc_context3(codec);
+  bool opened = false;
+  if (avcodec_parameters_to_context(codec_context, stream->codecpar) >= 0) {
+    codec_context->pkt_timebase = stream->time_base;
+    opened = (avcodec_open2(codec_context, codec, NULL) >= 0);
+  }
+  if (!opened) {
+    fprintf(stderr, "Can't open hardware decoder %s; decoding in "
+            "software.\n", name.c_str());
+    avcodec_free_context(&codec_context);
+    return NULL;
+  }
+  return codec_context;
+}
+
 int main(int argc, char *argv[]) {
   RGBMatrix::Options matrix_options;
   rgb_matrix::RuntimeOptions runtime_opt;
@@ -176,12 +511,14 @@ int main(int argc, char *argv[]) {
   bool verbose = false;
   bool forever = false;
   unsigned thread_count = 1;
+  bool hardware_decode = false;
   int stream_output_fd = -1;
+  bool stream_delta_encoding = false;
   unsigned int frame_skip = 0;
   int64_t framecount_limit = INT64_MAX;
 
   int opt;
-  while ((opt = getopt(argc, argv, "vO:R:Lfc:s:FV:T:")) != -1) {
+  while ((opt = getopt(argc, argv, "vO:zR:Lfc:s:FV:T:H")) != -1) {
     switch (opt) {
     case 'v':
       verbose = true;
@@ -196,6 +533,9 @@ int main(int argc, char *argv[]) {
         return 1;
       }
       break;
+    case 'z':
+      stream_delta_encoding = true;
+      break;
     case 'L':
       fprintf(stderr, "-L is deprecated. Use\n\t--led-pixel-mapper=\"U-mapper\" --led-chain=4\ninstead.\n");
       return 1;
@@ -214,6 +554,9 @@ int main(int argc, char *argv[]) {
     case 'T':
       thread_count = atoi(optarg);
       break;
+    case 'H':
+      hardware_decode = true;
+      break;
     case 'F':
       maintain_aspect_ratio = false;
       break;
@@ -242,14 +585,17 @@ int main(int argc, char *argv[]) {
   if (matrix == NULL) {
     return 1;
   }
-  FrameCanvas *offscreen_canvas = matrix->CreateFrameCanvas();
+  std::vector<FrameCanvas*> canvases;
+  for (int i = 0; i < kCanvases; ++i) {
+    canvases.push_back(matrix->CreateFrameCanvas());
+  }
 
   long frame_count = 0;
   StreamIO *stream_io = NULL;
   StreamWriter *stream_writer = NULL;
   if (stream_output_fd >= 0) {
     stream_io = new rgb_matrix::FileStreamIO(stream_output_fd);
-    stream_writer = new StreamWriter(stream_io);
+    stream_writer = new StreamWriter(stream_io, stream_delta_encoding);
     if (forever) {
       fprintf(stderr, "-f (forever) doesn't make sense with -O; disabling\n");
       forever = false;
@@ -311,19 +657,28 @@ int main(int argc, char *argv[]) {
       const long frame_wait_nanos = 1e9 * rate.den / rate.num;
       if (verbose) fprintf(stderr, "FPS: %f\n", 1.0*rate.num / rate.den);
 
-      AVCodecContext *codec_context = avcodec_alloc_context3(av_codec);
-      if (thread_count > 1 &&
-          av_codec->capabilities & AV_CODEC_CAP_FRAME_THREADS &&
-          std::thread::hardware_concurrency() > 1) {
-        codec_context->thread_type = FF_THREAD_FRAME;
-        codec_context->thread_count =
-          std::min(thread_count, std::thread::hardware_concurrency());
+      AVCodecContext *codec_context = NULL;
+      if (hardware_decode) {
+        codec_context = OpenHardwareDecoder(av_codec, stream);
       }
+      if (!codec_context) {
+        codec_context = avcodec_alloc_context3(av_codec);
+        if (thread_count > 1 &&
+            av_codec->capabilities & AV_CODEC_CAP_FRAME_THREADS &&
+            std::thread::hardware_concurrency() > 1) {
+          codec_context->thread_type = FF_THREAD_FRAME;
+          codec_context->thread_count =
+            std::min(thread_count, std::thread::hardware_concurrency());
+        }
 
-      if (avcodec_parameters_to_context(codec_context, codec_parameters) < 0)
-        return -1;
-      if (avcodec_open2(codec_context, av_codec, NULL) < 0)
-        return -1;
+        if (avcodec_parameters_to_context(codec_context, codec_parameters) < 0)
+          return -1;
+        if (avcodec_open2(codec_context, av_codec, NULL) < 0)
+          return -1;
+      }
+      if (verbose && hardware_decode) {
+        fprintf(stderr, "Decoder: %s\n", codec_context->codec->name);
+      }
 
       /*
        * Prepare frame to hold the scaled target frame to be send to matrix.
@@ -359,94 +714,97 @@ int main(int argc, char *argv[]) {
                 display_offset_x, display_offset_y);
       }
 
-      // initialize SWS context for software scaling
-      SwsContext *const sws_ctx = CreateSWSContext(
-        codec_context, display_width, display_height);
-      if (!sws_ctx) {
-        fprintf(stderr, "Trouble doing scaling to %dx%d :(\n",
-                matrix->width(), matrix->height());
-        return 1;
+      PlaybackContext playback;
+      playback.format_context = format_context;
+      playback.codec_context = codec_context;
+      playback.video_stream = videoStream;
+      playback.time_base = stream->time_base;
+      playback.frame_wait_nanos = frame_wait_nanos;
+      playback.frame_skip = frame_skip;
+      playback.framecount_limit = framecount_limit;
+      playback.loop = one_video_forever;
+      // Streams are written in full; with vsync timing, there is no clock.
+      playback.drop_late = !stream_writer && !use_vsync_for_frame_timing;
+      playback.output_frame = output_frame;
+      playback.display_offset_x = display_offset_x;
+      playback.display_offset_y = display_offset_y;
+      playback.display_width = display_width;
+      playback.display_height = display_height;
+
+      // The stages hand decoded frames and filled canvases to the next
+      // stage through these queues. The free queues give them back.
+      std::vector<AVFrame*> decode_frames;
+      BoundedQueue<AVFrame*> free_decode_frames(kDecodedFrames);
+      BoundedQueue<DecodedFrame> decoded(kDecodedFrames);
+      for (int i = 0; i < kDecodedFrames; ++i) {
+        decode_frames.push_back(av_frame_alloc());
+        free_decode_frames.Push(decode_frames.back());
       }
-
-
-      struct timespec next_frame;
-
-      AVPacket *packet = av_packet_alloc();
-      AVFrame *decode_frame = av_frame_alloc();  // Decode video into this
-      do {
-        int64_t frames_left = framecount_limit;
-        unsigned int frames_to_skip = frame_skip;
-        if (one_video_forever) {
-          av_seek_frame(format_context, videoStream, 0, AVSEEK_FLAG_ANY);
-          avcodec_flush_buffers(codec_context);
-        }
-        clock_gettime(CLOCK_MONOTONIC, &next_frame);
-
-        int decode_in_flight = 0;
-        bool state_reading = true;
-
-        while (!interrupt_received && frames_left > 0) {
-          if (state_reading &&
-              av_read_frame(format_context, packet) != 0) {
-            state_reading = false;  // ran out of packets from input
+      BoundedQueue<FrameCanvas*> free_canvases(canvases.size());
+      BoundedQueue<ConvertedFrame> converted(canvases.size());
+      for (FrameCanvas *canvas : canvases) free_canvases.Push(canvas);
+      canvases.clear();
+
+      StageTiming decode_timing, scale_timing, copy_timing, display_timing;
+      std::thread decode_thread(DecodeStage, &playback, &free_decode_frames,
+                                &decoded, &decode_timing);
+      long dropped_frames = 0;
+      std::thread convert_thread(ConvertStage, &playback,
+                                 &decoded, &free_decode_frames,
+                                 &free_canvases, &converted,
+                                 &scale_timing, &copy_timing,
+                                 &dropped_frames);
+
+      // Display stage.
+      ConvertedFrame frame;
+      while (!interrupt_received && converted.Pop(&frame)) {
+        const uint64_t start_us = GetMonotonicMicros();
+        FrameCanvas *done;
+        frame_count++;
+        if (stream_writer) {
+          if (verbose) fprintf(stderr, "%6ld", frame_count);
+          stream_writer->Stream(*frame.canvas, frame_wait_nanos/1000);
+          done = frame.canvas;
+        } else if (use_vsync_for_frame_timing) {
+          done = matrix->SwapOnVSync(frame.canvas, vsync_multiple);
+        } else {
+          if (!playback.clock.started()) {
+            playback.clock.Start(rgb_matrix::GetMicrosecondCounter(),
+                                 frame.offset_us);
           }
+          done = matrix->SwapOnVSyncAt(
+            frame.canvas, playback.clock.PresentationTime(frame.offset_us));
+        }
+        display_timing.Add(GetMonotonicMicros() - start_us);
+        free_canvases.Push(done);
+      }
 
-          if (!state_reading && decode_in_flight == 0)
-            break;  // Decoder fully drained.
-
-          // Is this a packet from the video stream?
-          if (state_reading && packet->stream_index != videoStream) {
-            av_packet_unref(packet);
-            continue;  // Not interested in that.
-          }
+      // Unblock the other stages in case we stopped early.
+      free_decode_frames.Close();
+      decoded.Close();
+      free_canvases.Close();
+      converted.Close();
+      decode_thread.join();
+      convert_thread.join();
 
-          if (state_reading) {
-            // Decode video frame
-            if (avcodec_send_packet(codec_context, packet) == 0) {
-              ++decode_in_flight;
-            }
-            av_packet_unref(packet);
-          } else {
-            avcodec_send_packet(codec_context, nullptr); // Trigger decode drain
-          }
+      // All canvases are somewhere in these queues now.
+      FrameCanvas *canvas;
+      while (free_canvases.Pop(&canvas)) canvases.push_back(canvas);
+      while (converted.Pop(&frame)) canvases.push_back(frame.canvas);
 
-          while (decode_in_flight &&
-                 avcodec_receive_frame(codec_context, decode_frame) == 0) {
-            --decode_in_flight;
-
-            if (frames_to_skip) { frames_to_skip--; continue; }
-
-            // Determine absolute end of this frame now so that we don't include
-            // decoding overhead. TODO: skip frames if getting too slow ?
-            add_nanos(&next_frame, frame_wait_nanos);
-
-            // Convert the image from its native format to RGB
-            sws_scale(sws_ctx, (uint8_t const * const *)decode_frame->data,
-                      decode_frame->linesize, 0, codec_context->height,
-                      output_frame->data, output_frame->linesize);
-            CopyFrame(output_frame, offscreen_canvas,
-                      display_offset_x, display_offset_y,
-                      display_width, display_height);
-            frame_count++;
-            frames_left--;
-            if (stream_writer) {
-              if (verbose) fprintf(stderr, "%6ld", frame_count);
-              stream_writer->Stream(*offscreen_canvas, frame_wait_nanos/1000);
-            } else {
-              offscreen_canvas = matrix->SwapOnVSync(offscreen_canvas,
-                                                     vsync_multiple);
-            }
-            if (!stream_writer && !use_vsync_for_frame_timing) {
-              clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
-            }
-          }
-        }
-      } while (one_video_forever && !interrupt_received);
-
-      av_packet_free(&packet);
+      if (verbose) {
+        fprintf(stderr, "\nPer frame: decode %.2fms, scale %.2fms, "
+                "copy %.2fms, display %.2fms (incl. waiting for vsync)\n",
+                decode_timing.AverageMillis(), scale_timing.AverageMillis(),
+                copy_timing.AverageMillis(), display_timing.AverageMillis());
+      }
+      if (dropped_frames) {
+        fprintf(stderr, "Dropped %ld frames that were late.\n",
+                dropped_frames);
+      }
 
+      for (AVFrame *f : decode_frames) av_frame_free(&f);
       av_frame_free(&output_frame);
-      av_frame_free(&decode_frame);
       avcodec_close(codec_context);
       avformat_close_input(&format_context);
     }
@@ -459,6 +817,7 @@ int main(int argc, char *argv[]) {
   }
 
   delete matrix;
+  if (stream_writer) stream_writer->WriteIndex();
   delete stream_writer;
   delete stream_io;
   fprintf(stderr, "Total of %ld frames decoded\n", frame_count);